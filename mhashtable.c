@@ -31,8 +31,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <errno.h>
 
+#if defined (__linux__)
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#include <linux/futex.h>
+	#include <limits.h>
+#endif
+
+#if defined (THREAD_LOCAL) && (__STDC_VERSION__ >= 201112L) && !defined (__STDC_NO_ATOMICS__)
+	#define ATOMICS_SUPPORTED
+	#include <stdatomic.h>
+#endif
+
+#if defined (_WIN32)
+	#include <windows.h>
+#else
+	#include <sched.h>
+	#include <pthread.h>
+#endif
+
 
 #if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 199901L)
 	#error "This program requires C99 or higher."
@@ -61,31 +82,145 @@
 #define ALL_GET_ARR_INITIAL_SIZE 16
 
 
+#define TUPLE_KEY_INLINE_WORDS 2
+
+#define SMALL_TABLE_CAPACITY 8
+#define SMALL_TABLE_UPGRADE_SIZE 16
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define HUGE_PAGE_MIN_BYTES HUGE_PAGE_SIZE  /* これより小さいバケット配列は常に calloc で確保する */
+
+#define CUCKOO_WAYS 4  /* 64 ビット環境で 1 バケットが 40 バイトになり、1 キャッシュラインに収まる */
+#define CUCKOO_STASH_SIZE 8
+#define CUCKOO_BFS_MAX_BUCKETS 256  /* 追い出し経路の探索で調べるバケット数の上限 */
+#define CUCKOO_MAX_LOAD 0.95
+#define CUCKOO_HASH_RANGE ((size_t)1 << (sizeof(size_t) * 8 - 1))  /* hash_key_uni からほぼ全ビットを得るための size */
+
+#if SIZE_MAX > UINT32_MAX
+	#define POINTER_KEY_SHIFT 4  /* malloc が返すポインタのアラインメント（16 バイト） */
+#else
+	#define POINTER_KEY_SHIFT 3
+#endif
+
+#ifdef ATOMICS_SUPPORTED
+	#define READ_CACHE_SLOTS 64  /* 2 の累乗であること */
+	#define READ_CACHE_KEY_BYTES 32  /* これより長いキーはキャッシュしない */
+
+	#define FC_SPINS_BEFORE_YIELD 64
+	#define FC_COMBINE_PASSES 2  /* 結合役が 1 回のロックで公開スロットを走査する回数 */
+
+	#ifdef MHT_FAIR_LOCK
+		#define FAIR_LOCK_SPINS 128  /* 眠る前に番を待ってスピンする回数 */
+		#define FAIR_LOCK_SLOTS 64  /* 待機スロットの数。待つスレッドがこれより少なければ起こすのは常に 1 つ */
+	#endif
+#endif
+
+#define SKETCH_MAX_CAPACITY 65536
+
+#define DESTROY_ASYNC_MIN_COUNT 4096  /* これより要素の少ないテーブルはスレッドを作らずにその場で解放する */
+
+#define CLONE_PARALLEL_MIN_BUCKETS 65536  /* 複製のスレッド 1 つあたりが受け持つ最小のバケット数 */
+#define CLONE_MAX_THREADS 8
+
+#define KEY_POOL_MIN_PAGE 1024  /* キープールの最初のページの大きさ */
+#define KEY_POOL_MAX_PAGE 65536
+
+#define INTERN_BLOCK_SIZE 65536  /* インターンした文字列を置くアリーナの 1 ブロックの大きさ */
+#define INTERN_INITIAL_SLOTS 64
+
+#define FROZEN_BLOCK_KEYS 16  /* 凍結したテーブルの 1 ブロックに入れるキーの数。先頭のキーだけを丸ごと持つ */
+#define VARINT_MAX_BYTES ((sizeof(size_t) * 8 + 6) / 7)  /* size_t を 7 ビットずつ書いたときの最大のバイト数 */
+
+#define LZ_HASH_BITS 11  /* 値の圧縮で一致を探すハッシュ表の大きさ */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define VALUE_SIZE_COMPRESSED ((size_t)1 << (sizeof(size_t) * 8 - 1))  /* 圧縮して格納した値の value_size に立てるビット */
+
+#define DEDUP_INITIAL_BUCKETS 64  /* 重複排除の値ストアの最初のバケット数 */
+
+#define NUMA_MAX_NODES 64  /* ノードマスクを unsigned long 1 つで扱える範囲 */
+#define NUMA_NODE_REFRESH_INTERVAL 4096  /* スレッドが動いているノードをこの回数の読み出しごとに問い合わせ直す */
+
+/* libnuma に依存しないよう、set_mempolicy と get_mempolicy の定数をここで定義する */
+#define NUMA_MPOL_DEFAULT 0
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MPOL_F_MEMS_ALLOWED (1 << 2)
+
+
 typedef enum {
 	KEY_TYPE_UINT,
-	KEY_TYPE_STR
+	KEY_TYPE_STR,
+	KEY_TYPE_TUPLE,
+	KEY_TYPE_UINT32
 } KeyType;
 
 
 typedef struct MHtEntry {
+	struct MHtEntry* next;
+	void* value;
+	union {
+		size_t value_size;  /* raw モードで set された場合 0 */
+		struct {
+			uint32_t value_size;
+			uint32_t key;
+		} packed;  /* KEY_TYPE_UINT32 の場合はサイズとキーをここに詰めて持ち、key 以降は確保しない */
+	} meta;
 	union {
 		uint_keyt uint;
 		str_keyt str;
-	} key;
-	size_t value_size;  /* raw モードで set された場合 0 */
-	void* value;
-	struct MHtEntry* next;
+		uint_keyt tuple[TUPLE_KEY_INLINE_WORDS];  /* これを超える語数のキーはエントリの後ろに続けて確保する */
+	} key;  /* 可変長のキーを後ろに伸ばすため、必ず最後のメンバにすること */
 } MHtEntry;
 
 
+typedef struct AccessSketch AccessSketch;
+typedef struct SplitTable SplitTable;
+typedef struct CuckooTable CuckooTable;
+typedef struct CompactTable CompactTable;
+typedef struct KeyPool KeyPool;
+typedef struct FrozenTable FrozenTable;
+typedef struct ValueStore ValueStore;
+typedef struct ChangeLog ChangeLog;
+typedef struct TableVersion TableVersion;
+
+
 struct MHashTable {
-	MHtEntry** buckets;
+	MHtEntry** buckets;  /* スモールモードの間は NULL */
 	size_t size;     /* number of buckets */
 	size_t count;    /* number of elements */
 	KeyType key_type;
+	size_t key_words;   /* KEY_TYPE_TUPLE の場合のキーの語数、それ以外は 0 */
+	size_t entry_size;  /* 1 エントリあたりの確保サイズ */
+	MHtHugePageMode huge_page_mode;
+	bool buckets_mapped;  /* 現在のバケット配列が mmap で確保されているか */
+	size_t numa_nodes;  /* NUMA レプリカ配列の長さ（最大ノード番号 + 1）、レプリカを持たない場合は 0 */
+	MHashTable** numa_replicas;  /* ノード番号で引く。自分自身も含み、存在しないノードは NULL */
+	bool read_cache;  /* スレッドローカルな読み出しキャッシュを使うか */
+	AccessSketch* sketch;  /* アクセス頻度の追跡を行わない場合は NULL */
+	SplitTable* split;  /* mht_split_create で作成した場合のみ非 NULL。このとき buckets は使わない */
+	CuckooTable* cuckoo;  /* カッコーハッシュに切り替えた場合のみ非 NULL。このとき buckets は使わない */
+	CompactTable* compact;  /* コンパクトモードに切り替えた場合のみ非 NULL。このとき buckets は使わない */
+	bool pointer_keys;  /* uint_keyt のキーをポインタとして安価にハッシュするか */
+	bool ordered_chains;  /* 連鎖をキーの昇順に並べるか。連鎖法のバケット配列でのみ使う */
+	KeyPool* key_pool;  /* 文字列キーをテーブルごとのページに詰める場合のみ非 NULL */
+	FrozenTable* frozen;  /* mht_freeze で読み取り専用にした場合のみ非 NULL。このとき buckets は使わない */
+	size_t compress_threshold;  /* これ以上の大きさの値を圧縮して格納する。圧縮しない場合は 0 */
+	ValueStore* dedup;  /* 同じ内容の値を共有する場合のみ非 NULL */
+	ChangeLog* change_log;  /* 変更を記録する場合のみ非 NULL */
+#ifdef ATOMICS_SUPPORTED
+	TableVersion* version;  /* 読み出しキャッシュを一度も有効にしていない場合は NULL */
+#endif
+	MHtEntry small[];   /* スモールモードで作成した場合のみ SMALL_TABLE_CAPACITY 個分確保される */
 };
 
 
+typedef enum {
+	WRITE_OP_SET,
+	WRITE_OP_SET_RAW,
+	WRITE_OP_DELETE
+} WriteOp;
+
+
 typedef struct {
 	MHashTable* ptr;
 #ifdef DEBUG
@@ -100,6 +235,8 @@ typedef struct {
 	union {
 		uint_keyt uint;
 		str_keyt str;
+		const uint_keyt* tuple;
+		uint32_t uint32;
 	} key;
 	KeyType key_type;
 } KeyUni;
@@ -109,6 +246,81 @@ static MHashTable* mht_entries = NULL;
 static MHashTable* all_get_arr_entries = NULL;
 
 
+#ifdef ATOMICS_SUPPORTED
+	/*
+	 * テーブルのバージョンを持つセル。内容が変わるたびに増え、読み出しキャッシュからロックなしで読まれる。
+	 * キャッシュのスロットはテーブルが破棄された後もセルを指したまま残るので、セルは解放せず、
+	 * 破棄のときにバージョンを進めてから空きリストに戻し、次のテーブルで使い回す。
+	 * 値は減らないので、古いスロットのバージョンが使い回されたセルの値と一致することはない
+	 */
+	struct TableVersion {
+		atomic_uint_fast64_t value;
+		TableVersion* next_free;
+	};
+
+	static TableVersion* table_version_free_list = NULL;  /* ロック内で操作する */
+#endif
+
+
+/* 変更を始める前に呼ぶ。ロック内で使用すること */
+static void table_version_bump (MHashTable* ht) {
+#ifdef ATOMICS_SUPPORTED
+	if (ht->version != NULL) atomic_fetch_add_explicit(&ht->version->value, 1, memory_order_release);
+#else
+	(void)ht;
+#endif
+}
+
+
+#ifdef ATOMICS_SUPPORTED
+/* ロック内で使用すること。既にセルを持っていれば何もしない。確保できなければ false を返す */
+static bool table_version_attach (MHashTable* ht) {
+	if (ht->version != NULL) return true;
+
+	if (table_version_free_list != NULL) {
+		ht->version = table_version_free_list;
+		table_version_free_list = ht->version->next_free;
+		return true;
+	}
+
+	ht->version = malloc(sizeof(TableVersion));
+	if (UNLIKELY(ht->version == NULL)) return false;
+	atomic_init(&ht->version->value, 0);
+	return true;
+}
+#endif
+
+
+/* ロック内で、テーブルが他のスレッドから見えなくなるときに呼ぶ。セルを持っていなければ何もしない */
+static void table_version_detach (MHashTable* ht) {
+#ifdef ATOMICS_SUPPORTED
+	if (ht->version == NULL) return;
+	table_version_bump(ht);  /* このセルを指すスロットをすべて無効にする */
+	ht->version->next_free = table_version_free_list;
+	table_version_free_list = ht->version;
+	ht->version = NULL;
+#else
+	(void)ht;
+#endif
+}
+
+
+static bool flat_combining_active (void);
+static bool mht_write_combined (WriteOp op, MHashTable* ht, KeyUni key, void* value_data, size_t value_size, const char* file, int line);
+
+
+/* 読み出しに使う NUMA レプリカを選ぶためのスレッドのノード番号（-1 は未設定） */
+#ifdef THREAD_LOCAL
+	static THREAD_LOCAL int numa_preferred_node = -1;
+	static THREAD_LOCAL int numa_detected_node = -1;
+	static THREAD_LOCAL unsigned int numa_detect_countdown = 0;  /* 0 になったら問い合わせ直す */
+#else
+	static int numa_preferred_node = -1;  /* 非スレッドセーフ */
+	static int numa_detected_node = -1;   /* 非スレッドセーフ */
+	static unsigned int numa_detect_countdown = 0;  /* 非スレッドセーフ */
+#endif
+
+
 /* errno 記録時に関数名を記録する */
 #ifdef THREAD_LOCAL
 	THREAD_LOCAL const char* mht_errfunc = NULL;
@@ -117,13 +329,198 @@ static MHashTable* all_get_arr_entries = NULL;
 #endif
 
 
-#define GLOBAL_LOCK_FUNC_NAME mht_lock
-#define GLOBAL_UNLOCK_FUNC_NAME mht_unlock
+#ifdef ATOMICS_SUPPORTED
+static void cpu_yield (void) {
+#if defined (_WIN32)
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+#endif
+
+
+#if defined (MHT_FAIR_LOCK) && defined (ATOMICS_SUPPORTED)
+
+/*
+ * チケットロック
+ * ロックを取りに来た順に番号を配り、fair_lock_serving が自分の番号になったスレッドがロックを得る。
+ * 到着順に処理されるので、特定のスレッドだけが待たされ続けることがない。待っている間は
+ * fair_lock_serving を読むだけのスピンを FAIR_LOCK_SPINS 回行い、それでも番が来なければ
+ * 番号ごとに決まる待機スロットで futex（Windows では WaitOnAddress）を使って眠る。
+ * 解放時には次の番号のスロットだけを起こすので、眠っている全員が一斉に起きることはない。
+ * 次の番のスレッドは眠らずに待ち続け、ロックの受け渡しにシステムコールの往復を挟まないようにする
+ */
+typedef struct {
+	_Atomic uint32_t seq;  /* このスロットで起こすたびに増える。futex で待つ値 */
+	atomic_uint sleepers;  /* 眠っているか眠ろうとしているスレッドの数。0 なら起こす必要がない */
+	unsigned char pad[64 - sizeof(_Atomic uint32_t) - sizeof(atomic_uint)];  /* スロットごとにキャッシュラインを分ける */
+} FairLockSlot;
+
+static _Atomic uint32_t fair_lock_next = 0;
+static _Atomic uint32_t fair_lock_serving = 0;
+static FairLockSlot fair_lock_slots[FAIR_LOCK_SLOTS];
+
+
+static void cpu_pause (void) {
+#if (defined (__GNUC__) || defined (__clang__)) && (defined (__x86_64__) || defined (__i386__))
+	__builtin_ia32_pause();
+#elif defined (_WIN32)
+	YieldProcessor();
+#endif
+}
+
+
+/* slot->seq がまだ observed なら眠る。起こされたか値が変わっていればすぐに戻る */
+static void fair_lock_sleep (FairLockSlot* slot, uint32_t observed) {
+#if defined (__linux__)
+	syscall(SYS_futex, &slot->seq, FUTEX_WAIT_PRIVATE, observed, NULL, NULL, 0);
+#elif defined (_WIN32)
+	WaitOnAddress((volatile VOID*)&slot->seq, &observed, sizeof(observed), INFINITE);
+#else
+	(void)slot;
+	(void)observed;
+	cpu_yield();  /* 待機用のシステムコールがない環境では譲るだけにする */
+#endif
+}
+
+
+static void fair_lock_wake (FairLockSlot* slot) {
+#if defined (__linux__)
+	syscall(SYS_futex, &slot->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#elif defined (_WIN32)
+	WakeByAddressAll((PVOID)&slot->seq);
+#else
+	(void)slot;
+#endif
+}
+
+
+static void mht_lock (void) {
+	uint32_t ticket = atomic_fetch_add_explicit(&fair_lock_next, 1, memory_order_relaxed);
+	FairLockSlot* slot = &fair_lock_slots[ticket % FAIR_LOCK_SLOTS];
+
+	for (size_t spins = 0;; spins++) {
+		uint32_t serving = atomic_load_explicit(&fair_lock_serving, memory_order_acquire);
+		if (serving == ticket) return;
+
+		if (spins < FAIR_LOCK_SPINS) {
+			cpu_pause();
+		} else if (ticket - serving == 1) {
+			cpu_yield();
+		} else {
+			/*
+			 * seq を読んでから sleepers を増やし、番号を読み直してから眠る。解放側は serving を進めてから
+			 * sleepers を読んで seq を進めるので、どの順で競合しても起こし損ねない
+			 */
+			uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_seq_cst);
+			atomic_fetch_add_explicit(&slot->sleepers, 1, memory_order_seq_cst);
+			if (atomic_load_explicit(&fair_lock_serving, memory_order_seq_cst) != ticket)
+				fair_lock_sleep(slot, seq);
+			atomic_fetch_sub_explicit(&slot->sleepers, 1, memory_order_relaxed);
+		}
+	}
+}
+
+
+static void mht_unlock (void) {
+	uint32_t serving = atomic_fetch_add_explicit(&fair_lock_serving, 1, memory_order_seq_cst) + 1;
+	FairLockSlot* slot = &fair_lock_slots[serving % FAIR_LOCK_SLOTS];
+	if (atomic_load_explicit(&slot->sleepers, memory_order_seq_cst) != 0) {
+		atomic_fetch_add_explicit(&slot->seq, 1, memory_order_seq_cst);
+		fair_lock_wake(slot);  /* 同じスロットを共有する先の番号のスレッドは眠り直す */
+	}
+}
+
+
+/* 配り済みの番号がすべて処理済みの場合だけ、次の番号を自分で取る */
+static bool mht_try_lock (void) {
+	uint32_t serving = atomic_load_explicit(&fair_lock_serving, memory_order_relaxed);
+	uint32_t expected = serving;
+	if (!atomic_compare_exchange_strong_explicit(&fair_lock_next, &expected, serving + 1, memory_order_relaxed, memory_order_relaxed)) {
+		errno = EWOULDBLOCK;
+		return false;
+	}
+	atomic_load_explicit(&fair_lock_serving, memory_order_acquire);  /* 直前の解放と同期する */
+	return true;
+}
+
+
+static void global_lock_quit (void) {}  /* チケットロックには後始末が要らない */
+
+#else
+
+#ifdef ATOMICS_SUPPORTED
+	#define GLOBAL_LOCK_FUNC_NAME mht_lock_acquire
+	#define GLOBAL_UNLOCK_FUNC_NAME mht_lock_release
+#else
+	#define GLOBAL_LOCK_FUNC_NAME mht_lock
+	#define GLOBAL_UNLOCK_FUNC_NAME mht_unlock
+#endif
 #define GLOBAL_LOCK_FUNC_SCOPE static
 
 #include "global_lock.h"
 
 
+#ifdef ATOMICS_SUPPORTED
+/*
+ * ロックを持っているか、取ろうとしているスレッドの数。ロックを取る前に増やし、外した後に減らすので、
+ * 0 のときに試みたスレッドは誰とも競合していない
+ */
+static atomic_size_t lock_users = 0;
+
+/*
+ * 実際に排他を行うフラグ。mht_lock は global_lock.h のロックで待ち合わせてからこれを立て、
+ * mht_try_lock は global_lock.h のロックを使わずにこれだけを立てるので、決して待たない
+ */
+static atomic_bool lock_taken = false;
+static THREAD_LOCAL bool lock_taken_by_try = false;
+
+static void mht_lock (void) {
+	atomic_fetch_add_explicit(&lock_users, 1, memory_order_relaxed);
+	mht_lock_acquire();
+
+	/* 待たされるのは mht_try_lock で取ったスレッドが持っている間だけで、その区間は短い */
+	bool expected = false;
+	while (!atomic_compare_exchange_weak_explicit(&lock_taken, &expected, true, memory_order_acquire, memory_order_relaxed)) {
+		expected = false;
+		cpu_yield();
+	}
+}
+
+
+static void mht_unlock (void) {
+	atomic_store_explicit(&lock_taken, false, memory_order_release);
+	if (lock_taken_by_try) {
+		lock_taken_by_try = false;
+		return;
+	}
+	mht_lock_release();
+	atomic_fetch_sub_explicit(&lock_users, 1, memory_order_relaxed);
+}
+#endif
+
+
+/* 待たずに取れる場合だけロックを取る。取れなければ errno を設定して false を返す */
+static bool mht_try_lock (void) {
+#ifdef ATOMICS_SUPPORTED
+	/* mht_lock で待っているスレッドがいれば、先を越さずに譲る */
+	bool expected = false;
+	if (atomic_load_explicit(&lock_users, memory_order_relaxed) != 0 || !atomic_compare_exchange_strong_explicit(&lock_taken, &expected, true, memory_order_acquire, memory_order_relaxed)) {
+		errno = EWOULDBLOCK;
+		return false;
+	}
+	lock_taken_by_try = true;
+	return true;
+#else
+	errno = ENOSYS;  /* ロックの使用者を数えられないので、待たずに済むか判断できない */
+	return false;
+#endif
+}
+
+#endif
+
+
 uint64_t wang_hash64 (uint64_t num) {
 	num = (~num) + (num << 21);             /* num = (num << 21) - num - 1; */
 	num = num ^ (num >> 24);
@@ -196,6 +593,46 @@ static size_t hash_str_key (str_keyt key, size_t size) {
 }
 
 
+/*
+ * ポインタの下位ビットはアラインメントで 0 になるので捨ててから、黄金比の乗算 1 回で撹拌する。
+ * ページ境界などもっと粗く揃ったポインタでは捨てた後も下位ビットが 0 のまま残るので、
+ * 乗算で全ビットを上位へ広げ、上半分を下位へ畳み込む。wang_hash よりずっと安い。
+ * バケット数によらない値を下位ビットで切り取るだけなので、整列した連鎖の分割もそのまま使える
+ */
+static size_t hash_pointer_key (uint_keyt key, size_t size) {
+#if SIZE_MAX > UINT32_MAX
+	size_t hash = ((size_t)key >> POINTER_KEY_SHIFT) * 0x9E3779B97F4A7C15ULL;
+	return (hash ^ (hash >> 32)) & (size - 1);
+#else
+	size_t hash = ((size_t)key >> POINTER_KEY_SHIFT) * 0x9E3779B9U;
+	return (hash ^ (hash >> 16)) & (size - 1);
+#endif
+}
+
+
+static size_t hash_uint32_key (uint32_t key, size_t size) {
+	return (size_t)wang_hash32(key) & (size - 1);
+}
+
+
+/* 各語を wang_hash で撹拌してから混ぜ合わせるので、語の順序や語同士の偏りに強い */
+static size_t hash_tuple_key (const uint_keyt* words, size_t key_words, size_t size) {
+#if SIZE_MAX > UINT32_MAX
+	uint64_t hash = (uint64_t)key_words;
+	for (size_t i = 0; i < key_words; i++)
+		hash ^= wang_hash64((uint64_t)words[i]) + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+	hash = wang_hash64(hash);
+	return (size_t)(hash ^ (hash >> 32)) & (size - 1);
+#else
+	uint32_t hash = (uint32_t)key_words;
+	for (size_t i = 0; i < key_words; i++)
+		hash ^= wang_hash32((uint32_t)words[i]) + 0x9E3779B9U + (hash << 6) + (hash >> 2);
+	hash = wang_hash32(hash);
+	return (size_t)(hash ^ (hash >> 16)) & (size - 1);
+#endif
+}
+
+
 bool mht_str_key_is_valid (str_keyt key) {
 	if (key.ptr == NULL) return false;
 	if (key.ptr[0] == '\0') return false;
@@ -224,80 +661,304 @@ bool mht_str_key_equal (str_keyt a, str_keyt b) {
 }
 
 
-static MHashTable* mht_create_without_register_generic (size_t size, KeyType key_type, const char* file, int line);
+/* タプルキーはエントリの key から後ろへ連続して格納されている */
+static uint_keyt* entry_tuple_key (MHtEntry* entry) {
+	return entry->key.tuple;
+}
+
+
+/* KEY_TYPE_UINT32 の場合は事前に UINT32_MAX 以下であることを確認しておくこと */
+static void entry_set_value_size (const MHashTable* ht, MHtEntry* entry, size_t value_size) {
+	if (ht->key_type == KEY_TYPE_UINT32)
+		entry->meta.packed.value_size = (uint32_t)value_size;
+	else
+		entry->meta.value_size = value_size;
+}
+
+
+static size_t entry_value_size (const MHashTable* ht, const MHtEntry* entry) {
+	if (ht->key_type == KEY_TYPE_UINT32)
+		return entry->meta.packed.value_size;
+	return entry->meta.value_size;
+}
+
+
+static size_t hash_key_uni (const MHashTable* ht, KeyUni key, size_t size) {
+	if (ht->key_type == KEY_TYPE_UINT)
+		return ht->pointer_keys ? hash_pointer_key(key.key.uint, size) : hash_uint_key(key.key.uint, size);
+	else if (ht->key_type == KEY_TYPE_UINT32)
+		return hash_uint32_key(key.key.uint32, size);
+	else if (ht->key_type == KEY_TYPE_STR)
+		return hash_str_key(key.key.str, size);
+	else  /* if (ht->key_type == KEY_TYPE_TUPLE) */
+		return hash_tuple_key(key.key.tuple, ht->key_words, size);
+}
+
+
+static size_t hash_entry_key (const MHashTable* ht, MHtEntry* entry, size_t size) {
+	if (ht->key_type == KEY_TYPE_UINT)
+		return ht->pointer_keys ? hash_pointer_key(entry->key.uint, size) : hash_uint_key(entry->key.uint, size);
+	else if (ht->key_type == KEY_TYPE_UINT32)
+		return hash_uint32_key(entry->meta.packed.key, size);
+	else if (ht->key_type == KEY_TYPE_STR)
+		return hash_str_key(entry->key.str, size);
+	else  /* if (ht->key_type == KEY_TYPE_TUPLE) */
+		return hash_tuple_key(entry_tuple_key(entry), ht->key_words, size);
+}
+
+
+static bool key_uni_equal (const MHashTable* ht, KeyUni a, KeyUni b) {
+	if (ht->key_type == KEY_TYPE_UINT)
+		return a.key.uint == b.key.uint;
+	else if (ht->key_type == KEY_TYPE_UINT32)
+		return a.key.uint32 == b.key.uint32;
+	else if (ht->key_type == KEY_TYPE_STR)
+		return str_key_equal(a.key.str, b.key.str);
+	else  /* if (ht->key_type == KEY_TYPE_TUPLE) */
+		return memcmp(a.key.tuple, b.key.tuple, ht->key_words * sizeof(uint_keyt)) == 0;
+}
+
+
+static bool entry_key_equal (const MHashTable* ht, MHtEntry* entry, KeyUni key) {
+	if (ht->key_type == KEY_TYPE_UINT)
+		return entry->key.uint == key.key.uint;
+	else if (ht->key_type == KEY_TYPE_UINT32)
+		return entry->meta.packed.key == key.key.uint32;
+	else if (ht->key_type == KEY_TYPE_STR)
+		return str_key_equal(entry->key.str, key.key.str);
+	else  /* if (ht->key_type == KEY_TYPE_TUPLE) */
+		return memcmp(entry_tuple_key(entry), key.key.tuple, ht->key_words * sizeof(uint_keyt)) == 0;
+}
+
+
+static MHashTable* mht_create_without_register_generic (size_t size, KeyType key_type, size_t key_words, const char* file, int line);
 static void quit (void);
 static MHashTable* mht_uint_create_without_lock (size_t size, const char* file, int line);
 
-/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
-static void init (void) {
+/* expected 個の要素を入れても LOAD_FACTOR を超えない、initial_size 以上の 2 の累乗を返す */
+static size_t registry_size_for (size_t expected, size_t initial_size) {
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wunsuffixed-float-constants"  /* mhashtable自体のデバッグを行う際は必ず外すこと */
+#endif
+
+	size_t size = initial_size;
+	while (size <= (SIZE_MAX / sizeof(MHtEntry*) / 2) && ((double)expected / (double)size) > LOAD_FACTOR)
+		size *= 2;
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic pop
+#endif
+
+	return size;
+}
+
+
+/*
+ * 重要: この関数は必ずロックした後に呼び出す必要があります！
+ * 失敗した場合は mht_entries が NULL のまま false を返す。all_get_arr_entries の作成に失敗しても初期化自体は成功とする
+ */
+static bool init_with_sizes (size_t entries_size, size_t all_get_arr_size) {
 	for (size_t i = 0; i < MHT_ENTRIES_TRIAL; i++) {
-		mht_entries = mht_create_without_register_generic(MHT_ENTRIES_INITIAL_SIZE, KEY_TYPE_UINT, __FILE__, __LINE__);
+		mht_entries = mht_create_without_register_generic(entries_size, KEY_TYPE_UINT, 0, __FILE__, __LINE__);
 		if (LIKELY(mht_entries != NULL)) break;
 	}
-	if (UNLIKELY(mht_entries == NULL)) {
-		fprintf(stderr, "Failed to initialize mhashtable library.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-		mht_unlock();
-		global_lock_quit();
-		exit(EXIT_FAILURE);
-	}
+	if (UNLIKELY(mht_entries == NULL)) return false;
 
 	atexit(quit);
 
-	all_get_arr_entries = mht_uint_create_without_lock(ALL_GET_ARR_INITIAL_SIZE, __FILE__, __LINE__);
+	all_get_arr_entries = mht_uint_create_without_lock(all_get_arr_size, __FILE__, __LINE__);
 	if (UNLIKELY(all_get_arr_entries == NULL)) {
 		fprintf(stderr, "Failed to prepare the hashtable that manages the array returned by the mht_all_get function.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
 		mht_errfunc = "init";
 	}
+	return true;
 }
 
 
-static MHashTable* mht_create_without_register_generic (size_t size, KeyType key_type, const char* file, int line) {
-	if (size == 0) {
-		fprintf(stderr, "Hashtable size cannot be zero.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		return NULL;
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void init (void) {
+	if (UNLIKELY(!init_with_sizes(MHT_ENTRIES_INITIAL_SIZE, ALL_GET_ARR_INITIAL_SIZE))) {
+		fprintf(stderr, "Failed to initialize mhashtable library.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		mht_unlock();
+		global_lock_quit();
+		exit(EXIT_FAILURE);
 	}
+}
 
-	if (!mutils_is_power_of_two(size)) {
-		size_t adjusted = mutils_next_power_of_two(size);
-		printf("Hashtable size adjusted from %zu to %zu\n", size, adjusted);
-		size = adjusted;
-	}
 
-	if (size > (SIZE_MAX / sizeof(MHtEntry*))) {
-		fprintf(stderr, "Hashtable size is too large.\nFile: %s   Line: %d\n", file, line);
+static void mht_reserve (MHashTable* ht, size_t count);
+
+/*
+ * 管理用のテーブルを予定の数に合わせた大きさで作っておき、定常状態でのテーブルの作成中に拡張が起きないようにする。
+ * 既に初期化済みの場合は、足りない分だけ管理用のテーブルを広げる
+ */
+bool _mht_init (const MHtInitOptions* options, const char* file, int line) {
+	size_t expected_tables = (options != NULL) ? options->expected_tables : 0;
+	size_t expected_all_get_arrays = (options != NULL) ? options->expected_all_get_arrays : 0;
+
+	if (expected_tables > SIZE_MAX - 1) {
+		fprintf(stderr, "Expected table count is too large.\nFile: %s   Line: %d\n", file, line);
 		errno = EINVAL;
-		return NULL;
+		mht_errfunc = "_mht_init";
+		return false;
 	}
+	expected_tables++;  /* all_get_arr_entries も mht_entries に登録される */
 
-	MHashTable* ht = calloc(1, sizeof(MHashTable));
-	if (UNLIKELY(ht == NULL)) {
-		fprintf(stderr, "Failed to allocate memory for hashtable.\nFile: %s   Line: %d\n", file, line);
-		errno = ENOMEM;
-		return NULL;
+	mht_lock();
+
+	if (mht_entries == NULL) {
+		if (UNLIKELY(!init_with_sizes(registry_size_for(expected_tables, MHT_ENTRIES_INITIAL_SIZE), registry_size_for(expected_all_get_arrays, ALL_GET_ARR_INITIAL_SIZE)))) {
+			fprintf(stderr, "Failed to initialize mhashtable library.\nFile: %s   Line: %d\n", file, line);
+			errno = ENOMEM;
+			mht_errfunc = "_mht_init";
+			mht_unlock();
+			return false;
+		}
+	} else {
+		mht_reserve(mht_entries, expected_tables);
+		if (all_get_arr_entries != NULL) mht_reserve(all_get_arr_entries, expected_all_get_arrays);
 	}
 
-	ht->buckets = calloc(size, sizeof(MHtEntry*));  /* 今後の処理のために必ず初期化が必要 */
-	if (UNLIKELY(ht->buckets == NULL)) {
-		fprintf(stderr, "Failed to allocate memory for hashtable buckets.\nFile: %s   Line: %d\n", file, line);
+	bool result = (all_get_arr_entries != NULL);
+	if (!result) {
 		errno = ENOMEM;
-
-		free(ht);
-
-		return NULL;
+		mht_errfunc = "_mht_init";
 	}
-	ht->size = size;
-	ht->count = 0;
-	ht->key_type = key_type;
 
-	return ht;
+	mht_unlock();
+	return result;
+}
+
+
+static size_t huge_page_round (size_t bytes) {
+	return (bytes + (HUGE_PAGE_SIZE - 1)) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
+
+
+/*
+ * バケット配列を確保する。ゼロ初期化されていることが保証される。
+ * huge_page_mode が有効で HUGE_PAGE_MIN_BYTES 以上の場合は mmap を試み、失敗すれば calloc に戻る。
+ * out_mapped には mmap で確保したかどうかが入る。
+ */
+static MHtEntry** buckets_alloc (MHtHugePageMode mode, size_t count, bool* out_mapped) {
+	*out_mapped = false;
+	size_t bytes = count * sizeof(MHtEntry*);
+
+#if defined (__linux__)
+	if (mode != MHT_HUGE_PAGE_OFF && bytes >= HUGE_PAGE_MIN_BYTES && bytes <= SIZE_MAX - HUGE_PAGE_SIZE) {
+		size_t map_bytes = huge_page_round(bytes);
+		void* mem = MAP_FAILED;
+
+	#ifdef MAP_HUGETLB
+		if (mode == MHT_HUGE_PAGE_EXPLICIT)
+			mem = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	#endif
+
+		if (mem == MAP_FAILED) {  /* 予約済みの huge page がなければ THP に任せる */
+			mem = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	#ifdef MADV_HUGEPAGE
+			if (mem != MAP_FAILED) madvise(mem, map_bytes, MADV_HUGEPAGE);
+	#endif
+		}
+
+		if (mem != MAP_FAILED) {
+			*out_mapped = true;
+			return mem;
+		}
+	}
+#else
+	(void)mode;
+#endif
+
+	return calloc(count, sizeof(MHtEntry*));
+}
+
+
+static void buckets_free (MHtEntry** buckets, size_t count, bool mapped) {
+#if defined (__linux__)
+	if (mapped) {
+		munmap(buckets, huge_page_round(count * sizeof(MHtEntry*)));
+		return;
+	}
+#else
+	(void)count;
+	(void)mapped;
+#endif
+	free(buckets);
+}
+
+
+static size_t entry_size_for_key (KeyType key_type, size_t key_words) {
+	if (key_type == KEY_TYPE_UINT32)
+		return offsetof(MHtEntry, key);  /* キーは meta に詰めてあるので、key 以降は確保しない */
+	if (key_type == KEY_TYPE_TUPLE && key_words > TUPLE_KEY_INLINE_WORDS)
+		return offsetof(MHtEntry, key) + key_words * sizeof(uint_keyt);
+	return sizeof(MHtEntry);
+}
+
+
+/*
+ * 作成時のサイズが SMALL_TABLE_CAPACITY 以下なら、バケット配列を確保せずに
+ * テーブル本体の後ろに置いたエントリ配列を線形探索するスモールモードで作成する。
+ */
+static MHashTable* mht_create_without_register_generic (size_t size, KeyType key_type, size_t key_words, const char* file, int line) {
+	if (size == 0) {
+		fprintf(stderr, "Hashtable size cannot be zero.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!mutils_is_power_of_two(size)) {
+		size_t adjusted = mutils_next_power_of_two(size);
+		printf("Hashtable size adjusted from %zu to %zu\n", size, adjusted);
+		size = adjusted;
+	}
+
+	if (size > (SIZE_MAX / sizeof(MHtEntry*))) {
+		fprintf(stderr, "Hashtable size is too large.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t entry_size = entry_size_for_key(key_type, key_words);
+	bool small = (size <= SMALL_TABLE_CAPACITY && entry_size <= sizeof(MHtEntry));
+
+	MHashTable* ht = calloc(1, sizeof(MHashTable) + (small ? SMALL_TABLE_CAPACITY * sizeof(MHtEntry) : 0));
+	if (UNLIKELY(ht == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (small) {
+		ht->buckets = NULL;
+		ht->size = 0;
+	} else {
+		ht->buckets = buckets_alloc(MHT_HUGE_PAGE_OFF, size, &ht->buckets_mapped);  /* 今後の処理のために必ず初期化が必要 */
+		if (UNLIKELY(ht->buckets == NULL)) {
+			fprintf(stderr, "Failed to allocate memory for hashtable buckets.\nFile: %s   Line: %d\n", file, line);
+			errno = ENOMEM;
+
+			free(ht);
+
+			return NULL;
+		}
+		ht->size = size;
+	}
+	ht->count = 0;
+	ht->key_type = key_type;
+	ht->key_words = key_words;
+	ht->entry_size = entry_size;
+
+	return ht;
 }
 
 
 static bool mht_uint_set_without_lock (MHashTable* ht, uint_keyt key, void* value_data, size_t value_size, const char* file, int line);
 
 static MHashTable* mht_uint_create_without_lock (size_t size, const char* file, int line) {
-	MHashTable* ht = mht_create_without_register_generic(size, KEY_TYPE_UINT, file, line);
+	MHashTable* ht = mht_create_without_register_generic(size, KEY_TYPE_UINT, 0, file, line);
 	if (ht == NULL) {
 		mht_errfunc = "_mht_uint_create";
 		return NULL;
@@ -335,7 +996,7 @@ MHashTable* _mht_uint_create (size_t size, const char* file, int line) {
 
 
 static MHashTable* mht_str_create_without_lock (size_t size, const char* file, int line) {
-	MHashTable* ht = mht_create_without_register_generic(size, KEY_TYPE_STR, file, line);
+	MHashTable* ht = mht_create_without_register_generic(size, KEY_TYPE_STR, 0, file, line);
 	if (ht == NULL) {
 		mht_errfunc = "_mht_str_create";
 		return NULL;
@@ -372,6 +1033,90 @@ MHashTable* _mht_str_create (size_t size, const char* file, int line) {
 }
 
 
+static MHashTable* mht_tuple_create_without_lock (size_t size, size_t key_words, const char* file, int line) {
+	if (key_words == 0 || key_words > TUPLE_KEY_MAX_WORDS) {
+		fprintf(stderr, "Tuple key width must be between 1 and %d words.\nFile: %s   Line: %d\n", TUPLE_KEY_MAX_WORDS, file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_tuple_create";
+		return NULL;
+	}
+
+	/* キーはエントリの中にそのまま置くので、インラインに収まらない分だけエントリを大きく確保する */
+	MHashTable* ht = mht_create_without_register_generic(size, KEY_TYPE_TUPLE, key_words, file, line);
+	if (ht == NULL) {
+		mht_errfunc = "_mht_tuple_create";
+		return NULL;
+	}
+
+	if (UNLIKELY(mht_entries == NULL)) {
+		init();
+	}
+
+	MHtTrackEntry mht_entry = {
+		.ptr = ht
+#ifdef DEBUG
+		,
+		.create_file = file,
+		.create_line = line,
+		.key_type = KEY_TYPE_TUPLE
+#endif
+	};
+
+	if (UNLIKELY(!mht_uint_set_without_lock(mht_entries, (uint_keyt)ht, &mht_entry, sizeof(MHtTrackEntry), file, line))) {
+		fprintf(stderr, "Failed to set hashtable in hashtable entries.\nFile: %s   Line: %d\n", file, line);
+		mht_errfunc = "_mht_tuple_create";
+	}
+
+	return ht;
+}
+
+
+MHashTable* _mht_tuple_create (size_t size, size_t key_words, const char* file, int line) {
+	mht_lock();
+	MHashTable* ht = mht_tuple_create_without_lock(size, key_words, file, line);
+	mht_unlock();
+	return ht;
+}
+
+
+static MHashTable* mht_uint32_create_without_lock (size_t size, const char* file, int line) {
+	MHashTable* ht = mht_create_without_register_generic(size, KEY_TYPE_UINT32, 0, file, line);
+	if (ht == NULL) {
+		mht_errfunc = "_mht_uint32_create";
+		return NULL;
+	}
+
+	if (UNLIKELY(mht_entries == NULL)) {
+		init();
+	}
+
+	MHtTrackEntry mht_entry = {
+		.ptr = ht
+#ifdef DEBUG
+		,
+		.create_file = file,
+		.create_line = line,
+		.key_type = KEY_TYPE_UINT32
+#endif
+	};
+
+	if (UNLIKELY(!mht_uint_set_without_lock(mht_entries, (uint_keyt)ht, &mht_entry, sizeof(MHtTrackEntry), file, line))) {
+		fprintf(stderr, "Failed to set hashtable in hashtable entries.\nFile: %s   Line: %d\n", file, line);
+		mht_errfunc = "_mht_uint32_create";
+	}
+
+	return ht;
+}
+
+
+MHashTable* _mht_uint32_create (size_t size, const char* file, int line) {
+	mht_lock();
+	MHashTable* ht = mht_uint32_create_without_lock(size, file, line);
+	mht_unlock();
+	return ht;
+}
+
+
 static void* mht_uint_get_without_lock (MHashTable* ht, uint_keyt key, const char* file, int line);
 
 static bool mht_pre_execution_check (MHashTable* ht, const char* file, int line) {
@@ -400,235 +1145,5028 @@ static bool mht_pre_execution_check (MHashTable* ht, const char* file, int line)
 }
 
 
-static void mht_destroy_value_choose_delete (MHashTable* ht, bool value_delete) {
-	for (size_t i = 0; i < ht->size; i++) {
-		MHtEntry* entry = ht->buckets[i];
-		while (entry != NULL) {  /* bucketsが確保時に初期化されていることが前提 */
-			MHtEntry* next = entry->next;
+/*
+ * 追記専用のアリーナ
+ * 文字列を終端のヌル文字ごとブロックに詰めて置く。1 つの文字列はブロックをまたがず、
+ * ブロックは移動しないので、書き込んだ文字列のアドレスはブロックを解放するまで変わらない。
+ * インターンとキープールで共用する。
+ */
 
-			/* value_delete が true の場合のみ、値を削除 */
-			if (value_delete) free(entry->value);
+typedef struct ArenaBlock {
+	struct ArenaBlock* prev;
+	size_t used;
+	size_t capacity;
+	char data[];
+} ArenaBlock;
+
+
+/* 追記中のブロックに収まらなければ、block_size（文字列の方が大きければその大きさ）のブロックを足す */
+static char* arena_copy (ArenaBlock** head, str_keyt key, size_t block_size) {
+	size_t bytes = key.len + 1;
+	ArenaBlock* block = *head;
+
+	if (block == NULL || block->capacity - block->used < bytes) {
+		size_t capacity = (bytes > block_size) ? bytes : block_size;
+		ArenaBlock* new_block = malloc(sizeof(ArenaBlock) + capacity);
+		if (UNLIKELY(new_block == NULL)) return NULL;
+
+		new_block->prev = block;
+		new_block->used = 0;
+		new_block->capacity = capacity;
+		*head = new_block;
+		block = new_block;
+	}
 
-			/* キーの型が文字列の場合は、キーの文字列のために確保していたメモリブロックを解放 */
-			if (ht->key_type == KEY_TYPE_STR) free(entry->key.str.ptr);
+	char* dst = block->data + block->used;
+	memcpy(dst, key.ptr, key.len);
+	dst[key.len] = '\0';
+	block->used += bytes;
+	return dst;
+}
 
-			free(entry);
-			entry = next;
-		}
+
+static void arena_free (ArenaBlock* block) {
+	while (block != NULL) {
+		ArenaBlock* prev = block->prev;
+		free(block);
+		block = prev;
 	}
-	free(ht->buckets);
-	free(ht);
 }
 
 
-static bool mht_uint_delete_without_lock (MHashTable* ht, uint_keyt key, const char* file, int line);
+/*
+ * キープール
+ * 文字列キーをキーごとに確保せず、テーブルごとのページに詰めて置く。エントリの key.str.ptr は
+ * ページ内を指すので、ハッシュや比較はそのまま使える。削除したキーの領域は dead_bytes に数えるだけで
+ * 再利用せず、圧縮の際に生きているキーだけを新しいページへ写して取り戻す。
+ */
 
-void _mht_destroy (MHashTable* ht, const char* file, int line) {
-	mht_lock();
+struct KeyPool {
+	ArenaBlock* page;  /* 追記中のページ。古いページは prev で辿る */
+	size_t live_bytes;  /* 生きているキーが終端込みで使っているバイト数 */
+	size_t dead_bytes;  /* 削除されたキーが残しているバイト数 */
+};
 
-	if (!mht_pre_execution_check(ht, file, line)) {
-		mht_errfunc = "_mht_destroy";
-		mht_unlock();
-		return;
-	}
 
-	mht_destroy_value_choose_delete(ht, true);
+/* ページは KEY_POOL_MIN_PAGE から倍々に大きくし、KEY_POOL_MAX_PAGE で止める */
+static size_t key_pool_page_size (const KeyPool* pool) {
+	if (pool->page == NULL) return KEY_POOL_MIN_PAGE;
+	if (pool->page->capacity >= KEY_POOL_MAX_PAGE / 2) return KEY_POOL_MAX_PAGE;
+	return (pool->page->capacity < KEY_POOL_MIN_PAGE) ? KEY_POOL_MIN_PAGE : pool->page->capacity * 2;
+}
 
-	if (ht != mht_entries)
-		mht_uint_delete_without_lock(mht_entries, (uint_keyt)ht, file, line);
 
-	mht_unlock();
-}
+/* キーの文字列を複製する。キープールを使うテーブルではページに追記する */
+static char* key_str_dup (MHashTable* ht, str_keyt key) {
+	if (ht->key_pool == NULL) return mutils_strndup(key.ptr, key.len);
 
+	char* str = arena_copy(&ht->key_pool->page, key, key_pool_page_size(ht->key_pool));
+	if (str != NULL) ht->key_pool->live_bytes += key.len + 1;
+	return str;
+}
 
-void _mht_destroy_without_value (MHashTable* ht, const char* file, int line) {
-	mht_lock();
 
-	if (!mht_pre_execution_check(ht, file, line)) {
-		mht_errfunc = "_mht_destroy_without_value";
-		mht_unlock();
+/* キーの文字列を手放す。キープールの領域は圧縮するまで再利用しない */
+static void key_str_release (MHashTable* ht, MHtEntry* entry) {
+	if (ht->key_pool == NULL) {
+		free(entry->key.str.ptr);
 		return;
 	}
 
-	mht_destroy_value_choose_delete(ht, false);
+	if (entry->key.str.ptr == NULL) return;  /* 複製に失敗したエントリ */
+	ht->key_pool->live_bytes -= entry->key.str.len + 1;
+	ht->key_pool->dead_bytes += entry->key.str.len + 1;
+}
 
-	if (ht != mht_entries)
-		mht_uint_delete_without_lock(mht_entries, (uint_keyt)ht, file, line);
 
-	mht_unlock();
+/* ページをすべて手放して空のプールに戻す。エントリが残っていないときに呼ぶこと */
+static void key_pool_reset (KeyPool* pool) {
+	if (pool == NULL) return;
+	arena_free(pool->page);
+	*pool = (KeyPool){ NULL, 0, 0 };
 }
 
 
-static void mht_rehash (MHashTable* ht) {
-	if (ht->size > (SIZE_MAX / 2)) {
-		fprintf(stderr, "Hashtable size is too large for rehashing.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-		errno = EIO;
-		mht_errfunc = "mht_rehash";
-		return;
-	}
+static void key_pool_free (KeyPool* pool) {
+	if (pool == NULL) return;
+	arena_free(pool->page);
+	free(pool);
+}
 
-	size_t new_size = ht->size * 2;
 
-	if (new_size > (SIZE_MAX / sizeof(MHtEntry*))) {
-		fprintf(stderr, "Hashtable size is too large for rehashing.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-		errno = EIO;
-		mht_errfunc = "mht_rehash";
-		return;
-	}
+/*
+ * 重複排除の値ストア
+ * 複製して格納する値を内容のハッシュで引き、同じ内容の値は 1 つの SharedValue を参照数で共有する。
+ * エントリの value は SharedValue の data を指すので、取得の際はそのまま返せる。
+ */
 
-	MHtEntry** new_buckets = calloc(new_size, sizeof(MHtEntry*));  /* 今後の処理のために必ず初期化が必要 */
-	if (UNLIKELY(new_buckets == NULL)) {
-		fprintf(stderr, "Failed to allocate memory for rehashing.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-		errno = ENOMEM;
-		mht_errfunc = "mht_rehash";
-		return;
-	}
+typedef struct SharedValue {
+	struct SharedValue* next;
+	size_t hash;
+	size_t size;
+	size_t refs;
+	unsigned char data[];  /* ヘッダは 4 語なので、data も malloc の返す境界に揃う */
+} SharedValue;
 
-	for (size_t i = 0; i < ht->size; i++) {
-		MHtEntry* entry = ht->buckets[i];
-		while (entry != NULL) {  /* bucketsが確保時に初期化されていることが前提 */
-			MHtEntry* next = entry->next;
 
-			size_t new_index;
-			if (ht->key_type == KEY_TYPE_UINT)
-				new_index = hash_uint_key(entry->key.uint, new_size);
-			else  /* if (ht->key_type == KEY_TYPE_STR) */
-				new_index = hash_str_key(entry->key.str, new_size);
+struct ValueStore {
+	SharedValue** buckets;
+	size_t size;  /* バケット数、2 の冪 */
+	size_t count;  /* 異なる内容の値の数 */
+};
 
-			entry->next = new_buckets[new_index];
-			new_buckets[new_index] = entry;
-			entry = next;
-		}
-	}
 
-	free(ht->buckets);
-	ht->buckets = new_buckets;
-	ht->size = new_size;
+/* 値の内容のハッシュ。djb2_hash64n と違い、途中の 0 で止まらない */
+static size_t hash_value_bytes (const void* data, size_t len) {
+	const uint8_t* p = data;
+#if SIZE_MAX > UINT32_MAX
+	uint64_t hash = 14695981039346656037ULL;  /* FNV-1a */
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+#else
+	uint32_t hash = 2166136261U;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 16777619U;
+	}
+#endif
+	return (size_t)hash;
 }
 
 
-/* value_size が 0 のときに raw モードになる。ロック内で使用すること。 */
-static bool mht_set_generic (MHashTable* ht, KeyUni key, void* value_data, size_t value_size, const char* file, int line) {
-	if (!mht_pre_execution_check(ht, file, line))
-		return false;
+static ValueStore* dedup_create (void) {
+	ValueStore* store = calloc(1, sizeof(ValueStore));
+	if (UNLIKELY(store == NULL)) return NULL;
 
-	if (value_data == NULL) {
-		fprintf(stderr, "Value pointer is NULL.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		return false;
+	store->buckets = calloc(DEDUP_INITIAL_BUCKETS, sizeof(SharedValue*));
+	if (UNLIKELY(store->buckets == NULL)) {
+		free(store);
+		return NULL;
 	}
+	store->size = DEDUP_INITIAL_BUCKETS;
+	return store;
+}
 
-	if (ht->key_type != key.key_type) {
-		fprintf(stderr, "Key type mismatch in hashtable.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		return false;
+
+/* 広げられなくても長い連鎖のまま使い続けられる */
+static void dedup_grow (ValueStore* store) {
+	size_t new_size = store->size * 2;
+	SharedValue** new_buckets = calloc(new_size, sizeof(SharedValue*));
+	if (UNLIKELY(new_buckets == NULL)) return;
+
+	for (size_t i = 0; i < store->size; i++) {
+		SharedValue* shared = store->buckets[i];
+		while (shared != NULL) {
+			SharedValue* next = shared->next;
+			size_t index = shared->hash & (new_size - 1);
+			shared->next = new_buckets[index];
+			new_buckets[index] = shared;
+			shared = next;
+		}
 	}
+	free(store->buckets);
+	store->buckets = new_buckets;
+	store->size = new_size;
+}
 
-#if defined (__GNUC__) && !defined (__clang__)
-	#pragma GCC diagnostic push
-	#pragma GCC diagnostic ignored "-Wunsuffixed-float-constants"  /* mhashtable自体のデバッグを行う際は必ず外すこと */
-#endif
 
-	if (UNLIKELY(((double)ht->count / (double)ht->size) > LOAD_FACTOR))
-		mht_rehash(ht);
+/* 同じ内容の値があれば参照数を増やしてそれを返し、なければ複製して登録する */
+static void* dedup_acquire (ValueStore* store, const void* value_data, size_t value_size) {
+	size_t hash = hash_value_bytes(value_data, value_size);
+	for (SharedValue* shared = store->buckets[hash & (store->size - 1)]; shared != NULL; shared = shared->next) {
+		if (shared->hash == hash && shared->size == value_size && memcmp(shared->data, value_data, value_size) == 0) {
+			shared->refs++;
+			return shared->data;
+		}
+	}
 
-#if defined (__GNUC__) && !defined (__clang__)
-	#pragma GCC diagnostic pop
-#endif
+	SharedValue* shared = malloc(sizeof(SharedValue) + value_size);
+	if (UNLIKELY(shared == NULL)) return NULL;
+	shared->hash = hash;
+	shared->size = value_size;
+	shared->refs = 1;
+	memcpy(shared->data, value_data, value_size);
+
+	if (store->count >= store->size) dedup_grow(store);
+	size_t index = hash & (store->size - 1);
+	shared->next = store->buckets[index];
+	store->buckets[index] = shared;
+	store->count++;
+	return shared->data;
+}
 
-	size_t index;
-	if (ht->key_type == KEY_TYPE_UINT)
-		index = hash_uint_key(key.key.uint, ht->size);
-	else  /* if (ht->key_type == KEY_TYPE_STR) */
-		index = hash_str_key(key.key.str, ht->size);
 
-	MHtEntry* entry = ht->buckets[index];
+static void dedup_release (ValueStore* store, void* value) {
+	SharedValue* shared = (SharedValue*)(void*)((unsigned char*)value - offsetof(SharedValue, data));
+	if (--shared->refs != 0) return;
 
-	/* 既存キーを更新（上書き） */
-	while (entry != NULL) {  /* bucketsが確保時に初期化されていることが前提 */
-		if ((ht->key_type == KEY_TYPE_UINT && entry->key.uint == key.key.uint) ||
-			(ht->key_type == KEY_TYPE_STR && str_key_equal(entry->key.str, key.key.str))) {
-			if (value_size != 0) {
-				void* new_value = calloc(1, value_size);
-				if (UNLIKELY(new_value == NULL)) return false;
+	SharedValue** link = &store->buckets[shared->hash & (store->size - 1)];
+	while (*link != shared) link = &(*link)->next;
+	*link = shared->next;
+	store->count--;
+	free(shared);
+}
 
-				free(entry->value);
-				entry->value = new_value;
-				memcpy(entry->value, value_data, value_size);
-			} else {
-				free(entry->value);
-				entry->value = value_data;
-			}
-			entry->value_size = value_size;
-			return true;
+
+/* 値はストアの持ち物なので、参照が残っていてもすべて解放する */
+static void dedup_free (ValueStore* store) {
+	if (store == NULL) return;
+	for (size_t i = 0; i < store->size; i++) {
+		SharedValue* shared = store->buckets[i];
+		while (shared != NULL) {
+			SharedValue* next = shared->next;
+			free(shared);
+			shared = next;
 		}
+	}
+	free(store->buckets);
+	free(store);
+}
+
+
+/*
+ * 変更ログ
+ * set と delete と clear が成功するたびに、1 から始まる通し番号を付けてリングバッファに記録する。
+ * 文字列とタプルのキーは記録ごとに複製して持つ。満杯になると最も古い記録から上書きする。
+ */
+
+typedef struct {
+	uint64_t seq;
+	MHtChangeType type;
+	KeyUni key;  /* 文字列とタプルのキーは key_mem を指す */
+	void* key_mem;
+} ChangeRecord;
+
+
+struct ChangeLog {
+	ChangeRecord* records;
+	size_t capacity;
+	size_t head;  /* 最も古い記録の位置 */
+	size_t count;
+	uint64_t last_seq;  /* 最後に付けた番号。まだ変更がなければ 0 */
+};
+
+
+static ChangeLog* change_log_create (size_t capacity, uint64_t last_seq) {
+	ChangeLog* log = calloc(1, sizeof(ChangeLog));
+	if (UNLIKELY(log == NULL)) return NULL;
+
+	log->records = calloc(capacity, sizeof(ChangeRecord));
+	if (UNLIKELY(log->records == NULL)) {
+		free(log);
+		return NULL;
+	}
+	log->capacity = capacity;
+	log->last_seq = last_seq;
+	return log;
+}
+
+
+/* 残っている記録をすべて捨てる。番号はそのまま続ける */
+static void change_log_drop (ChangeLog* log) {
+	for (size_t i = 0; i < log->count; i++)
+		free(log->records[(log->head + i) % log->capacity].key_mem);
+	log->head = 0;
+	log->count = 0;
+}
+
+
+static void change_log_free (ChangeLog* log) {
+	if (log == NULL) return;
+	change_log_drop(log);
+	free(log->records);
+	free(log);
+}
+
+
+/* 記録に持たせるキーの複製を作る。整数のキーは複製せず NULL を返す */
+static void* change_key_copy (const MHashTable* ht, KeyUni key) {
+	if (ht->key_type == KEY_TYPE_STR)
+		return mutils_strndup(key.key.str.ptr, key.key.str.len);
+
+	if (ht->key_type == KEY_TYPE_TUPLE) {
+		uint_keyt* words = malloc(ht->key_words * sizeof(uint_keyt));
+		if (words != NULL) memcpy(words, key.key.tuple, ht->key_words * sizeof(uint_keyt));
+		return words;
+	}
+	return NULL;
+}
+
+
+/* key_mem は change_key_copy で作ったもので、この関数が引き取る */
+static void change_log_push (MHashTable* ht, MHtChangeType type, KeyUni key, void* key_mem) {
+	ChangeLog* log = ht->change_log;
+	log->last_seq++;
+
+	/* キーを複製できなかった変更は記録できないので、それより前の記録も捨てて読み手に読み直させる */
+	if (UNLIKELY(type != MHT_CHANGE_CLEAR && key_mem == NULL && (ht->key_type == KEY_TYPE_STR || ht->key_type == KEY_TYPE_TUPLE))) {
+		change_log_drop(log);
+		return;
+	}
+
+	size_t pos;
+	if (log->count == log->capacity) {
+		pos = log->head;
+		free(log->records[pos].key_mem);
+		log->head = (log->head + 1) % log->capacity;
+	} else {
+		pos = (log->head + log->count) % log->capacity;
+		log->count++;
+	}
+
+	ChangeRecord* record = &log->records[pos];
+	record->seq = log->last_seq;
+	record->type = type;
+	record->key = key;
+	record->key_mem = key_mem;
+	if (ht->key_type == KEY_TYPE_STR && key_mem != NULL)
+		record->key.key.str.ptr = key_mem;
+	else if (ht->key_type == KEY_TYPE_TUPLE && key_mem != NULL)
+		record->key.key.tuple = key_mem;
+}
+
+
+static void change_log_record (MHashTable* ht, MHtChangeType type, KeyUni key) {
+	if (ht->change_log == NULL) return;
+	change_log_push(ht, type, key, (type == MHT_CHANGE_CLEAR) ? NULL : change_key_copy(ht, key));
+}
+
+
+/* エントリの値を手放す。raw モードの値は常に解放し、重複排除した値は参照がなくなったときだけ解放する */
+static void entry_value_free (MHashTable* ht, MHtEntry* entry) {
+	if (ht->dedup != NULL && entry_value_size(ht, entry) != 0) {
+		if (entry->value != NULL) dedup_release(ht->dedup, entry->value);  /* 複製に失敗したエントリは NULL */
+	} else {
+		free(entry->value);
+	}
+}
+
+
+/* 連鎖法とスモールモードのエントリをすべて解放する。バケット配列はそのまま残すので、続けて解放するか空にすること */
+static void chain_release_entries (MHashTable* ht, bool value_delete) {
+	if (ht->buckets == NULL) {  /* スモールモード */
+		for (size_t i = 0; i < ht->count; i++) {
+			if (value_delete) entry_value_free(ht, &ht->small[i]);
+			if (ht->key_type == KEY_TYPE_STR) key_str_release(ht, &ht->small[i]);
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < ht->size; i++) {
+		MHtEntry* entry = ht->buckets[i];
+		while (entry != NULL) {  /* bucketsが確保時に初期化されていることが前提 */
+			MHtEntry* next = entry->next;
+
+			/* value_delete が true の場合のみ、値を削除 */
+			if (value_delete) entry_value_free(ht, entry);
+
+			/* キーの型が文字列の場合は、キーの文字列のために確保していたメモリブロックを解放 */
+			if (ht->key_type == KEY_TYPE_STR) key_str_release(ht, entry);
+
+			free(entry);
+			entry = next;
+		}
+	}
+}
+
+
+static void sketch_free (AccessSketch* sketch);
+static void split_free (SplitTable* table, bool value_delete);
+static void cuckoo_free (MHashTable* ht, bool value_delete);
+static void compact_free (MHashTable* ht, bool value_delete);
+static void frozen_free (FrozenTable* table, bool value_delete);
+
+/* 非同期の破棄ではロックの外で呼ばれるので、バージョンのセルは呼び出し側がロック内で手放しておくこと */
+static void mht_destroy_value_choose_delete (MHashTable* ht, bool value_delete) {
+	/* 他ノードのレプリカの値は常にこのライブラリがコピーしたものなので必ず解放する */
+	if (ht->numa_replicas != NULL) {
+		for (size_t i = 0; i < ht->numa_nodes; i++) {
+			if (ht->numa_replicas[i] != NULL && ht->numa_replicas[i] != ht)
+				mht_destroy_value_choose_delete(ht->numa_replicas[i], true);
+		}
+		free(ht->numa_replicas);
+	}
+
+	sketch_free(ht->sketch);
+
+	if (ht->split != NULL) {
+		split_free(ht->split, value_delete);
+	} else if (ht->frozen != NULL) {
+		frozen_free(ht->frozen, value_delete);
+	} else if (ht->cuckoo != NULL) {
+		cuckoo_free(ht, value_delete);
+	} else if (ht->compact != NULL) {
+		compact_free(ht, value_delete);
+	} else {
+		chain_release_entries(ht, value_delete);
+		if (ht->buckets != NULL) buckets_free(ht->buckets, ht->size, ht->buckets_mapped);
+	}
+
+	key_pool_free(ht->key_pool);  /* キーはすべて手放し済み */
+	dedup_free(ht->dedup);
+	change_log_free(ht->change_log);
+	free(ht);
+}
+
+
+static bool mht_uint_delete_without_lock (MHashTable* ht, uint_keyt key, const char* file, int line);
+
+void _mht_destroy (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_destroy";
+		mht_unlock();
+		return;
+	}
+
+	table_version_detach(ht);
+	mht_destroy_value_choose_delete(ht, true);
+
+	if (ht != mht_entries)
+		mht_uint_delete_without_lock(mht_entries, (uint_keyt)ht, file, line);
+
+	mht_unlock();
+}
+
+
+void _mht_destroy_without_value (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_destroy_without_value";
+		mht_unlock();
+		return;
+	}
+
+	table_version_detach(ht);
+	mht_destroy_value_choose_delete(ht, false);
+
+	if (ht != mht_entries)
+		mht_uint_delete_without_lock(mht_entries, (uint_keyt)ht, file, line);
+
+	mht_unlock();
+}
+
+
+#if defined (_WIN32)
+static DWORD WINAPI destroy_async_thread (LPVOID arg) {
+	mht_destroy_value_choose_delete((MHashTable*)arg, true);
+	return 0;
+}
+#else
+static void* destroy_async_thread (void* arg) {
+	mht_destroy_value_choose_delete((MHashTable*)arg, true);
+	return NULL;
+}
+#endif
+
+
+/* 解放用のスレッドを切り離して起動する。起動できなければ false を返す */
+static bool destroy_async_start (MHashTable* ht) {
+#if defined (_WIN32)
+	HANDLE thread = CreateThread(NULL, 0, destroy_async_thread, ht, 0, NULL);
+	if (thread == NULL) return false;
+	CloseHandle(thread);
+	return true;
+#else
+	pthread_attr_t attr;
+	if (pthread_attr_init(&attr) != 0) return false;
+
+	pthread_t thread;
+	int result = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (result == 0) result = pthread_create(&thread, &attr, destroy_async_thread, ht);
+	pthread_attr_destroy(&attr);
+	return result == 0;
+#endif
+}
+
+
+/*
+ * 登録の解除だけをロック内で行い、中身の解放はロックの外で行う。
+ * 登録を外したテーブルには他のスレッドから到達できないため、解放中にロックは要らない
+ */
+void _mht_destroy_async (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_destroy_async";
+		mht_unlock();
+		return;
+	}
+
+	if (ht == mht_entries || ht == all_get_arr_entries) {
+		fprintf(stderr, "Internal hashtables cannot be destroyed asynchronously.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_destroy_async";
+		mht_unlock();
+		return;
+	}
+
+	mht_uint_delete_without_lock(mht_entries, (uint_keyt)ht, file, line);
+	table_version_detach(ht);
+
+	mht_unlock();
+
+	/* 分割順序リストは count を使わないので、要素数に関わらずスレッドに任せる */
+	if ((ht->split == NULL && ht->count < DESTROY_ASYNC_MIN_COUNT) || !destroy_async_start(ht))
+		mht_destroy_value_choose_delete(ht, true);
+}
+
+
+static bool key_pool_compact (MHashTable* ht);
+
+/* new_size は現在の大きさの 2 の累乗倍であること。昇順の連鎖を持つテーブルは 2 倍ずつしか広げられない */
+static void mht_rehash_to (MHashTable* ht, size_t new_size) {
+	table_version_bump(ht);
+
+	if (new_size > (SIZE_MAX / sizeof(MHtEntry*))) {
+		fprintf(stderr, "Hashtable size is too large for rehashing.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		errno = EIO;
+		mht_errfunc = "mht_rehash";
+		return;
+	}
+
+	bool new_mapped;
+	MHtEntry** new_buckets = buckets_alloc(ht->huge_page_mode, new_size, &new_mapped);  /* 今後の処理のために必ず初期化が必要 */
+	if (UNLIKELY(new_buckets == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for rehashing.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		errno = ENOMEM;
+		mht_errfunc = "mht_rehash";
+		return;
+	}
+
+	for (size_t i = 0; i < ht->size; i++) {
+		/* 昇順の連鎖は順序を保って末尾に繋ぐ。バケット i の要素は i か i + size にしか移らない */
+		MHtEntry** tails[2] = { &new_buckets[i], &new_buckets[i + ht->size] };
+
+		MHtEntry* entry = ht->buckets[i];
+		while (entry != NULL) {  /* bucketsが確保時に初期化されていることが前提 */
+			MHtEntry* next = entry->next;
+
+			size_t new_index = hash_entry_key(ht, entry, new_size);
+
+			if (ht->ordered_chains) {
+				size_t side = (new_index != i);
+				entry->next = NULL;
+				*tails[side] = entry;
+				tails[side] = &entry->next;
+			} else {
+				entry->next = new_buckets[new_index];
+				new_buckets[new_index] = entry;
+			}
+			entry = next;
+		}
+	}
+
+	buckets_free(ht->buckets, ht->size, ht->buckets_mapped);
+	ht->buckets = new_buckets;
+	ht->buckets_mapped = new_mapped;
+	ht->size = new_size;
+
+	/* 全エントリに触れた直後なので、削除済みのキーが半分を超えていればついでに詰める */
+	if (ht->key_pool != NULL && ht->key_pool->dead_bytes > ht->key_pool->live_bytes)
+		key_pool_compact(ht);
+}
+
+
+static void mht_rehash (MHashTable* ht) {
+	if (ht->size > (SIZE_MAX / 2)) {
+		fprintf(stderr, "Hashtable size is too large for rehashing.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		errno = EIO;
+		mht_errfunc = "mht_rehash";
+		return;
+	}
+
+	mht_rehash_to(ht, ht->size * 2);
+}
+
+
+bool _mht_set_huge_pages (MHashTable* ht, MHtHugePageMode mode, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_set_huge_pages";
+		mht_unlock();
+		return false;
+	}
+
+	if (mode != MHT_HUGE_PAGE_OFF && mode != MHT_HUGE_PAGE_TRANSPARENT && mode != MHT_HUGE_PAGE_EXPLICIT) {
+		fprintf(stderr, "Invalid huge page mode.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_huge_pages";
+		mht_unlock();
+		return false;
+	}
+
+	ht->huge_page_mode = mode;
+
+	/* 既に十分大きなバケット配列を持っている場合は、その場で移し替える */
+	if (ht->buckets != NULL && !ht->buckets_mapped && mode != MHT_HUGE_PAGE_OFF) {
+		bool new_mapped;
+		MHtEntry** new_buckets = buckets_alloc(mode, ht->size, &new_mapped);
+		if (new_buckets != NULL && new_mapped) {
+			memcpy(new_buckets, ht->buckets, ht->size * sizeof(MHtEntry*));
+			free(ht->buckets);
+			ht->buckets = new_buckets;
+			ht->buckets_mapped = true;
+		} else if (new_buckets != NULL) {
+			free(new_buckets);
+		}
+	}
+
+	mht_unlock();
+	return true;
+}
+
+
+/*
+ * 分割順序リスト（split-ordered list）によるロックフリーなエンジン
+ * 全要素をハッシュ値のビットを反転した順に並べた 1 本の整列済みリストに置き、
+ * バケットはそのリスト上のダミーノードへの近道として、初めて使われた時点で作る。
+ * バケット数を倍にしても要素を移し替える必要がないため、拡張は論理バケット数を
+ * 書き換えるだけで終わり、挿入・検索・削除はロックを取らずに拡張と並行して進められる。
+ * 外したノードと置き換えた値は他のスレッドがまだ参照している可能性があるため、
+ * 退避リストに積んでおき、エポックで猶予期間を区切って解放する。操作中のスレッドは
+ * 開始時のエポックの偶奇ごとに数えられ、書き込みの後に退避リストを取り出してエポックを進め、
+ * 古い偶奇の操作が全て終わった時点で取り出した分を解放する。
+ */
+
+#ifdef ATOMICS_SUPPORTED
+
+#define SPLIT_SEGMENTS (sizeof(size_t) * 8)  /* セグメント s (s >= 1) はバケット [2^(s-1), 2^s) を持つ */
+#define SPLIT_LOAD_FACTOR 2  /* バケットあたりの平均要素数がこれを超えたらバケット数を倍にする */
+#define SPLIT_MARK ((uintptr_t)1)  /* next の最下位ビット。立っていればそのノード自身が論理削除済み */
+
+
+typedef struct SplitNode {
+	uint64_t so_key;  /* ハッシュ値のビット反転。通常のノードは最下位ビットが 1、ダミーノードは 0 */
+	uint_keyt key;
+	_Atomic(void*) value;  /* ダミーノードでは NULL */
+	atomic_uintptr_t next;
+	struct SplitNode* retired_next;
+} SplitNode;
+
+
+typedef struct SplitRetired {
+	void* value;
+	struct SplitRetired* next;
+} SplitRetired;
+
+
+struct SplitTable {
+	atomic_size_t size;   /* 論理バケット数。2 の累乗で、増えるだけ */
+	atomic_size_t count;  /* 近似値。拡張の判断にだけ使う */
+	_Atomic(_Atomic(SplitNode*)*) segments[SPLIT_SEGMENTS];  /* バケットからダミーノードへの近道 */
+	SplitNode head;  /* バケット 0 のダミーノード */
+	_Atomic(SplitNode*) retired_nodes;
+	_Atomic(SplitRetired*) retired_values;
+	atomic_size_t epoch;
+	atomic_size_t active[2];  /* エポックの偶奇ごとの操作中のスレッド数 */
+	atomic_bool reclaiming;  /* 以下の 3 つは、これを立てたスレッドだけが触る */
+	SplitNode* pending_nodes;  /* 取り出し済みで、pending_parity の操作が終わるのを待っている */
+	SplitRetired* pending_values;
+	size_t pending_parity;
+};
+
+
+static uint64_t split_reverse (uint64_t x) {
+	x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+	x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+	x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+	x = ((x >> 8) & 0x00FF00FF00FF00FFULL) | ((x & 0x00FF00FF00FF00FFULL) << 8);
+	x = ((x >> 16) & 0x0000FFFF0000FFFFULL) | ((x & 0x0000FFFF0000FFFFULL) << 16);
+	return (x >> 32) | (x << 32);
+}
+
+
+static size_t split_bit_length (size_t x) {
+	size_t bits = 0;
+	while (x != 0) {
+		bits++;
+		x >>= 1;
+	}
+	return bits;
+}
+
+
+static SplitTable* split_table_create (size_t size) {
+	SplitTable* table = calloc(1, sizeof(SplitTable));
+	if (UNLIKELY(table == NULL)) return NULL;
+
+	_Atomic(SplitNode*)* first = calloc(1, sizeof(_Atomic(SplitNode*)));
+	if (UNLIKELY(first == NULL)) {
+		free(table);
+		return NULL;
+	}
+	atomic_init(first, &table->head);
+	atomic_init(&table->segments[0], first);
+	atomic_init(&table->size, size);
+	return table;
+}
+
+
+static void split_retire_node (SplitTable* table, SplitNode* node) {
+	SplitNode* top = atomic_load_explicit(&table->retired_nodes, memory_order_relaxed);
+	do {
+		node->retired_next = top;
+	} while (!atomic_compare_exchange_weak_explicit(&table->retired_nodes, &top, node, memory_order_release, memory_order_relaxed));
+}
+
+
+/* 記録を確保できなければ値を手放せないので、解放を諦めて取りこぼす */
+static void split_retire_value (SplitTable* table, void* value) {
+	SplitRetired* record = malloc(sizeof(SplitRetired));
+	if (UNLIKELY(record == NULL)) return;
+
+	record->value = value;
+	SplitRetired* top = atomic_load_explicit(&table->retired_values, memory_order_relaxed);
+	do {
+		record->next = top;
+	} while (!atomic_compare_exchange_weak_explicit(&table->retired_values, &top, record, memory_order_release, memory_order_relaxed));
+}
+
+
+/* 操作の開始時に呼び、戻り値を split_leave に渡す。読んだエポックが変わっていたら数え直す */
+static size_t split_enter (SplitTable* table) {
+	while (true) {
+		size_t epoch = atomic_load(&table->epoch);
+		atomic_fetch_add(&table->active[epoch & 1], 1);
+		if (atomic_load(&table->epoch) == epoch) return epoch & 1;
+		atomic_fetch_sub(&table->active[epoch & 1], 1);
+	}
+}
+
+
+static void split_leave (SplitTable* table, size_t parity) {
+	atomic_fetch_sub(&table->active[parity], 1);
+}
+
+
+static void split_release_retired (SplitNode* nodes, SplitRetired* values) {
+	while (nodes != NULL) {
+		SplitNode* next = nodes->retired_next;
+		free(atomic_load_explicit(&nodes->value, memory_order_relaxed));
+		free(nodes);
+		nodes = next;
+	}
+	while (values != NULL) {
+		SplitRetired* next = values->next;
+		free(values->value);
+		free(values);
+		values = next;
+	}
+}
+
+
+/*
+ * 書き込みの後、split_leave を呼んでから呼ぶ。他のスレッドが回収中なら何もせずに戻る。
+ * エポックを進めるのは前回取り出した分を解放できた後だけなので、取り出した時点で操作中だったスレッドは
+ * 全て古い偶奇に数えられている。新しいエポックで始まった操作は、取り出し済みのノードと値には到達できない
+ */
+static void split_reclaim (SplitTable* table) {
+	bool expected = false;
+	if (!atomic_compare_exchange_strong(&table->reclaiming, &expected, true)) return;
+
+	if (table->pending_nodes != NULL || table->pending_values != NULL) {
+		if (atomic_load(&table->active[table->pending_parity]) != 0) {
+			atomic_store(&table->reclaiming, false);
+			return;
+		}
+		split_release_retired(table->pending_nodes, table->pending_values);
+		table->pending_nodes = NULL;
+		table->pending_values = NULL;
+	}
+
+	SplitNode* nodes = atomic_exchange(&table->retired_nodes, NULL);
+	SplitRetired* values = atomic_exchange(&table->retired_values, NULL);
+	if (nodes != NULL || values != NULL) {
+		size_t parity = atomic_fetch_add(&table->epoch, 1) & 1;
+		if (atomic_load(&table->active[parity]) == 0) {
+			split_release_retired(nodes, values);
+		} else {
+			table->pending_nodes = nodes;
+			table->pending_values = values;
+			table->pending_parity = parity;
+		}
+	}
+
+	atomic_store(&table->reclaiming, false);
+}
+
+
+/*
+ * start から (so_key, key) 以上の最初のノードを探し、そのノードを *out_cur に、そこを指すリンクを *out_prev に返す。
+ * 途中で見つけた論理削除済みのノードはリストから外して退避する。完全に一致するノードが見つかれば true を返す
+ */
+static bool split_find (SplitTable* table, SplitNode* start, uint64_t so_key, uint_keyt key, atomic_uintptr_t** out_prev, SplitNode** out_cur) {
+	bool restart = true;
+	atomic_uintptr_t* prev = NULL;
+	SplitNode* cur = NULL;
+
+	while (restart) {
+		restart = false;
+		prev = &start->next;
+		cur = (SplitNode*)(atomic_load_explicit(prev, memory_order_acquire) & ~SPLIT_MARK);
+
+		while (cur != NULL) {
+			uintptr_t next = atomic_load_explicit(&cur->next, memory_order_acquire);
+			if (next & SPLIT_MARK) {
+				uintptr_t expected = (uintptr_t)cur;
+				if (!atomic_compare_exchange_strong_explicit(prev, &expected, next & ~SPLIT_MARK, memory_order_acq_rel, memory_order_acquire)) {
+					restart = true;  /* 直前のノードも削除されたか、間に挿入があった */
+					break;
+				}
+				split_retire_node(table, cur);
+				cur = (SplitNode*)(next & ~SPLIT_MARK);
+				continue;
+			}
+
+			if (cur->so_key > so_key || (cur->so_key == so_key && cur->key >= key)) break;
+
+			prev = &cur->next;
+			cur = (SplitNode*)next;
+		}
+	}
+
+	*out_prev = prev;
+	*out_cur = cur;
+	return cur != NULL && cur->so_key == so_key && cur->key == key;
+}
+
+
+/* バケットに対応するダミーノードを返す。まだ無ければ、最上位ビットを落とした親バケットから辿って挿入する */
+static SplitNode* split_bucket (SplitTable* table, size_t bucket) {
+	size_t segment_index = split_bit_length(bucket);
+	size_t base = (segment_index == 0) ? 0 : ((size_t)1 << (segment_index - 1));
+
+	_Atomic(SplitNode*)* segment = atomic_load_explicit(&table->segments[segment_index], memory_order_acquire);
+	if (segment == NULL) {
+		_Atomic(SplitNode*)* fresh = calloc(base, sizeof(_Atomic(SplitNode*)));  /* segment_index >= 1 なので base >= 1 */
+		if (UNLIKELY(fresh == NULL)) return NULL;
+
+		_Atomic(SplitNode*)* expected = NULL;
+		if (atomic_compare_exchange_strong_explicit(&table->segments[segment_index], &expected, fresh, memory_order_acq_rel, memory_order_acquire)) {
+			segment = fresh;
+		} else {
+			free(fresh);
+			segment = expected;
+		}
+	}
+
+	_Atomic(SplitNode*)* slot = &segment[bucket - base];
+	SplitNode* dummy = atomic_load_explicit(slot, memory_order_acquire);
+	if (dummy != NULL) return dummy;
+
+	SplitNode* parent = split_bucket(table, bucket - base);  /* bucket >= 1 なので base は最上位ビット */
+	if (UNLIKELY(parent == NULL)) return NULL;
+
+	SplitNode* fresh = calloc(1, sizeof(SplitNode));
+	if (UNLIKELY(fresh == NULL)) return NULL;
+	fresh->so_key = split_reverse((uint64_t)bucket);
+
+	while (dummy == NULL) {
+		atomic_uintptr_t* prev;
+		SplitNode* cur;
+		if (split_find(table, parent, fresh->so_key, 0, &prev, &cur)) {  /* 他のスレッドが先に挿入した */
+			free(fresh);
+			dummy = cur;
+			break;
+		}
+
+		atomic_store_explicit(&fresh->next, (uintptr_t)cur, memory_order_relaxed);
+		uintptr_t expected = (uintptr_t)cur;
+		if (atomic_compare_exchange_strong_explicit(prev, &expected, (uintptr_t)fresh, memory_order_acq_rel, memory_order_acquire))
+			dummy = fresh;
+	}
+
+	atomic_store_explicit(slot, dummy, memory_order_release);
+	return dummy;
+}
+
+
+static SplitNode* split_start (SplitTable* table, uint64_t hash) {
+	size_t size = atomic_load_explicit(&table->size, memory_order_acquire);
+	return split_bucket(table, (size_t)(hash & (size - 1)));
+}
+
+
+/* split_enter と split_leave の間で呼ぶ */
+static bool split_insert (SplitTable* table, uint_keyt key, void* value_data, size_t value_size) {
+	void* value = value_data;
+	if (value_size != 0) {
+		value = malloc(value_size);
+		if (UNLIKELY(value == NULL)) {
+			errno = ENOMEM;
+			return false;
+		}
+		memcpy(value, value_data, value_size);
+	}
+
+	uint64_t hash = wang_hash64(key);
+	uint64_t so_key = split_reverse(hash) | 1;
+
+	SplitNode* start = split_start(table, hash);
+	if (UNLIKELY(start == NULL)) {
+		if (value_size != 0) free(value);
+		errno = ENOMEM;
+		return false;
+	}
+
+	SplitNode* node = NULL;
+	while (true) {
+		atomic_uintptr_t* prev;
+		SplitNode* cur;
+		if (split_find(table, start, so_key, key, &prev, &cur)) {  /* 既存キーを更新（上書き） */
+			void* old = atomic_exchange_explicit(&cur->value, value, memory_order_acq_rel);
+			split_retire_value(table, old);
+			free(node);
+			return true;
+		}
+
+		if (node == NULL) {
+			node = calloc(1, sizeof(SplitNode));
+			if (UNLIKELY(node == NULL)) {
+				if (value_size != 0) free(value);
+				errno = ENOMEM;
+				return false;
+			}
+			node->so_key = so_key;
+			node->key = key;
+			atomic_init(&node->value, value);
+		}
+
+		atomic_store_explicit(&node->next, (uintptr_t)cur, memory_order_relaxed);
+		uintptr_t expected = (uintptr_t)cur;
+		if (atomic_compare_exchange_strong_explicit(prev, &expected, (uintptr_t)node, memory_order_acq_rel, memory_order_acquire))
+			break;
+	}
+
+	/* 拡張は論理バケット数を倍にするだけ。新しいバケットは使われた時点で親から分かれる */
+	size_t size = atomic_load_explicit(&table->size, memory_order_relaxed);
+	size_t count = atomic_fetch_add_explicit(&table->count, 1, memory_order_relaxed) + 1;
+	if (count / size > SPLIT_LOAD_FACTOR && size < ((size_t)1 << (SPLIT_SEGMENTS - 1)))
+		atomic_compare_exchange_strong_explicit(&table->size, &size, size * 2, memory_order_release, memory_order_relaxed);
+
+	return true;
+}
+
+
+/* split_enter と split_leave の間で呼ぶ */
+static void* split_lookup (SplitTable* table, uint_keyt key) {
+	uint64_t hash = wang_hash64(key);
+
+	SplitNode* start = split_start(table, hash);
+	if (UNLIKELY(start == NULL)) return NULL;
+
+	atomic_uintptr_t* prev;
+	SplitNode* cur;
+	if (!split_find(table, start, split_reverse(hash) | 1, key, &prev, &cur)) return NULL;
+
+	return atomic_load_explicit(&cur->value, memory_order_acquire);
+}
+
+
+/* split_enter と split_leave の間で呼ぶ。next に削除の印を付けた時点で削除が成立し、リストから外すのはその後で誰が行ってもよい */
+static bool split_remove (SplitTable* table, uint_keyt key) {
+	uint64_t hash = wang_hash64(key);
+	uint64_t so_key = split_reverse(hash) | 1;
+
+	SplitNode* start = split_start(table, hash);
+	if (UNLIKELY(start == NULL)) return false;
+
+	while (true) {
+		atomic_uintptr_t* prev;
+		SplitNode* cur;
+		if (!split_find(table, start, so_key, key, &prev, &cur)) return false;
+
+		uintptr_t next = atomic_load_explicit(&cur->next, memory_order_acquire);
+		if (next & SPLIT_MARK) continue;  /* 他のスレッドが削除した。次の split_find で外れる */
+
+		if (!atomic_compare_exchange_strong_explicit(&cur->next, &next, next | SPLIT_MARK, memory_order_acq_rel, memory_order_acquire))
+			continue;
+
+		atomic_fetch_sub_explicit(&table->count, 1, memory_order_relaxed);
+
+		uintptr_t expected = (uintptr_t)cur;
+		if (atomic_compare_exchange_strong_explicit(prev, &expected, next, memory_order_acq_rel, memory_order_acquire))
+			split_retire_node(table, cur);
+		else
+			split_find(table, start, so_key, key, &prev, &cur);  /* 外すのは split_find に任せる */
+		return true;
+	}
+}
+
+
+/*
+ * value_size が 0 のときに raw モードになる。ロックは不要。
+ * 同じキーへの set と delete が競合した場合、set は delete より先に行われたものとして扱われることがある
+ */
+static bool split_set (SplitTable* table, uint_keyt key, void* value_data, size_t value_size) {
+	size_t parity = split_enter(table);
+	bool result = split_insert(table, key, value_data, value_size);
+	split_leave(table, parity);
+	split_reclaim(table);
+	return result;
+}
+
+
+/* ロックは不要。見つからなければ NULL を返す。返した値はそのキーが上書きか削除されるまで有効 */
+static void* split_get (SplitTable* table, uint_keyt key) {
+	size_t parity = split_enter(table);
+	void* value = split_lookup(table, key);
+	split_leave(table, parity);
+	return value;
+}
+
+
+/* ロックは不要 */
+static bool split_delete (SplitTable* table, uint_keyt key) {
+	size_t parity = split_enter(table);
+	bool result = split_remove(table, key);
+	split_leave(table, parity);
+	split_reclaim(table);
+	return result;
+}
+
+
+/* ロック内で、他のスレッドが使っていない状態で呼ぶ */
+static size_t split_count_live (SplitTable* table) {
+	size_t count = 0;
+	uintptr_t link = atomic_load_explicit(&table->head.next, memory_order_acquire);
+	while ((link & ~SPLIT_MARK) != 0) {
+		SplitNode* node = (SplitNode*)(link & ~SPLIT_MARK);
+		link = atomic_load_explicit(&node->next, memory_order_acquire);
+		if ((node->so_key & 1) && !(link & SPLIT_MARK)) count++;
+	}
+	return count;
+}
+
+
+/* 並行して挿入された値は capacity を超えた分だけ取りこぼす */
+static size_t split_collect (SplitTable* table, void** values, size_t capacity) {
+	size_t parity = split_enter(table);
+	size_t idx = 0;
+	uintptr_t link = atomic_load_explicit(&table->head.next, memory_order_acquire);
+	while ((link & ~SPLIT_MARK) != 0 && idx < capacity) {
+		SplitNode* node = (SplitNode*)(link & ~SPLIT_MARK);
+		link = atomic_load_explicit(&node->next, memory_order_acquire);
+		if ((node->so_key & 1) && !(link & SPLIT_MARK))
+			values[idx++] = atomic_load_explicit(&node->value, memory_order_acquire);
+	}
+	split_leave(table, parity);
+	return idx;
+}
+
+
+/*
+ * 通常のノードをすべて削除する。ロックを取らない操作と並行してもよい。
+ * 1 回目の走査で全ての通常のノードに削除の印を付け、2 回目の走査でまとめてリストから外す。
+ * 外したノードは、並行する操作がなければこの呼び出しの中で解放される
+ */
+static void split_clear (SplitTable* table) {
+	size_t parity = split_enter(table);
+
+	uintptr_t link = atomic_load_explicit(&table->head.next, memory_order_acquire);
+	while ((link & ~SPLIT_MARK) != 0) {
+		SplitNode* node = (SplitNode*)(link & ~SPLIT_MARK);
+		link = atomic_load_explicit(&node->next, memory_order_acquire);
+		if (!(node->so_key & 1)) continue;  /* ダミーノードは残す */
+
+		while (!(link & SPLIT_MARK)) {
+			if (atomic_compare_exchange_weak_explicit(&node->next, &link, link | SPLIT_MARK, memory_order_acq_rel, memory_order_acquire)) {
+				atomic_fetch_sub_explicit(&table->count, 1, memory_order_relaxed);
+				break;
+			}
+		}
+	}
+
+	/* リストの末尾より後ろを探させて、途中の印の付いたノードを全て外して退避させる */
+	atomic_uintptr_t* prev;
+	SplitNode* cur;
+	split_find(table, &table->head, UINT64_MAX, UINTPTR_MAX, &prev, &cur);
+
+	split_leave(table, parity);
+	split_reclaim(table);
+}
+
+
+/* 削除済みの値と置き換えられた値は value_delete に関わらず解放する。他のスレッドが使っていない状態で呼ぶこと */
+static void split_free (SplitTable* table, bool value_delete) {
+	uintptr_t link = atomic_load_explicit(&table->head.next, memory_order_relaxed);
+	while ((link & ~SPLIT_MARK) != 0) {
+		SplitNode* node = (SplitNode*)(link & ~SPLIT_MARK);
+		link = atomic_load_explicit(&node->next, memory_order_relaxed);
+		if (value_delete || (link & SPLIT_MARK)) free(atomic_load_explicit(&node->value, memory_order_relaxed));
+		free(node);
+	}
+
+	split_release_retired(atomic_load_explicit(&table->retired_nodes, memory_order_relaxed), atomic_load_explicit(&table->retired_values, memory_order_relaxed));
+	split_release_retired(table->pending_nodes, table->pending_values);
+
+	for (size_t i = 0; i < SPLIT_SEGMENTS; i++)
+		free(atomic_load_explicit(&table->segments[i], memory_order_relaxed));
+	free(table);
+}
+
+#else
+
+static SplitTable* split_table_create (size_t size) {
+	(void)size;
+	errno = ENOSYS;
+	return NULL;
+}
+
+
+/* 以下は ht->split が常に NULL なので呼ばれない */
+
+static bool split_set (SplitTable* table, uint_keyt key, void* value_data, size_t value_size) {
+	(void)table; (void)key; (void)value_data; (void)value_size;
+	return false;
+}
+
+
+static void* split_get (SplitTable* table, uint_keyt key) {
+	(void)table; (void)key;
+	return NULL;
+}
+
+
+static bool split_delete (SplitTable* table, uint_keyt key) {
+	(void)table; (void)key;
+	return false;
+}
+
+
+static size_t split_enter (SplitTable* table) {
+	(void)table;
+	return 0;
+}
+
+
+static void split_leave (SplitTable* table, size_t parity) {
+	(void)table; (void)parity;
+}
+
+
+static size_t split_count_live (SplitTable* table) {
+	(void)table;
+	return 0;
+}
+
+
+static size_t split_collect (SplitTable* table, void** values, size_t capacity) {
+	(void)table; (void)values; (void)capacity;
+	return 0;
+}
+
+
+static void split_clear (SplitTable* table) {
+	(void)table;
+}
+
+
+static void split_free (SplitTable* table, bool value_delete) {
+	(void)table; (void)value_delete;
+}
+
+#endif
+
+
+/* 作成したテーブルは key_type が KEY_TYPE_UINT の通常のテーブルとしても扱えるが、buckets は常に NULL のまま使わない */
+static MHashTable* mht_split_create_without_lock (size_t size, const char* file, int line) {
+	if (size == 0) {
+		fprintf(stderr, "Hashtable size cannot be zero.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_split_create";
+		return NULL;
+	}
+
+	if (!mutils_is_power_of_two(size)) {
+		size_t adjusted = mutils_next_power_of_two(size);
+		printf("Hashtable size adjusted from %zu to %zu\n", size, adjusted);
+		size = adjusted;
+	}
+
+	MHashTable* ht = calloc(1, sizeof(MHashTable));
+	if (UNLIKELY(ht == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_split_create";
+		return NULL;
+	}
+
+	ht->split = split_table_create(size);
+	if (ht->split == NULL) {
+		if (errno == ENOSYS)
+			fprintf(stderr, "Split-ordered hashtables require C11 atomics.\nFile: %s   Line: %d\n", file, line);
+		else
+			fprintf(stderr, "Failed to allocate memory for hashtable buckets.\nFile: %s   Line: %d\n", file, line);
+		mht_errfunc = "_mht_split_create";
+		free(ht);
+		return NULL;
+	}
+	ht->key_type = KEY_TYPE_UINT;
+	ht->entry_size = sizeof(MHtEntry);
+
+	if (UNLIKELY(mht_entries == NULL)) {
+		init();
+	}
+
+	MHtTrackEntry mht_entry = {
+		.ptr = ht
+#ifdef DEBUG
+		,
+		.create_file = file,
+		.create_line = line,
+		.key_type = KEY_TYPE_UINT
+#endif
+	};
+
+	if (UNLIKELY(!mht_uint_set_without_lock(mht_entries, (uint_keyt)ht, &mht_entry, sizeof(MHtTrackEntry), file, line))) {
+		fprintf(stderr, "Failed to set hashtable in hashtable entries.\nFile: %s   Line: %d\n", file, line);
+		mht_errfunc = "_mht_split_create";
+	}
+
+	return ht;
+}
+
+
+MHashTable* _mht_split_create (size_t size, const char* file, int line) {
+	mht_lock();
+	MHashTable* ht = mht_split_create_without_lock(size, file, line);
+	mht_unlock();
+	return ht;
+}
+
+
+/* ロックを取らないため、テーブルの登録は確認できない。破棄済みのテーブルを渡してはならない */
+static bool mht_split_check (MHashTable* ht, const char* file, int line) {
+	if (ht == NULL) {
+		fprintf(stderr, "Hashtable is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	if (ht->split == NULL) {
+		fprintf(stderr, "Hashtable was not created with mht_split_create.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	return true;
+}
+
+
+bool _mht_split_set (MHashTable* ht, uint_keyt key, void* value_data, size_t value_size, const char* file, int line) {
+	if (!mht_split_check(ht, file, line)) {
+		mht_errfunc = "_mht_split_set";
+		return false;
+	}
+
+	if (value_data == NULL) {
+		fprintf(stderr, "Value pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_split_set";
+		return false;
+	}
+
+	if (value_size == 0) {
+		fprintf(stderr, "Value size is zero.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_split_set";
+		return false;
+	}
+
+	if (!split_set(ht->split, key, value_data, value_size)) {
+		mht_errfunc = "_mht_split_set";
+		return false;
+	}
+	return true;
+}
+
+
+void* _mht_split_get (MHashTable* ht, uint_keyt key, const char* file, int line) {
+	if (!mht_split_check(ht, file, line)) {
+		mht_errfunc = "_mht_split_get";
+		return NULL;
+	}
+
+	void* value = split_get(ht->split, key);
+	if (value != NULL) return value;
+
+	fprintf(stderr, "Key not found in hashtable.\nFile: %s   Line: %d\n", file, line);
+	errno = EINVAL;
+	mht_errfunc = "_mht_split_get";
+	return NULL;
+}
+
+
+bool _mht_split_delete (MHashTable* ht, uint_keyt key, const char* file, int line) {
+	if (!mht_split_check(ht, file, line)) {
+		mht_errfunc = "_mht_split_delete";
+		return false;
+	}
+
+	if (split_delete(ht->split, key)) return true;
+
+	fprintf(stderr, "Key not found in hashtable.\nFile: %s   Line: %d\n", file, line);
+	errno = EINVAL;
+	mht_errfunc = "_mht_split_delete";
+	return false;
+}
+
+
+
+bool _mht_split_read_begin (MHashTable* ht, size_t* token, const char* file, int line) {
+	if (!mht_split_check(ht, file, line)) {
+		mht_errfunc = "_mht_split_read_begin";
+		return false;
+	}
+
+	if (token == NULL) {
+		fprintf(stderr, "Token pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_split_read_begin";
+		return false;
+	}
+
+	*token = split_enter(ht->split);
+	return true;
+}
+
+
+void _mht_split_read_end (MHashTable* ht, size_t token, const char* file, int line) {
+	if (!mht_split_check(ht, file, line)) {
+		mht_errfunc = "_mht_split_read_end";
+		return;
+	}
+
+	if (token > 1) {
+		fprintf(stderr, "Invalid read section token.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_split_read_end";
+		return;
+	}
+
+	split_leave(ht->split, token);
+}
+
+static bool mht_store_entry (MHashTable* ht, KeyUni key, void* value_data, size_t value_size);
+static bool mht_set_entry (MHashTable* ht, KeyUni key, void* value_data, size_t value_size);
+static bool mht_remove_entry (MHashTable* ht, KeyUni key);
+static bool mht_delete_entry (MHashTable* ht, KeyUni key);
+static MHtEntry* mht_find_entry (MHashTable* ht, KeyUni key);
+
+#if defined (__linux__) && defined (SYS_set_mempolicy) && defined (SYS_get_mempolicy)
+	#define NUMA_SUPPORTED
+#endif
+
+#ifdef NUMA_SUPPORTED
+
+typedef struct {
+	int mode;
+	unsigned long mask;
+	bool changed;
+} NumaPolicy;
+
+
+/* このスレッドが使用を許されているノードのマスクを返す。取得できなければ 0 */
+static unsigned long numa_allowed_nodes (void) {
+	int mode = 0;
+	unsigned long mask = 0;
+	if (syscall(SYS_get_mempolicy, &mode, &mask, (unsigned long)(NUMA_MAX_NODES + 1), NULL, (unsigned long)NUMA_MPOL_F_MEMS_ALLOWED) != 0)
+		return 0;
+	return mask;
+}
+
+
+static int numa_current_node (void) {
+	if (numa_preferred_node >= 0) return numa_preferred_node;
+
+	/*
+	 * getcpu はシステムコールなので毎回は呼ばず、NUMA_NODE_REFRESH_INTERVAL 回ごとに問い合わせ直す。
+	 * 別のソケットへ移されたスレッドも、しばらくすれば移った先のノードのレプリカを読むようになる
+	 */
+	if (numa_detect_countdown == 0) {
+		unsigned int cpu = 0;
+		unsigned int node = 0;
+	#ifdef SYS_getcpu
+		if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) node = 0;
+	#endif
+		numa_detected_node = (node < NUMA_MAX_NODES) ? (int)node : 0;
+		numa_detect_countdown = NUMA_NODE_REFRESH_INTERVAL;
+	}
+	numa_detect_countdown--;
+	return numa_detected_node;
+}
+
+
+/*
+ * 以降このスレッドで新しく確保されるページを node に置くよう指示し、元のポリシーを saved に保存する。
+ * MPOL_PREFERRED は希望にすぎず、node に空きがなければ他のノードに置かれる。また malloc が既に
+ * 割り当て済みのページから返す領域には効かないので、レプリカが node に置かれることは保証されない
+ */
+static void numa_policy_enter (int node, NumaPolicy* saved) {
+	saved->changed = false;
+	if (syscall(SYS_get_mempolicy, &saved->mode, &saved->mask, (unsigned long)(NUMA_MAX_NODES + 1), NULL, 0UL) != 0)
+		return;
+
+	unsigned long mask = 1UL << node;
+	if (syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, &mask, (unsigned long)(NUMA_MAX_NODES + 1)) == 0)
+		saved->changed = true;
+}
+
+
+static void numa_policy_leave (NumaPolicy* saved) {
+	if (!saved->changed) return;
+	if (saved->mode == NUMA_MPOL_DEFAULT)
+		syscall(SYS_set_mempolicy, NUMA_MPOL_DEFAULT, NULL, 0UL);
+	else
+		syscall(SYS_set_mempolicy, saved->mode, &saved->mask, (unsigned long)(NUMA_MAX_NODES + 1));
+}
+
+#endif
+
+
+bool mht_numa_prefer_node (int node) {
+	if (node < -1 || node >= NUMA_MAX_NODES) {
+		errno = EINVAL;
+		mht_errfunc = "mht_numa_prefer_node";
+		return false;
+	}
+
+	numa_preferred_node = node;
+	return true;
+}
+
+
+/* 読み出しに使うレプリカを返す。レプリカを持たないテーブルではそのまま返す */
+static MHashTable* numa_local_replica (MHashTable* ht) {
+#ifdef NUMA_SUPPORTED
+	if (ht->numa_replicas != NULL) {
+		int node = numa_current_node();
+		if ((size_t)node < ht->numa_nodes && ht->numa_replicas[node] != NULL)
+			return ht->numa_replicas[node];
+	}
+#endif
+	return ht;
+}
+
+
+/*
+ * 全てのレプリカに書き込む。途中で失敗した場合は、書き込み済みのレプリカだけを元の状態に戻す。
+ * 元の値は書き込み前にエントリから外して預かっておくので、戻す処理でメモリを確保することはない
+ */
+static bool mht_numa_set_entry (MHashTable* ht, KeyUni key, void* value_data, size_t value_size) {
+#ifdef NUMA_SUPPORTED
+	void* old_values[NUMA_MAX_NODES];
+	size_t old_sizes[NUMA_MAX_NODES];
+	bool existed[NUMA_MAX_NODES];
+
+	for (size_t i = 0; i < ht->numa_nodes; i++) {
+		MHashTable* replica = ht->numa_replicas[i];
+		if (replica == NULL) continue;
+
+		/* 値を外しておけば、上書きの際に entry_value_free が元の値を解放しない */
+		MHtEntry* entry = mht_find_entry(replica, key);
+		existed[i] = (entry != NULL);
+		if (entry != NULL) {
+			old_values[i] = entry->value;
+			old_sizes[i] = entry_value_size(replica, entry);
+			entry->value = NULL;
+		}
+
+		NumaPolicy saved;
+		numa_policy_enter((int)i, &saved);
+		bool result = mht_store_entry(replica, key, value_data, value_size);
+		numa_policy_leave(&saved);
+
+		if (UNLIKELY(!result)) {
+			int saved_errno = errno;
+			for (size_t j = 0; j <= i; j++) {
+				if (ht->numa_replicas[j] == NULL) continue;
+
+				if (existed[j]) {
+					entry = mht_find_entry(ht->numa_replicas[j], key);
+					if (j != i) free(entry->value);  /* 失敗したレプリカのエントリは NULL のまま */
+					entry->value = old_values[j];
+					entry_set_value_size(ht->numa_replicas[j], entry, old_sizes[j]);
+				} else if (j != i) {
+					mht_remove_entry(ht->numa_replicas[j], key);
+				}
+			}
+			errno = saved_errno;
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < ht->numa_nodes; i++) {
+		if (ht->numa_replicas[i] != NULL && existed[i]) free(old_values[i]);
+	}
+	change_log_record(ht, MHT_CHANGE_SET, key);
+	return true;
+#else
+	return mht_set_entry(ht, key, value_data, value_size);
+#endif
+}
+
+
+static bool mht_numa_delete_entry (MHashTable* ht, KeyUni key) {
+	bool result = false;
+	for (size_t i = 0; i < ht->numa_nodes; i++) {
+		if (ht->numa_replicas[i] != NULL && mht_delete_entry(ht->numa_replicas[i], key))
+			result = true;
+	}
+	return result;
+}
+
+
+bool _mht_set_numa_replicas (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_set_numa_replicas";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->split != NULL) {
+		fprintf(stderr, "This option is not supported by split-ordered hashtables.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_numa_replicas";
+		mht_unlock();
+		return false;
+	}
+
+#ifdef NUMA_SUPPORTED
+	if (ht->count != 0 || ht->frozen != NULL || ht->compress_threshold != 0 || ht->dedup != NULL || ht->numa_replicas != NULL || ht == mht_entries || ht == all_get_arr_entries) {
+		fprintf(stderr, "NUMA replicas can only be added to an empty hashtable once.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_numa_replicas";
+		mht_unlock();
+		return false;
+	}
+
+	unsigned long allowed = numa_allowed_nodes();
+	if (allowed == 0 || (allowed & (allowed - 1)) == 0) {  /* ノードが 1 つしかなければ何もしない */
+		mht_unlock();
+		return true;
+	}
+
+	size_t nodes = 0;
+	for (size_t i = 0; i < NUMA_MAX_NODES; i++) {
+		if (allowed & (1UL << i)) nodes = i + 1;
+	}
+
+	MHashTable** replicas = calloc(nodes, sizeof(MHashTable*));
+	if (UNLIKELY(replicas == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for NUMA replicas.\nFile: %s   Line: %d\n", file, line);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_set_numa_replicas";
+		mht_unlock();
+		return false;
+	}
+
+	/* 最初のノードは ht 自身が受け持ち、残りのノードにはそのノードを優先して確保した登録なしのテーブルを置く */
+	bool primary_assigned = false;
+	size_t size = (ht->buckets == NULL) ? SMALL_TABLE_CAPACITY : ht->size;
+	for (size_t i = 0; i < nodes; i++) {
+		if (!(allowed & (1UL << i))) continue;
+
+		if (!primary_assigned) {
+			replicas[i] = ht;
+			primary_assigned = true;
+			continue;
+		}
+
+		NumaPolicy saved;
+		numa_policy_enter((int)i, &saved);
+		replicas[i] = mht_create_without_register_generic(size, ht->key_type, ht->key_words, file, line);
+		numa_policy_leave(&saved);
+
+		if (UNLIKELY(replicas[i] == NULL)) {
+			for (size_t j = 0; j < i; j++) {
+				if (replicas[j] != NULL && replicas[j] != ht) mht_destroy_value_choose_delete(replicas[j], true);
+			}
+			free(replicas);
+			mht_errfunc = "_mht_set_numa_replicas";
+			mht_unlock();
+			return false;
+		}
+		replicas[i]->huge_page_mode = ht->huge_page_mode;
+	}
+
+	ht->numa_nodes = nodes;
+	ht->numa_replicas = replicas;
+
+	mht_unlock();
+	return true;
+#else
+	fprintf(stderr, "NUMA replicas are not supported on this platform.\nFile: %s   Line: %d\n", file, line);
+	errno = ENOSYS;
+	mht_errfunc = "_mht_set_numa_replicas";
+	mht_unlock();
+	return false;
+#endif
+}
+
+
+/* スモールモードのエントリ配列を線形探索する。out_pos には見つかった位置が入る */
+static MHtEntry* mht_small_find (MHashTable* ht, KeyUni key, size_t* out_pos) {
+	for (size_t i = 0; i < ht->count; i++) {
+		if (entry_key_equal(ht, &ht->small[i], key)) {
+			if (out_pos != NULL) *out_pos = i;
+			return &ht->small[i];
+		}
+	}
+	return NULL;
+}
+
+
+/* スモールモードのエントリを個別に確保し直して、通常のバケット配列へ移行する */
+static bool mht_small_upgrade (MHashTable* ht) {
+	bool new_mapped;
+	MHtEntry** new_buckets = buckets_alloc(ht->huge_page_mode, SMALL_TABLE_UPGRADE_SIZE, &new_mapped);  /* 今後の処理のために必ず初期化が必要 */
+	if (UNLIKELY(new_buckets == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for hashtable buckets.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		errno = ENOMEM;
+		mht_errfunc = "mht_small_upgrade";
+		return false;
+	}
+
+	MHtEntry* moved[SMALL_TABLE_CAPACITY];
+	for (size_t i = 0; i < ht->count; i++) {
+		moved[i] = malloc(ht->entry_size);
+		if (UNLIKELY(moved[i] == NULL)) {
+			for (size_t j = 0; j < i; j++) free(moved[j]);
+			buckets_free(new_buckets, SMALL_TABLE_UPGRADE_SIZE, new_mapped);
+			errno = ENOMEM;
+			mht_errfunc = "mht_small_upgrade";
+			return false;
+		}
+		memcpy(moved[i], &ht->small[i], ht->entry_size);
+	}
+
+	for (size_t i = 0; i < ht->count; i++) {
+		size_t index = hash_entry_key(ht, moved[i], SMALL_TABLE_UPGRADE_SIZE);
+		moved[i]->next = new_buckets[index];
+		new_buckets[index] = moved[i];
+	}
+
+	ht->buckets = new_buckets;
+	ht->buckets_mapped = new_mapped;
+	ht->size = SMALL_TABLE_UPGRADE_SIZE;
+	return true;
+}
+
+
+/* スモールモードが満杯で、かつ新しいキーが追加される場合にだけ移行する */
+static bool mht_small_prepare_set (MHashTable* ht, KeyUni key) {
+	if (ht->count < SMALL_TABLE_CAPACITY || mht_small_find(ht, key, NULL) != NULL)
+		return true;
+	return mht_small_upgrade(ht);
+}
+
+
+/*
+ * 値の圧縮に使う LZ77 系の符号。LZ4 のブロック形式と同じく、上位 4 ビットにリテラル長、
+ * 下位 4 ビットに一致長 - LZ_MIN_MATCH を持つトークンに続けて、リテラル、2 バイトのオフセット、
+ * 15 以上の長さの続きを並べる。最後のシーケンスはリテラルだけで終わる
+ */
+static bool lz_emit (unsigned char* dst, size_t dst_cap, size_t* out, const unsigned char* literals, size_t literal_len, size_t offset, size_t match_len) {
+	size_t need = 1 + literal_len / 255 + 1 + literal_len;
+	if (match_len != 0) need += 2 + (match_len - LZ_MIN_MATCH) / 255 + 1;
+	if (need > dst_cap - *out) return false;
+
+	size_t pos = *out;
+	unsigned char* token = &dst[pos++];
+	size_t literal_code = (literal_len < 15) ? literal_len : 15;
+	if (literal_len >= 15) {
+		size_t rest = literal_len - 15;
+		for (; rest >= 255; rest -= 255) dst[pos++] = 255;
+		dst[pos++] = (unsigned char)rest;
+	}
+	memcpy(&dst[pos], literals, literal_len);
+	pos += literal_len;
+
+	size_t match_code = 0;
+	if (match_len != 0) {
+		dst[pos++] = (unsigned char)(offset & 0xFF);
+		dst[pos++] = (unsigned char)(offset >> 8);
+		size_t rest = match_len - LZ_MIN_MATCH;
+		match_code = (rest < 15) ? rest : 15;
+		if (rest >= 15) {
+			for (rest -= 15; rest >= 255; rest -= 255) dst[pos++] = 255;
+			dst[pos++] = (unsigned char)rest;
+		}
+	}
+
+	*token = (unsigned char)((literal_code << 4) | match_code);
+	*out = pos;
+	return true;
+}
+
+
+/* dst_cap に収まらなければ 0 を返す */
+static size_t lz_compress (const unsigned char* src, size_t src_len, unsigned char* dst, size_t dst_cap) {
+	if (src_len > UINT32_MAX) return 0;
+
+	uint32_t table[1 << LZ_HASH_BITS];  /* 4 バイト列のハッシュから最後に現れた位置を引く */
+	memset(table, 0, sizeof(table));
+
+	size_t anchor = 0;
+	size_t pos = 0;
+	size_t out = 0;
+	while (pos + LZ_MIN_MATCH <= src_len) {
+		uint32_t sequence;
+		memcpy(&sequence, &src[pos], sizeof(sequence));
+		uint32_t hash = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+		size_t candidate = table[hash];
+		table[hash] = (uint32_t)pos;
+
+		if (candidate < pos && pos - candidate <= LZ_MAX_OFFSET && memcmp(&src[candidate], &src[pos], LZ_MIN_MATCH) == 0) {
+			size_t match_len = LZ_MIN_MATCH;
+			while (pos + match_len < src_len && src[candidate + match_len] == src[pos + match_len]) match_len++;
+			if (!lz_emit(dst, dst_cap, &out, &src[anchor], pos - anchor, pos - candidate, match_len)) return 0;
+			pos += match_len;
+			anchor = pos;
+		} else {
+			pos += 1 + ((pos - anchor) >> 6);  /* 一致しない区間が続くほど大きく飛ばす */
+		}
+	}
+
+	if (!lz_emit(dst, dst_cap, &out, &src[anchor], src_len - anchor, 0, 0)) return 0;
+	return out;
+}
+
+
+static bool lz_read_length (const unsigned char* src, size_t src_len, size_t* in, size_t* length) {
+	unsigned char byte;
+	do {
+		if (*in >= src_len) return false;
+		byte = src[(*in)++];
+		*length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+
+/* 壊れた入力でも dst の外には書き込まない。ちょうど dst_len バイトに展開できた場合だけ true を返す */
+static bool lz_decompress (const unsigned char* src, size_t src_len, unsigned char* dst, size_t dst_len) {
+	size_t in = 0;
+	size_t out = 0;
+	while (in < src_len) {
+		unsigned char token = src[in++];
+
+		size_t literal_len = (size_t)(token >> 4);
+		if (literal_len == 15 && !lz_read_length(src, src_len, &in, &literal_len)) return false;
+		if (literal_len > src_len - in || literal_len > dst_len - out) return false;
+		memcpy(&dst[out], &src[in], literal_len);
+		in += literal_len;
+		out += literal_len;
+
+		if (in == src_len) break;  /* 最後のシーケンス */
+
+		if (src_len - in < 2) return false;
+		size_t offset = (size_t)src[in] | ((size_t)src[in + 1] << 8);
+		in += 2;
+		if (offset == 0 || offset > out) return false;
+
+		size_t match_len = (size_t)(token & 0x0F);
+		if (match_len == 15 && !lz_read_length(src, src_len, &in, &match_len)) return false;
+		match_len += LZ_MIN_MATCH;
+		if (match_len > dst_len - out) return false;
+
+		if (offset >= match_len) {
+			memcpy(&dst[out], &dst[out - offset], match_len);
+			out += match_len;
+		} else {  /* 重なっている場合は 1 バイトずつ写して繰り返しを作る */
+			for (size_t i = 0; i < match_len; i++, out++) dst[out] = dst[out - offset];
+		}
+	}
+	return out == dst_len;
+}
+
+
+/* 圧縮した値の value_size には VALUE_SIZE_COMPRESSED が立っている。KEY_TYPE_UINT32 のテーブルでは圧縮しない */
+static bool entry_value_compressed (const MHashTable* ht, const MHtEntry* entry) {
+	return ht->compress_threshold != 0 && (entry->meta.value_size & VALUE_SIZE_COMPRESSED) != 0;
+}
+
+
+/*
+ * 格納する値の複製を作る。圧縮の閾値以上の大きさで、圧縮して小さくなる場合は、
+ * 元の大きさの後ろに圧縮したデータを続けたものを返し、value_size を格納した大きさに書き換える
+ */
+static void* value_store (const MHashTable* ht, const void* value_data, size_t* value_size) {
+	size_t size = *value_size;
+	if (ht->dedup != NULL) return dedup_acquire(ht->dedup, value_data, size);
+
+	if (ht->compress_threshold != 0 && size >= ht->compress_threshold && size > sizeof(size_t) + 1 && size < VALUE_SIZE_COMPRESSED) {
+		unsigned char* stored = malloc(size);
+		if (UNLIKELY(stored == NULL)) return NULL;
+
+		size_t compressed = lz_compress(value_data, size, stored + sizeof(size_t), size - sizeof(size_t) - 1);
+		if (compressed != 0) {
+			memcpy(stored, &size, sizeof(size_t));
+			size_t stored_size = sizeof(size_t) + compressed;
+			unsigned char* shrunk = realloc(stored, stored_size);
+			if (shrunk != NULL) stored = shrunk;  /* 縮められなくても中身はそのまま使える */
+			*value_size = stored_size | VALUE_SIZE_COMPRESSED;
+			return stored;
+		}
+		free(stored);  /* 小さくならないデータはそのまま持つ */
+	}
+
+	void* value = calloc(1, size);
+	if (UNLIKELY(value == NULL)) return NULL;
+	memcpy(value, value_data, size);
+	return value;
+}
+
+
+/* 既存のエントリの値を置き換える。value_size が 0 のときに raw モードになる */
+static bool entry_replace_value (MHashTable* ht, MHtEntry* entry, void* value_data, size_t value_size) {
+	if (value_size != 0) {
+		void* new_value = value_store(ht, value_data, &value_size);
+		if (UNLIKELY(new_value == NULL)) return false;
+
+		entry_value_free(ht, entry);  /* 同じ内容で置き換えた場合も、先に参照を増やしてあるので解放されない */
+		entry->value = new_value;
+	} else {
+		entry_value_free(ht, entry);
+		entry->value = value_data;
+	}
+	entry_set_value_size(ht, entry, value_size);
+	return true;
+}
+
+
+/* 新しいエントリにキーと値を書き込む。失敗してもエントリ自体は解放しない */
+static bool entry_fill (MHashTable* ht, MHtEntry* new_entry, KeyUni key, void* value_data, size_t value_size) {
+	if (ht->key_type == KEY_TYPE_UINT) {
+		new_entry->key.uint = key.key.uint;
+	} else if (ht->key_type == KEY_TYPE_UINT32) {
+		new_entry->meta.packed.key = key.key.uint32;
+	} else if (ht->key_type == KEY_TYPE_TUPLE) {
+		memcpy(entry_tuple_key(new_entry), key.key.tuple, ht->key_words * sizeof(uint_keyt));
+	} else {  /* if (ht->key_type == KEY_TYPE_STR) */
+		char* key_str = key_str_dup(ht, key.key.str);
+		if (UNLIKELY(key_str == NULL)) {
+			errno = ENOMEM;
+			return false;
+		}
+
+		new_entry->key.str.ptr = key_str;
+		new_entry->key.str.len = key.key.str.len;
+	}
+
+	if (value_size != 0) {
+		new_entry->value = value_store(ht, value_data, &value_size);
+		if (UNLIKELY(new_entry->value == NULL)) {
+			if (ht->key_type == KEY_TYPE_STR) key_str_release(ht, new_entry);
+			errno = ENOMEM;
+			return false;
+		}
+	} else {
+		new_entry->value = value_data;
+	}
+	entry_set_value_size(ht, new_entry, value_size);
+	return true;
+}
+
+
+/*
+ * バケット化カッコーハッシュ
+ * 各キーはハッシュで決まる 2 つのバケットのどちらかに置かれるので、検索は最大 2 バケットと stash で終わる。
+ * 1 バケットに CUCKOO_WAYS 個のスロットを持たせ、スロットごとにハッシュの上位 8 ビットをタグとして
+ * 並べておくことで、キーの比較はタグが一致した場合にだけ行う。両方のバケットが埋まっている場合は
+ * 幅優先探索で空きスロットまでの最短の追い出し経路を探し、見つからなければ stash に退避する。
+ * stash は普段 CUCKOO_STASH_SIZE 個までに抑えるが、ハッシュ値全体が衝突するキーは何倍に広げても
+ * 同じ 2 バケットに集まるので、占有率が低いうちはそれ以上あふれても広げずに stash を伸ばす。
+ */
+
+typedef struct {
+	uint8_t tags[CUCKOO_WAYS];  /* 0 は空きスロット */
+	MHtEntry* entries[CUCKOO_WAYS];
+} CuckooBucket;
+
+
+struct CuckooTable {
+	CuckooBucket* buckets;
+	size_t bucket_count;  /* 2 の累乗 */
+	size_t stash_count;
+	size_t stash_capacity;
+	MHtEntry** stash;  /* どちらのバケットにも置けなかったエントリ */
+};
+
+
+typedef struct {
+	size_t bucket;
+	size_t parent;  /* 探索の起点では SIZE_MAX */
+	size_t way;     /* 親のバケットのどのスロットを追い出すとここへ来るか */
+} CuckooPath;
+
+
+/*
+ * uint32 キーや短い文字列キー、ポインタキーのハッシュ値は上位ビットが 0 のままなので、
+ * 全ビットを撹拌し直してから最上位の 8 ビットを取る。バケットの選択に使う下位ビットとも独立になる
+ */
+static uint8_t cuckoo_tag (size_t hash) {
+	uint8_t tag = (uint8_t)(wang_hash64((uint64_t)hash) >> 56);
+	return (tag != 0) ? tag : 1;
+}
+
+
+/* タグだけから相方のバケットが求まるので、追い出しの際にキーをハッシュし直さなくてよい */
+static size_t cuckoo_alt_bucket (const CuckooTable* table, size_t bucket, uint8_t tag) {
+	return (bucket ^ ((size_t)tag * 0x5BD1E995U)) & (table->bucket_count - 1);
+}
+
+
+static size_t cuckoo_free_way (const CuckooBucket* bucket) {
+	for (size_t way = 0; way < CUCKOO_WAYS; way++) {
+		if (bucket->tags[way] == 0) return way;
+	}
+	return CUCKOO_WAYS;
+}
+
+
+/* 見つかった場合、stash にあれば *out_bucket に NULL を、*out_way に stash 内の位置を返す */
+static MHtEntry* cuckoo_find (const MHashTable* ht, KeyUni key, CuckooBucket** out_bucket, size_t* out_way) {
+	CuckooTable* table = ht->cuckoo;
+	size_t hash = hash_key_uni(ht, key, CUCKOO_HASH_RANGE);
+	uint8_t tag = cuckoo_tag(hash);
+	size_t first = hash & (table->bucket_count - 1);
+	size_t candidates[2] = { first, cuckoo_alt_bucket(table, first, tag) };
+
+	for (size_t i = 0; i < 2; i++) {
+		CuckooBucket* bucket = &table->buckets[candidates[i]];
+		for (size_t way = 0; way < CUCKOO_WAYS; way++) {
+			if (bucket->tags[way] == tag && entry_key_equal(ht, bucket->entries[way], key)) {
+				if (out_bucket != NULL) *out_bucket = bucket;
+				if (out_way != NULL) *out_way = way;
+				return bucket->entries[way];
+			}
+		}
+	}
+
+	for (size_t i = 0; i < table->stash_count; i++) {
+		if (entry_key_equal(ht, table->stash[i], key)) {
+			if (out_bucket != NULL) *out_bucket = NULL;
+			if (out_way != NULL) *out_way = i;
+			return table->stash[i];
+		}
+	}
+	return NULL;
+}
+
+
+/* 2 つのバケットか、そこから追い出しで空けられるスロットにエントリを置く。置けなければ false を返す */
+static bool cuckoo_place (CuckooTable* table, MHtEntry* entry, size_t hash) {
+	uint8_t tag = cuckoo_tag(hash);
+	size_t first = hash & (table->bucket_count - 1);
+	size_t second = cuckoo_alt_bucket(table, first, tag);
+
+	CuckooPath queue[CUCKOO_BFS_MAX_BUCKETS];
+	size_t head = 0;
+	size_t tail = 0;
+	queue[tail++] = (CuckooPath){ first, SIZE_MAX, 0 };
+	if (second != first) queue[tail++] = (CuckooPath){ second, SIZE_MAX, 0 };
+
+	while (head < tail) {
+		size_t current = head++;
+		CuckooBucket* bucket = &table->buckets[queue[current].bucket];
+
+		size_t way = cuckoo_free_way(bucket);
+		if (way != CUCKOO_WAYS) {
+			/* 空きスロットから起点に向かって、経路上のエントリを 1 つずつ後ろへずらす */
+			while (queue[current].parent != SIZE_MAX) {
+				CuckooPath* step = &queue[current];
+				CuckooBucket* from = &table->buckets[queue[step->parent].bucket];
+				bucket->tags[way] = from->tags[step->way];
+				bucket->entries[way] = from->entries[step->way];
+				bucket = from;
+				way = step->way;
+				current = step->parent;
+			}
+			bucket->tags[way] = tag;
+			bucket->entries[way] = entry;
+			return true;
+		}
+
+		for (size_t w = 0; w < CUCKOO_WAYS && tail < CUCKOO_BFS_MAX_BUCKETS; w++) {
+			size_t alt = cuckoo_alt_bucket(table, queue[current].bucket, bucket->tags[w]);
+
+			/* 同じバケットを経路に 2 度含めると、ずらす途中でエントリを上書きしてしまう */
+			bool queued = false;
+			for (size_t i = 0; i < tail && !queued; i++)
+				queued = (queue[i].bucket == alt);
+			if (!queued) queue[tail++] = (CuckooPath){ alt, current, w };
+		}
+	}
+	return false;
+}
+
+
+static bool cuckoo_stash_push (CuckooTable* table, MHtEntry* entry) {
+	if (table->stash_count == table->stash_capacity) {
+		size_t capacity = (table->stash_capacity != 0) ? table->stash_capacity * 2 : CUCKOO_STASH_SIZE;
+		MHtEntry** stash = realloc(table->stash, capacity * sizeof(MHtEntry*));
+		if (UNLIKELY(stash == NULL)) {
+			errno = ENOMEM;
+			return false;
+		}
+		table->stash = stash;
+		table->stash_capacity = capacity;
+	}
+	table->stash[table->stash_count++] = entry;
+	return true;
+}
+
+
+/* 全エントリを bucket_count 個のバケットに置き直す。メモリが足りなければ false を返し、元の配置はそのまま残す */
+static bool cuckoo_rebuild (MHashTable* ht, size_t bucket_count) {
+	CuckooTable* old = ht->cuckoo;
+	CuckooTable fresh = {
+		.buckets = calloc(bucket_count, sizeof(CuckooBucket)),
+		.bucket_count = bucket_count,
+		.stash_count = 0,
+		.stash_capacity = 0,
+		.stash = NULL
+	};
+	if (UNLIKELY(fresh.buckets == NULL)) {
+		errno = ENOMEM;
+		return false;
+	}
+
+	for (size_t i = 0; i < old->bucket_count + old->stash_count; i++) {
+		size_t count = (i < old->bucket_count) ? CUCKOO_WAYS : 1;
+		for (size_t way = 0; way < count; way++) {
+			MHtEntry* entry;
+			if (i < old->bucket_count) {
+				if (old->buckets[i].tags[way] == 0) continue;
+				entry = old->buckets[i].entries[way];
+			} else {
+				entry = old->stash[i - old->bucket_count];
+			}
+
+			if (cuckoo_place(&fresh, entry, hash_entry_key(ht, entry, CUCKOO_HASH_RANGE))) continue;
+			if (cuckoo_stash_push(&fresh, entry)) continue;
+
+			free(fresh.buckets);
+			free(fresh.stash);
+			return false;
+		}
+	}
+
+	free(old->buckets);
+	free(old->stash);
+	*old = fresh;
+	return true;
+}
+
+
+/* バケット数を倍にする。置き直しても stash に残るエントリは、次に stash があふれるまでそのまま持つ */
+static bool cuckoo_grow (MHashTable* ht) {
+	size_t bucket_count = ht->cuckoo->bucket_count;
+	if (bucket_count > (SIZE_MAX / 2 / sizeof(CuckooBucket))) {
+		fprintf(stderr, "Hashtable size is too large for rehashing.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		errno = EIO;
+		mht_errfunc = "cuckoo_grow";
+		return false;
+	}
+	return cuckoo_rebuild(ht, bucket_count * 2);
+}
+
+
+static bool cuckoo_insert (MHashTable* ht, MHtEntry* entry) {
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wunsuffixed-float-constants"  /* mhashtable自体のデバッグを行う際は必ず外すこと */
+#endif
+
+	/* 占有率が上がりきる前に広げておかないと、追い出しの経路が長くなり stash もすぐに埋まる */
+	if (UNLIKELY((double)(ht->count + 1) > (double)(ht->cuckoo->bucket_count * CUCKOO_WAYS) * CUCKOO_MAX_LOAD))
+		cuckoo_grow(ht);  /* 失敗しても、置けるうちはそのまま置く */
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic pop
+#endif
+
+	size_t hash = hash_entry_key(ht, entry, CUCKOO_HASH_RANGE);
+	if (cuckoo_place(ht->cuckoo, entry, hash)) return true;
+
+	/*
+	 * stash があふれた場合は、半分以上埋まっているときだけ広げる。占有率が低いのに置けないのは
+	 * ハッシュ値が衝突するキーが集まっているためで、広げるたびに倍にしていくとメモリを使い果たす
+	 */
+	CuckooTable* table = ht->cuckoo;
+	if (table->stash_count >= CUCKOO_STASH_SIZE && ht->count >= table->bucket_count * CUCKOO_WAYS / 2) {
+		if (cuckoo_grow(ht) && cuckoo_place(ht->cuckoo, entry, hash)) return true;
+	}
+	return cuckoo_stash_push(ht->cuckoo, entry);
+}
+
+
+/* mht_store_entry から呼ぶ */
+static bool cuckoo_set_entry (MHashTable* ht, KeyUni key, void* value_data, size_t value_size) {
+	MHtEntry* entry = cuckoo_find(ht, key, NULL, NULL);
+	if (entry != NULL)
+		return entry_replace_value(ht, entry, value_data, value_size);
+
+	MHtEntry* new_entry = calloc(1, ht->entry_size);
+	if (UNLIKELY(new_entry == NULL)) {
+		errno = ENOMEM;
+		return false;
+	}
+
+	if (!entry_fill(ht, new_entry, key, value_data, value_size)) {
+		free(new_entry);
+		return false;
+	}
+
+	if (UNLIKELY(!cuckoo_insert(ht, new_entry))) {
+		if (value_size != 0) entry_value_free(ht, new_entry);
+		if (ht->key_type == KEY_TYPE_STR) key_str_release(ht, new_entry);
+		free(new_entry);
+		errno = ENOMEM;
+		return false;
+	}
+
+	ht->count++;
+	return true;
+}
+
+
+/* mht_remove_entry から呼ぶ */
+static bool cuckoo_delete_entry (MHashTable* ht, KeyUni key) {
+	CuckooBucket* bucket;
+	size_t way;
+	MHtEntry* entry = cuckoo_find(ht, key, &bucket, &way);
+	if (entry == NULL) return false;
+
+	if (bucket != NULL) {
+		bucket->tags[way] = 0;
+		bucket->entries[way] = NULL;
+	} else {
+		CuckooTable* table = ht->cuckoo;
+		table->stash[way] = table->stash[--table->stash_count];
+	}
+
+	entry_value_free(ht, entry);
+	if (ht->key_type == KEY_TYPE_STR) key_str_release(ht, entry);
+	free(entry);
+	ht->count--;
+	return true;
+}
+
+
+static size_t cuckoo_collect (CuckooTable* table, void** values) {
+	size_t idx = 0;
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		for (size_t way = 0; way < CUCKOO_WAYS; way++) {
+			if (table->buckets[i].tags[way] != 0)
+				values[idx++] = table->buckets[i].entries[way]->value;
+		}
+	}
+	for (size_t i = 0; i < table->stash_count; i++)
+		values[idx++] = table->stash[i]->value;
+	return idx;
+}
+
+
+static void cuckoo_release_entries (MHashTable* ht, bool value_delete) {
+	CuckooTable* table = ht->cuckoo;
+	for (size_t i = 0; i < table->bucket_count + table->stash_count; i++) {
+		size_t count = (i < table->bucket_count) ? CUCKOO_WAYS : 1;
+		for (size_t way = 0; way < count; way++) {
+			MHtEntry* entry;
+			if (i < table->bucket_count) {
+				if (table->buckets[i].tags[way] == 0) continue;
+				entry = table->buckets[i].entries[way];
+			} else {
+				entry = table->stash[i - table->bucket_count];
+			}
+
+			if (value_delete) entry_value_free(ht, entry);
+			if (ht->key_type == KEY_TYPE_STR) key_str_release(ht, entry);
+			free(entry);
+		}
+	}
+}
+
+
+static void cuckoo_free (MHashTable* ht, bool value_delete) {
+	cuckoo_release_entries(ht, value_delete);
+	free(ht->cuckoo->buckets);
+	free(ht->cuckoo->stash);
+	free(ht->cuckoo);
+}
+
+
+static void cuckoo_clear (MHashTable* ht) {
+	cuckoo_release_entries(ht, true);
+	memset(ht->cuckoo->buckets, 0, ht->cuckoo->bucket_count * sizeof(CuckooBucket));
+	ht->cuckoo->stash_count = 0;
+}
+
+
+bool _mht_set_cuckoo (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_set_cuckoo";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->count != 0 || ht->cuckoo != NULL || ht->compact != NULL || ht->split != NULL || ht->frozen != NULL || ht->numa_replicas != NULL || ht == mht_entries || ht == all_get_arr_entries) {
+		fprintf(stderr, "Cuckoo hashing can only be enabled once on an empty hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_cuckoo";
+		mht_unlock();
+		return false;
+	}
+
+	/* _mht_set_pointer_keys と同じ組み合わせを逆の順序でも拒否する */
+	if (ht->pointer_keys) {
+		fprintf(stderr, "Cuckoo hashing does not support pointer keys.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_cuckoo";
+		mht_unlock();
+		return false;
+	}
+
+	/* 連鎖法のバケット数と同じだけのスロットから始める */
+	size_t slots = (ht->buckets == NULL) ? SMALL_TABLE_CAPACITY : ht->size;
+	size_t bucket_count = (slots > CUCKOO_WAYS) ? slots / CUCKOO_WAYS : 1;
+
+	CuckooTable* table = calloc(1, sizeof(CuckooTable));
+	CuckooBucket* buckets = calloc(bucket_count, sizeof(CuckooBucket));
+	if (UNLIKELY(table == NULL || buckets == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for hashtable buckets.\nFile: %s   Line: %d\n", file, line);
+		free(table);
+		free(buckets);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_set_cuckoo";
+		mht_unlock();
+		return false;
+	}
+	table->buckets = buckets;
+	table->bucket_count = bucket_count;
+
+	table_version_bump(ht);
+	if (ht->buckets != NULL) {
+		buckets_free(ht->buckets, ht->size, ht->buckets_mapped);
+		ht->buckets = NULL;
+		ht->buckets_mapped = false;
+		ht->size = 0;
+	}
+	ht->cuckoo = table;
+
+	mht_unlock();
+	return true;
+}
+
+
+/*
+ * コンパクトモード
+ * エントリを 1 つの連続した配列（プール）に entry_size ごとに並べ、バケットの先頭と連鎖を
+ * ポインタではなく 32 ビットの番号で繋ぐ。バケット配列は半分の大きさになり、エントリごとの
+ * malloc のヘッダとアラインメントの無駄もなくなる。番号は 1 始まりで、0 を終端として使う。
+ * 連鎖は links で表すので各スロットの next は使わないが、スロットを詰めて重ねると隣のスロットの領域を
+ * MHtEntry として読み書きすることになるため、next の分も含めて MHtEntry をそのまま置く。
+ * 削除で空いたエントリは links で繋いで再利用し、プールは縮めない。
+ */
+
+struct CompactTable {
+	uint32_t* heads;  /* バケットごとの先頭エントリの番号 */
+	uint32_t* links;  /* エントリごとの次のエントリの番号。空きエントリでは次の空きエントリの番号 */
+	unsigned char* pool;
+	size_t bucket_count;  /* 2 の累乗 */
+	size_t capacity;  /* pool と links に確保済みのエントリ数 */
+	size_t used;      /* 一度でも使ったエントリ数 */
+	uint32_t free_head;
+};
+
+
+static MHtEntry* compact_entry (const MHashTable* ht, uint32_t index) {
+	return (MHtEntry*)(void*)(ht->compact->pool + (size_t)(index - 1) * ht->entry_size);  /* entry_size はポインタの大きさの倍数 */
+}
+
+
+static uint32_t compact_find_index (MHashTable* ht, KeyUni key) {
+	CompactTable* table = ht->compact;
+	uint32_t index = table->heads[hash_key_uni(ht, key, table->bucket_count)];
+	while (index != 0) {
+		if (entry_key_equal(ht, compact_entry(ht, index), key))
+			return index;
+		index = table->links[index - 1];
+	}
+	return 0;
+}
+
+
+static MHtEntry* compact_find (MHashTable* ht, KeyUni key) {
+	uint32_t index = compact_find_index(ht, key);
+	return (index != 0) ? compact_entry(ht, index) : NULL;
+}
+
+
+static void compact_rehash (MHashTable* ht) {
+	CompactTable* table = ht->compact;
+	if (table->bucket_count > (SIZE_MAX / 2 / sizeof(uint32_t))) return;
+
+	size_t new_count = table->bucket_count * 2;
+	uint32_t* new_heads = calloc(new_count, sizeof(uint32_t));
+	if (UNLIKELY(new_heads == NULL)) return;  /* 広げられなくても連鎖が長くなるだけ */
+
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		uint32_t index = table->heads[i];
+		while (index != 0) {
+			uint32_t next = table->links[index - 1];
+			size_t new_bucket = hash_entry_key(ht, compact_entry(ht, index), new_count);
+			table->links[index - 1] = new_heads[new_bucket];
+			new_heads[new_bucket] = index;
+			index = next;
+		}
+	}
+
+	free(table->heads);
+	table->heads = new_heads;
+	table->bucket_count = new_count;
+}
+
+
+/* 空きエントリを 1 つ取り出し、ゼロで埋めて番号を返す。確保できなければ 0 を返す */
+static uint32_t compact_alloc (MHashTable* ht) {
+	CompactTable* table = ht->compact;
+	uint32_t index;
+
+	if (table->free_head != 0) {
+		index = table->free_head;
+		table->free_head = table->links[index - 1];
+	} else {
+		if (table->used == table->capacity) {
+			if (table->capacity >= UINT32_MAX) {
+				errno = EIO;
+				return 0;
+			}
+			size_t new_capacity;
+			if (table->capacity == 0)
+				new_capacity = table->bucket_count;
+			else
+				new_capacity = (table->capacity > UINT32_MAX / 2) ? UINT32_MAX : table->capacity * 2;
+			if (new_capacity > SIZE_MAX / ht->entry_size) {
+				errno = ENOMEM;
+				return 0;
+			}
+
+			/* プールが動くので、エントリへのポインタをこの呼び出しの前後で持ち越さないこと */
+			unsigned char* new_pool = realloc(table->pool, new_capacity * ht->entry_size);
+			if (UNLIKELY(new_pool == NULL)) {
+				errno = ENOMEM;
+				return 0;
+			}
+			table->pool = new_pool;
+
+			uint32_t* new_links = realloc(table->links, new_capacity * sizeof(uint32_t));
+			if (UNLIKELY(new_links == NULL)) {
+				errno = ENOMEM;
+				return 0;
+			}
+			table->links = new_links;
+			table->capacity = new_capacity;
+		}
+		index = (uint32_t)++table->used;
+	}
+
+	memset(compact_entry(ht, index), 0, ht->entry_size);
+	return index;
+}
+
+
+static void compact_release (MHashTable* ht, uint32_t index) {
+	CompactTable* table = ht->compact;
+	table->links[index - 1] = table->free_head;
+	table->free_head = index;
+}
+
+
+/* mht_store_entry から呼ぶ */
+static bool compact_set_entry (MHashTable* ht, KeyUni key, void* value_data, size_t value_size) {
+	MHtEntry* entry = compact_find(ht, key);
+	if (entry != NULL)
+		return entry_replace_value(ht, entry, value_data, value_size);
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wunsuffixed-float-constants"  /* mhashtable自体のデバッグを行う際は必ず外すこと */
+#endif
+
+	if (UNLIKELY(((double)ht->count / (double)ht->compact->bucket_count) > LOAD_FACTOR))
+		compact_rehash(ht);
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic pop
+#endif
+
+	uint32_t index = compact_alloc(ht);
+	if (UNLIKELY(index == 0)) {
+		if (errno == EIO) {
+			fprintf(stderr, "Compact hashtable cannot hold more than UINT32_MAX entries.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+			mht_errfunc = "compact_set_entry";
+		}
+		return false;
+	}
+
+	if (!entry_fill(ht, compact_entry(ht, index), key, value_data, value_size)) {
+		compact_release(ht, index);
+		return false;
+	}
+
+	CompactTable* table = ht->compact;
+	size_t bucket = hash_key_uni(ht, key, table->bucket_count);
+	table->links[index - 1] = table->heads[bucket];
+	table->heads[bucket] = index;
+	ht->count++;
+	return true;
+}
+
+
+/* mht_remove_entry から呼ぶ */
+static bool compact_delete_entry (MHashTable* ht, KeyUni key) {
+	CompactTable* table = ht->compact;
+	size_t bucket = hash_key_uni(ht, key, table->bucket_count);
+
+	uint32_t prev = 0;
+	uint32_t index = table->heads[bucket];
+	while (index != 0) {
+		MHtEntry* entry = compact_entry(ht, index);
+		if (entry_key_equal(ht, entry, key)) {
+			if (prev != 0)
+				table->links[prev - 1] = table->links[index - 1];
+			else
+				table->heads[bucket] = table->links[index - 1];
+
+			entry_value_free(ht, entry);
+			if (ht->key_type == KEY_TYPE_STR) key_str_release(ht, entry);
+			compact_release(ht, index);
+			ht->count--;
+			return true;
+		}
+		prev = index;
+		index = table->links[index - 1];
+	}
+	return false;
+}
+
+
+static size_t compact_collect (MHashTable* ht, void** values) {
+	CompactTable* table = ht->compact;
+	size_t idx = 0;
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		for (uint32_t index = table->heads[i]; index != 0; index = table->links[index - 1])
+			values[idx++] = compact_entry(ht, index)->value;
+	}
+	return idx;
+}
+
+
+static void compact_release_entries (MHashTable* ht, bool value_delete) {
+	CompactTable* table = ht->compact;
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		for (uint32_t index = table->heads[i]; index != 0; index = table->links[index - 1]) {
+			MHtEntry* entry = compact_entry(ht, index);
+			if (value_delete) entry_value_free(ht, entry);
+			if (ht->key_type == KEY_TYPE_STR) key_str_release(ht, entry);
+		}
+	}
+}
+
+
+static void compact_free (MHashTable* ht, bool value_delete) {
+	CompactTable* table = ht->compact;
+	compact_release_entries(ht, value_delete);
+	free(table->heads);
+	free(table->links);
+	free(table->pool);
+	free(table);
+}
+
+
+/* プールは確保済みの大きさのまま、先頭から使い直す */
+static void compact_clear (MHashTable* ht) {
+	CompactTable* table = ht->compact;
+	compact_release_entries(ht, true);
+	memset(table->heads, 0, table->bucket_count * sizeof(uint32_t));
+	table->used = 0;
+	table->free_head = 0;
+}
+
+
+bool _mht_set_compact (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_set_compact";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->count != 0 || ht->compact != NULL || ht->cuckoo != NULL || ht->split != NULL || ht->frozen != NULL || ht->numa_replicas != NULL || ht == mht_entries || ht == all_get_arr_entries) {
+		fprintf(stderr, "Compact mode can only be enabled once on an empty hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_compact";
+		mht_unlock();
+		return false;
+	}
+
+	/* mht_find_entry はコンパクトモードを昇順の連鎖より先に判定するため、昇順を前提とした探索が行われなくなる */
+	if (ht->ordered_chains) {
+		fprintf(stderr, "Compact mode does not support ordered pointer keys.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_compact";
+		mht_unlock();
+		return false;
+	}
+
+	size_t bucket_count = (ht->buckets == NULL) ? SMALL_TABLE_CAPACITY : ht->size;
+
+	CompactTable* table = calloc(1, sizeof(CompactTable));
+	uint32_t* heads = calloc(bucket_count, sizeof(uint32_t));
+	if (UNLIKELY(table == NULL || heads == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for hashtable buckets.\nFile: %s   Line: %d\n", file, line);
+		free(table);
+		free(heads);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_set_compact";
+		mht_unlock();
+		return false;
+	}
+	table->heads = heads;
+	table->bucket_count = bucket_count;  /* pool と links は最初の追加時に確保する */
+
+	table_version_bump(ht);
+	if (ht->buckets != NULL) {
+		buckets_free(ht->buckets, ht->size, ht->buckets_mapped);
+		ht->buckets = NULL;
+		ht->buckets_mapped = false;
+		ht->size = 0;
+	}
+	ht->compact = table;
+
+	mht_unlock();
+	return true;
+}
+
+
+bool _mht_set_pointer_keys (MHashTable* ht, bool ordered, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_set_pointer_keys";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->key_type != KEY_TYPE_UINT || ht->count != 0 || ht == mht_entries || ht == all_get_arr_entries) {
+		fprintf(stderr, "Pointer keys can only be enabled on an empty uint hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_pointer_keys";
+		mht_unlock();
+		return false;
+	}
+
+	/* カッコーハッシュはハッシュの上位ビットをタグに使い、分割順序リストは独自のハッシュを使う */
+	if (ht->cuckoo != NULL || ht->split != NULL || (ordered && ht->compact != NULL)) {
+		fprintf(stderr, "This option is not supported by the engine of this hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_pointer_keys";
+		mht_unlock();
+		return false;
+	}
+
+	/* スモールモードからの移行は並び順を考慮しないので、昇順にする場合は先にバケット配列へ移しておく */
+	if (ordered && ht->buckets == NULL && ht->compact == NULL && !mht_small_upgrade(ht)) {
+		mht_unlock();
+		return false;
+	}
+
+	table_version_bump(ht);
+	ht->pointer_keys = true;
+	ht->ordered_chains = ordered;
+
+	mht_unlock();
+	return true;
+}
+
+
+static void frozen_clear (FrozenTable* table);
+
+/* ロック内で使用すること。バケット配列とエントリのプールは現在の大きさのまま残す */
+static void mht_clear_entries (MHashTable* ht) {
+	table_version_bump(ht);
+
+	/* 他ノードのレプリカの値は常にこのライブラリがコピーしたものなので必ず解放する */
+	if (ht->numa_replicas != NULL) {
+		for (size_t i = 0; i < ht->numa_nodes; i++) {
+			if (ht->numa_replicas[i] != NULL && ht->numa_replicas[i] != ht)
+				mht_clear_entries(ht->numa_replicas[i]);
+		}
+	}
+
+	if (ht->split != NULL) {
+		split_clear(ht->split);
+		return;
+	}
+
+	if (ht->frozen != NULL) {
+		frozen_clear(ht->frozen);
+	} else if (ht->cuckoo != NULL) {
+		cuckoo_clear(ht);
+	} else if (ht->compact != NULL) {
+		compact_clear(ht);
+	} else {
+		chain_release_entries(ht, true);
+		if (ht->buckets == NULL)  /* スモールモード */
+			memset(ht->small, 0, ht->count * sizeof(MHtEntry));
+		else
+			memset(ht->buckets, 0, ht->size * sizeof(MHtEntry*));
+	}
+	ht->count = 0;
+	key_pool_reset(ht->key_pool);
+	change_log_record(ht, MHT_CHANGE_CLEAR, (KeyUni){ .key_type = ht->key_type });
+}
+
+
+void _mht_clear (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_clear";
+		mht_unlock();
+		return;
+	}
+
+	if (ht == mht_entries || ht == all_get_arr_entries) {
+		fprintf(stderr, "Internal hashtables cannot be cleared.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_clear";
+		mht_unlock();
+		return;
+	}
+
+	mht_clear_entries(ht);
+
+	mht_unlock();
+}
+
+
+/*
+ * ht のエントリ src のキーと値を複製して、複製先のテーブル clone のエントリ dst に書き込む。
+ * raw モードの値は大きさが分からず複製できないので EINVAL で失敗する。
+ * 失敗した場合、dst の値とキーの文字列は NULL になっているので、そのまま解放処理に渡してよい
+ */
+static bool entry_clone (const MHashTable* ht, MHashTable* clone, MHtEntry* dst, const MHtEntry* src) {
+	memcpy(dst, src, ht->entry_size);
+	dst->next = NULL;
+	dst->value = NULL;
+	if (ht->key_type == KEY_TYPE_STR) dst->key.str.ptr = NULL;
+
+	size_t value_size = entry_value_size(ht, src) & ~VALUE_SIZE_COMPRESSED;  /* 圧縮した値はそのまま写す */
+	if (value_size == 0) {
+		errno = EINVAL;
+		return false;
+	}
+
+	void* value;
+	if (clone->dedup != NULL) {
+		value = dedup_acquire(clone->dedup, src->value, value_size);
+	} else {
+		value = malloc(value_size);
+		if (value != NULL) memcpy(value, src->value, value_size);
+	}
+	if (UNLIKELY(value == NULL)) {
+		errno = ENOMEM;
+		return false;
+	}
+
+	if (ht->key_type == KEY_TYPE_STR) {
+		char* key_str = key_str_dup(clone, src->key.str);
+		if (UNLIKELY(key_str == NULL)) {
+			if (clone->dedup != NULL)
+				dedup_release(clone->dedup, value);
+			else
+				free(value);
+			errno = ENOMEM;
+			return false;
+		}
+		dst->key.str.ptr = key_str;
+	}
+
+	dst->value = value;
+	return true;
+}
+
+
+/* 連鎖の順序を保ったまま、バケット [begin, end) を複製する。途中で失敗しても、それまでに複製したエントリは dst に繋がっている */
+static bool clone_buckets (const MHashTable* src, MHashTable* dst, size_t begin, size_t end) {
+	for (size_t i = begin; i < end; i++) {
+		MHtEntry** tail = &dst->buckets[i];
+		for (MHtEntry* entry = src->buckets[i]; entry != NULL; entry = entry->next) {
+			MHtEntry* copy = malloc(src->entry_size);
+			if (UNLIKELY(copy == NULL)) {
+				errno = ENOMEM;
+				return false;
+			}
+			if (!entry_clone(src, dst, copy, entry)) {
+				free(copy);
+				return false;
+			}
+			*tail = copy;
+			tail = &copy->next;
+		}
+	}
+	return true;
+}
+
+
+typedef struct {
+	const MHashTable* src;
+	MHashTable* dst;
+	size_t begin;
+	size_t end;
+	bool result;
+	int result_errno;
+} CloneRange;
+
+
+#if defined (_WIN32)
+static DWORD WINAPI clone_thread (LPVOID arg) {
+	CloneRange* range = arg;
+	range->result = clone_buckets(range->src, range->dst, range->begin, range->end);
+	range->result_errno = errno;
+	return 0;
+}
+#else
+static void* clone_thread (void* arg) {
+	CloneRange* range = arg;
+	range->result = clone_buckets(range->src, range->dst, range->begin, range->end);
+	range->result_errno = errno;
+	return NULL;
+}
+#endif
+
+
+/* 大きなテーブルはバケットの範囲ごとにスレッドを分けて複製する。呼び出し元はロックを持ったまま待つ */
+static bool clone_buckets_parallel (const MHashTable* src, MHashTable* dst) {
+	size_t thread_count = src->size / CLONE_PARALLEL_MIN_BUCKETS;
+	if (thread_count > CLONE_MAX_THREADS) thread_count = CLONE_MAX_THREADS;
+	if (thread_count <= 1 || dst->key_pool != NULL || dst->dedup != NULL) return clone_buckets(src, dst, 0, src->size);  /* キープールと値ストアへの追記は並行できない */
+
+	CloneRange ranges[CLONE_MAX_THREADS];
+	bool started[CLONE_MAX_THREADS] = { false };
+#if defined (_WIN32)
+	HANDLE threads[CLONE_MAX_THREADS];
+#else
+	pthread_t threads[CLONE_MAX_THREADS];
+#endif
+
+	size_t chunk = src->size / thread_count;
+	for (size_t i = 0; i < thread_count; i++) {
+		ranges[i] = (CloneRange){
+			.src = src,
+			.dst = dst,
+			.begin = i * chunk,
+			.end = (i + 1 == thread_count) ? src->size : (i + 1) * chunk,
+			.result = false,
+			.result_errno = 0
+		};
+	}
+
+	/* 最後の範囲は自分で受け持つ。起動できなかった範囲も後で自分で複製する */
+	for (size_t i = 0; i + 1 < thread_count; i++) {
+#if defined (_WIN32)
+		threads[i] = CreateThread(NULL, 0, clone_thread, &ranges[i], 0, NULL);
+		started[i] = (threads[i] != NULL);
+#else
+		started[i] = (pthread_create(&threads[i], NULL, clone_thread, &ranges[i]) == 0);
+#endif
+	}
+
+	bool result = true;
+	int result_errno = 0;
+	for (size_t i = thread_count; i-- > 0;) {
+		if (started[i]) {
+#if defined (_WIN32)
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+#else
+			pthread_join(threads[i], NULL);
+#endif
+		} else {
+			ranges[i].result = clone_buckets(src, dst, ranges[i].begin, ranges[i].end);
+			ranges[i].result_errno = errno;
+		}
+
+		if (!ranges[i].result) {
+			result = false;
+			result_errno = ranges[i].result_errno;
+		}
+	}
+
+	if (!result) errno = result_errno;
+	return result;
+}
+
+
+static bool clone_cuckoo (const MHashTable* src, MHashTable* dst) {
+	const CuckooTable* from = src->cuckoo;
+	CuckooTable* to = calloc(1, sizeof(CuckooTable));
+	if (UNLIKELY(to == NULL)) {
+		errno = ENOMEM;
+		return false;
+	}
+	to->buckets = calloc(from->bucket_count, sizeof(CuckooBucket));
+	if (UNLIKELY(to->buckets == NULL)) {
+		free(to);
+		errno = ENOMEM;
+		return false;
+	}
+	to->bucket_count = from->bucket_count;
+	dst->cuckoo = to;
+
+	if (from->stash_count != 0) {
+		to->stash = malloc(from->stash_count * sizeof(MHtEntry*));
+		if (UNLIKELY(to->stash == NULL)) {
+			errno = ENOMEM;
+			return false;
+		}
+		to->stash_capacity = from->stash_count;
+	}
+
+	/* タグは複製し終えたスロットにだけ書くので、途中で失敗しても cuckoo_free で解放できる */
+	for (size_t i = 0; i < from->bucket_count; i++) {
+		for (size_t way = 0; way < CUCKOO_WAYS; way++) {
+			if (from->buckets[i].tags[way] == 0) continue;
+
+			MHtEntry* copy = malloc(src->entry_size);
+			if (UNLIKELY(copy == NULL)) {
+				errno = ENOMEM;
+				return false;
+			}
+			if (!entry_clone(src, dst, copy, from->buckets[i].entries[way])) {
+				free(copy);
+				return false;
+			}
+			to->buckets[i].entries[way] = copy;
+			to->buckets[i].tags[way] = from->buckets[i].tags[way];
+		}
+	}
+
+	for (size_t i = 0; i < from->stash_count; i++) {
+		MHtEntry* copy = malloc(src->entry_size);
+		if (UNLIKELY(copy == NULL)) {
+			errno = ENOMEM;
+			return false;
+		}
+		if (!entry_clone(src, dst, copy, from->stash[i])) {
+			free(copy);
+			return false;
+		}
+		to->stash[to->stash_count++] = copy;
+	}
+	return true;
+}
+
+
+static bool clone_compact (const MHashTable* src, MHashTable* dst) {
+	const CompactTable* from = src->compact;
+	CompactTable* to = calloc(1, sizeof(CompactTable));
+	if (UNLIKELY(to == NULL)) {
+		errno = ENOMEM;
+		return false;
+	}
+	dst->compact = to;
+
+	to->heads = malloc(from->bucket_count * sizeof(uint32_t));
+	to->links = (from->capacity != 0) ? malloc(from->capacity * sizeof(uint32_t)) : NULL;
+	to->pool = (from->capacity != 0) ? calloc(from->capacity, src->entry_size) : NULL;  /* まだ複製していないエントリを NULL にしておく */
+	if (UNLIKELY(to->heads == NULL || (from->capacity != 0 && (to->links == NULL || to->pool == NULL)))) {
+		free(to->heads);
+		free(to->links);
+		free(to->pool);
+		to->heads = NULL;
+		to->links = NULL;
+		to->pool = NULL;
+		dst->compact = NULL;
+		free(to);
+		errno = ENOMEM;
+		return false;
+	}
+
+	/* 連鎖と空きエントリの繋がりは番号なので、配列ごとそのまま写せる */
+	memcpy(to->heads, from->heads, from->bucket_count * sizeof(uint32_t));
+	if (from->capacity != 0) memcpy(to->links, from->links, from->capacity * sizeof(uint32_t));
+	to->bucket_count = from->bucket_count;
+	to->capacity = from->capacity;
+	to->used = from->used;
+	to->free_head = from->free_head;
+
+	for (size_t i = 0; i < from->bucket_count; i++) {
+		for (uint32_t index = from->heads[i]; index != 0; index = from->links[index - 1]) {
+			if (!entry_clone(src, dst, compact_entry(dst, index), compact_entry(src, index)))
+				return false;
+		}
+	}
+	return true;
+}
+
+
+static bool clone_small (const MHashTable* src, MHashTable* dst) {
+	for (size_t i = 0; i < src->count; i++) {
+		if (!entry_clone(src, dst, &dst->small[i], &src->small[i]))
+			return false;
+		dst->count++;  /* 複製し終えた分だけを解放させる */
+	}
+	return true;
+}
+
+
+MHashTable* _mht_clone (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_clone";
+		mht_unlock();
+		return NULL;
+	}
+
+	if (ht->split != NULL || ht->frozen != NULL || ht == mht_entries || ht == all_get_arr_entries) {
+		fprintf(stderr, "This hashtable cannot be cloned.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_clone";
+		mht_unlock();
+		return NULL;
+	}
+
+	bool small = (ht->buckets == NULL && ht->cuckoo == NULL && ht->compact == NULL);
+	MHashTable* clone = calloc(1, sizeof(MHashTable) + (small ? SMALL_TABLE_CAPACITY * sizeof(MHtEntry) : 0));
+	if (UNLIKELY(clone == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_clone";
+		mht_unlock();
+		return NULL;
+	}
+
+	/* NUMA レプリカとアクセス頻度の集計と変更ログは引き継がない。count は複製が終わるまで 0 のままにしておく */
+	clone->key_type = ht->key_type;
+	clone->key_words = ht->key_words;
+	clone->entry_size = ht->entry_size;
+	clone->huge_page_mode = ht->huge_page_mode;
+	clone->read_cache = ht->read_cache;
+	clone->pointer_keys = ht->pointer_keys;
+	clone->ordered_chains = ht->ordered_chains;
+	clone->compress_threshold = ht->compress_threshold;
+	if (ht->key_pool != NULL) clone->key_pool = calloc(1, sizeof(KeyPool));
+	if (ht->dedup != NULL) clone->dedup = dedup_create();
+	if (UNLIKELY((ht->key_pool != NULL && clone->key_pool == NULL) || (ht->dedup != NULL && clone->dedup == NULL))) {
+		fprintf(stderr, "Failed to allocate memory for hashtable.\nFile: %s   Line: %d\n", file, line);
+		key_pool_free(clone->key_pool);
+		dedup_free(clone->dedup);
+		free(clone);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_clone";
+		mht_unlock();
+		return NULL;
+	}
+
+	bool result;
+	if (ht->cuckoo != NULL) {
+		result = clone_cuckoo(ht, clone);
+	} else if (ht->compact != NULL) {
+		result = clone_compact(ht, clone);
+	} else if (small) {
+		result = clone_small(ht, clone);
+	} else {
+		clone->buckets = buckets_alloc(ht->huge_page_mode, ht->size, &clone->buckets_mapped);  /* 今後の処理のために必ず初期化が必要 */
+		if (UNLIKELY(clone->buckets == NULL)) {
+			errno = ENOMEM;
+			result = false;
+		} else {
+			clone->size = ht->size;
+			result = clone_buckets_parallel(ht, clone);
+		}
+	}
+
+#ifdef ATOMICS_SUPPORTED
+	/* バージョンのセルは共有せず、複製にも別のものを持たせる */
+	if (result && clone->read_cache && UNLIKELY(!table_version_attach(clone))) {
+		errno = ENOMEM;
+		result = false;
+	}
+#endif
+
+	if (!result) {
+		int saved_errno = errno;
+		if (saved_errno == EINVAL)
+			fprintf(stderr, "Hashtables holding raw values cannot be cloned.\nFile: %s   Line: %d\n", file, line);
+		else
+			fprintf(stderr, "Failed to allocate memory for hashtable clone.\nFile: %s   Line: %d\n", file, line);
+		mht_destroy_value_choose_delete(clone, true);  /* 確保できなかった部分は空のまま残っている */
+		errno = saved_errno;
+		mht_errfunc = "_mht_clone";
+		mht_unlock();
+		return NULL;
+	}
+	clone->count = ht->count;
+
+	MHtTrackEntry mht_entry = {
+		.ptr = clone
+#ifdef DEBUG
+		,
+		.create_file = file,
+		.create_line = line,
+		.key_type = clone->key_type
+#endif
+	};
+
+	if (UNLIKELY(!mht_uint_set_without_lock(mht_entries, (uint_keyt)clone, &mht_entry, sizeof(MHtTrackEntry), file, line))) {
+		fprintf(stderr, "Failed to set hashtable in hashtable entries.\nFile: %s   Line: %d\n", file, line);
+		mht_errfunc = "_mht_clone";
+	}
+
+	mht_unlock();
+	return clone;
+}
+
+
+static KeyUni entry_key_uni (const MHashTable* ht, MHtEntry* entry) {
+	KeyUni key = { .key_type = ht->key_type };
+	if (ht->key_type == KEY_TYPE_UINT)
+		key.key.uint = entry->key.uint;
+	else if (ht->key_type == KEY_TYPE_UINT32)
+		key.key.uint32 = entry->meta.packed.key;
+	else if (ht->key_type == KEY_TYPE_STR)
+		key.key.str = entry->key.str;
+	else  /* if (ht->key_type == KEY_TYPE_TUPLE) */
+		key.key.tuple = entry_tuple_key(entry);
+	return key;
+}
+
+
+/* count 個の要素を入れても LOAD_FACTOR を超えない大きさまで、バケット配列を一度に広げる。失敗しても挿入時に広がるので結果は返さない */
+static void mht_reserve (MHashTable* ht, size_t count) {
+	if (ht->cuckoo != NULL || ht->compact != NULL) return;  /* 自前で広がる */
+
+	if (ht->buckets == NULL) {  /* スモールモード */
+		if (count <= SMALL_TABLE_CAPACITY || !mht_small_upgrade(ht)) return;
+	}
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wunsuffixed-float-constants"  /* mhashtable自体のデバッグを行う際は必ず外すこと */
+#endif
+
+	size_t new_size = ht->size;
+	while (new_size <= (SIZE_MAX / 4) && ((double)count / (double)new_size) > LOAD_FACTOR)
+		new_size *= 2;
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic pop
+#endif
+
+	if (ht->ordered_chains) {
+		while (ht->size < new_size) {
+			size_t old_size = ht->size;
+			mht_rehash(ht);
+			if (ht->size == old_size) return;
+		}
+	} else if (new_size != ht->size) {
+		mht_rehash_to(ht, new_size);
+	}
+}
+
+
+typedef struct {
+	MHashTable* dst;
+	MHashTable* src;
+	MHtMergePolicy policy;
+	MHtMergeCombine combine;
+	void* arg;
+	bool consume;
+} MergeContext;
+
+
+/* consume が true の場合は値をコピーせずに dst へ渡し、渡した値は entry->value を NULL にして src 側で解放されないようにする */
+static bool merge_entry_value (MergeContext* ctx, MHtEntry* entry) {
+	MHashTable* dst = ctx->dst;
+	KeyUni key = entry_key_uni(ctx->src, entry);
+	size_t value_size = entry_value_size(ctx->src, entry);
+
+	MHtEntry* existing = mht_find_entry(dst, key);
+	if (existing != NULL) {
+		if (ctx->policy == MHT_MERGE_KEEP_DST) return true;
+
+		if (ctx->policy == MHT_MERGE_COMBINE) {
+			ctx->combine(existing->value, entry_value_size(dst, existing), entry->value, value_size, ctx->arg);
+		} else if (ctx->consume) {  /* MHT_MERGE_TAKE_SRC */
+			free(existing->value);
+			existing->value = entry->value;
+			entry_set_value_size(dst, existing, value_size);
+			entry->value = NULL;
+		} else {
+			if (value_size == 0) {
+				errno = EINVAL;
+				return false;
+			}
+			if (!entry_replace_value(dst, existing, entry->value, value_size)) return false;
+		}
+		change_log_record(dst, MHT_CHANGE_SET, key);
+		return true;
+	}
+
+	if (!ctx->consume) {
+		if (value_size == 0) {
+			errno = EINVAL;
+			return false;
+		}
+		return mht_set_entry(dst, key, entry->value, value_size);
+	}
+
+	/* raw モードで値のポインタだけを渡し、元の大きさを書き戻す */
+	if (!mht_set_entry(dst, key, entry->value, 0)) return false;
+	entry_set_value_size(dst, mht_find_entry(dst, key), value_size);
+	entry->value = NULL;
+	return true;
+}
+
+
+/*
+ * src のエントリ 1 つを dst に取り込む。consume が true の場合は取り込み終えたエントリを src から削除する。
+ * 失敗した場合、そのエントリと未処理のエントリは src に残る
+ */
+static bool merge_entry (MergeContext* ctx, MHtEntry* entry) {
+	if (!merge_entry_value(ctx, entry)) return false;
+	if (ctx->consume) mht_delete_entry(ctx->src, entry_key_uni(ctx->src, entry));  /* 渡した値は NULL になっている */
+	return true;
+}
+
+
+/* consume の場合は走査中に削除が起きるので、削除で位置の変わる stash とスモールモードは後ろから辿る */
+static bool merge_entries (MergeContext* ctx) {
+	MHashTable* src = ctx->src;
+
+	if (src->cuckoo != NULL) {
+		CuckooTable* table = src->cuckoo;
+		for (size_t i = 0; i < table->bucket_count; i++) {
+			for (size_t way = 0; way < CUCKOO_WAYS; way++) {
+				if (table->buckets[i].tags[way] != 0 && !merge_entry(ctx, table->buckets[i].entries[way]))
+					return false;
+			}
+		}
+		for (size_t i = table->stash_count; i-- > 0;) {
+			if (!merge_entry(ctx, table->stash[i])) return false;
+		}
+		return true;
+	}
+
+	if (src->compact != NULL) {
+		CompactTable* table = src->compact;
+		for (size_t i = 0; i < table->bucket_count; i++) {
+			uint32_t index = table->heads[i];
+			while (index != 0) {
+				uint32_t next = table->links[index - 1];
+				if (!merge_entry(ctx, compact_entry(src, index))) return false;
+				index = next;
+			}
+		}
+		return true;
+	}
+
+	if (src->buckets == NULL) {  /* スモールモード */
+		for (size_t i = src->count; i-- > 0;) {
+			if (!merge_entry(ctx, &src->small[i])) return false;
+		}
+		return true;
+	}
+
+	for (size_t i = 0; i < src->size; i++) {
+		MHtEntry* entry = src->buckets[i];
+		while (entry != NULL) {
+			MHtEntry* next = entry->next;
+			if (!merge_entry(ctx, entry)) return false;
+			entry = next;
+		}
+	}
+	return true;
+}
+
+
+/*
+ * 連鎖法のテーブル同士で src を使い切る場合は、エントリをキーごと dst の連鎖へ繋ぎ替える。
+ * 確保を伴わないので失敗せず、src のバケットは空になる
+ */
+static void merge_relink_entries (MergeContext* ctx) {
+	MHashTable* dst = ctx->dst;
+	MHashTable* src = ctx->src;
+
+	for (size_t i = 0; i < src->size; i++) {
+		MHtEntry* entry = src->buckets[i];
+		src->buckets[i] = NULL;
+
+		while (entry != NULL) {
+			MHtEntry* next = entry->next;
+			KeyUni key = entry_key_uni(src, entry);
+
+			MHtEntry* existing = mht_find_entry(dst, key);
+			if (existing == NULL) {
+				MHtEntry** link = &dst->buckets[hash_entry_key(dst, entry, dst->size)];
+				if (dst->ordered_chains) {
+					while (*link != NULL && (*link)->key.uint < entry->key.uint)
+						link = &(*link)->next;
+				}
+				entry->next = *link;
+				*link = entry;
+				dst->count++;
+			} else {
+				if (ctx->policy == MHT_MERGE_TAKE_SRC) {
+					free(existing->value);
+					existing->value = entry->value;
+					entry_set_value_size(dst, existing, entry_value_size(src, entry));
+					entry->value = NULL;
+				} else if (ctx->policy == MHT_MERGE_COMBINE) {
+					ctx->combine(existing->value, entry_value_size(dst, existing), entry->value, entry_value_size(src, entry), ctx->arg);
+				}
+
+				free(entry->value);
+				if (src->key_type == KEY_TYPE_STR) key_str_release(src, entry);
+				free(entry);
+			}
+			entry = next;
+		}
+	}
+	src->count = 0;
+}
+
+
+static bool mht_merge_generic (MHashTable* dst, MHashTable* src, MHtMergePolicy policy, MHtMergeCombine combine, void* arg, bool consume, const char* file, int line) {
+	if (!mht_pre_execution_check(dst, file, line) || !mht_pre_execution_check(src, file, line))
+		return false;
+
+	if (dst == src || dst == mht_entries || dst == all_get_arr_entries || src == mht_entries || src == all_get_arr_entries) {
+		fprintf(stderr, "These hashtables cannot be merged.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	if (dst->key_type != src->key_type || dst->key_words != src->key_words) {
+		fprintf(stderr, "Key type mismatch in hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	if (policy != MHT_MERGE_KEEP_DST && policy != MHT_MERGE_TAKE_SRC && policy != MHT_MERGE_COMBINE) {
+		fprintf(stderr, "Invalid merge policy.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	if (policy == MHT_MERGE_COMBINE && combine == NULL) {
+		fprintf(stderr, "Combine function is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	/* 分割順序リストはロックの外から書き換わり、レプリカには値を個別にコピーする必要があるため扱わない */
+	if (dst->split != NULL || src->split != NULL || dst->numa_replicas != NULL || (consume && src->numa_replicas != NULL)) {
+		fprintf(stderr, "Split-ordered or replicated hashtables cannot be merged.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	/* 圧縮した値は結合関数にも相手のテーブルにもそのまま渡せず、共有している値は相手のテーブルへ移せない */
+	if (dst->compress_threshold != 0 || src->compress_threshold != 0 || dst->dedup != NULL || src->dedup != NULL) {
+		fprintf(stderr, "Compressed or deduplicated hashtables cannot be merged.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	if (dst->frozen != NULL || src->frozen != NULL) {
+		fprintf(stderr, "Frozen hashtables cannot be merged.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	MergeContext ctx = {
+		.dst = dst,
+		.src = src,
+		.policy = policy,
+		.combine = combine,
+		.arg = arg,
+		.consume = consume
+	};
+
+	table_version_bump(dst);
+	mht_reserve(dst, dst->count + src->count);
+
+	/* キープールのキーは持ち主のテーブルのページにあり、変更ログには 1 件ずつ記録する必要があるので、エントリごと移すことはできない */
+	if (consume && src->buckets != NULL && dst->buckets != NULL && src->key_pool == NULL && dst->key_pool == NULL && src->change_log == NULL && dst->change_log == NULL) {
+		table_version_bump(src);
+		merge_relink_entries(&ctx);
+		return true;
+	}
+
+	bool result = merge_entries(&ctx);
+	if (!result && errno == EINVAL)
+		fprintf(stderr, "Raw values cannot be copied by a merge.\nFile: %s   Line: %d\n", file, line);
+	else if (!result)
+		fprintf(stderr, "Failed to allocate memory for merging hashtables.\nFile: %s   Line: %d\n", file, line);
+	return result;
+}
+
+
+bool _mht_merge (MHashTable* dst, MHashTable* src, MHtMergePolicy policy, MHtMergeCombine combine, void* arg, const char* file, int line) {
+	mht_lock();
+
+	bool result = mht_merge_generic(dst, src, policy, combine, arg, false, file, line);
+	if (!result) mht_errfunc = "_mht_merge";
+
+	mht_unlock();
+	return result;
+}
+
+
+bool _mht_merge_consume (MHashTable* dst, MHashTable* src, MHtMergePolicy policy, MHtMergeCombine combine, void* arg, const char* file, int line) {
+	mht_lock();
+
+	bool result = mht_merge_generic(dst, src, policy, combine, arg, true, file, line);
+	if (!result) mht_errfunc = "_mht_merge_consume";
+
+	mht_unlock();
+	return result;
+}
+
+
+/* ht のすべてのエントリに visit を呼ぶ。visit の中でエントリを追加・削除してはならない */
+static void for_each_entry (MHashTable* ht, void (*visit)(MHashTable* ht, MHtEntry* entry, void* arg), void* arg) {
+	if (ht->cuckoo != NULL) {
+		CuckooTable* table = ht->cuckoo;
+		for (size_t i = 0; i < table->bucket_count; i++) {
+			for (size_t way = 0; way < CUCKOO_WAYS; way++) {
+				if (table->buckets[i].tags[way] != 0) visit(ht, table->buckets[i].entries[way], arg);
+			}
+		}
+		for (size_t i = 0; i < table->stash_count; i++)
+			visit(ht, table->stash[i], arg);
+	} else if (ht->compact != NULL) {
+		CompactTable* table = ht->compact;
+		for (size_t i = 0; i < table->bucket_count; i++) {
+			for (uint32_t index = table->heads[i]; index != 0; index = table->links[index - 1])
+				visit(ht, compact_entry(ht, index), arg);
+		}
+	} else if (ht->buckets == NULL) {  /* スモールモード */
+		for (size_t i = 0; i < ht->count; i++)
+			visit(ht, &ht->small[i], arg);
+	} else {
+		for (size_t i = 0; i < ht->size; i++) {
+			for (MHtEntry* entry = ht->buckets[i]; entry != NULL; entry = entry->next)
+				visit(ht, entry, arg);
+		}
+	}
+}
+
+
+/* 新しいページは生きているキーがすべて収まる大きさで確保してあるので、ここでの追記は失敗しない */
+static void key_pool_move (MHashTable* ht, MHtEntry* entry, void* arg) {
+	(void)arg;
+	entry->key.str.ptr = arena_copy(&ht->key_pool->page, entry->key.str, 0);
+}
+
+
+/* 生きているキーだけを 1 枚の新しいページに写し、古いページを解放する。失敗しても元のまま使い続けられる */
+static bool key_pool_compact (MHashTable* ht) {
+	KeyPool* pool = ht->key_pool;
+	ArenaBlock* old_pages = pool->page;
+
+	pool->page = NULL;
+	if (pool->live_bytes != 0) {
+		pool->page = malloc(sizeof(ArenaBlock) + pool->live_bytes);
+		if (UNLIKELY(pool->page == NULL)) {
+			pool->page = old_pages;
+			errno = ENOMEM;
+			return false;
+		}
+		pool->page->prev = NULL;
+		pool->page->used = 0;
+		pool->page->capacity = pool->live_bytes;
+
+		for_each_entry(ht, key_pool_move, NULL);
+	}
+
+	arena_free(old_pages);
+	pool->dead_bytes = 0;
+	return true;
+}
+
+
+bool _mht_set_key_pool (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_set_key_pool";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->key_type != KEY_TYPE_STR) {
+		fprintf(stderr, "Key pool can only be used with string keys.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_key_pool";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->count != 0 || ht->frozen != NULL) {
+		fprintf(stderr, "Key pool can only be enabled on an empty hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_key_pool";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->key_pool == NULL) {
+		ht->key_pool = calloc(1, sizeof(KeyPool));
+		if (UNLIKELY(ht->key_pool == NULL)) {
+			fprintf(stderr, "Failed to allocate memory for key pool.\nFile: %s   Line: %d\n", file, line);
+			errno = ENOMEM;
+			mht_errfunc = "_mht_set_key_pool";
+			mht_unlock();
+			return false;
+		}
+	}
+
+	mht_unlock();
+	return true;
+}
+
+
+bool _mht_compact_keys (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_compact_keys";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->key_pool == NULL) {
+		fprintf(stderr, "Hashtable does not use a key pool.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_compact_keys";
+		mht_unlock();
+		return false;
+	}
+
+	bool result = true;
+	if (ht->key_pool->dead_bytes != 0 && !key_pool_compact(ht)) {
+		fprintf(stderr, "Failed to allocate memory for compacting keys.\nFile: %s   Line: %d\n", file, line);
+		mht_errfunc = "_mht_compact_keys";
+		result = false;
+	}
+
+	mht_unlock();
+	return result;
+}
+
+
+/*
+ * 凍結したテーブル。キーを昇順に並べて FROZEN_BLOCK_KEYS 個ずつのブロックに分け、
+ * ブロックの先頭のキーは長さと本体をそのまま、続くキーは直前のキーと共有する接頭辞の長さと
+ * 残りの長さと残りの本体だけを持つ。長さはすべて 7 ビットずつの可変長整数で書く。
+ * 検索はブロック先頭のキーを二分探索してから、そのブロックの中を先頭から順に復号する
+ */
+struct FrozenTable {
+	unsigned char* keys;  /* ブロックを並べた前方圧縮のキー列 */
+	size_t* blocks;       /* 疎な索引。各ブロックの先頭の keys 内での位置 */
+	size_t block_count;
+	void** values;        /* キーの昇順に並べた値 */
+	size_t count;
+};
+
+
+typedef struct {
+	str_keyt key;
+	void* value;
+} FrozenItem;
+
+
+typedef struct {
+	FrozenItem* items;
+	size_t count;
+} FrozenItems;
+
+
+static size_t varint_put (unsigned char* dst, size_t value) {
+	size_t bytes = 0;
+	while (value >= 0x80) {
+		dst[bytes++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	dst[bytes++] = (unsigned char)value;
+	return bytes;
+}
+
+
+static size_t varint_get (const unsigned char** src) {
+	const unsigned char* p = *src;
+	size_t value = 0;
+	unsigned int shift = 0;
+	while (*p & 0x80) {
+		value |= (size_t)(*p++ & 0x7F) << shift;
+		shift += 7;
+	}
+	value |= (size_t)*p++ << shift;
+	*src = p;
+	return value;
+}
+
+
+/* memcmp の順に比べ、一方が他方の接頭辞なら短い方を小さいとする */
+static int frozen_key_compare (const void* a, size_t a_len, const void* b, size_t b_len) {
+	int cmp = memcmp(a, b, (a_len < b_len) ? a_len : b_len);
+	if (cmp != 0) return cmp;
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+
+static int frozen_item_compare (const void* a, const void* b) {
+	const FrozenItem* item_a = a;
+	const FrozenItem* item_b = b;
+	return frozen_key_compare(item_a->key.ptr, item_a->key.len, item_b->key.ptr, item_b->key.len);
+}
+
+
+static size_t frozen_common_prefix (const unsigned char* a, size_t a_len, const char* b, size_t b_len) {
+	size_t limit = (a_len < b_len) ? a_len : b_len;
+	size_t i = 0;
+	while (i < limit && a[i] == (unsigned char)b[i]) i++;
+	return i;
+}
+
+
+static void frozen_add_item (MHashTable* ht, MHtEntry* entry, void* arg) {
+	(void)ht;
+	FrozenItems* items = arg;
+	items->items[items->count].key = entry->key.str;
+	items->items[items->count].value = entry->value;
+	items->count++;
+}
+
+
+/* items はキーの昇順に並べておくこと。キーの文字列は写すので、呼び出し後に解放してよい */
+static FrozenTable* frozen_build (const FrozenItem* items, size_t count) {
+	FrozenTable* table = calloc(1, sizeof(FrozenTable));
+	if (UNLIKELY(table == NULL)) return NULL;
+	if (count == 0) return table;
+
+	size_t bytes = 0;
+	for (size_t i = 0; i < count; i++)
+		bytes += items[i].key.len + 2 * VARINT_MAX_BYTES;
+
+	size_t block_count = (count + FROZEN_BLOCK_KEYS - 1) / FROZEN_BLOCK_KEYS;
+	table->keys = malloc(bytes);
+	table->blocks = malloc(block_count * sizeof(size_t));
+	table->values = malloc(count * sizeof(void*));
+	if (UNLIKELY(table->keys == NULL || table->blocks == NULL || table->values == NULL)) {
+		free(table->keys);
+		free(table->blocks);
+		free(table->values);
+		free(table);
+		return NULL;
+	}
+
+	size_t pos = 0;
+	for (size_t i = 0; i < count; i++) {
+		str_keyt key = items[i].key;
+		if (i % FROZEN_BLOCK_KEYS == 0) {
+			table->blocks[i / FROZEN_BLOCK_KEYS] = pos;
+			pos += varint_put(table->keys + pos, key.len);
+			memcpy(table->keys + pos, key.ptr, key.len);
+			pos += key.len;
+		} else {
+			str_keyt prev = items[i - 1].key;
+			size_t shared = frozen_common_prefix((const unsigned char*)prev.ptr, prev.len, key.ptr, key.len);
+			pos += varint_put(table->keys + pos, shared);
+			pos += varint_put(table->keys + pos, key.len - shared);
+			memcpy(table->keys + pos, key.ptr + shared, key.len - shared);
+			pos += key.len - shared;
+		}
+		table->values[i] = items[i].value;
+	}
+
+	unsigned char* keys = realloc(table->keys, pos);
+	if (keys != NULL) table->keys = keys;  /* 縮められなくても見積もった大きさのまま使える */
+
+	table->block_count = block_count;
+	table->count = count;
+	return table;
+}
+
+
+static void* frozen_get (const FrozenTable* table, str_keyt key) {
+	/* 先頭のキーが key 以下である最後のブロックを探す */
+	size_t low = 0;
+	size_t high = table->block_count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		const unsigned char* p = table->keys + table->blocks[mid];
+		size_t len = varint_get(&p);
+		if (frozen_key_compare(p, len, key.ptr, key.len) <= 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low == 0) return NULL;
+
+	size_t index = (low - 1) * FROZEN_BLOCK_KEYS;
+	size_t end = (index + FROZEN_BLOCK_KEYS < table->count) ? index + FROZEN_BLOCK_KEYS : table->count;
+	const unsigned char* p = table->keys + table->blocks[low - 1];
+	size_t len = varint_get(&p);
+
+	/* matched は直前のキーと key の共通接頭辞の長さ。直前のキーは常に key より小さい */
+	size_t matched = frozen_common_prefix(p, len, key.ptr, key.len);
+	if (matched == len && matched == key.len) return table->values[index];
+	p += len;
+
+	for (index++; index < end; index++) {
+		size_t shared = varint_get(&p);
+		size_t suffix_len = varint_get(&p);
+
+		/* 直前のキーと matched より手前で分かれたなら、その位置の文字は key より大きい */
+		if (shared < matched) return NULL;
+
+		/* matched より先まで直前のキーと同じなら、key との大小も直前のキーと同じ */
+		if (shared == matched) {
+			size_t common = frozen_common_prefix(p, suffix_len, key.ptr + matched, key.len - matched);
+			if (common == suffix_len && matched + common == key.len) return table->values[index];
+			if (common != suffix_len && (matched + common == key.len || p[common] > (unsigned char)key.ptr[matched + common]))
+				return NULL;
+			matched += common;
+		}
+		p += suffix_len;
+	}
+	return NULL;
+}
+
+
+static size_t frozen_collect (const FrozenTable* table, void** values) {
+	if (table->count != 0) memcpy(values, table->values, table->count * sizeof(void*));
+	return table->count;
+}
+
+
+/* 空の凍結したテーブルに戻す。テーブルは読み取り専用のまま */
+static void frozen_clear (FrozenTable* table) {
+	for (size_t i = 0; i < table->count; i++)
+		free(table->values[i]);
+	free(table->keys);
+	free(table->blocks);
+	free(table->values);
+	table->keys = NULL;
+	table->blocks = NULL;
+	table->values = NULL;
+	table->block_count = 0;
+	table->count = 0;
+}
+
+
+static void frozen_free (FrozenTable* table, bool value_delete) {
+	if (value_delete) {
+		frozen_clear(table);
+	} else {
+		free(table->keys);
+		free(table->blocks);
+		free(table->values);
+	}
+	free(table);
+}
+
+
+bool _mht_freeze (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_freeze";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->key_type != KEY_TYPE_STR) {
+		fprintf(stderr, "Only hashtables with string keys can be frozen.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_freeze";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->numa_replicas != NULL || ht->compress_threshold != 0 || ht->dedup != NULL || ht == mht_entries || ht == all_get_arr_entries) {
+		fprintf(stderr, "This hashtable cannot be frozen.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_freeze";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->frozen != NULL) {  /* 凍結済み */
+		mht_unlock();
+		return true;
+	}
+
+	FrozenItems items = {
+		.items = (ht->count != 0) ? malloc(ht->count * sizeof(FrozenItem)) : NULL,
+		.count = 0
+	};
+	FrozenTable* table = NULL;
+	if (LIKELY(ht->count == 0 || items.items != NULL)) {
+		for_each_entry(ht, frozen_add_item, &items);
+		if (items.count != 0) qsort(items.items, items.count, sizeof(FrozenItem), frozen_item_compare);
+		table = frozen_build(items.items, items.count);
+	}
+	free(items.items);
+
+	if (UNLIKELY(table == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for freezing hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_freeze";
+		mht_unlock();
+		return false;
+	}
+
+	/* キーは凍結したテーブルに写し終えたので、値だけを残して元のエントリを手放す */
+	if (ht->cuckoo != NULL) {
+		cuckoo_free(ht, false);
+		ht->cuckoo = NULL;
+	} else if (ht->compact != NULL) {
+		compact_free(ht, false);
+		ht->compact = NULL;
+	} else {
+		chain_release_entries(ht, false);
+		if (ht->buckets != NULL) buckets_free(ht->buckets, ht->size, ht->buckets_mapped);
+		ht->buckets = NULL;
+		ht->size = 0;
+		ht->buckets_mapped = false;
+	}
+	key_pool_free(ht->key_pool);
+	ht->key_pool = NULL;
+
+	ht->frozen = table;
+	table_version_bump(ht);
+
+	mht_unlock();
+	return true;
+}
+
+
+bool _mht_set_compression (MHashTable* ht, size_t threshold, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_set_compression";
+		mht_unlock();
+		return false;
+	}
+
+	/* KEY_TYPE_UINT32 のエントリには圧縮の印を置く場所がない */
+	if (ht->key_type == KEY_TYPE_UINT32 || ht->split != NULL || ht->frozen != NULL || ht->dedup != NULL || ht->numa_replicas != NULL || ht == mht_entries || ht == all_get_arr_entries) {
+		fprintf(stderr, "This option is not supported by this hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_compression";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->count != 0) {
+		fprintf(stderr, "Compression can only be changed on an empty hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_compression";
+		mht_unlock();
+		return false;
+	}
+
+	ht->compress_threshold = threshold;
+
+	mht_unlock();
+	return true;
+}
+
+
+bool _mht_set_dedup (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_set_dedup";
+		mht_unlock();
+		return false;
+	}
+
+	/* 圧縮した値は内容が同じでも格納した大きさを共有できないので、圧縮とは併用しない */
+	if (ht->split != NULL || ht->frozen != NULL || ht->compress_threshold != 0 || ht->numa_replicas != NULL || ht == mht_entries || ht == all_get_arr_entries) {
+		fprintf(stderr, "This option is not supported by this hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_dedup";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->count != 0) {
+		fprintf(stderr, "Deduplication can only be enabled on an empty hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_dedup";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->dedup == NULL) {
+		ht->dedup = dedup_create();
+		if (UNLIKELY(ht->dedup == NULL)) {
+			fprintf(stderr, "Failed to allocate memory for value store.\nFile: %s   Line: %d\n", file, line);
+			errno = ENOMEM;
+			mht_errfunc = "_mht_set_dedup";
+			mht_unlock();
+			return false;
+		}
+	}
+
+	mht_unlock();
+	return true;
+}
+
+
+bool _mht_set_change_log (MHashTable* ht, size_t capacity, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_set_change_log";
+		mht_unlock();
+		return false;
+	}
+
+	if (ht->split != NULL || ht == mht_entries || ht == all_get_arr_entries) {
+		fprintf(stderr, "This option is not supported by this hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_change_log";
+		mht_unlock();
+		return false;
+	}
+
+	if (capacity > SIZE_MAX / sizeof(ChangeRecord)) {
+		fprintf(stderr, "Change log capacity is too large.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_change_log";
+		mht_unlock();
+		return false;
+	}
+
+	ChangeLog* log = NULL;
+	uint64_t last_seq = (ht->change_log != NULL) ? ht->change_log->last_seq : 0;  /* 番号は作り直しても続ける */
+	if (capacity != 0) {
+		log = change_log_create(capacity, last_seq);
+		if (UNLIKELY(log == NULL)) {
+			fprintf(stderr, "Failed to allocate memory for change log.\nFile: %s   Line: %d\n", file, line);
+			errno = ENOMEM;
+			mht_errfunc = "_mht_set_change_log";
+			mht_unlock();
+			return false;
+		}
+	}
+
+	change_log_free(ht->change_log);
+	ht->change_log = log;
+
+	mht_unlock();
+	return true;
+}
+
+
+uint64_t _mht_change_seq (MHashTable* ht, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_change_seq";
+		mht_unlock();
+		return 0;
+	}
+
+	if (ht->change_log == NULL) {
+		fprintf(stderr, "Hashtable does not have a change log.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_change_seq";
+		mht_unlock();
+		return 0;
+	}
+
+	uint64_t seq = ht->change_log->last_seq;
+
+	mht_unlock();
+	return seq;
+}
+
+
+bool _mht_changes_since (MHashTable* ht, uint64_t seq, MHtChangeCallback callback, void* arg, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_changes_since";
+		mht_unlock();
+		return false;
+	}
+
+	if (callback == NULL) {
+		fprintf(stderr, "Callback function is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_changes_since";
+		mht_unlock();
+		return false;
+	}
+
+	ChangeLog* log = ht->change_log;
+	if (log == NULL) {
+		fprintf(stderr, "Hashtable does not have a change log.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_changes_since";
+		mht_unlock();
+		return false;
+	}
+
+	if (seq > log->last_seq) {
+		fprintf(stderr, "Sequence number is ahead of the change log.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_changes_since";
+		mht_unlock();
+		return false;
+	}
+
+	/* 残っている記録は last_seq - count + 1 から last_seq までの連番 */
+	uint64_t missing = log->last_seq - seq;
+	if (missing > log->count) {
+		fprintf(stderr, "Changes since this sequence number are no longer in the change log.\nFile: %s   Line: %d\n", file, line);
+		errno = ERANGE;
+		mht_errfunc = "_mht_changes_since";
+		mht_unlock();
+		return false;
+	}
+
+	for (size_t i = log->count - (size_t)missing; i < log->count; i++) {
+		const ChangeRecord* record = &log->records[(log->head + i) % log->capacity];
+		MHtChange change = {
+			.seq = record->seq,
+			.type = record->type
+		};
+		if (ht->key_type == KEY_TYPE_UINT)
+			change.key.uint = record->key.key.uint;
+		else if (ht->key_type == KEY_TYPE_UINT32)
+			change.key.uint32 = record->key.key.uint32;
+		else if (ht->key_type == KEY_TYPE_STR)
+			change.key.str = record->key.key.str;
+		else  /* if (ht->key_type == KEY_TYPE_TUPLE) */
+			change.key.tuple = record->key.key.tuple;
+		callback(&change, arg);
+	}
+
+	mht_unlock();
+	return true;
+}
+
+
+/* mht_set_entry から呼ぶ。変更ログには記録しない */
+static bool mht_store_entry (MHashTable* ht, KeyUni key, void* value_data, size_t value_size) {
+	if (ht->split != NULL) return split_set(ht->split, key.key.uint, value_data, value_size);
+
+	table_version_bump(ht);
+
+	if (ht->cuckoo != NULL) return cuckoo_set_entry(ht, key, value_data, value_size);
+	if (ht->compact != NULL) return compact_set_entry(ht, key, value_data, value_size);
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wunsuffixed-float-constants"  /* mhashtable自体のデバッグを行う際は必ず外すこと */
+#endif
+
+	if (UNLIKELY(ht->buckets != NULL && ((double)ht->count / (double)ht->size) > LOAD_FACTOR))
+		mht_rehash(ht);
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic pop
+#endif
+
+	if (ht->buckets == NULL && !mht_small_prepare_set(ht, key))
+		return false;
+
+	size_t index = 0;
+	MHtEntry* entry;
+	if (ht->buckets == NULL) {  /* スモールモード */
+		entry = mht_small_find(ht, key, NULL);
+	} else {
+		index = hash_key_uni(ht, key, ht->size);
+		entry = ht->buckets[index];
+	}
+
+	/* 既存キーを更新（上書き） */
+	while (entry != NULL) {  /* bucketsが確保時に初期化されていることが前提 */
+		if (entry_key_equal(ht, entry, key))
+			return entry_replace_value(ht, entry, value_data, value_size);
+		if (ht->ordered_chains && entry->key.uint > key.key.uint) break;
+		entry = entry->next;
+	}
+
+	/* 新規追加 */
+	MHtEntry* new_entry;
+	if (ht->buckets == NULL)  /* スモールモードでは配列の末尾をそのまま使う */
+		new_entry = &ht->small[ht->count];
+	else
+		new_entry = calloc(1, ht->entry_size);
+	if (UNLIKELY(new_entry == NULL)) return false;
+
+	if (!entry_fill(ht, new_entry, key, value_data, value_size)) {
+		if (ht->buckets != NULL) free(new_entry);
+		return false;
+	}
+
+	if (ht->buckets != NULL) {
+		MHtEntry** link = &ht->buckets[index];
+		if (ht->ordered_chains) {
+			while (*link != NULL && (*link)->key.uint < key.key.uint)
+				link = &(*link)->next;
+		}
+		new_entry->next = *link;
+		*link = new_entry;
+	}
+	ht->count++;
+	return true;
+}
+
+
+/* value_size が 0 のときに raw モードになる。ロック内で使用すること。検査済みのテーブルとキーに対して呼ぶ */
+static bool mht_set_entry (MHashTable* ht, KeyUni key, void* value_data, size_t value_size) {
+	bool result = mht_store_entry(ht, key, value_data, value_size);
+	if (result) change_log_record(ht, MHT_CHANGE_SET, key);
+	return result;
+}
+
+
+static void sketch_record (MHashTable* ht, KeyUni key);
+
+/* value_size が 0 のときに raw モードになる。ロック内で使用すること。 */
+static bool mht_set_generic (MHashTable* ht, KeyUni key, void* value_data, size_t value_size, const char* file, int line) {
+	if (!mht_pre_execution_check(ht, file, line))
+		return false;
+
+	if (value_data == NULL) {
+		fprintf(stderr, "Value pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	if (ht->key_type != key.key_type) {
+		fprintf(stderr, "Key type mismatch in hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	if (ht->key_type == KEY_TYPE_UINT32 && value_size > UINT32_MAX) {
+		fprintf(stderr, "Value size is too large for a uint32 key hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	if (ht->frozen != NULL) {
+		fprintf(stderr, "Frozen hashtables are read-only.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	if (ht->sketch != NULL) sketch_record(ht, key);
+
+	if (ht->numa_replicas != NULL) {
+		/* raw モードの値は全レプリカで共有されてしまい、解放できなくなるため受け付けない */
+		if (value_size == 0) {
+			fprintf(stderr, "Raw values cannot be set in a hashtable with NUMA replicas.\nFile: %s   Line: %d\n", file, line);
+			errno = EINVAL;
+			return false;
+		}
+		return mht_numa_set_entry(ht, key, value_data, value_size);
+	}
+
+	return mht_set_entry(ht, key, value_data, value_size);
+}
+
+
+static bool mht_uint_set_raw_without_lock (MHashTable* ht, uint_keyt key, void* value_data, const char* file, int line) {
+	KeyUni key_uni = {
+		.key.uint = key,
+		.key_type = KEY_TYPE_UINT
+	};
+
+	/* value_data に 0 を渡して raw モードに */
+	bool result = mht_set_generic(ht, key_uni, value_data, 0, file, line);
+	if (!result) mht_errfunc = "_mht_uint_set_raw";
+	return result;
+}
+
+
+bool _mht_uint_set_raw (MHashTable* ht, uint_keyt key, void* value_data, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.uint = key,
+			.key_type = KEY_TYPE_UINT
+		};
+		return mht_write_combined(WRITE_OP_SET_RAW, ht, key_uni, value_data, 0, file, line);
+	}
+
+	mht_lock();
+	bool result = mht_uint_set_raw_without_lock(ht, key, value_data, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+static bool mht_uint_set_without_lock (MHashTable* ht, uint_keyt key, void* value_data, size_t value_size, const char* file, int line) {
+	/* mht_set_generic の value_data に 0 を渡すと raw モードになってしまうので、先に排除しておく */
+	if (value_size == 0) {
+		fprintf(stderr, "Value size is zero.\nFile: %s   Line: %d\n", file, line);
+		return false;
+	}
+
+	KeyUni key_uni = {
+		.key.uint = key,
+		.key_type = KEY_TYPE_UINT
+	};
+
+	bool result = mht_set_generic(ht, key_uni, value_data, value_size, file, line);
+	if (!result) mht_errfunc = "_mht_uint_set";
+	return result;
+}
+
+
+bool _mht_uint_set (MHashTable* ht, uint_keyt key, void* value_data, size_t value_size, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.uint = key,
+			.key_type = KEY_TYPE_UINT
+		};
+		return mht_write_combined(WRITE_OP_SET, ht, key_uni, value_data, value_size, file, line);
+	}
+
+	mht_lock();
+	bool result = mht_uint_set_without_lock(ht, key, value_data, value_size, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+/* 結合役を待つことになるので、フラットコンバイニングは使わずに直接書き込む */
+bool _mht_uint_try_set (MHashTable* ht, uint_keyt key, void* value_data, size_t value_size, const char* file, int line) {
+	if (!mht_try_lock()) {
+		mht_errfunc = "_mht_uint_try_set";
+		return false;
+	}
+	bool result = mht_uint_set_without_lock(ht, key, value_data, value_size, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+static bool mht_str_set_raw_without_lock (MHashTable* ht, str_keyt key, void* value_data, const char* file, int line) {
+	if (!mht_str_key_is_valid(key)) {
+		fprintf(stderr, "Invalid string key.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_str_set_raw";
+		return false;
+	}
+
+	KeyUni key_uni = {
+		.key.str = key,
+		.key_type = KEY_TYPE_STR
+	};
+
+	/* value_data に 0 を渡して raw モードに */
+	bool result = mht_set_generic(ht, key_uni, value_data, 0, file, line);
+	if (!result) mht_errfunc = "_mht_str_set_raw";
+	return result;
+}
+
+
+bool _mht_str_set_raw (MHashTable* ht, str_keyt key, void* value_data, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.str = key,
+			.key_type = KEY_TYPE_STR
+		};
+		return mht_write_combined(WRITE_OP_SET_RAW, ht, key_uni, value_data, 0, file, line);
+	}
+
+	mht_lock();
+	bool result = mht_str_set_raw_without_lock(ht, key, value_data, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+static bool mht_str_set_without_lock (MHashTable* ht, str_keyt key, void* value_data, size_t value_size, const char* file, int line) {
+	/* mht_set_generic の value_data に 0 を渡すと raw モードになってしまうので、先に排除しておく */
+	if (value_size == 0) {
+		fprintf(stderr, "Value size is zero.\nFile: %s   Line: %d\n", file, line);
+		return false;
+	}
+
+	if (!mht_str_key_is_valid(key)) {
+		fprintf(stderr, "Invalid string key.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_str_set";
+		return false;
+	}
+
+	KeyUni key_uni = {
+		.key.str = key,
+		.key_type = KEY_TYPE_STR
+	};
+
+	bool result = mht_set_generic(ht, key_uni, value_data, value_size, file, line);
+	if (!result) mht_errfunc = "_mht_str_set";
+	return result;
+}
+
+
+bool _mht_str_set (MHashTable* ht, str_keyt key, void* value_data, size_t value_size, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.str = key,
+			.key_type = KEY_TYPE_STR
+		};
+		return mht_write_combined(WRITE_OP_SET, ht, key_uni, value_data, value_size, file, line);
+	}
+
+	mht_lock();
+	bool result = mht_str_set_without_lock(ht, key, value_data, value_size, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+bool _mht_str_try_set (MHashTable* ht, str_keyt key, void* value_data, size_t value_size, const char* file, int line) {
+	if (!mht_try_lock()) {
+		mht_errfunc = "_mht_str_try_set";
+		return false;
+	}
+	bool result = mht_str_set_without_lock(ht, key, value_data, value_size, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+static bool mht_uint32_set_raw_without_lock (MHashTable* ht, uint32_t key, void* value_data, const char* file, int line) {
+	KeyUni key_uni = {
+		.key.uint32 = key,
+		.key_type = KEY_TYPE_UINT32
+	};
+
+	/* value_data に 0 を渡して raw モードに */
+	bool result = mht_set_generic(ht, key_uni, value_data, 0, file, line);
+	if (!result) mht_errfunc = "_mht_uint32_set_raw";
+	return result;
+}
+
+
+bool _mht_uint32_set_raw (MHashTable* ht, uint32_t key, void* value_data, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.uint32 = key,
+			.key_type = KEY_TYPE_UINT32
+		};
+		return mht_write_combined(WRITE_OP_SET_RAW, ht, key_uni, value_data, 0, file, line);
+	}
+
+	mht_lock();
+	bool result = mht_uint32_set_raw_without_lock(ht, key, value_data, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+static bool mht_uint32_set_without_lock (MHashTable* ht, uint32_t key, void* value_data, size_t value_size, const char* file, int line) {
+	/* mht_set_generic の value_data に 0 を渡すと raw モードになってしまうので、先に排除しておく */
+	if (value_size == 0) {
+		fprintf(stderr, "Value size is zero.\nFile: %s   Line: %d\n", file, line);
+		return false;
+	}
+
+	KeyUni key_uni = {
+		.key.uint32 = key,
+		.key_type = KEY_TYPE_UINT32
+	};
+
+	bool result = mht_set_generic(ht, key_uni, value_data, value_size, file, line);
+	if (!result) mht_errfunc = "_mht_uint32_set";
+	return result;
+}
+
+
+bool _mht_uint32_set (MHashTable* ht, uint32_t key, void* value_data, size_t value_size, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.uint32 = key,
+			.key_type = KEY_TYPE_UINT32
+		};
+		return mht_write_combined(WRITE_OP_SET, ht, key_uni, value_data, value_size, file, line);
+	}
+
+	mht_lock();
+	bool result = mht_uint32_set_without_lock(ht, key, value_data, value_size, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+bool _mht_uint32_try_set (MHashTable* ht, uint32_t key, void* value_data, size_t value_size, const char* file, int line) {
+	if (!mht_try_lock()) {
+		mht_errfunc = "_mht_uint32_try_set";
+		return false;
+	}
+	bool result = mht_uint32_set_without_lock(ht, key, value_data, value_size, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+static bool mht_tuple_set_raw_without_lock (MHashTable* ht, const uint_keyt* key, void* value_data, const char* file, int line) {
+	if (key == NULL) {
+		fprintf(stderr, "Tuple key pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_tuple_set_raw";
+		return false;
+	}
+
+	KeyUni key_uni = {
+		.key.tuple = key,
+		.key_type = KEY_TYPE_TUPLE
+	};
+
+	/* value_data に 0 を渡して raw モードに */
+	bool result = mht_set_generic(ht, key_uni, value_data, 0, file, line);
+	if (!result) mht_errfunc = "_mht_tuple_set_raw";
+	return result;
+}
+
+
+bool _mht_tuple_set_raw (MHashTable* ht, const uint_keyt* key, void* value_data, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.tuple = key,
+			.key_type = KEY_TYPE_TUPLE
+		};
+		return mht_write_combined(WRITE_OP_SET_RAW, ht, key_uni, value_data, 0, file, line);
+	}
+
+	mht_lock();
+	bool result = mht_tuple_set_raw_without_lock(ht, key, value_data, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+static bool mht_tuple_set_without_lock (MHashTable* ht, const uint_keyt* key, void* value_data, size_t value_size, const char* file, int line) {
+	/* mht_set_generic の value_data に 0 を渡すと raw モードになってしまうので、先に排除しておく */
+	if (value_size == 0) {
+		fprintf(stderr, "Value size is zero.\nFile: %s   Line: %d\n", file, line);
+		return false;
+	}
+
+	if (key == NULL) {
+		fprintf(stderr, "Tuple key pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_tuple_set";
+		return false;
+	}
+
+	KeyUni key_uni = {
+		.key.tuple = key,
+		.key_type = KEY_TYPE_TUPLE
+	};
+
+	bool result = mht_set_generic(ht, key_uni, value_data, value_size, file, line);
+	if (!result) mht_errfunc = "_mht_tuple_set";
+	return result;
+}
+
+
+bool _mht_tuple_set (MHashTable* ht, const uint_keyt* key, void* value_data, size_t value_size, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.tuple = key,
+			.key_type = KEY_TYPE_TUPLE
+		};
+		return mht_write_combined(WRITE_OP_SET, ht, key_uni, value_data, value_size, file, line);
+	}
+
+	mht_lock();
+	bool result = mht_tuple_set_without_lock(ht, key, value_data, value_size, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+bool _mht_tuple_try_set (MHashTable* ht, const uint_keyt* key, void* value_data, size_t value_size, const char* file, int line) {
+	if (!mht_try_lock()) {
+		mht_errfunc = "_mht_tuple_try_set";
+		return false;
+	}
+	bool result = mht_tuple_set_without_lock(ht, key, value_data, value_size, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+/*
+ * 読み出しキャッシュ
+ * スレッドごとの直接マップ方式のキャッシュで、(テーブル, キー) から値のポインタを引く。
+ * 各スロットは格納時のテーブルのバージョンのセルとその値を持ち、値が変わっていれば
+ * 使わないので、set や delete の結果はすぐに見えるようになる。
+ * キーとキーの型もスロットにコピーして持ち、セルは解放されないので、ヒットの判定でテーブルのメモリには触れない。
+ */
+
+#ifdef ATOMICS_SUPPORTED
+
+typedef struct {
+	MHashTable* ht;
+	TableVersion* cell;
+	uint_fast64_t version;
+	KeyType key_type;
+	size_t key_len;  /* 文字列キーのバイト数、タプルキーの語数 */
+	union {
+		uint_keyt uint;
+		uint32_t uint32;
+		char str[READ_CACHE_KEY_BYTES];
+		uint_keyt tuple[READ_CACHE_KEY_BYTES / sizeof(uint_keyt)];
+	} key;
+	void* value;
+} ReadCacheSlot;
+
+
+static THREAD_LOCAL ReadCacheSlot read_cache_slots[READ_CACHE_SLOTS];
+
+
+/* キャッシュできないキーなら false を返す */
+static bool read_cache_key_fits (KeyUni key, size_t key_words) {
+	if (key.key_type == KEY_TYPE_STR)
+		return mht_str_key_is_valid(key.key.str) && key.key.str.len <= READ_CACHE_KEY_BYTES;
+	if (key.key_type == KEY_TYPE_TUPLE)
+		return key.key.tuple != NULL && key_words * sizeof(uint_keyt) <= READ_CACHE_KEY_BYTES;
+	return true;
+}
+
+
+/* タプルの語数はテーブルを読まないと分からないので、タプルキーは先頭の語だけでスロットを選ぶ */
+static ReadCacheSlot* read_cache_slot (MHashTable* ht, KeyUni key) {
+	size_t index;
+	if (key.key_type == KEY_TYPE_UINT)
+		index = hash_uint_key(key.key.uint, READ_CACHE_SLOTS);
+	else if (key.key_type == KEY_TYPE_UINT32)
+		index = hash_uint32_key(key.key.uint32, READ_CACHE_SLOTS);
+	else if (key.key_type == KEY_TYPE_STR)
+		index = hash_str_key(key.key.str, READ_CACHE_SLOTS);
+	else  /* if (key.key_type == KEY_TYPE_TUPLE) */
+		index = hash_uint_key(key.key.tuple[0], READ_CACHE_SLOTS);
+	return &read_cache_slots[index ^ hash_uint_key((uint_keyt)ht, READ_CACHE_SLOTS)];
+}
+
+
+/* タプルキーはスロットの語数で比べる。バージョンが一致していれば、それはテーブルの語数と等しい */
+static bool read_cache_key_equal (const ReadCacheSlot* slot, KeyUni key) {
+	if (slot->key_type != key.key_type) return false;
+	if (key.key_type == KEY_TYPE_UINT)
+		return slot->key.uint == key.key.uint;
+	if (key.key_type == KEY_TYPE_UINT32)
+		return slot->key.uint32 == key.key.uint32;
+	if (key.key_type == KEY_TYPE_STR)
+		return slot->key_len == key.key.str.len && memcmp(slot->key.str, key.key.str.ptr, key.key.str.len) == 0;
+	return memcmp(slot->key.tuple, key.key.tuple, slot->key_len * sizeof(uint_keyt)) == 0;
+}
+
+
+/*
+ * ロックを取らずに呼ぶ。ht は破棄の途中かもしれないので読まず、スロットが指すセルとスロット自身だけを読む。
+ * セルの値がスロットのものと等しければ、格納後に ht は変更も破棄もされておらず、値のポインタはまだ有効である。
+ */
+static void* read_cache_lookup (MHashTable* ht, KeyUni key) {
+	if (ht == NULL) return NULL;
+	if (key.key_type == KEY_TYPE_STR && !read_cache_key_fits(key, 0)) return NULL;
+	if (key.key_type == KEY_TYPE_TUPLE && key.key.tuple == NULL) return NULL;
+
+	ReadCacheSlot* slot = read_cache_slot(ht, key);
+	if (slot->ht != ht || slot->cell == NULL) return NULL;
+	if (slot->version != atomic_load_explicit(&slot->cell->value, memory_order_acquire)) return NULL;
+	if (!read_cache_key_equal(slot, key)) return NULL;
+	return slot->value;
+}
+
+
+/* ロック内で、取得に成功した直後に呼ぶ */
+static void read_cache_store (MHashTable* ht, KeyUni key, void* value) {
+	/* アクセス頻度を追跡している間は、全ての読み出しを数えるためにキャッシュしない */
+	if (!ht->read_cache || ht->sketch != NULL || !read_cache_key_fits(key, ht->key_words)) return;
+
+	ReadCacheSlot* slot = read_cache_slot(ht, key);
+	slot->ht = ht;
+	slot->cell = ht->version;  /* read_cache を有効にしたときに必ず割り当てている */
+	slot->version = atomic_load_explicit(&ht->version->value, memory_order_relaxed);
+	slot->key_type = key.key_type;
+	if (key.key_type == KEY_TYPE_UINT) {
+		slot->key.uint = key.key.uint;
+	} else if (key.key_type == KEY_TYPE_UINT32) {
+		slot->key.uint32 = key.key.uint32;
+	} else if (key.key_type == KEY_TYPE_STR) {
+		memcpy(slot->key.str, key.key.str.ptr, key.key.str.len);
+		slot->key_len = key.key.str.len;
+	} else {  /* if (key.key_type == KEY_TYPE_TUPLE) */
+		memcpy(slot->key.tuple, key.key.tuple, ht->key_words * sizeof(uint_keyt));
+		slot->key_len = ht->key_words;
+	}
+	slot->value = value;
+}
+
+#else
+
+static void* read_cache_lookup (MHashTable* ht, KeyUni key) {
+	(void)ht;
+	(void)key;
+	return NULL;
+}
+
+
+static void read_cache_store (MHashTable* ht, KeyUni key, void* value) {
+	(void)ht;
+	(void)key;
+	(void)value;
+}
+
+#endif
+
+
+bool _mht_set_read_cache (MHashTable* ht, bool enable, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_set_read_cache";
+		mht_unlock();
+		return false;
+	}
+
+	if (enable && ht->split != NULL) {
+		fprintf(stderr, "This option is not supported by split-ordered hashtables.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_read_cache";
+		mht_unlock();
+		return false;
+	}
+
+#ifdef ATOMICS_SUPPORTED
+	if (enable && UNLIKELY(!table_version_attach(ht))) {
+		fprintf(stderr, "Failed to allocate memory for read cache.\nFile: %s   Line: %d\n", file, line);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_set_read_cache";
+		mht_unlock();
+		return false;
+	}
+	ht->read_cache = enable;
+	table_version_bump(ht);  /* 無効化する前に格納されたスロットを使わせない */
+	mht_unlock();
+	return true;
+#else
+	if (enable) {
+		fprintf(stderr, "Read cache requires C11 atomics and thread-local storage.\nFile: %s   Line: %d\n", file, line);
+		errno = ENOSYS;
+		mht_errfunc = "_mht_set_read_cache";
+		mht_unlock();
+		return false;
+	}
+	mht_unlock();
+	return true;
+#endif
+}
+
+
+/*
+ * アクセス頻度の追跡
+ * Space-Saving アルゴリズムで、アクセスの多いキー上位 capacity 個とその近似回数を保持する。
+ * 追跡していないキーにアクセスがあり、カウンタが埋まっている場合は、最小のカウンタを
+ * そのキーに譲り、元の回数を誤差として引き継ぐ。カウンタはキーのハッシュで引き、
+ * 最小のカウンタは回数の最小ヒープの先頭から取るので、1 回のアクセスは O(log capacity) で済む。
+ */
+
+typedef struct {
+	KeyUni key;  /* 文字列とタプルは確保したコピー */
+	uint64_t count;
+	uint64_t error;  /* count がこれだけ多く見積もられている可能性がある */
+	size_t next;  /* 同じバケットの次のカウンタの番号 + 1、0 で終端 */
+	size_t heap_pos;  /* heap の中での位置 */
+} SketchCounter;
+
+
+struct AccessSketch {
+	size_t capacity;
+	size_t used;
+	size_t bucket_count;  /* 2 の累乗 */
+	size_t* buckets;  /* カウンタの番号 + 1、0 で空 */
+	size_t* heap;  /* カウンタの番号を count の最小ヒープに並べたもの、長さは used */
+	SketchCounter counters[];
+};
+
+
+/* dst に src のキーを確保してコピーする。文字列とタプルの場合は out_mem に確保したメモリが入る */
+static bool key_uni_copy (const MHashTable* ht, KeyUni src, KeyUni* dst, void** out_mem) {
+	*dst = src;
+	*out_mem = NULL;
+	if (src.key_type == KEY_TYPE_STR) {
+		char* copy = mutils_strndup(src.key.str.ptr, src.key.str.len);
+		if (UNLIKELY(copy == NULL)) return false;
+		dst->key.str.ptr = copy;
+		*out_mem = copy;
+	} else if (src.key_type == KEY_TYPE_TUPLE) {
+		uint_keyt* copy = malloc(ht->key_words * sizeof(uint_keyt));
+		if (UNLIKELY(copy == NULL)) return false;
+		memcpy(copy, src.key.tuple, ht->key_words * sizeof(uint_keyt));
+		dst->key.tuple = copy;
+		*out_mem = copy;
+	}
+	return true;
+}
+
+
+static void sketch_free (AccessSketch* sketch) {
+	if (sketch == NULL) return;
+	for (size_t i = 0; i < sketch->used; i++) {
+		if (sketch->counters[i].key.key_type == KEY_TYPE_STR)
+			free(sketch->counters[i].key.key.str.ptr);
+		else if (sketch->counters[i].key.key_type == KEY_TYPE_TUPLE)
+			free((void*)(uintptr_t)sketch->counters[i].key.key.tuple);  /* key_uni_copy で確保したもの */
+	}
+	free(sketch->buckets);
+	free(sketch->heap);
+	free(sketch);
+}
+
+
+static void sketch_heap_place (AccessSketch* sketch, size_t pos, size_t index) {
+	sketch->heap[pos] = index;
+	sketch->counters[index].heap_pos = pos;
+}
+
+
+static void sketch_heap_up (AccessSketch* sketch, size_t pos) {
+	size_t index = sketch->heap[pos];
+	uint64_t count = sketch->counters[index].count;
+	while (pos > 0) {
+		size_t parent = (pos - 1) / 2;
+		if (sketch->counters[sketch->heap[parent]].count <= count) break;
+		sketch_heap_place(sketch, pos, sketch->heap[parent]);
+		pos = parent;
+	}
+	sketch_heap_place(sketch, pos, index);
+}
+
+
+/* 回数が増えたカウンタを下へ移す */
+static void sketch_heap_down (AccessSketch* sketch, size_t pos) {
+	size_t index = sketch->heap[pos];
+	uint64_t count = sketch->counters[index].count;
+	for (;;) {
+		size_t child = pos * 2 + 1;
+		if (child >= sketch->used) break;
+		if (child + 1 < sketch->used && sketch->counters[sketch->heap[child + 1]].count < sketch->counters[sketch->heap[child]].count)
+			child++;
+		if (count <= sketch->counters[sketch->heap[child]].count) break;
+		sketch_heap_place(sketch, pos, sketch->heap[child]);
+		pos = child;
+	}
+	sketch_heap_place(sketch, pos, index);
+}
+
+
+static void sketch_unlink (AccessSketch* sketch, size_t bucket, size_t index) {
+	size_t* link = &sketch->buckets[bucket];
+	while (*link != 0) {
+		if (*link == index + 1) {
+			*link = sketch->counters[index].next;
+			return;
+		}
+		link = &sketch->counters[*link - 1].next;
+	}
+}
+
+
+/* ロック内で、検査済みのキーに対して呼ぶ */
+static void sketch_record (MHashTable* ht, KeyUni key) {
+	AccessSketch* sketch = ht->sketch;
+	size_t bucket = hash_key_uni(ht, key, sketch->bucket_count);
+
+	for (size_t i = sketch->buckets[bucket]; i != 0; i = sketch->counters[i - 1].next) {
+		SketchCounter* counter = &sketch->counters[i - 1];
+		if (key_uni_equal(ht, counter->key, key)) {
+			counter->count++;
+			sketch_heap_down(sketch, counter->heap_pos);
+			return;
+		}
+	}
+
+	KeyUni copy;
+	void* copy_mem;
+	if (UNLIKELY(!key_uni_copy(ht, key, &copy, &copy_mem))) return;  /* 追跡は近似なので、確保に失敗したアクセスは数えない */
+
+	size_t index;
+	uint64_t base = 0;
+	bool fresh = (sketch->used < sketch->capacity);
+	if (fresh) {
+		index = sketch->used++;
+	} else {
+		index = sketch->heap[0];
+		SketchCounter* victim = &sketch->counters[index];
+		sketch_unlink(sketch, hash_key_uni(ht, victim->key, sketch->bucket_count), index);
+		if (victim->key.key_type == KEY_TYPE_STR)
+			free(victim->key.key.str.ptr);
+		else if (victim->key.key_type == KEY_TYPE_TUPLE)
+			free((void*)(uintptr_t)victim->key.key.tuple);  /* key_uni_copy で確保したもの */
+		base = victim->count;
+	}
+
+	SketchCounter* counter = &sketch->counters[index];
+	counter->key = copy;
+	counter->count = base + 1;
+	counter->error = base;
+	counter->next = sketch->buckets[bucket];
+	sketch->buckets[bucket] = index + 1;
+
+	if (fresh) {
+		sketch_heap_place(sketch, index, index);
+		sketch_heap_up(sketch, index);
+	} else {
+		sketch_heap_down(sketch, 0);
+	}
+}
+
+
+bool _mht_set_access_tracking (MHashTable* ht, size_t capacity, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_set_access_tracking";
+		mht_unlock();
+		return false;
+	}
+
+	if (capacity != 0 && ht->split != NULL) {
+		fprintf(stderr, "This option is not supported by split-ordered hashtables.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_access_tracking";
+		mht_unlock();
+		return false;
+	}
+
+	if (capacity > SKETCH_MAX_CAPACITY) {
+		fprintf(stderr, "Access tracking capacity is too large.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_set_access_tracking";
+		mht_unlock();
+		return false;
+	}
+
+	/* 設定し直す場合は、それまでの集計を捨てる */
+	sketch_free(ht->sketch);
+	ht->sketch = NULL;
+
+	/* 有効にする前に読み出しキャッシュに入った値で、追跡すべき読み出しが素通りしないようにする */
+	table_version_bump(ht);
+
+	if (capacity == 0) {
+		mht_unlock();
+		return true;
+	}
+
+	AccessSketch* sketch = calloc(1, sizeof(AccessSketch) + capacity * sizeof(SketchCounter));
+	if (UNLIKELY(sketch == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for access tracking.\nFile: %s   Line: %d\n", file, line);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_set_access_tracking";
+		mht_unlock();
+		return false;
+	}
+
+	sketch->capacity = capacity;
+	sketch->bucket_count = mutils_next_power_of_two(capacity * 2);
+	sketch->buckets = calloc(sketch->bucket_count, sizeof(size_t));
+	sketch->heap = malloc(capacity * sizeof(size_t));
+	if (UNLIKELY(sketch->buckets == NULL || sketch->heap == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for access tracking.\nFile: %s   Line: %d\n", file, line);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_set_access_tracking";
+		sketch_free(sketch);
+		mht_unlock();
+		return false;
+	}
+
+	ht->sketch = sketch;
+	mht_unlock();
+	return true;
+}
+
+
+static int sketch_counter_compare (const void* a, const void* b) {
+	const SketchCounter* ca = *(const SketchCounter* const*)a;
+	const SketchCounter* cb = *(const SketchCounter* const*)b;
+	if (ca->count != cb->count) return (ca->count < cb->count) ? 1 : -1;
+	return 0;
+}
+
+
+void mht_top_keys_release (MHtKeyCount* keys, size_t count) {
+	if (keys == NULL) return;
+	for (size_t i = 0; i < count; i++) {
+		free(keys[i].key_mem);
+		keys[i].key_mem = NULL;
+	}
+}
+
+
+size_t _mht_top_keys (MHashTable* ht, size_t k, MHtKeyCount* out, const char* file, int line) {
+	mht_lock();
+
+	if (!mht_pre_execution_check(ht, file, line)) {
+		mht_errfunc = "_mht_top_keys";
+		mht_unlock();
+		return 0;
+	}
+
+	if (out == NULL) {
+		fprintf(stderr, "Output array pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_top_keys";
+		mht_unlock();
+		return 0;
+	}
+
+	if (ht->sketch == NULL) {
+		fprintf(stderr, "Access tracking is not enabled for this hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_top_keys";
+		mht_unlock();
+		return 0;
+	}
+
+	AccessSketch* sketch = ht->sketch;
+	if (sketch->used == 0 || k == 0) {
+		mht_unlock();
+		return 0;
+	}
+
+	const SketchCounter** order = malloc(sketch->used * sizeof(SketchCounter*));
+	if (UNLIKELY(order == NULL)) {
+		errno = ENOMEM;
+		mht_errfunc = "_mht_top_keys";
+		mht_unlock();
+		return 0;
+	}
+	for (size_t i = 0; i < sketch->used; i++) order[i] = &sketch->counters[i];
+	qsort(order, sketch->used, sizeof(SketchCounter*), sketch_counter_compare);
+
+	size_t n = (k < sketch->used) ? k : sketch->used;
+	for (size_t i = 0; i < n; i++) {
+		KeyUni copy;
+		void* copy_mem;
+		if (UNLIKELY(!key_uni_copy(ht, order[i]->key, &copy, &copy_mem))) {
+			mht_top_keys_release(out, i);
+			free(order);
+			errno = ENOMEM;
+			mht_errfunc = "_mht_top_keys";
+			mht_unlock();
+			return 0;
+		}
+
+		memset(&out[i], 0, sizeof(MHtKeyCount));
+		if (copy.key_type == KEY_TYPE_UINT)
+			out[i].key.uint = copy.key.uint;
+		else if (copy.key_type == KEY_TYPE_UINT32)
+			out[i].key.uint32 = copy.key.uint32;
+		else if (copy.key_type == KEY_TYPE_STR)
+			out[i].key.str = copy.key.str;
+		else  /* if (copy.key_type == KEY_TYPE_TUPLE) */
+			out[i].key.tuple = copy.key.tuple;
+		out[i].key_mem = copy_mem;
+		out[i].count = order[i]->count;
+		out[i].error = order[i]->error;
+	}
+
+	free(order);
+	mht_unlock();
+	return n;
+}
+
+
+/* 検査済みのテーブルとキーに対して呼ぶ。見つからなければ NULL を返す */
+static MHtEntry* mht_find_entry (MHashTable* ht, KeyUni key) {
+	if (ht->cuckoo != NULL) return cuckoo_find(ht, key, NULL, NULL);
+	if (ht->compact != NULL) return compact_find(ht, key);
+
+	MHtEntry* entry;
+	if (ht->buckets == NULL)  /* スモールモード */
+		entry = mht_small_find(ht, key, NULL);
+	else
+		entry = ht->buckets[hash_key_uni(ht, key, ht->size)];
+
+	while (entry != NULL) {  /* bucketsが確保時に初期化されていることが前提 */
+		if (entry_key_equal(ht, entry, key))
+			return entry;
+		if (ht->ordered_chains && entry->key.uint > key.key.uint) return NULL;  /* 昇順なのでこの先には無い */
 		entry = entry->next;
 	}
+	return NULL;
+}
 
-	/* 新規追加 */
-	MHtEntry* new_entry = calloc(1, sizeof(MHtEntry));
-	if (UNLIKELY(new_entry == NULL)) return false;
 
-	if (ht->key_type == KEY_TYPE_UINT) {
-		new_entry->key.uint = key.key.uint;
-	} else {  /* if (ht->key_type == KEY_TYPE_STR) */
-		char* key_str = mutils_strndup(key.key.str.ptr, key.key.str.len);
-		if (UNLIKELY(key_str == NULL)) {
-			free(new_entry);
-			errno = ENOMEM;
-			return false;
-		}
+static void* mht_get_without_lock_generic (MHashTable* ht, KeyUni key, const char* file, int line) {
+	if (!mht_pre_execution_check(ht, file, line)) return NULL;
 
-		new_entry->key.str.ptr = key_str;
-		new_entry->key.str.len = key.key.str.len;
+	if (ht->key_type != key.key_type) {
+		fprintf(stderr, "Key type mismatch in hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return NULL;
 	}
 
-	if (value_size != 0) {
-		new_entry->value = calloc(1, value_size);
-		if (UNLIKELY(new_entry->value == NULL)) {
-			if (ht->key_type == KEY_TYPE_STR) free(new_entry->key.str.ptr);
-			free(new_entry);
-			errno = ENOMEM;
-			return false;
-		}
-		memcpy(new_entry->value, value_data, value_size);
+	if (ht->sketch != NULL) sketch_record(ht, key);
+
+	if (ht->split != NULL) {
+		void* value = split_get(ht->split, key.key.uint);
+		if (value != NULL) return value;
+	} else if (ht->frozen != NULL) {
+		void* value = frozen_get(ht->frozen, key.key.str);
+		if (value != NULL) return value;
 	} else {
-		new_entry->value = value_data;
+		MHtEntry* entry = mht_find_entry(numa_local_replica(ht), key);
+		if (entry != NULL && entry_value_compressed(ht, entry)) {
+			fprintf(stderr, "Compressed values can only be read with a copy-out get function.\nFile: %s   Line: %d\n", file, line);
+			errno = EINVAL;
+			return NULL;
+		}
+		if (entry != NULL)
+			return entry->value;
 	}
-	new_entry->value_size = value_size;
 
-	new_entry->next = ht->buckets[index];
-	ht->buckets[index] = new_entry;
-	ht->count++;
-	return true;
+	fprintf(stderr, "Key not found in hashtable.\nFile: %s   Line: %d\n", file, line);
+	errno = EINVAL;
+	return NULL;
 }
 
 
-static bool mht_uint_set_raw_without_lock (MHashTable* ht, uint_keyt key, void* value_data, const char* file, int line) {
+static void* mht_uint_get_without_lock (MHashTable* ht, uint_keyt key, const char* file, int line) {
 	KeyUni key_uni = {
 		.key.uint = key,
 		.key_type = KEY_TYPE_UINT
 	};
 
-	/* value_data に 0 を渡して raw モードに */
-	bool result = mht_set_generic(ht, key_uni, value_data, 0, file, line);
-	if (!result) mht_errfunc = "_mht_uint_set_raw";
+	void* result = mht_get_without_lock_generic(ht, key_uni, file, line);
+	if (result == NULL) mht_errfunc = "_mht_uint_get";
+
 	return result;
 }
 
 
-bool _mht_uint_set_raw (MHashTable* ht, uint_keyt key, void* value_data, const char* file, int line) {
+void* _mht_uint_get (MHashTable* ht, uint_keyt key, const char* file, int line) {
+	KeyUni key_uni = {
+		.key.uint = key,
+		.key_type = KEY_TYPE_UINT
+	};
+
+	void* result = read_cache_lookup(ht, key_uni);
+	if (result != NULL) return result;
+
 	mht_lock();
-	bool result = mht_uint_set_raw_without_lock(ht, key, value_data, file, line);
+	result = mht_uint_get_without_lock(ht, key, file, line);
+	if (result != NULL) read_cache_store(ht, key_uni, result);
 	mht_unlock();
 	return result;
 }
 
 
-static bool mht_uint_set_without_lock (MHashTable* ht, uint_keyt key, void* value_data, size_t value_size, const char* file, int line) {
-	/* mht_set_generic の value_data に 0 を渡すと raw モードになってしまうので、先に排除しておく */
-	if (value_size == 0) {
-		fprintf(stderr, "Value size is zero.\nFile: %s   Line: %d\n", file, line);
+bool _mht_uint_try_get (MHashTable* ht, uint_keyt key, void** out_value, const char* file, int line) {
+	if (out_value == NULL) {
+		fprintf(stderr, "Output value pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_uint_try_get";
 		return false;
 	}
 
@@ -637,25 +6175,67 @@ static bool mht_uint_set_without_lock (MHashTable* ht, uint_keyt key, void* valu
 		.key_type = KEY_TYPE_UINT
 	};
 
-	bool result = mht_set_generic(ht, key_uni, value_data, value_size, file, line);
-	if (!result) mht_errfunc = "_mht_uint_set";
+	void* result = read_cache_lookup(ht, key_uni);
+	if (result != NULL) {
+		*out_value = result;
+		return true;
+	}
+
+	if (!mht_try_lock()) {
+		mht_errfunc = "_mht_uint_try_get";
+		return false;
+	}
+	result = mht_uint_get_without_lock(ht, key, file, line);
+	if (result != NULL) read_cache_store(ht, key_uni, result);
+	mht_unlock();
+
+	*out_value = result;
+	return true;
+}
+
+
+static void* mht_str_get_without_lock (MHashTable* ht, str_keyt key, const char* file, int line) {
+	if (!mht_str_key_is_valid(key)) {
+		fprintf(stderr, "Invalid string key.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_str_get";
+		return false;
+	}
+
+	KeyUni key_uni = {
+		.key.str = key,
+		.key_type = KEY_TYPE_STR
+	};
+
+	void* result = mht_get_without_lock_generic(ht, key_uni, file, line);
+	if (result == NULL) mht_errfunc = "_mht_str_get";
+
 	return result;
 }
 
 
-bool _mht_uint_set (MHashTable* ht, uint_keyt key, void* value_data, size_t value_size, const char* file, int line) {
+void* _mht_str_get (MHashTable* ht, str_keyt key, const char* file, int line) {
+	KeyUni key_uni = {
+		.key.str = key,
+		.key_type = KEY_TYPE_STR
+	};
+
+	void* result = read_cache_lookup(ht, key_uni);
+	if (result != NULL) return result;
+
 	mht_lock();
-	bool result = mht_uint_set_without_lock(ht, key, value_data, value_size, file, line);
+	result = mht_str_get_without_lock(ht, key, file, line);
+	if (result != NULL) read_cache_store(ht, key_uni, result);
 	mht_unlock();
 	return result;
 }
 
 
-static bool mht_str_set_raw_without_lock (MHashTable* ht, str_keyt key, void* value_data, const char* file, int line) {
-	if (!mht_str_key_is_valid(key)) {
-		fprintf(stderr, "Invalid string key.\nFile: %s   Line: %d\n", file, line);
+bool _mht_str_try_get (MHashTable* ht, str_keyt key, void** out_value, const char* file, int line) {
+	if (out_value == NULL) {
+		fprintf(stderr, "Output value pointer is NULL.\nFile: %s   Line: %d\n", file, line);
 		errno = EINVAL;
-		mht_errfunc = "_mht_str_set_raw";
+		mht_errfunc = "_mht_str_try_get";
 		return false;
 	}
 
@@ -664,110 +6244,241 @@ static bool mht_str_set_raw_without_lock (MHashTable* ht, str_keyt key, void* va
 		.key_type = KEY_TYPE_STR
 	};
 
-	/* value_data に 0 を渡して raw モードに */
-	bool result = mht_set_generic(ht, key_uni, value_data, 0, file, line);
-	if (!result) mht_errfunc = "_mht_str_set_raw";
+	void* result = read_cache_lookup(ht, key_uni);
+	if (result != NULL) {
+		*out_value = result;
+		return true;
+	}
+
+	if (!mht_try_lock()) {
+		mht_errfunc = "_mht_str_try_get";
+		return false;
+	}
+	result = mht_str_get_without_lock(ht, key, file, line);
+	if (result != NULL) read_cache_store(ht, key_uni, result);
+	mht_unlock();
+
+	*out_value = result;
+	return true;
+}
+
+
+static void* mht_uint32_get_without_lock (MHashTable* ht, uint32_t key, const char* file, int line) {
+	KeyUni key_uni = {
+		.key.uint32 = key,
+		.key_type = KEY_TYPE_UINT32
+	};
+
+	void* result = mht_get_without_lock_generic(ht, key_uni, file, line);
+	if (result == NULL) mht_errfunc = "_mht_uint32_get";
+
 	return result;
 }
 
 
-bool _mht_str_set_raw (MHashTable* ht, str_keyt key, void* value_data, const char* file, int line) {
+void* _mht_uint32_get (MHashTable* ht, uint32_t key, const char* file, int line) {
+	KeyUni key_uni = {
+		.key.uint32 = key,
+		.key_type = KEY_TYPE_UINT32
+	};
+
+	void* result = read_cache_lookup(ht, key_uni);
+	if (result != NULL) return result;
+
 	mht_lock();
-	bool result = mht_str_set_raw_without_lock(ht, key, value_data, file, line);
+	result = mht_uint32_get_without_lock(ht, key, file, line);
+	if (result != NULL) read_cache_store(ht, key_uni, result);
 	mht_unlock();
 	return result;
 }
 
 
-static bool mht_str_set_without_lock (MHashTable* ht, str_keyt key, void* value_data, size_t value_size, const char* file, int line) {
-	/* mht_set_generic の value_data に 0 を渡すと raw モードになってしまうので、先に排除しておく */
-	if (value_size == 0) {
-		fprintf(stderr, "Value size is zero.\nFile: %s   Line: %d\n", file, line);
+bool _mht_uint32_try_get (MHashTable* ht, uint32_t key, void** out_value, const char* file, int line) {
+	if (out_value == NULL) {
+		fprintf(stderr, "Output value pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_uint32_try_get";
 		return false;
 	}
 
-	if (!mht_str_key_is_valid(key)) {
-		fprintf(stderr, "Invalid string key.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		mht_errfunc = "_mht_str_set";
+	KeyUni key_uni = {
+		.key.uint32 = key,
+		.key_type = KEY_TYPE_UINT32
+	};
+
+	void* result = read_cache_lookup(ht, key_uni);
+	if (result != NULL) {
+		*out_value = result;
+		return true;
+	}
+
+	if (!mht_try_lock()) {
+		mht_errfunc = "_mht_uint32_try_get";
 		return false;
 	}
+	result = mht_uint32_get_without_lock(ht, key, file, line);
+	if (result != NULL) read_cache_store(ht, key_uni, result);
+	mht_unlock();
+
+	*out_value = result;
+	return true;
+}
+
+
+static void* mht_tuple_get_without_lock (MHashTable* ht, const uint_keyt* key, const char* file, int line) {
+	if (key == NULL) {
+		fprintf(stderr, "Tuple key pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_tuple_get";
+		return NULL;
+	}
 
 	KeyUni key_uni = {
-		.key.str = key,
-		.key_type = KEY_TYPE_STR
+		.key.tuple = key,
+		.key_type = KEY_TYPE_TUPLE
 	};
 
-	bool result = mht_set_generic(ht, key_uni, value_data, value_size, file, line);
-	if (!result) mht_errfunc = "_mht_str_set";
+	void* result = mht_get_without_lock_generic(ht, key_uni, file, line);
+	if (result == NULL) mht_errfunc = "_mht_tuple_get";
+
 	return result;
 }
 
 
-bool _mht_str_set (MHashTable* ht, str_keyt key, void* value_data, size_t value_size, const char* file, int line) {
+void* _mht_tuple_get (MHashTable* ht, const uint_keyt* key, const char* file, int line) {
+	KeyUni key_uni = {
+		.key.tuple = key,
+		.key_type = KEY_TYPE_TUPLE
+	};
+
+	void* result = read_cache_lookup(ht, key_uni);
+	if (result != NULL) return result;
+
 	mht_lock();
-	bool result = mht_str_set_without_lock(ht, key, value_data, value_size, file, line);
+	result = mht_tuple_get_without_lock(ht, key, file, line);
+	if (result != NULL) read_cache_store(ht, key_uni, result);
 	mht_unlock();
 	return result;
 }
 
 
-static void* mht_get_without_lock_generic (MHashTable* ht, KeyUni key, const char* file, int line) {
-	if (!mht_pre_execution_check(ht, file, line)) return NULL;
+bool _mht_tuple_try_get (MHashTable* ht, const uint_keyt* key, void** out_value, const char* file, int line) {
+	if (out_value == NULL) {
+		fprintf(stderr, "Output value pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_tuple_try_get";
+		return false;
+	}
+
+	KeyUni key_uni = {
+		.key.tuple = key,
+		.key_type = KEY_TYPE_TUPLE
+	};
+
+	void* result = read_cache_lookup(ht, key_uni);
+	if (result != NULL) {
+		*out_value = result;
+		return true;
+	}
+
+	if (!mht_try_lock()) {
+		mht_errfunc = "_mht_tuple_try_get";
+		return false;
+	}
+	result = mht_tuple_get_without_lock(ht, key, file, line);
+	if (result != NULL) read_cache_store(ht, key_uni, result);
+	mht_unlock();
+
+	*out_value = result;
+	return true;
+}
+
+
+/* ロック内で使用すること。値の大きさを out_size に書き、buffer_size に収まれば buffer に展開する */
+static bool mht_get_copy_generic (MHashTable* ht, KeyUni key, void* buffer, size_t buffer_size, size_t* out_size, const char* file, int line) {
+	if (!mht_pre_execution_check(ht, file, line)) return false;
+
+	if (out_size == NULL) {
+		fprintf(stderr, "Output size pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	if (buffer == NULL && buffer_size != 0) {
+		fprintf(stderr, "Buffer pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
 
 	if (ht->key_type != key.key_type) {
 		fprintf(stderr, "Key type mismatch in hashtable.\nFile: %s   Line: %d\n", file, line);
 		errno = EINVAL;
-		return NULL;
+		return false;
 	}
 
-	size_t index;
-	if (ht->key_type == KEY_TYPE_UINT)
-		index = hash_uint_key(key.key.uint, ht->size);
-	else  /* if (ht->key_type == KEY_TYPE_STR) */
-		index = hash_str_key(key.key.str, ht->size);
+	/* 分割順序リストと凍結したテーブルは値の大きさを持たない */
+	if (ht->split != NULL || ht->frozen != NULL) {
+		fprintf(stderr, "Values of this hashtable cannot be copied out.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
 
-	MHtEntry* entry = ht->buckets[index];
+	if (ht->sketch != NULL) sketch_record(ht, key);
 
-	while (entry != NULL) {  /* bucketsが確保時に初期化されていることが前提 */
-		if ((ht->key_type == KEY_TYPE_UINT && entry->key.uint == key.key.uint) ||
-			(ht->key_type == KEY_TYPE_STR && str_key_equal(entry->key.str, key.key.str)))
-			return entry->value;
-		entry = entry->next;
+	MHtEntry* entry = mht_find_entry(numa_local_replica(ht), key);
+	if (entry == NULL) {
+		fprintf(stderr, "Key not found in hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
 	}
 
-	fprintf(stderr, "Key not found in hashtable.\nFile: %s   Line: %d\n", file, line);
-	errno = EINVAL;
-	return NULL;
+	size_t stored_size = entry_value_size(ht, entry);
+	if (stored_size == 0) {
+		fprintf(stderr, "Raw values cannot be copied out.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	bool compressed = entry_value_compressed(ht, entry);
+	size_t value_size = stored_size;
+	if (compressed) memcpy(&value_size, entry->value, sizeof(size_t));
+
+	*out_size = value_size;
+	if (value_size > buffer_size) {  /* 大きさを調べるための呼び出しでもあるので、メッセージは出さない */
+		errno = ERANGE;
+		return false;
+	}
+
+	if (!compressed) {
+		memcpy(buffer, entry->value, value_size);
+	} else if (!lz_decompress((const unsigned char*)entry->value + sizeof(size_t), (stored_size & ~VALUE_SIZE_COMPRESSED) - sizeof(size_t), buffer, value_size)) {
+		fprintf(stderr, "Compressed value is corrupted.\nFile: %s   Line: %d\n", file, line);
+		errno = EIO;
+		return false;
+	}
+	return true;
 }
 
 
-static void* mht_uint_get_without_lock (MHashTable* ht, uint_keyt key, const char* file, int line) {
+bool _mht_uint_get_copy (MHashTable* ht, uint_keyt key, void* buffer, size_t buffer_size, size_t* out_size, const char* file, int line) {
 	KeyUni key_uni = {
 		.key.uint = key,
 		.key_type = KEY_TYPE_UINT
 	};
 
-	void* result = mht_get_without_lock_generic(ht, key_uni, file, line);
-	if (result == NULL) mht_errfunc = "_mht_uint_get";
-
-	return result;
-}
-
-
-void* _mht_uint_get (MHashTable* ht, uint_keyt key, const char* file, int line) {
 	mht_lock();
-	void* result = mht_uint_get_without_lock(ht, key, file, line);
+	bool result = mht_get_copy_generic(ht, key_uni, buffer, buffer_size, out_size, file, line);
+	if (!result) mht_errfunc = "_mht_uint_get_copy";
 	mht_unlock();
 	return result;
 }
 
 
-static void* mht_str_get_without_lock (MHashTable* ht, str_keyt key, const char* file, int line) {
+bool _mht_str_get_copy (MHashTable* ht, str_keyt key, void* buffer, size_t buffer_size, size_t* out_size, const char* file, int line) {
 	if (!mht_str_key_is_valid(key)) {
 		fprintf(stderr, "Invalid string key.\nFile: %s   Line: %d\n", file, line);
 		errno = EINVAL;
-		mht_errfunc = "_mht_str_get";
+		mht_errfunc = "_mht_str_get_copy";
 		return false;
 	}
 
@@ -776,16 +6487,44 @@ static void* mht_str_get_without_lock (MHashTable* ht, str_keyt key, const char*
 		.key_type = KEY_TYPE_STR
 	};
 
-	void* result = mht_get_without_lock_generic(ht, key_uni, file, line);
-	if (result == NULL) mht_errfunc = "_mht_str_get";
+	mht_lock();
+	bool result = mht_get_copy_generic(ht, key_uni, buffer, buffer_size, out_size, file, line);
+	if (!result) mht_errfunc = "_mht_str_get_copy";
+	mht_unlock();
+	return result;
+}
+
+
+bool _mht_uint32_get_copy (MHashTable* ht, uint32_t key, void* buffer, size_t buffer_size, size_t* out_size, const char* file, int line) {
+	KeyUni key_uni = {
+		.key.uint32 = key,
+		.key_type = KEY_TYPE_UINT32
+	};
 
+	mht_lock();
+	bool result = mht_get_copy_generic(ht, key_uni, buffer, buffer_size, out_size, file, line);
+	if (!result) mht_errfunc = "_mht_uint32_get_copy";
+	mht_unlock();
 	return result;
 }
 
 
-void* _mht_str_get (MHashTable* ht, str_keyt key, const char* file, int line) {
+bool _mht_tuple_get_copy (MHashTable* ht, const uint_keyt* key, void* buffer, size_t buffer_size, size_t* out_size, const char* file, int line) {
+	if (key == NULL) {
+		fprintf(stderr, "Tuple key pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_tuple_get_copy";
+		return false;
+	}
+
+	KeyUni key_uni = {
+		.key.tuple = key,
+		.key_type = KEY_TYPE_TUPLE
+	};
+
 	mht_lock();
-	void* result = mht_str_get_without_lock(ht, key, file, line);
+	bool result = mht_get_copy_generic(ht, key_uni, buffer, buffer_size, out_size, file, line);
+	if (!result) mht_errfunc = "_mht_tuple_get_copy";
 	mht_unlock();
 	return result;
 }
@@ -807,14 +6546,23 @@ void** _mht_all_get (MHashTable* ht, size_t* out_count, const char* file, int li
 		return NULL;
 	}
 
-	if (ht->count > (SIZE_MAX / sizeof(void*))) {
+	if (ht->compress_threshold != 0) {  /* 圧縮した値へのポインタは返せない */
+		fprintf(stderr, "Compressed hashtables do not support all_get.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_all_get";
+		mht_unlock();
+		return NULL;
+	}
+
+	size_t capacity = (ht->split != NULL) ? split_count_live(ht->split) : ht->count;
+	if (capacity > (SIZE_MAX / sizeof(void*))) {
 		fprintf(stderr, "Hashtable count is too large for all_get.\nFile: %s   Line: %d\n", file, line);
 		errno = EIO;
 		mht_errfunc = "_mht_all_get";
 		return NULL;
 	}
 
-	void** values = calloc(ht->count, sizeof(void*));
+	void** values = calloc(capacity, sizeof(void*));
 	if (UNLIKELY(values == NULL)) {
 		errno = ENOMEM;
 		mht_errfunc = "_mht_all_get";
@@ -823,11 +6571,24 @@ void** _mht_all_get (MHashTable* ht, size_t* out_count, const char* file, int li
 	}
 
 	size_t idx = 0;
-	for (size_t i = 0; i < ht->size; ++i) {
-		MHtEntry* entry = ht->buckets[i];
-		while (entry) {
-			values[idx++] = entry->value;
-			entry = entry->next;
+	if (ht->split != NULL) {  /* ロックを取らない書き込みと並行していれば、その時点の内容とは限らない */
+		idx = split_collect(ht->split, values, capacity);
+	} else if (ht->frozen != NULL) {
+		idx = frozen_collect(ht->frozen, values);
+	} else if (ht->cuckoo != NULL) {
+		idx = cuckoo_collect(ht->cuckoo, values);
+	} else if (ht->compact != NULL) {
+		idx = compact_collect(ht, values);
+	} else if (ht->buckets == NULL) {  /* スモールモード */
+		for (size_t i = 0; i < ht->count; ++i)
+			values[idx++] = ht->small[i].value;
+	} else {
+		for (size_t i = 0; i < ht->size; ++i) {
+			MHtEntry* entry = ht->buckets[i];
+			while (entry) {
+				values[idx++] = entry->value;
+				entry = entry->next;
+			}
 		}
 	}
 
@@ -844,33 +6605,42 @@ bool _mht_all_release_arr (void* values, const char* file, int line) {
 }
 
 
-static bool mht_delete_without_lock_generic (MHashTable* ht, KeyUni key, const char* file, int line) {
-	if (!mht_pre_execution_check(ht, file, line)) return false;
+/* mht_delete_entry から呼ぶ。変更ログには記録しない */
+static bool mht_remove_entry (MHashTable* ht, KeyUni key) {
+	if (ht->split != NULL) return split_delete(ht->split, key.key.uint);
 
-	if (ht->key_type != key.key_type) {
-		fprintf(stderr, "Key type mismatch in hashtable.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		return NULL;
+	table_version_bump(ht);
+
+	if (ht->cuckoo != NULL) return cuckoo_delete_entry(ht, key);
+	if (ht->compact != NULL) return compact_delete_entry(ht, key);
+
+	if (ht->buckets == NULL) {  /* スモールモードでは末尾のエントリを空いた位置に詰める */
+		size_t pos;
+		MHtEntry* found = mht_small_find(ht, key, &pos);
+		if (found == NULL) return false;
+
+		entry_value_free(ht, found);
+		if (ht->key_type == KEY_TYPE_STR) key_str_release(ht, found);
+		ht->count--;
+		if (pos != ht->count) ht->small[pos] = ht->small[ht->count];
+		memset(&ht->small[ht->count], 0, sizeof(MHtEntry));
+		return true;
 	}
 
-	size_t index;
-	if (ht->key_type == KEY_TYPE_UINT)
-		index = hash_uint_key(key.key.uint, ht->size);
-	else  /* if (ht->key_type == KEY_TYPE_STR) */
-		index = hash_str_key(key.key.str, ht->size);
+	size_t index = hash_key_uni(ht, key, ht->size);
 
 	MHtEntry* prev = NULL;
 	MHtEntry* entry = ht->buckets[index];
 
 	while (entry != NULL) {  /* bucketsが確保時に初期化されていることが前提 */
-		if ((ht->key_type == KEY_TYPE_UINT && entry->key.uint == key.key.uint) ||
-			(ht->key_type == KEY_TYPE_STR && str_key_equal(entry->key.str, key.key.str))) {
+		if (entry_key_equal(ht, entry, key)) {
 			if (prev)
 				prev->next = entry->next;
 			else
 				ht->buckets[index] = entry->next;
 
-			free(entry->value);
+			entry_value_free(ht, entry);
+			if (ht->key_type == KEY_TYPE_STR) key_str_release(ht, entry);
 			free(entry);
 			ht->count--;
 			return true;
@@ -878,6 +6648,46 @@ static bool mht_delete_without_lock_generic (MHashTable* ht, KeyUni key, const c
 		prev = entry;
 		entry = entry->next;
 	}
+	return false;
+}
+
+
+/* 検査済みのテーブルとキーに対して呼ぶ。見つからなければ false を返す */
+static bool mht_delete_entry (MHashTable* ht, KeyUni key) {
+	if (ht->change_log == NULL) return mht_remove_entry(ht, key);
+
+	/* キーはこれから解放するエントリのものかもしれないので、先に複製しておく */
+	void* key_mem = change_key_copy(ht, key);
+	bool result = mht_remove_entry(ht, key);
+	if (result)
+		change_log_push(ht, MHT_CHANGE_DELETE, key, key_mem);
+	else
+		free(key_mem);
+	return result;
+}
+
+
+static bool mht_delete_without_lock_generic (MHashTable* ht, KeyUni key, const char* file, int line) {
+	if (!mht_pre_execution_check(ht, file, line)) return false;
+
+	if (ht->key_type != key.key_type) {
+		fprintf(stderr, "Key type mismatch in hashtable.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (ht->frozen != NULL) {
+		fprintf(stderr, "Frozen hashtables are read-only.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		return false;
+	}
+
+	bool result;
+	if (ht->numa_replicas != NULL)
+		result = mht_numa_delete_entry(ht, key);
+	else
+		result = mht_delete_entry(ht, key);
+	if (result) return true;
 
 	fprintf(stderr, "Key not found in hashtable.\nFile: %s   Line: %d\n", file, line);
 	errno = EINVAL;
@@ -899,6 +6709,14 @@ static bool mht_uint_delete_without_lock (MHashTable* ht, uint_keyt key, const c
 
 
 bool _mht_uint_delete (MHashTable* ht, uint_keyt key, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.uint = key,
+			.key_type = KEY_TYPE_UINT
+		};
+		return mht_write_combined(WRITE_OP_DELETE, ht, key_uni, NULL, 0, file, line);
+	}
+
 	mht_lock();
 	bool result = mht_uint_delete_without_lock(ht, key, file, line);
 	mht_unlock();
@@ -927,6 +6745,14 @@ static bool mht_str_delete_without_lock (MHashTable* ht, str_keyt key, const cha
 
 
 bool _mht_str_delete (MHashTable* ht, str_keyt key, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.str = key,
+			.key_type = KEY_TYPE_STR
+		};
+		return mht_write_combined(WRITE_OP_DELETE, ht, key_uni, NULL, 0, file, line);
+	}
+
 	mht_lock();
 	bool result = mht_str_delete_without_lock(ht, key, file, line);
 	mht_unlock();
@@ -934,17 +6760,496 @@ bool _mht_str_delete (MHashTable* ht, str_keyt key, const char* file, int line)
 }
 
 
+static bool mht_uint32_delete_without_lock (MHashTable* ht, uint32_t key, const char* file, int line) {
+	KeyUni key_uni = {
+		.key.uint32 = key,
+		.key_type = KEY_TYPE_UINT32
+	};
+
+	bool result = mht_delete_without_lock_generic(ht, key_uni, file, line);
+	if (result == false) mht_errfunc = "_mht_uint32_delete";
+
+	return result;
+}
+
+
+bool _mht_uint32_delete (MHashTable* ht, uint32_t key, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.uint32 = key,
+			.key_type = KEY_TYPE_UINT32
+		};
+		return mht_write_combined(WRITE_OP_DELETE, ht, key_uni, NULL, 0, file, line);
+	}
+
+	mht_lock();
+	bool result = mht_uint32_delete_without_lock(ht, key, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+static bool mht_tuple_delete_without_lock (MHashTable* ht, const uint_keyt* key, const char* file, int line) {
+	if (key == NULL) {
+		fprintf(stderr, "Tuple key pointer is NULL.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_tuple_delete";
+		return false;
+	}
+
+	KeyUni key_uni = {
+		.key.tuple = key,
+		.key_type = KEY_TYPE_TUPLE
+	};
+
+	bool result = mht_delete_without_lock_generic(ht, key_uni, file, line);
+	if (result == false) mht_errfunc = "_mht_tuple_delete";
+
+	return result;
+}
+
+
+bool _mht_tuple_delete (MHashTable* ht, const uint_keyt* key, const char* file, int line) {
+	if (flat_combining_active()) {
+		KeyUni key_uni = {
+			.key.tuple = key,
+			.key_type = KEY_TYPE_TUPLE
+		};
+		return mht_write_combined(WRITE_OP_DELETE, ht, key_uni, NULL, 0, file, line);
+	}
+
+	mht_lock();
+	bool result = mht_tuple_delete_without_lock(ht, key, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+/*
+ * フラットコンバイニング
+ * 書き込みを行うスレッドは自分専用のスロットに要求を公開し、結合役を獲得できたスレッドが
+ * mht_lock を 1 回取る間に公開済みの要求をまとめて実行する。結合役になれなかったスレッドは
+ * 自分のスロットが完了するのを待つだけなので、ロックの受け渡しとテーブルのキャッシュラインの移動が減る。
+ */
+
+static bool mht_write_execute (WriteOp op, MHashTable* ht, KeyUni key, void* value_data, size_t value_size, const char* file, int line) {
+	switch (key.key_type) {
+		case KEY_TYPE_UINT:
+			if (op == WRITE_OP_DELETE) return mht_uint_delete_without_lock(ht, key.key.uint, file, line);
+			if (op == WRITE_OP_SET_RAW) return mht_uint_set_raw_without_lock(ht, key.key.uint, value_data, file, line);
+			return mht_uint_set_without_lock(ht, key.key.uint, value_data, value_size, file, line);
+		case KEY_TYPE_STR:
+			if (op == WRITE_OP_DELETE) return mht_str_delete_without_lock(ht, key.key.str, file, line);
+			if (op == WRITE_OP_SET_RAW) return mht_str_set_raw_without_lock(ht, key.key.str, value_data, file, line);
+			return mht_str_set_without_lock(ht, key.key.str, value_data, value_size, file, line);
+		case KEY_TYPE_UINT32:
+			if (op == WRITE_OP_DELETE) return mht_uint32_delete_without_lock(ht, key.key.uint32, file, line);
+			if (op == WRITE_OP_SET_RAW) return mht_uint32_set_raw_without_lock(ht, key.key.uint32, value_data, file, line);
+			return mht_uint32_set_without_lock(ht, key.key.uint32, value_data, value_size, file, line);
+		case KEY_TYPE_TUPLE:
+			if (op == WRITE_OP_DELETE) return mht_tuple_delete_without_lock(ht, key.key.tuple, file, line);
+			if (op == WRITE_OP_SET_RAW) return mht_tuple_set_raw_without_lock(ht, key.key.tuple, value_data, file, line);
+			return mht_tuple_set_without_lock(ht, key.key.tuple, value_data, value_size, file, line);
+		default:
+			errno = EINVAL;
+			return false;
+	}
+}
+
+
+#ifdef ATOMICS_SUPPORTED
+
+enum {
+	FC_SLOT_EMPTY,
+	FC_SLOT_PENDING,
+	FC_SLOT_DONE,
+	FC_SLOT_FREE  /* 持ち主のスレッドが終了し、別のスレッドが引き継げる */
+};
+
+
+typedef struct FcSlot {
+	atomic_int state;
+	WriteOp op;
+	MHashTable* ht;
+	KeyUni key;
+	void* value_data;
+	size_t value_size;
+	const char* file;
+	int line;
+	bool result;
+	int result_errno;
+	const char* result_errfunc;
+	struct FcSlot* next;  /* リストに繋いだ後は変更しない */
+} FcSlot;
+
+
+static atomic_bool fc_enabled = false;
+static atomic_flag fc_combiner = ATOMIC_FLAG_INIT;
+static _Atomic(FcSlot*) fc_slots = NULL;
+static THREAD_LOCAL FcSlot* fc_own_slot = NULL;
+
+#if defined (_WIN32)
+	static DWORD fc_slot_key = FLS_OUT_OF_INDEXES;
+#else
+	static pthread_key_t fc_slot_key;
+#endif
+static bool fc_slot_key_created = false;  /* mht_lock で保護 */
+
+
+static bool flat_combining_active (void) {
+	return atomic_load_explicit(&fc_enabled, memory_order_relaxed);
+}
+
+
+/* スレッドの終了時に呼ばれ、そのスレッドのスロットを空きに戻す */
+#if defined (_WIN32)
+static VOID WINAPI fc_slot_release (PVOID arg) {
+#else
+static void fc_slot_release (void* arg) {
+#endif
+	if (arg != NULL) atomic_store_explicit(&((FcSlot*)arg)->state, FC_SLOT_FREE, memory_order_release);
+}
+
+
+/* mht_lock 内で呼ぶ */
+static bool fc_slot_key_create (void) {
+	if (fc_slot_key_created) return true;
+
+#if defined (_WIN32)
+	fc_slot_key = FlsAlloc(fc_slot_release);
+	if (fc_slot_key == FLS_OUT_OF_INDEXES) return false;
+#else
+	if (pthread_key_create(&fc_slot_key, fc_slot_release) != 0) return false;
+#endif
+	fc_slot_key_created = true;
+	return true;
+}
+
+
+/*
+ * スレッドごとのスロットは初回の書き込み時に割り当てる。終了したスレッドが空けたスロットがあればそれを引き継ぎ、
+ * なければ新しく確保してリストの先頭に繋ぐ。スロットはスレッドの終了時に空きに戻り、ライブラリの終了時に解放する
+ */
+static FcSlot* fc_slot_get (void) {
+	if (fc_own_slot != NULL) return fc_own_slot;
+
+	mht_lock();
+
+	if (UNLIKELY(!fc_slot_key_create())) {
+		mht_unlock();
+		return NULL;
+	}
+
+	FcSlot* slot;
+	for (slot = atomic_load(&fc_slots); slot != NULL; slot = slot->next) {
+		int expected = FC_SLOT_FREE;
+		if (atomic_compare_exchange_strong(&slot->state, &expected, FC_SLOT_EMPTY)) break;
+	}
+
+	if (slot == NULL) {
+		slot = calloc(1, sizeof(FcSlot));
+		if (UNLIKELY(slot == NULL)) {
+			mht_unlock();
+			return NULL;
+		}
+		atomic_init(&slot->state, FC_SLOT_EMPTY);
+		slot->next = atomic_load(&fc_slots);
+		atomic_store(&fc_slots, slot);  /* 追加は mht_lock 内でしか行わない */
+	}
+
+#if defined (_WIN32)
+	bool registered = (FlsSetValue(fc_slot_key, slot) != 0);
+#else
+	bool registered = (pthread_setspecific(fc_slot_key, slot) == 0);
+#endif
+	if (UNLIKELY(!registered)) {  /* 終了時に空きに戻せないスロットは持たない */
+		atomic_store(&slot->state, FC_SLOT_FREE);
+		mht_unlock();
+		return NULL;
+	}
+
+	mht_unlock();
+	fc_own_slot = slot;
+	return slot;
+}
+
+
+/* mht_lock を取った結合役だけが呼ぶ */
+static void fc_combine (void) {
+	for (size_t pass = 0; pass < FC_COMBINE_PASSES; pass++) {
+		for (FcSlot* slot = atomic_load(&fc_slots); slot != NULL; slot = slot->next) {
+			if (atomic_load_explicit(&slot->state, memory_order_acquire) != FC_SLOT_PENDING) continue;
+
+			mht_errfunc = NULL;
+			slot->result = mht_write_execute(slot->op, slot->ht, slot->key, slot->value_data, slot->value_size, slot->file, slot->line);
+			slot->result_errno = errno;
+			slot->result_errfunc = mht_errfunc;
+			atomic_store_explicit(&slot->state, FC_SLOT_DONE, memory_order_release);
+		}
+	}
+}
+
+
+static bool mht_write_combined (WriteOp op, MHashTable* ht, KeyUni key, void* value_data, size_t value_size, const char* file, int line) {
+	FcSlot* slot = fc_slot_get();
+	if (UNLIKELY(slot == NULL)) {  /* スロットが用意できなければ通常どおりロックして実行する */
+		mht_lock();
+		bool result = mht_write_execute(op, ht, key, value_data, value_size, file, line);
+		mht_unlock();
+		return result;
+	}
+
+	int saved_errno = errno;
+	const char* saved_errfunc = mht_errfunc;
+
+	slot->op = op;
+	slot->ht = ht;
+	slot->key = key;
+	slot->value_data = value_data;
+	slot->value_size = value_size;
+	slot->file = file;
+	slot->line = line;
+	atomic_store_explicit(&slot->state, FC_SLOT_PENDING, memory_order_release);
+
+	unsigned int spins = 0;
+	while (atomic_load_explicit(&slot->state, memory_order_acquire) != FC_SLOT_DONE) {
+		if (!atomic_flag_test_and_set_explicit(&fc_combiner, memory_order_acquire)) {
+			mht_lock();
+			fc_combine();
+			mht_unlock();
+			atomic_flag_clear_explicit(&fc_combiner, memory_order_release);
+			continue;
+		}
+
+		if (++spins >= FC_SPINS_BEFORE_YIELD) {
+			spins = 0;
+			cpu_yield();
+		}
+	}
+
+	bool result = slot->result;
+	if (result) {
+		errno = saved_errno;
+		mht_errfunc = saved_errfunc;
+	} else {
+		errno = slot->result_errno;
+		mht_errfunc = slot->result_errfunc;
+	}
+	atomic_store_explicit(&slot->state, FC_SLOT_EMPTY, memory_order_relaxed);
+	return result;
+}
+
+
+static void fc_slots_free (void) {
+	/* Windows では FlsFree が各スレッドの fc_slot_release を呼ぶため、スロットより先にキーを破棄する */
+	if (fc_slot_key_created) {
+#if defined (_WIN32)
+		FlsFree(fc_slot_key);
+#else
+		pthread_key_delete(fc_slot_key);
+#endif
+		fc_slot_key_created = false;
+	}
+
+	FcSlot* slot = atomic_exchange(&fc_slots, NULL);
+	while (slot != NULL) {
+		FcSlot* next = slot->next;
+		free(slot);
+		slot = next;
+	}
+	fc_own_slot = NULL;
+}
+
+
+bool mht_set_flat_combining (bool enable) {
+	atomic_store(&fc_enabled, enable);
+	return true;
+}
+
+#else
+
+static bool flat_combining_active (void) {
+	return false;
+}
+
+
+static bool mht_write_combined (WriteOp op, MHashTable* ht, KeyUni key, void* value_data, size_t value_size, const char* file, int line) {
+	mht_lock();
+	bool result = mht_write_execute(op, ht, key, value_data, value_size, file, line);
+	mht_unlock();
+	return result;
+}
+
+
+bool mht_set_flat_combining (bool enable) {
+	if (!enable) return true;
+
+	errno = ENOSYS;
+	mht_errfunc = "mht_set_flat_combining";
+	return false;
+}
+
+#endif
+
+
+/*
+ * 文字列のインターン
+ * 同じ内容の文字列に同じ番号を割り当て、文字列そのものは追記専用のアリーナに 1 度だけ保存する。
+ * アリーナのブロックは終了まで解放しないので、番号から引いた文字列のアドレスは変わらない。
+ * 文字列から番号への索引は番号だけを並べた開番地法の
+ * 配列で、ハッシュには文字列キーのテーブルと同じ関数を使い、比較はアリーナ内の文字列と行う。
+ * 全体で 1 つだけ持ち、グローバルロックで守る。
+ */
+
+typedef struct {
+	uint32_t* slots;  /* 番号を並べた索引。0 は空き */
+	size_t slot_count;  /* 2 の累乗 */
+	str_keyt* strings;  /* 番号 - 1 で引く。ptr はアリーナ内を指す */
+	size_t count;
+	size_t capacity;
+	ArenaBlock* block;  /* 追記中のブロック。古いブロックは prev で辿る */
+} Interner;
+
+static Interner interner = { NULL, 0, NULL, 0, 0, NULL };  /* グローバルロックで保護する */
+
+
+/* key の番号が入っている索引の位置、無ければ入れるべき空きの位置を返す */
+static size_t intern_slot_find (str_keyt key) {
+	size_t mask = interner.slot_count - 1;
+	size_t pos = hash_str_key(key, interner.slot_count);
+	while (interner.slots[pos] != 0 && !str_key_equal(interner.strings[interner.slots[pos] - 1], key))
+		pos = (pos + 1) & mask;
+	return pos;
+}
+
+
+/* 索引を倍の大きさに作り直す。文字列はアリーナにあるので、番号を並べ直すだけで済む */
+static bool intern_slots_grow (void) {
+	size_t new_count = (interner.slot_count == 0) ? INTERN_INITIAL_SLOTS : interner.slot_count * 2;
+	uint32_t* new_slots = calloc(new_count, sizeof(uint32_t));
+	if (UNLIKELY(new_slots == NULL)) return false;
+
+	free(interner.slots);
+	interner.slots = new_slots;
+	interner.slot_count = new_count;
+
+	for (size_t i = 0; i < interner.count; i++)
+		interner.slots[intern_slot_find(interner.strings[i])] = (uint32_t)(i + 1);
+	return true;
+}
+
+
+static bool intern_strings_grow (void) {
+	size_t new_capacity = (interner.capacity == 0) ? INTERN_INITIAL_SLOTS : interner.capacity * 2;
+	str_keyt* new_strings = realloc(interner.strings, new_capacity * sizeof(str_keyt));
+	if (UNLIKELY(new_strings == NULL)) return false;
+
+	interner.strings = new_strings;
+	interner.capacity = new_capacity;
+	return true;
+}
+
+
+static void intern_free (void) {
+	arena_free(interner.block);
+	free(interner.slots);
+	free(interner.strings);
+	interner = (Interner){ NULL, 0, NULL, 0, 0, NULL };
+}
+
+
+uint32_t _mht_intern (str_keyt key, const char* file, int line) {
+	if (!mht_str_key_is_valid(key)) {
+		fprintf(stderr, "Invalid string key.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_intern";
+		return MHT_INTERN_NONE;
+	}
+
+	mht_lock();
+
+	if (UNLIKELY(mht_entries == NULL)) {
+		init();  /* 終了時にアリーナを解放させるため */
+	}
+
+	/* 索引の使用率を半分以下に保つ */
+	if (interner.count + 1 > interner.slot_count / 2 && !intern_slots_grow()) {
+		fprintf(stderr, "Failed to allocate memory for the string interner.\nFile: %s   Line: %d\n", file, line);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_intern";
+		mht_unlock();
+		return MHT_INTERN_NONE;
+	}
+
+	size_t pos = intern_slot_find(key);
+	if (interner.slots[pos] != 0) {
+		uint32_t id = interner.slots[pos];
+		mht_unlock();
+		return id;
+	}
+
+	if (interner.count >= (size_t)UINT32_MAX - 1) {
+		fprintf(stderr, "Too many strings are interned.\nFile: %s   Line: %d\n", file, line);
+		errno = ERANGE;
+		mht_errfunc = "_mht_intern";
+		mht_unlock();
+		return MHT_INTERN_NONE;
+	}
+
+	char* str = (interner.count < interner.capacity || intern_strings_grow()) ? arena_copy(&interner.block, key, INTERN_BLOCK_SIZE) : NULL;
+	if (UNLIKELY(str == NULL)) {
+		fprintf(stderr, "Failed to allocate memory for the string interner.\nFile: %s   Line: %d\n", file, line);
+		errno = ENOMEM;
+		mht_errfunc = "_mht_intern";
+		mht_unlock();
+		return MHT_INTERN_NONE;
+	}
+
+	interner.strings[interner.count] = (str_keyt){ .ptr = str, .len = key.len };
+	interner.count++;
+
+	uint32_t id = (uint32_t)interner.count;
+	interner.slots[pos] = id;
+
+	mht_unlock();
+	return id;
+}
+
+
+str_keyt _mht_intern_lookup (uint32_t id, const char* file, int line) {
+	mht_lock();
+
+	if (id == MHT_INTERN_NONE || id > interner.count) {
+		fprintf(stderr, "Unknown interned string ID.\nFile: %s   Line: %d\n", file, line);
+		errno = EINVAL;
+		mht_errfunc = "_mht_intern_lookup";
+		mht_unlock();
+		return STR_KEYT_INVALID;
+	}
+
+	str_keyt result = interner.strings[id - 1];
+
+	mht_unlock();
+	return result;
+}
+
+
 static void quit (void) {
 	_mht_destroy(all_get_arr_entries, __FILE__, __LINE__);
 	all_get_arr_entries = NULL;
 
-	for (size_t i = 0; i < mht_entries->size; i++) {
+	/* スモールモードでは buckets が NULL になる。mht_entries は MHT_ENTRIES_INITIAL_SIZE で作るのでそうはならないが、念のため確かめる */
+	for (size_t i = 0; mht_entries->buckets != NULL && i < mht_entries->size; i++) {
 		MHtEntry* entry = mht_entries->buckets[i];
 		while (entry != NULL) {  /* bucketsが確保時に初期化されていることが前提 */
 			MHtEntry* next = entry->next;
 #ifdef DEBUG
 			if (((MHtTrackEntry*)entry->value)->key_type == KEY_TYPE_UINT)
 				fprintf(stderr, "\nHashtable not destroyed!\nKey type: %s\nFile: %s   Line: %d\n", "uint", ((MHtTrackEntry*)entry->value)->create_file, ((MHtTrackEntry*)entry->value)->create_line);
+			else if (((MHtTrackEntry*)entry->value)->key_type == KEY_TYPE_UINT32)
+				fprintf(stderr, "\nHashtable not destroyed!\nKey type: %s\nFile: %s   Line: %d\n", "uint32", ((MHtTrackEntry*)entry->value)->create_file, ((MHtTrackEntry*)entry->value)->create_line);
+			else if (((MHtTrackEntry*)entry->value)->key_type == KEY_TYPE_TUPLE)
+				fprintf(stderr, "\nHashtable not destroyed!\nKey type: %s\nFile: %s   Line: %d\n", "tuple", ((MHtTrackEntry*)entry->value)->create_file, ((MHtTrackEntry*)entry->value)->create_line);
 			else  /* if (((MHtTrackEntry*)entry->value)->key_type == KEY_TYPE_STR) */
 				fprintf(stderr, "\nHashtable not destroyed!\nKey type: %s\nFile: %s   Line: %d\n", "str", ((MHtTrackEntry*)entry->value)->create_file, ((MHtTrackEntry*)entry->value)->create_line);
 #endif
@@ -955,5 +7260,11 @@ static void quit (void) {
 	_mht_destroy(mht_entries, __FILE__, __LINE__);
 	mht_entries = NULL;
 
+#ifdef ATOMICS_SUPPORTED
+	fc_slots_free();
+#endif
+
+	intern_free();
+
 	global_lock_quit();
 }
@@ -50,7 +50,20 @@
  * In high-load environments or those with many threads, it is recommended to design
  * your application to minimize simultaneous access whenever possible.
  *
+ * Hashtables created with a size of 8 or less start in a small mode that keeps
+ * the entries in a flat array allocated together with the hashtable and searches
+ * it linearly. They switch to the regular bucket layout automatically once a
+ * ninth key is added, so the size passed at creation only affects performance.
+ *
  * To enable debug mode, define DEBUG macro before including this file.
+ *
+ * Defining the MHT_FAIR_LOCK macro when compiling mhashtable.c replaces the lock
+ * from global_lock.h with a ticket lock that grants the lock in arrival order, so
+ * no thread can be starved under heavy contention. Waiting threads spin briefly and
+ * then sleep with futex on Linux or WaitOnAddress on Windows, which requires
+ * Windows 8 or later and linking with Synchronization.lib. The fair lock trades
+ * throughput for tail latency, especially when there are more threads than CPUs, and
+ * is only used when C11 atomics are available.
  */
 
 #pragma once
@@ -69,20 +82,72 @@ MUTILS_CPP_C_BEGIN
  * The functions replaced by the following macros are specific to this library.
  * It is recommended not to remove them unless a conflict occurs.
  */
+#define mht_init(options) _mht_init((options), __FILE__, __LINE__)
+#define mht_intern(key) _mht_intern((key), __FILE__, __LINE__)
+#define mht_intern_lookup(id) _mht_intern_lookup((id), __FILE__, __LINE__)
 #define mht_uint_create(size) _mht_uint_create((size), __FILE__, __LINE__)
 #define mht_str_create(size) _mht_str_create((size), __FILE__, __LINE__)
+#define mht_uint32_create(size) _mht_uint32_create((size), __FILE__, __LINE__)
+#define mht_tuple_create(size, key_words) _mht_tuple_create((size), (key_words), __FILE__, __LINE__)
 #define mht_destroy(ht) _mht_destroy((ht), __FILE__, __LINE__)
 #define mht_destroy_without_value(ht) _mht_destroy_without_value((ht), __FILE__, __LINE__)
+#define mht_destroy_async(ht) _mht_destroy_async((ht), __FILE__, __LINE__)
+#define mht_clear(ht) _mht_clear((ht), __FILE__, __LINE__)
+#define mht_clone(ht) _mht_clone((ht), __FILE__, __LINE__)
+#define mht_merge(dst, src, policy, combine, arg) _mht_merge((dst), (src), (policy), (combine), (arg), __FILE__, __LINE__)
+#define mht_merge_consume(dst, src, policy, combine, arg) _mht_merge_consume((dst), (src), (policy), (combine), (arg), __FILE__, __LINE__)
 #define mht_uint_set(ht, key, value_data, value_size) _mht_uint_set((ht), (key), (value_data), (value_size), __FILE__, __LINE__)
 #define mht_str_set(ht, key, value_data, value_size) _mht_str_set((ht), (key), (value_data), (value_size), __FILE__, __LINE__)
+#define mht_uint32_set(ht, key, value_data, value_size) _mht_uint32_set((ht), (key), (value_data), (value_size), __FILE__, __LINE__)
+#define mht_tuple_set(ht, key, value_data, value_size) _mht_tuple_set((ht), (key), (value_data), (value_size), __FILE__, __LINE__)
 #define mht_uint_get(ht, key) _mht_uint_get((ht), (key), __FILE__, __LINE__)
 #define mht_str_get(ht, key) _mht_str_get((ht), (key), __FILE__, __LINE__)
+#define mht_uint32_get(ht, key) _mht_uint32_get((ht), (key), __FILE__, __LINE__)
+#define mht_tuple_get(ht, key) _mht_tuple_get((ht), (key), __FILE__, __LINE__)
+#define mht_uint_try_set(ht, key, value_data, value_size) _mht_uint_try_set((ht), (key), (value_data), (value_size), __FILE__, __LINE__)
+#define mht_str_try_set(ht, key, value_data, value_size) _mht_str_try_set((ht), (key), (value_data), (value_size), __FILE__, __LINE__)
+#define mht_uint32_try_set(ht, key, value_data, value_size) _mht_uint32_try_set((ht), (key), (value_data), (value_size), __FILE__, __LINE__)
+#define mht_tuple_try_set(ht, key, value_data, value_size) _mht_tuple_try_set((ht), (key), (value_data), (value_size), __FILE__, __LINE__)
+#define mht_uint_try_get(ht, key, out_value) _mht_uint_try_get((ht), (key), (out_value), __FILE__, __LINE__)
+#define mht_str_try_get(ht, key, out_value) _mht_str_try_get((ht), (key), (out_value), __FILE__, __LINE__)
+#define mht_uint32_try_get(ht, key, out_value) _mht_uint32_try_get((ht), (key), (out_value), __FILE__, __LINE__)
+#define mht_tuple_try_get(ht, key, out_value) _mht_tuple_try_get((ht), (key), (out_value), __FILE__, __LINE__)
+#define mht_uint_get_copy(ht, key, buffer, buffer_size, out_size) _mht_uint_get_copy((ht), (key), (buffer), (buffer_size), (out_size), __FILE__, __LINE__)
+#define mht_str_get_copy(ht, key, buffer, buffer_size, out_size) _mht_str_get_copy((ht), (key), (buffer), (buffer_size), (out_size), __FILE__, __LINE__)
+#define mht_uint32_get_copy(ht, key, buffer, buffer_size, out_size) _mht_uint32_get_copy((ht), (key), (buffer), (buffer_size), (out_size), __FILE__, __LINE__)
+#define mht_tuple_get_copy(ht, key, buffer, buffer_size, out_size) _mht_tuple_get_copy((ht), (key), (buffer), (buffer_size), (out_size), __FILE__, __LINE__)
 #define mht_all_get(ht, out_count) _mht_all_get((ht), (out_count), __FILE__, __LINE__)
 #define mht_all_release_arr(values) _mht_all_release_arr((values), __FILE__, __LINE__)
 #define mht_uint_delete(ht, key) _mht_uint_delete((ht), (key), __FILE__, __LINE__)
 #define mht_str_delete(ht, key) _mht_str_delete((ht), (key), __FILE__, __LINE__)
+#define mht_uint32_delete(ht, key) _mht_uint32_delete((ht), (key), __FILE__, __LINE__)
+#define mht_tuple_delete(ht, key) _mht_tuple_delete((ht), (key), __FILE__, __LINE__)
 #define mht_uint_set_raw(ht, key, value_data) _mht_uint_set_raw((ht), (key), (value_data), __FILE__, __LINE__)
 #define mht_str_set_raw(ht, key, value_data) _mht_str_set_raw((ht), (key), (value_data), __FILE__, __LINE__)
+#define mht_set_access_tracking(ht, capacity) _mht_set_access_tracking((ht), (capacity), __FILE__, __LINE__)
+#define mht_top_keys(ht, k, out) _mht_top_keys((ht), (k), (out), __FILE__, __LINE__)
+#define mht_set_read_cache(ht, enable) _mht_set_read_cache((ht), (enable), __FILE__, __LINE__)
+#define mht_set_numa_replicas(ht) _mht_set_numa_replicas((ht), __FILE__, __LINE__)
+#define mht_set_huge_pages(ht, mode) _mht_set_huge_pages((ht), (mode), __FILE__, __LINE__)
+#define mht_uint32_set_raw(ht, key, value_data) _mht_uint32_set_raw((ht), (key), (value_data), __FILE__, __LINE__)
+#define mht_set_pointer_keys(ht, ordered) _mht_set_pointer_keys((ht), (ordered), __FILE__, __LINE__)
+#define mht_set_key_pool(ht) _mht_set_key_pool((ht), __FILE__, __LINE__)
+#define mht_compact_keys(ht) _mht_compact_keys((ht), __FILE__, __LINE__)
+#define mht_freeze(ht) _mht_freeze((ht), __FILE__, __LINE__)
+#define mht_set_compression(ht, threshold) _mht_set_compression((ht), (threshold), __FILE__, __LINE__)
+#define mht_set_dedup(ht) _mht_set_dedup((ht), __FILE__, __LINE__)
+#define mht_set_change_log(ht, capacity) _mht_set_change_log((ht), (capacity), __FILE__, __LINE__)
+#define mht_change_seq(ht) _mht_change_seq((ht), __FILE__, __LINE__)
+#define mht_changes_since(ht, seq, callback, arg) _mht_changes_since((ht), (seq), (callback), (arg), __FILE__, __LINE__)
+#define mht_set_compact(ht) _mht_set_compact((ht), __FILE__, __LINE__)
+#define mht_set_cuckoo(ht) _mht_set_cuckoo((ht), __FILE__, __LINE__)
+#define mht_split_create(size) _mht_split_create((size), __FILE__, __LINE__)
+#define mht_split_set(ht, key, value_data, value_size) _mht_split_set((ht), (key), (value_data), (value_size), __FILE__, __LINE__)
+#define mht_split_get(ht, key) _mht_split_get((ht), (key), __FILE__, __LINE__)
+#define mht_split_delete(ht, key) _mht_split_delete((ht), (key), __FILE__, __LINE__)
+#define mht_split_read_begin(ht, token) _mht_split_read_begin((ht), (token), __FILE__, __LINE__)
+#define mht_split_read_end(ht, token) _mht_split_read_end((ht), (token), __FILE__, __LINE__)
+#define mht_tuple_set_raw(ht, key, value_data) _mht_tuple_set_raw((ht), (key), (value_data), __FILE__, __LINE__)
 
 
 /*
@@ -116,11 +181,134 @@ typedef struct {
  */
 #define STR_KEY_LITERAL(s) (str_keyt){ .ptr = (s), .len = sizeof(s) - 1 }
 
+/*
+ * mht_intern assigns IDs starting from 1 and returns MHT_INTERN_NONE on failure,
+ * so MHT_INTERN_NONE can also be used by the caller to mean "no string".
+ */
+#define MHT_INTERN_NONE 0
+
+
+/*
+ * Tuple keys are fixed-width keys made of several uint_keyt words, such as a
+ * (tenant_id, object_id) pair or a 128-bit identifier. The width is declared when
+ * the table is created with mht_tuple_create and every key passed to the
+ * mht_tuple_* family of functions must point to exactly that many words.
+ * Keys are compared word by word and are stored inside the entry itself.
+ */
+#define TUPLE_KEY_MAX_WORDS 16
+
+/*
+ * The TUPLE_KEY(a, b, ...) macro creates a temporary tuple key from its arguments,
+ * for example mht_tuple_get(ht, TUPLE_KEY(tenant_id, object_id)).
+ * The number of arguments must match the width of the table.
+ */
+#define TUPLE_KEY(...) ((const uint_keyt[]){ __VA_ARGS__ })
+
 
 /* MHashTable* is used as a handle to a hashtable. */
 typedef struct MHashTable MHashTable;
 
 
+/*
+ * MHtInitOptions is passed to mht_init. A value of 0 selects the default for that member.
+ * expected_tables: number of hashtables expected to exist at the same time
+ * expected_all_get_arrays: number of arrays returned by mht_all_get expected to be held at the same time
+ */
+typedef struct {
+	size_t expected_tables;
+	size_t expected_all_get_arrays;
+} MHtInitOptions;
+
+
+/*
+ * MHtHugePageMode selects how large bucket arrays are backed, see mht_set_huge_pages.
+ * MHT_HUGE_PAGE_OFF: always use calloc (default)
+ * MHT_HUGE_PAGE_TRANSPARENT: use mmap and ask for transparent huge pages with madvise
+ * MHT_HUGE_PAGE_EXPLICIT: use mmap with MAP_HUGETLB, falling back to transparent huge pages
+ * when no huge pages are reserved
+ */
+typedef enum {
+	MHT_HUGE_PAGE_OFF,
+	MHT_HUGE_PAGE_TRANSPARENT,
+	MHT_HUGE_PAGE_EXPLICIT
+} MHtHugePageMode;
+
+
+/*
+ * MHtMergePolicy decides what mht_merge and mht_merge_consume do with a key present in both hashtables.
+ * MHT_MERGE_KEEP_DST: keep the value already in the destination
+ * MHT_MERGE_TAKE_SRC: replace it with the value from the source
+ * MHT_MERGE_COMBINE: call the combine function, which folds the source value into the destination value in place
+ */
+typedef enum {
+	MHT_MERGE_KEEP_DST,
+	MHT_MERGE_TAKE_SRC,
+	MHT_MERGE_COMBINE
+} MHtMergePolicy;
+
+
+/*
+ * MHtMergeCombine is called with the global lock held and must not call any mht_* function.
+ * dst_size and src_size are 0 for values stored in raw mode.
+ */
+typedef void (*MHtMergeCombine)(void* dst_value, size_t dst_size, const void* src_value, size_t src_size, void* arg);
+
+
+/*
+ * MHtKeyCount is one row of the report produced by mht_top_keys.
+ * Only the member of key that matches the key type of the hashtable is meaningful.
+ * String and tuple keys point to copies owned by the report, which must be released
+ * with mht_top_keys_release; key_mem is used for that purpose and must not be modified.
+ */
+typedef struct {
+	union {
+		uint_keyt uint;
+		uint32_t uint32;
+		str_keyt str;
+		const uint_keyt* tuple;
+	} key;
+	uint64_t count;  /* approximate number of accesses */
+	uint64_t error;  /* count may be overestimated by at most this amount */
+	void* key_mem;
+} MHtKeyCount;
+
+
+/*
+ * MHtChangeType is the kind of modification recorded in the change log of a hashtable.
+ * MHT_CHANGE_SET: a value was added or replaced
+ * MHT_CHANGE_DELETE: a key was deleted
+ * MHT_CHANGE_CLEAR: all entries were removed, key is not meaningful
+ */
+typedef enum {
+	MHT_CHANGE_SET,
+	MHT_CHANGE_DELETE,
+	MHT_CHANGE_CLEAR
+} MHtChangeType;
+
+
+/*
+ * MHtChange is one event passed to an MHtChangeCallback by mht_changes_since.
+ * Only the member of key that matches the key type of the hashtable is meaningful.
+ * String and tuple keys point to copies owned by the change log and are only valid during the callback.
+ */
+typedef struct {
+	uint64_t seq;  /* sequence number of the change, starting at 1 */
+	MHtChangeType type;
+	union {
+		uint_keyt uint;
+		uint32_t uint32;
+		str_keyt str;
+		const uint_keyt* tuple;
+	} key;
+} MHtChange;
+
+
+/*
+ * MHtChangeCallback is called with the global lock held and must not call any mht_* function.
+ */
+typedef void (*MHtChangeCallback)(const MHtChange* change, void* arg);
+
+
 /*
  * mht_errfunc is a global variable that stores the name of the function
  * where the most recent error occurred within this library.
@@ -139,6 +327,36 @@ typedef struct MHashTable MHashTable;
 #endif
 
 
+/*
+ * _mht_init
+ * @param options: expected usage of the library, or NULL for the defaults
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: Calling this function is optional. Without it, the library initializes itself inside the first create function, which then pays for allocating its internal registry and registering the exit handler. This function does that work up front and sizes the registry for options->expected_tables hashtables, so creating up to that many hashtables never grows the registry. Unlike the implicit initialization, a failure is reported through the return value instead of terminating the process. If the library is already initialized, the registry is only grown to fit the expected counts
+ */
+extern bool _mht_init (const MHtInitOptions* options, const char* file, int line);
+
+/*
+ * _mht_intern
+ * @param key: string to intern
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: ID of the string, or MHT_INTERN_NONE on failure
+ * @note: This function returns the same small integer ID every time it is given a string with the same contents. The first time a string is seen, it is copied once into an append-only arena shared by the whole library, so tables keyed by the IDs (for example with mht_uint32_create) do not each keep their own copy of the string. Interned strings are never removed and are released when the program exits
+ */
+extern uint32_t _mht_intern (str_keyt key, const char* file, int line);
+
+/*
+ * _mht_intern_lookup
+ * @param id: ID returned by mht_intern
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: the interned string, or STR_KEYT_INVALID if the ID is unknown
+ * @note: The returned pointer refers to the arena, stays valid until the program exits and must not be modified. The string is null-terminated
+ */
+extern str_keyt _mht_intern_lookup (uint32_t id, const char* file, int line);
+
 /*
  * _mht_uint_create
  * @param size: initial size of the hashtable, it will automatically round up and display a message if size isn't a power of 2
@@ -159,6 +377,37 @@ extern MHashTable* _mht_uint_create (size_t size, const char* file, int line);
  */
 extern MHashTable* _mht_str_create (size_t size, const char* file, int line);
 
+/*
+ * _mht_uint32_create
+ * @param size: initial size of the hashtable, it will automatically round up and display a message if size isn't a power of 2
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the created hashtable
+ * @note: This function creates a hashtable that uses 32-bit unsigned integer keys. The key and the value size are packed together so each entry is noticeably smaller than in a uint_keyt hashtable on 64-bit platforms; in exchange, values copied by mht_uint32_set must be smaller than 4 GiB. The hashtable automatically expands when the number of entries becomes too large. However, for performance reasons, it is recommended to set the initial size based on the expected number of entries
+ */
+extern MHashTable* _mht_uint32_create (size_t size, const char* file, int line);
+
+/*
+ * _mht_tuple_create
+ * @param size: initial size of the hashtable, it will automatically round up and display a message if size isn't a power of 2
+ * @param key_words: number of uint_keyt words in each key, from 1 to TUPLE_KEY_MAX_WORDS (use 2 for 128-bit keys on 64-bit platforms)
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the created hashtable
+ * @note: This function creates a hashtable that uses fixed-width tuple keys. The hashtable automatically expands when the number of entries becomes too large. However, for performance reasons, it is recommended to set the initial size based on the expected number of entries
+ */
+extern MHashTable* _mht_tuple_create (size_t size, size_t key_words, const char* file, int line);
+
+/*
+ * _mht_split_create
+ * @param size: initial number of buckets, it will automatically round up and display a message if size isn't a power of 2
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the created hashtable, or NULL if an error occurred (split-ordered hashtables require C11 atomics)
+ * @note: This function creates a uint_keyt hashtable backed by a split-ordered list, which keeps every entry in one list sorted by bit-reversed hash and lazily adds buckets as shortcuts into it. Expanding only doubles the number of buckets, so the hashtable never stops to rehash, and mht_split_set, mht_split_get and mht_split_delete work without taking the global lock while it grows. The regular uint functions, mht_all_get and the destroy functions also accept the hashtable. Deleted entries and replaced values are freed by later writes once every lock-free operation that could still be reading them has finished. NUMA replicas, the read cache and access tracking are not supported
+ */
+extern MHashTable* _mht_split_create (size_t size, const char* file, int line);
+
 /*
  * _mht_destroy
  * @param ht: pointer to the hashtable to destroy
@@ -177,6 +426,62 @@ extern void _mht_destroy (MHashTable* ht, const char* file, int line);
  */
 extern void _mht_destroy_without_value (MHashTable* ht, const char* file, int line);
 
+/*
+ * _mht_destroy_async
+ * @param ht: pointer to the hashtable to destroy
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @note: This function destroys the hashtable along with the stored values like mht_destroy, but holds the global lock only long enough to unregister the hashtable. The entries, keys and values are then freed by a detached background thread, so tearing down a large hashtable does not stall other threads. Hashtables with fewer than 4096 entries, or when a thread cannot be started, are freed by the calling thread after the lock is released. The hashtable must not be used once this function is called
+ */
+extern void _mht_destroy_async (MHashTable* ht, const char* file, int line);
+
+/*
+ * _mht_clear
+ * @param ht: pointer to the hashtable to clear
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @note: This function deletes every entry along with the stored values but keeps the hashtable itself. The bucket array and, in compact mode, the entry pool keep their current size, so refilling the hashtable with a similar number of entries does not expand it again. Options set on the hashtable stay in effect. Split-ordered hashtables free the cleared entries right away unless other threads are inside lock-free operations, in which case the entries are freed by a later set or delete
+ */
+extern void _mht_clear (MHashTable* ht, const char* file, int line);
+
+/*
+ * _mht_clone
+ * @param ht: pointer to the hashtable to copy
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to a new, independent hashtable holding copies of every key and value, or NULL on failure
+ * @note: The copy has the same number of buckets and the same options (cuckoo or compact mode, pointer keys, huge pages, read cache) and is built directly from the buckets without hashing any key again. Large hashtables are copied by several threads at once. NUMA replicas and access tracking are not copied. Split-ordered hashtables cannot be cloned, and hashtables holding values stored in raw mode fail with EINVAL because the size of those values is unknown. The returned hashtable must be destroyed separately
+ */
+extern MHashTable* _mht_clone (MHashTable* ht, const char* file, int line);
+
+/*
+ * _mht_merge
+ * @param dst: pointer to the hashtable that receives the entries
+ * @param src: pointer to the hashtable whose entries are copied, it is not modified
+ * @param policy: what to do with keys present in both hashtables
+ * @param combine: function used with MHT_MERGE_COMBINE, may be NULL with the other policies
+ * @param arg: passed unchanged to combine
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true on success, false on failure
+ * @note: This function copies every key and value of src into dst under a single acquisition of the global lock. The bucket array of dst is grown once up front to hold both hashtables. Both hashtables must have the same key type. Values stored in raw mode cannot be copied and make the merge fail with EINVAL. On failure, dst keeps the entries merged so far. Split-ordered hashtables and a dst with NUMA replicas are not supported
+ */
+extern bool _mht_merge (MHashTable* dst, MHashTable* src, MHtMergePolicy policy, MHtMergeCombine combine, void* arg, const char* file, int line);
+
+/*
+ * _mht_merge_consume
+ * @param dst: pointer to the hashtable that receives the entries
+ * @param src: pointer to the hashtable whose entries are moved, it is left empty on success
+ * @param policy: what to do with keys present in both hashtables
+ * @param combine: function used with MHT_MERGE_COMBINE, may be NULL with the other policies
+ * @param arg: passed unchanged to combine
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true on success, false on failure
+ * @note: Like mht_merge, but values are handed over to dst without being copied, and values stored in raw mode are accepted. When both hashtables use chaining, whole entries are moved from src to dst and the merge cannot fail once the bucket array of dst has been grown. Source values that are not taken are freed. On failure, the entries not yet merged stay in src. The src hashtable itself stays valid and must still be destroyed. Split-ordered hashtables and hashtables with NUMA replicas are not supported
+ */
+extern bool _mht_merge_consume (MHashTable* dst, MHashTable* src, MHtMergePolicy policy, MHtMergeCombine combine, void* arg, const char* file, int line);
+
 /*
  * _mht_uint_set
  * @param ht: pointer to the hashtable
@@ -201,6 +506,30 @@ extern bool _mht_uint_set (MHashTable* ht, uint_keyt key, void* value_data, size
  */
 extern bool _mht_str_set (MHashTable* ht, str_keyt key, void* value_data, size_t value_size, const char* file, int line);
 
+/*
+ * _mht_uint32_set
+ * @param ht: pointer to the hashtable
+ * @param key: key to set
+ * @param value_data: pointer to the value data
+ * @param value_size: size of the value data, must not exceed UINT32_MAX
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ */
+extern bool _mht_uint32_set (MHashTable* ht, uint32_t key, void* value_data, size_t value_size, const char* file, int line);
+
+/*
+ * _mht_tuple_set
+ * @param ht: pointer to the hashtable
+ * @param key: pointer to the key words to set, the number of words must match the width of the hashtable
+ * @param value_data: pointer to the value data
+ * @param value_size: size of the value data
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ */
+extern bool _mht_tuple_set (MHashTable* ht, const uint_keyt* key, void* value_data, size_t value_size, const char* file, int line);
+
 /*
  * _mht_uint_get
  * @param ht: pointer to the hashtable
@@ -221,6 +550,182 @@ extern void* _mht_uint_get (MHashTable* ht, uint_keyt key, const char* file, int
  */
 extern void* _mht_str_get (MHashTable* ht, str_keyt key, const char* file, int line);
 
+/*
+ * _mht_uint32_get
+ * @param ht: pointer to the hashtable
+ * @param key: key to get
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the value data, or NULL if not found or an error occurred
+ */
+extern void* _mht_uint32_get (MHashTable* ht, uint32_t key, const char* file, int line);
+
+/*
+ * _mht_tuple_get
+ * @param ht: pointer to the hashtable
+ * @param key: pointer to the key words to get, the number of words must match the width of the hashtable
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the value data, or NULL if not found or an error occurred
+ */
+extern void* _mht_tuple_get (MHashTable* ht, const uint_keyt* key, const char* file, int line);
+
+/*
+ * _mht_uint_try_set
+ * @param ht: pointer to the hashtable
+ * @param key: key to set
+ * @param value_data: pointer to the value data
+ * @param value_size: size of the value data
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: Like _mht_uint_set, but returns false with errno set to EWOULDBLOCK instead of waiting when another thread holds or is waiting for the global lock, so the caller can retry the operation later. The value is written directly even while flat combining is enabled. Without C11 atomics this function always fails with ENOSYS
+ */
+extern bool _mht_uint_try_set (MHashTable* ht, uint_keyt key, void* value_data, size_t value_size, const char* file, int line);
+
+/*
+ * _mht_str_try_set
+ * @param ht: pointer to the hashtable
+ * @param key: key to set
+ * @param value_data: pointer to the value data
+ * @param value_size: size of the value data
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: non-blocking variant of _mht_str_set, see _mht_uint_try_set
+ */
+extern bool _mht_str_try_set (MHashTable* ht, str_keyt key, void* value_data, size_t value_size, const char* file, int line);
+
+/*
+ * _mht_uint32_try_set
+ * @param ht: pointer to the hashtable
+ * @param key: key to set
+ * @param value_data: pointer to the value data
+ * @param value_size: size of the value data, must not exceed UINT32_MAX
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: non-blocking variant of _mht_uint32_set, see _mht_uint_try_set
+ */
+extern bool _mht_uint32_try_set (MHashTable* ht, uint32_t key, void* value_data, size_t value_size, const char* file, int line);
+
+/*
+ * _mht_tuple_try_set
+ * @param ht: pointer to the hashtable
+ * @param key: pointer to the key words to set, the number of words must match the width of the hashtable
+ * @param value_data: pointer to the value data
+ * @param value_size: size of the value data
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: non-blocking variant of _mht_tuple_set, see _mht_uint_try_set
+ */
+extern bool _mht_tuple_try_set (MHashTable* ht, const uint_keyt* key, void* value_data, size_t value_size, const char* file, int line);
+
+/*
+ * _mht_uint_try_get
+ * @param ht: pointer to the hashtable
+ * @param key: key to get
+ * @param out_value: pointer to store the value data, set to NULL if not found or an error occurred
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if the lookup was performed, false if the global lock was busy or out_value is NULL
+ * @note: Like _mht_uint_get, but returns false with errno set to EWOULDBLOCK instead of waiting when another thread holds or is waiting for the global lock. Values found in the read cache are returned without taking the lock at all. Without C11 atomics this function fails with ENOSYS unless the value is found in the read cache
+ */
+extern bool _mht_uint_try_get (MHashTable* ht, uint_keyt key, void** out_value, const char* file, int line);
+
+/*
+ * _mht_str_try_get
+ * @param ht: pointer to the hashtable
+ * @param key: key to get
+ * @param out_value: pointer to store the value data, set to NULL if not found or an error occurred
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if the lookup was performed, false if the global lock was busy or out_value is NULL
+ * @note: non-blocking variant of _mht_str_get, see _mht_uint_try_get
+ */
+extern bool _mht_str_try_get (MHashTable* ht, str_keyt key, void** out_value, const char* file, int line);
+
+/*
+ * _mht_uint32_try_get
+ * @param ht: pointer to the hashtable
+ * @param key: key to get
+ * @param out_value: pointer to store the value data, set to NULL if not found or an error occurred
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if the lookup was performed, false if the global lock was busy or out_value is NULL
+ * @note: non-blocking variant of _mht_uint32_get, see _mht_uint_try_get
+ */
+extern bool _mht_uint32_try_get (MHashTable* ht, uint32_t key, void** out_value, const char* file, int line);
+
+/*
+ * _mht_tuple_try_get
+ * @param ht: pointer to the hashtable
+ * @param key: pointer to the key words to get, the number of words must match the width of the hashtable
+ * @param out_value: pointer to store the value data, set to NULL if not found or an error occurred
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if the lookup was performed, false if the global lock was busy or out_value is NULL
+ * @note: non-blocking variant of _mht_tuple_get, see _mht_uint_try_get
+ */
+extern bool _mht_tuple_try_get (MHashTable* ht, const uint_keyt* key, void** out_value, const char* file, int line);
+
+/*
+ * _mht_uint_get_copy
+ * @param ht: pointer to the hashtable
+ * @param key: key to get
+ * @param buffer: buffer to copy the value data into, may be NULL if buffer_size is 0
+ * @param buffer_size: size of the buffer
+ * @param out_size: pointer to store the size of the value data
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if the value was copied, false otherwise
+ * @note: This function copies the value into a buffer owned by the caller, decompressing it if the hashtable stored it compressed (see _mht_set_compression). If the buffer is too small, nothing is copied, the required size is still stored in out_size and the function fails with ERANGE without printing a message, so calling it with a buffer_size of 0 queries the size. Raw values and the values of split-ordered or frozen hashtables cannot be copied out
+ */
+extern bool _mht_uint_get_copy (MHashTable* ht, uint_keyt key, void* buffer, size_t buffer_size, size_t* out_size, const char* file, int line);
+
+/*
+ * _mht_str_get_copy
+ * @param ht: pointer to the hashtable
+ * @param key: key to get
+ * @param buffer: buffer to copy the value data into, may be NULL if buffer_size is 0
+ * @param buffer_size: size of the buffer
+ * @param out_size: pointer to store the size of the value data
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if the value was copied, false otherwise
+ * @note: copy-out variant of _mht_str_get, see _mht_uint_get_copy
+ */
+extern bool _mht_str_get_copy (MHashTable* ht, str_keyt key, void* buffer, size_t buffer_size, size_t* out_size, const char* file, int line);
+
+/*
+ * _mht_uint32_get_copy
+ * @param ht: pointer to the hashtable
+ * @param key: key to get
+ * @param buffer: buffer to copy the value data into, may be NULL if buffer_size is 0
+ * @param buffer_size: size of the buffer
+ * @param out_size: pointer to store the size of the value data
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if the value was copied, false otherwise
+ * @note: copy-out variant of _mht_uint32_get, see _mht_uint_get_copy
+ */
+extern bool _mht_uint32_get_copy (MHashTable* ht, uint32_t key, void* buffer, size_t buffer_size, size_t* out_size, const char* file, int line);
+
+/*
+ * _mht_tuple_get_copy
+ * @param ht: pointer to the hashtable
+ * @param key: pointer to the key words to get, the number of words must match the width of the hashtable
+ * @param buffer: buffer to copy the value data into, may be NULL if buffer_size is 0
+ * @param buffer_size: size of the buffer
+ * @param out_size: pointer to store the size of the value data
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if the value was copied, false otherwise
+ * @note: copy-out variant of _mht_tuple_get, see _mht_uint_get_copy
+ */
+extern bool _mht_tuple_get_copy (MHashTable* ht, const uint_keyt* key, void* buffer, size_t buffer_size, size_t* out_size, const char* file, int line);
+
 /*
  * _mht_all_get
  * @param ht: pointer to the hashtable
@@ -262,6 +767,276 @@ extern bool _mht_uint_delete (MHashTable* ht, uint_keyt key, const char* file, i
  */
 extern bool _mht_str_delete (MHashTable* ht, str_keyt key, const char* file, int line);
 
+/*
+ * _mht_uint32_delete
+ * @param ht: pointer to the hashtable
+ * @param key: key to delete
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ */
+extern bool _mht_uint32_delete (MHashTable* ht, uint32_t key, const char* file, int line);
+
+/*
+ * _mht_tuple_delete
+ * @param ht: pointer to the hashtable
+ * @param key: pointer to the key words to delete, the number of words must match the width of the hashtable
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ */
+extern bool _mht_tuple_delete (MHashTable* ht, const uint_keyt* key, const char* file, int line);
+
+/*
+ * _mht_set_huge_pages
+ * @param ht: pointer to the hashtable
+ * @param mode: how to back bucket arrays of 2 MiB or more
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: Huge pages reduce TLB misses for hashtables with millions of buckets. The mode applies to the current bucket array if it is already large enough and to every array allocated by later expansions. Smaller arrays, platforms other than Linux, and failed mappings silently fall back to calloc
+ */
+extern bool _mht_set_huge_pages (MHashTable* ht, MHtHugePageMode mode, const char* file, int line);
+
+/*
+ * _mht_set_cuckoo
+ * @param ht: pointer to an empty hashtable
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: This function switches the hashtable from chaining to bucketized cuckoo hashing, and is meant to be called right after creation. Each key may live in one of two buckets of four slots, and each slot has a one-byte tag, so a lookup inspects at most two buckets and a small stash, and keys are compared only when their tags match. Inserts into full buckets move existing entries along the shortest path found by a breadth-first search. The hashtable fills to about 95% before it expands, instead of 75%. Keys whose full hashes collide share the same two buckets, so once those and the stash are full the stash grows instead of the hashtable expanding again and again; lookups of such keys scan the stash linearly, as a chain would. All key types are supported, but hashtables with pointer keys cannot switch to cuckoo hashing
+ */
+extern bool _mht_set_cuckoo (MHashTable* ht, const char* file, int line);
+
+/*
+ * _mht_set_compact
+ * @param ht: pointer to an empty hashtable
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: This function switches the hashtable to compact mode, and is meant to be called right after creation. Entries are kept in one contiguous pool, and bucket heads and chains are linked by 32-bit indices instead of pointers. This halves the bucket array and removes the per-entry allocation overhead, at the cost of a limit of UINT32_MAX entries. The pool grows by doubling and is not shrunk when entries are deleted; freed entries are reused by later inserts. Hashtables with ordered pointer keys cannot switch to compact mode
+ */
+extern bool _mht_set_compact (MHashTable* ht, const char* file, int line);
+
+/*
+ * _mht_set_pointer_keys
+ * @param ht: pointer to an empty uint hashtable
+ * @param ordered: true to keep each chain sorted by key so that lookups of missing keys stop early
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: This function is meant for hashtables keyed by object pointers cast to uint_keyt. Instead of the full integer hash, the keys are hashed by dropping the low bits that are always zero because of malloc alignment, multiplying once by a golden-ratio constant and folding the high half into the low half. This costs far less than the full hash and still spreads pointers with coarser alignment, such as page-aligned ones, over all buckets. Keys that are not pointers may distribute poorly. Cuckoo and split-ordered hashtables are not supported, and compact hashtables support it only with ordered set to false
+ */
+extern bool _mht_set_pointer_keys (MHashTable* ht, bool ordered, const char* file, int line);
+
+/*
+ * _mht_set_key_pool
+ * @param ht: pointer to an empty str hashtable
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: This function makes the hashtable store its string keys packed into large pages owned by the hashtable instead of allocating each key separately. This saves the allocator overhead of every key and keeps the key bytes close together. The space of deleted keys is not reused until it is reclaimed by mht_compact_keys, or automatically when the bucket array is expanded and more than half of the page space belongs to deleted keys. Clearing the hashtable releases all pages. Large chained hashtables that use a key pool are cloned by a single thread
+ */
+extern bool _mht_set_key_pool (MHashTable* ht, const char* file, int line);
+
+/*
+ * _mht_compact_keys
+ * @param ht: pointer to a hashtable that uses a key pool
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: This function copies the keys that are still in use into a single new page and frees the old pages, reclaiming the space left by deleted keys. On failure the hashtable keeps using its old pages
+ */
+extern bool _mht_compact_keys (MHashTable* ht, const char* file, int line);
+
+/*
+ * _mht_freeze
+ * @param ht: pointer to a str hashtable
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: This function turns the hashtable into a read-only form meant for large sets of similar string keys such as URLs and paths. The keys are sorted and stored in blocks of 16, where every key after the first one of a block only keeps the bytes that differ from the previous key, and a sparse index of the blocks is searched by binary search. This uses far less memory than separately allocated keys and entries, at the cost of a little more work per lookup. The values are kept as they are. After freezing, set and delete functions fail with EINVAL, while get, all_get, clear and destroy work as usual. Frozen hashtables cannot be cloned or merged, and hashtables with NUMA replicas cannot be frozen. Freezing an already frozen hashtable does nothing
+ */
+extern bool _mht_freeze (MHashTable* ht, const char* file, int line);
+
+/*
+ * _mht_set_compression
+ * @param ht: pointer to an empty hashtable
+ * @param threshold: values of at least this many bytes are compressed, 0 turns compression off
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: This function makes the set functions compress copied values of at least threshold bytes with a built-in LZ77 codec in the style of LZ4, which suits text such as JSON. A value is kept uncompressed when compressing does not make it smaller. Compressed values can only be read with the copy-out get functions such as _mht_uint_get_copy; the pointer-returning get functions fail with EINVAL for them, and _mht_all_get fails on hashtables with compression turned on. Compressed hashtables cannot be merged or frozen. uint32 keyed, split-ordered and replicated hashtables do not support this option
+ */
+extern bool _mht_set_compression (MHashTable* ht, size_t threshold, const char* file, int line);
+
+/*
+ * _mht_set_dedup
+ * @param ht: pointer to an empty hashtable
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: This function makes the hashtable store each distinct value only once. Values copied by the set functions are hashed and looked up in a value store owned by the hashtable; keys whose values are byte-identical share a single reference-counted copy, and set and delete adjust the reference counts. This saves memory when many keys map to the same data, at the cost of hashing and comparing every value on set. Because the copies are shared, values returned by the get functions must not be modified. Destroying the hashtable frees the stored values even with _mht_destroy_without_value, while raw values are handled as usual. Deduplicated hashtables cannot be merged or frozen, and compression, NUMA replicas and split-ordered hashtables do not support this option
+ */
+extern bool _mht_set_dedup (MHashTable* ht, const char* file, int line);
+
+/*
+ * _mht_set_change_log
+ * @param ht: pointer to the hashtable
+ * @param capacity: number of most recent changes to keep, 0 turns the change log off
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: This function makes the hashtable record every successful set, delete and clear, including those made by merges, in a ring buffer of the given capacity. Each change gets a sequence number one larger than the previous one, so downstream consumers such as derived indexes and replicas can follow the hashtable with _mht_changes_since instead of re-reading it with _mht_all_get. Values are not recorded; a consumer reads the current value with a get function. Calling this function again discards the recorded changes but keeps the numbering. Split-ordered hashtables do not support this option
+ */
+extern bool _mht_set_change_log (MHashTable* ht, size_t capacity, const char* file, int line);
+
+/*
+ * _mht_change_seq
+ * @param ht: pointer to a hashtable with a change log
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: sequence number of the latest change, 0 if there has been no change yet or an error occurred
+ * @note: A consumer starting from scratch should call this function before reading the whole hashtable, and then pass the result to _mht_changes_since. Changes made in between are reported again, which is harmless because sets and deletes can be replayed
+ */
+extern uint64_t _mht_change_seq (MHashTable* ht, const char* file, int line);
+
+/*
+ * _mht_changes_since
+ * @param ht: pointer to a hashtable with a change log
+ * @param seq: sequence number of the last change the caller has already seen
+ * @param callback: function called for each later change, in order
+ * @param arg: passed unchanged to callback
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if all changes after seq were reported, false otherwise
+ * @note: If changes after seq have already been overwritten in the ring buffer, this function reports nothing and fails with ERANGE; the caller must then read the whole hashtable again, starting from _mht_change_seq. The same happens if a change could not be recorded because memory ran out. A seq larger than the latest sequence number fails with EINVAL
+ */
+extern bool _mht_changes_since (MHashTable* ht, uint64_t seq, MHtChangeCallback callback, void* arg, const char* file, int line);
+
+/*
+ * _mht_set_numa_replicas
+ * @param ht: pointer to an empty hashtable
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: This function gives the hashtable one replica per NUMA node the calling thread may use, each allocated while set_mempolicy prefers that node. The placement is best effort: the kernel falls back to other nodes when the preferred one is short of memory, and the allocator may hand out memory from pages that were already placed elsewhere. Reads are served from the replica of the reading thread's node, so lookups mostly stay off the interconnect; in exchange every set and delete is applied to all replicas and memory use grows with the number of nodes. Values must be copied with the non-raw set functions, and hashtables with compression or deduplication turned on cannot have replicas. A pointer returned by a get function refers to the copy held by the caller's replica. On machines with a single node this function does nothing, and it fails with ENOSYS on platforms other than Linux
+ */
+extern bool _mht_set_numa_replicas (MHashTable* ht, const char* file, int line);
+
+/*
+ * mht_numa_prefer_node
+ * @param node: NUMA node whose replica the calling thread should read from, or -1 to use the node the thread is running on
+ * @return: true if successful, false otherwise
+ * @note: The node of a thread is cached and looked up again only every 4096 reads, so a thread that migrates to another socket keeps reading the old replica until the next lookup. Threads that are moved often, or that know their node in advance, can call this function instead. The setting applies to every hashtable with NUMA replicas and falls back to the first replica if the hashtable has no replica on the given node
+ */
+extern bool mht_numa_prefer_node (int node);
+
+/*
+ * _mht_set_access_tracking
+ * @param ht: pointer to the hashtable
+ * @param capacity: number of keys to track, or 0 to stop tracking
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: Tracking counts every get and set of the hashtable with the Space-Saving algorithm, which keeps the capacity most frequently accessed keys in a fixed amount of memory. Any key accessed more than (total accesses / capacity) times is guaranteed to be tracked. Calling this function again discards the counts collected so far. While tracking is enabled, lookups of the hashtable are not served from the read cache so that all of them are counted
+ */
+extern bool _mht_set_access_tracking (MHashTable* ht, size_t capacity, const char* file, int line);
+
+/*
+ * _mht_top_keys
+ * @param ht: pointer to the hashtable
+ * @param k: maximum number of keys to report
+ * @param out: array of at least k elements that receives the keys in order of decreasing count
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: number of keys written to out, 0 if none were tracked or an error occurred
+ * @note: the reported keys must be released with mht_top_keys_release when they are no longer needed
+ */
+extern size_t _mht_top_keys (MHashTable* ht, size_t k, MHtKeyCount* out, const char* file, int line);
+
+/*
+ * mht_top_keys_release
+ * @param keys: array previously filled by mht_top_keys
+ * @param count: number of elements filled, as returned by mht_top_keys
+ */
+extern void mht_top_keys_release (MHtKeyCount* keys, size_t count);
+
+/*
+ * _mht_set_read_cache
+ * @param ht: pointer to the hashtable
+ * @param enable: true to cache successful lookups of this hashtable per thread, false to stop caching
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise (the read cache requires C11 atomics and thread-local storage)
+ * @note: Each thread keeps a small direct-mapped cache of recent lookups, consulted by the get functions before taking the lock, so repeated reads of hot keys skip both the lock and the probe. Every set, delete and expansion of the hashtable invalidates its cached lookups immediately. Cache hits never read the hashtable itself, only a small version counter that is kept alive after the hashtable is destroyed, so a hashtable later created at the same address never sees stale entries. String keys longer than 32 bytes and tuple keys wider than 32 bytes are never cached
+ */
+extern bool _mht_set_read_cache (MHashTable* ht, bool enable, const char* file, int line);
+
+/*
+ * mht_set_flat_combining
+ * @param enable: true to route set, set_raw and delete calls through flat combining, false to return to taking the lock for each call
+ * @return: true if successful, false otherwise (flat combining requires C11 atomics and thread-local storage)
+ * @note: In flat combining mode a writing thread publishes its request in a per-thread slot, and whichever thread becomes the combiner takes the lock once and executes every pending request in a batch while the others wait for their slot to complete. Under heavy write contention this cuts lock handoffs and keeps the hashtables in the combiner's cache. The setting applies to all hashtables and may be changed at any time. The slot of a thread that exits is reused by the next thread that writes in this mode
+ */
+extern bool mht_set_flat_combining (bool enable);
+
+/*
+ * _mht_split_set
+ * @param ht: pointer to a hashtable created with mht_split_create
+ * @param key: key to set
+ * @param value_data: pointer to the value data
+ * @param value_size: size of the value data
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: this function does not take the global lock and therefore cannot check that the hashtable has not been destroyed
+ */
+extern bool _mht_split_set (MHashTable* ht, uint_keyt key, void* value_data, size_t value_size, const char* file, int line);
+
+/*
+ * _mht_split_get
+ * @param ht: pointer to a hashtable created with mht_split_create
+ * @param key: key to get
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the value data, or NULL if not found or an error occurred
+ * @note: the returned pointer stays valid until the key is set again or deleted. To keep it valid while other threads may replace or delete the key, call this function between _mht_split_read_begin and _mht_split_read_end
+ */
+extern void* _mht_split_get (MHashTable* ht, uint_keyt key, const char* file, int line);
+
+/*
+ * _mht_split_delete
+ * @param ht: pointer to a hashtable created with mht_split_create
+ * @param key: key to delete
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: the memory of the deleted entry is released by a later set or delete once no thread can still be reading it
+ */
+extern bool _mht_split_delete (MHashTable* ht, uint_keyt key, const char* file, int line);
+
+/*
+ * _mht_split_read_begin
+ * @param ht: pointer to a hashtable created with mht_split_create
+ * @param token: pointer to store the token to pass to _mht_split_read_end
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: Until the matching _mht_split_read_end, no entry or value of the hashtable is freed, so pointers returned by _mht_split_get stay valid even if other threads set or delete the keys. Sections may be nested. Keep them short, because memory retired by other threads piles up while a section is open. This function does not take the global lock
+ */
+extern bool _mht_split_read_begin (MHashTable* ht, size_t* token, const char* file, int line);
+
+/*
+ * _mht_split_read_end
+ * @param ht: pointer to a hashtable created with mht_split_create
+ * @param token: token stored by _mht_split_read_begin
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @note: pointers returned by _mht_split_get inside the section must not be used after this call
+ */
+extern void _mht_split_read_end (MHashTable* ht, size_t token, const char* file, int line);
+
 /*
  * mht_str_key_equal
  * @param a: first key to compare
@@ -303,6 +1078,30 @@ extern bool _mht_uint_set_raw (MHashTable* ht, uint_keyt key, void* value_data,
  */
 extern bool _mht_str_set_raw (MHashTable* ht, str_keyt key, void* value_data, const char* file, int line);
 
+/*
+ * _mht_uint32_set_raw
+ * @param ht: pointer to the hashtable
+ * @param key: key to set
+ * @param value_data: pointer to the value data
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: The use of this function is not recommended. Since this function sets the specified pointer directly as a value without copying the data, improper use of the mht_destroy and mht_destroy_without_value functions depending on the situation may lead to memory leaks or double frees
+ */
+extern bool _mht_uint32_set_raw (MHashTable* ht, uint32_t key, void* value_data, const char* file, int line);
+
+/*
+ * _mht_tuple_set_raw
+ * @param ht: pointer to the hashtable
+ * @param key: pointer to the key words to set, the number of words must match the width of the hashtable
+ * @param value_data: pointer to the value data
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if successful, false otherwise
+ * @note: The use of this function is not recommended. Since this function sets the specified pointer directly as a value without copying the data, improper use of the mht_destroy and mht_destroy_without_value functions depending on the situation may lead to memory leaks or double frees
+ */
+extern bool _mht_tuple_set_raw (MHashTable* ht, const uint_keyt* key, void* value_data, const char* file, int line);
+
 
 /*
  * The following functions are not part of this library's original purpose, but we
@@ -0,0 +1,197 @@
+/*
+ * tests/access_tracking.c -- tests for hot-key tracking with mht_top_keys
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define TRACKED 64
+#define HOT_KEYS 20
+#define ACCESSES 200000
+
+
+static uint32_t random_state = 1;
+
+/* 環境によって rand の結果が変わらないように、線形合同法で乱数を作る */
+static uint32_t next_random (void) {
+	random_state = random_state * 1103515245u + 12345u;
+	return random_state >> 16;
+}
+
+
+/* 報告された回数は真の回数を下回らず、誤差の範囲内で上回るだけで、合計は全アクセス数に一致する */
+static void test_uint_counts (void) {
+	static uint64_t truth[TEST_KEYS];
+
+	MHashTable* ht = mht_uint_create(4);  /* 追跡中に拡張させる */
+	CHECK(ht != NULL);
+	CHECK(mht_set_access_tracking(ht, TRACKED));
+
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		CHECK(mht_uint_set(ht, i, &i, sizeof(i)));
+		truth[i]++;
+	}
+
+	for (uint64_t i = 0; i < ACCESSES; i++) {
+		uint_keyt key = next_random() % TEST_KEYS;
+		if (next_random() % 2 != 0) key %= HOT_KEYS;
+		uint_keyt* value = mht_uint_get(ht, key);
+		CHECK(value != NULL && *value == key);
+		truth[key]++;
+	}
+
+	MHtKeyCount out[TRACKED];
+	size_t n = mht_top_keys(ht, TRACKED, out);
+	CHECK(n == TRACKED);
+
+	uint64_t sum = 0;
+	for (size_t i = 0; i < n; i++) {
+		uint_keyt key = out[i].key.uint;
+		CHECK(key < TEST_KEYS);
+		CHECK(truth[key] <= out[i].count && out[i].count - out[i].error <= truth[key]);
+		if (i != 0) CHECK(out[i].count <= out[i - 1].count);
+		sum += out[i].count;
+	}
+	CHECK(sum == TEST_KEYS + ACCESSES);
+
+	/* 全体の 1/64 より多くアクセスされたキーは必ず含まれる */
+	for (uint_keyt key = 0; key < HOT_KEYS; key++) {
+		bool found = false;
+		for (size_t i = 0; i < n; i++) found |= (out[i].key.uint == key);
+		CHECK(found);
+	}
+	mht_top_keys_release(out, n);
+
+	/* k が追跡数より小さければ上位 k 件だけが返る */
+	n = mht_top_keys(ht, 4, out);
+	CHECK(n == 4);
+	for (size_t i = 0; i < n; i++) CHECK(out[i].key.uint < HOT_KEYS);
+	mht_top_keys_release(out, n);
+
+	mht_destroy(ht);
+}
+
+
+static str_keyt str_key (char* buf, size_t buf_size, int i) {
+	int len = snprintf(buf, buf_size, "key%d", i);
+	CHECK(len > 0 && (size_t)len < buf_size);
+	return (str_keyt){ buf, (size_t)len };
+}
+
+
+/* 文字列とタプルのキーは報告の中に複製され、ハッシュテーブルから削除した後も読める */
+static void test_copied_keys (void) {
+	MHashTable* str_ht = mht_str_create(64);
+	MHashTable* tuple_ht = mht_tuple_create(64, 2);
+	CHECK(str_ht != NULL && tuple_ht != NULL);
+	CHECK(mht_set_access_tracking(str_ht, 8));
+	CHECK(mht_set_access_tracking(tuple_ht, 8));
+
+	char buf[32];
+	for (int i = 0; i < 100; i++) {
+		CHECK(mht_str_set(str_ht, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+		CHECK(mht_tuple_set(tuple_ht, TUPLE_KEY((uint_keyt)i, 7), &i, sizeof(i)));
+	}
+	for (int round = 0; round < 50; round++) {
+		for (int i = 0; i < 3; i++) {
+			CHECK(mht_str_get(str_ht, str_key(buf, sizeof(buf), i)) != NULL);
+			CHECK(mht_tuple_get(tuple_ht, TUPLE_KEY((uint_keyt)i, 7)) != NULL);
+		}
+	}
+
+	MHtKeyCount str_out[3], tuple_out[3];
+	CHECK(mht_top_keys(str_ht, 3, str_out) == 3);
+	CHECK(mht_top_keys(tuple_ht, 3, tuple_out) == 3);
+	mht_clear(str_ht);
+	mht_clear(tuple_ht);
+
+	for (size_t i = 0; i < 3; i++) {
+		CHECK(str_out[i].count >= 51 && str_out[i].count - str_out[i].error <= 51);  /* 1 回の set と 50 回の get */
+		CHECK(str_out[i].key.str.len == 4 && memcmp(str_out[i].key.str.ptr, "key", 3) == 0);
+		CHECK(str_out[i].key.str.ptr[3] >= '0' && str_out[i].key.str.ptr[3] <= '2');
+		CHECK(tuple_out[i].count >= 51 && tuple_out[i].count - tuple_out[i].error <= 51);
+		CHECK(tuple_out[i].key.tuple[0] < 3 && tuple_out[i].key.tuple[1] == 7);
+	}
+	mht_top_keys_release(str_out, 3);
+	mht_top_keys_release(tuple_out, 3);
+
+	mht_destroy(str_ht);
+	mht_destroy(tuple_ht);
+}
+
+
+/* 設定し直すと数え直しになり、0 を指定すると追跡をやめる */
+static void test_reset (void) {
+	MHashTable* ht = mht_uint32_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_access_tracking(ht, 4));
+
+	uint32_t value = 1;
+	CHECK(mht_uint32_set(ht, 1, &value, sizeof(value)));
+	for (int i = 0; i < 10; i++) CHECK(mht_uint32_get(ht, 1) != NULL);
+
+	CHECK(mht_set_access_tracking(ht, 4));
+	for (int i = 0; i < 3; i++) CHECK(mht_uint32_get(ht, 1) != NULL);
+	MHtKeyCount out[4];
+	CHECK(mht_top_keys(ht, 4, out) == 1);
+	CHECK(out[0].key.uint32 == 1 && out[0].count == 3 && out[0].error == 0);
+	mht_top_keys_release(out, 1);
+
+	CHECK(mht_set_access_tracking(ht, 0));
+	CHECK(mht_uint32_get(ht, 1) != NULL);
+	CHECK(mht_top_keys(ht, 4, out) == 0);
+
+	mht_destroy(ht);
+}
+
+
+/* 読み出しキャッシュを使っていても、追跡中の読み出しは全て数えられる */
+static void test_with_read_cache (void) {
+	MHashTable* ht = mht_uint_create(64);
+	CHECK(ht != NULL);
+	if (!mht_set_read_cache(ht, true)) {  /* C11 atomics が使えない環境 */
+		mht_destroy(ht);
+		return;
+	}
+
+	int value = 1;
+	CHECK(mht_uint_set(ht, 7, &value, sizeof(value)));
+	CHECK(mht_uint_get(ht, 7) != NULL);  /* キャッシュに入る */
+	CHECK(mht_uint_get(ht, 7) != NULL);
+	CHECK(mht_set_access_tracking(ht, 4));
+	for (int i = 0; i < 5; i++) CHECK(mht_uint_get(ht, 7) != NULL);
+
+	MHtKeyCount out[1];
+	CHECK(mht_top_keys(ht, 1, out) == 1);
+	CHECK(out[0].key.uint == 7 && out[0].count == 5);
+	mht_top_keys_release(out, 1);
+
+	mht_destroy(ht);
+}
+
+
+static void test_rejected (void) {
+	MHashTable* ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK_REJECTED(mht_set_access_tracking(ht, SIZE_MAX));
+	mht_destroy(ht);
+
+	ht = mht_split_create(16);
+	if (ht != NULL) {  /* C11 atomics が使えない環境では作れない */
+		CHECK_REJECTED(mht_set_access_tracking(ht, 8));
+		CHECK(mht_set_access_tracking(ht, 0));
+		mht_destroy(ht);
+	}
+}
+
+
+int main (void) {
+	test_uint_counts();
+	test_copied_keys();
+	test_reset();
+	test_with_read_cache();
+	test_rejected();
+	return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * tests/change_log.c -- tests for mht_set_change_log and mht_changes_since
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define CHANGE_LOG_KEYS 50
+#define CHANGE_LOG_CAPACITY 100
+
+
+typedef enum {
+	ENGINE_CHAINED,
+	ENGINE_SMALL,
+	ENGINE_CUCKOO,
+	ENGINE_COMPACT,
+	ENGINE_UINT32,
+	ENGINE_STR,
+	ENGINE_TUPLE,
+	ENGINE_COUNT
+} Engine;
+
+
+static MHashTable* engine_create (Engine engine) {
+	MHashTable* ht;
+	switch (engine) {
+		case ENGINE_UINT32: ht = mht_uint32_create(16); break;
+		case ENGINE_STR: ht = mht_str_create(16); break;
+		case ENGINE_TUPLE: ht = mht_tuple_create(16, 3); break;
+		default: ht = mht_uint_create((engine == ENGINE_SMALL) ? 4 : 16); break;
+	}
+	CHECK(ht != NULL);
+	switch (engine) {
+		case ENGINE_CUCKOO: CHECK(mht_set_cuckoo(ht)); break;
+		case ENGINE_COMPACT: CHECK(mht_set_compact(ht)); break;
+		default: break;
+	}
+	return ht;
+}
+
+
+/* キーの種類ごとの set / delete をまとめる */
+typedef struct {
+	Engine engine;
+	char str_buf[32];
+	uint_keyt tuple[3];
+} KeyCtx;
+
+
+static str_keyt str_key (KeyCtx* ctx, size_t i) {
+	int len = snprintf(ctx->str_buf, sizeof(ctx->str_buf), "key%zu", i);
+	CHECK(len > 0 && (size_t)len < sizeof(ctx->str_buf));
+	return (str_keyt){ ctx->str_buf, (size_t)len };
+}
+
+
+static const uint_keyt* tuple_key (KeyCtx* ctx, size_t i) {
+	ctx->tuple[0] = i;
+	ctx->tuple[1] = 2;
+	ctx->tuple[2] = 3;
+	return ctx->tuple;
+}
+
+
+static bool key_set (MHashTable* ht, KeyCtx* ctx, size_t i) {
+	if (ctx->engine == ENGINE_UINT32) return mht_uint32_set(ht, (uint32_t)i, &i, sizeof(i));
+	if (ctx->engine == ENGINE_STR) return mht_str_set(ht, str_key(ctx, i), &i, sizeof(i));
+	if (ctx->engine == ENGINE_TUPLE) return mht_tuple_set(ht, tuple_key(ctx, i), &i, sizeof(i));
+	return mht_uint_set(ht, i, &i, sizeof(i));
+}
+
+
+static bool key_delete (MHashTable* ht, KeyCtx* ctx, size_t i) {
+	if (ctx->engine == ENGINE_UINT32) return mht_uint32_delete(ht, (uint32_t)i);
+	if (ctx->engine == ENGINE_STR) return mht_str_delete(ht, str_key(ctx, i));
+	if (ctx->engine == ENGINE_TUPLE) return mht_tuple_delete(ht, tuple_key(ctx, i));
+	return mht_uint_delete(ht, i);
+}
+
+
+/* 受け取った変更を数え、最後のキーを番号に戻して覚える */
+typedef struct {
+	Engine engine;
+	uint64_t last_seq;
+	size_t sets;
+	size_t deletes;
+	size_t clears;
+	size_t last_key;
+} Consumer;
+
+
+static void consume (const MHtChange* change, void* arg) {
+	Consumer* consumer = arg;
+	CHECK(change->seq == consumer->last_seq + 1);
+	consumer->last_seq = change->seq;
+
+	switch (change->type) {
+		case MHT_CHANGE_SET: consumer->sets++; break;
+		case MHT_CHANGE_DELETE: consumer->deletes++; break;
+		default: consumer->clears++; return;
+	}
+
+	switch (consumer->engine) {
+		case ENGINE_UINT32: consumer->last_key = change->key.uint32; break;
+		case ENGINE_TUPLE:
+			CHECK(change->key.tuple[1] == 2 && change->key.tuple[2] == 3);
+			consumer->last_key = change->key.tuple[0];
+			break;
+		case ENGINE_STR: {
+			char buf[32];
+			CHECK(change->key.str.len < sizeof(buf));
+			memcpy(buf, change->key.str.ptr, change->key.str.len);
+			buf[change->key.str.len] = '\0';
+			CHECK(sscanf(buf, "key%zu", &consumer->last_key) == 1);
+			break;
+		}
+		default: consumer->last_key = change->key.uint; break;
+	}
+}
+
+
+static void test_engine (Engine engine) {
+	KeyCtx ctx = { .engine = engine };
+	MHashTable* ht = engine_create(engine);
+	CHECK(mht_set_change_log(ht, CHANGE_LOG_CAPACITY));
+	CHECK(mht_change_seq(ht) == 0);
+
+	for (size_t i = 0; i < CHANGE_LOG_KEYS; i++)
+		CHECK(key_set(ht, &ctx, i));
+	for (size_t i = 0; i < CHANGE_LOG_KEYS; i += 5)
+		CHECK(key_delete(ht, &ctx, i));
+	/* 失敗した削除は記録されない */
+	CHECK(!key_delete(ht, &ctx, CHANGE_LOG_KEYS));
+	CHECK(mht_change_seq(ht) == 60);
+
+	Consumer consumer = { .engine = engine };
+	CHECK(mht_changes_since(ht, 0, consume, &consumer));
+	CHECK(consumer.sets == CHANGE_LOG_KEYS && consumer.deletes == 10 && consumer.last_seq == 60);
+	CHECK(consumer.last_key == 45);
+
+	/* 追いついていれば何も報告しない。先の番号は EINVAL */
+	CHECK(mht_changes_since(ht, 60, consume, &consumer) && consumer.last_seq == 60);
+	errno = 0;
+	CHECK(!mht_changes_since(ht, 61, consume, &consumer));
+	CHECK(errno == EINVAL);
+
+	/* リングバッファから溢れた変更を求めると ERANGE で失敗する */
+	for (size_t i = 0; i < 150; i++)
+		CHECK(key_set(ht, &ctx, CHANGE_LOG_KEYS + i));
+	errno = 0;
+	CHECK(!mht_changes_since(ht, 60, consume, &consumer));
+	CHECK(errno == ERANGE);
+	consumer = (Consumer){ .engine = engine, .last_seq = 110 };
+	CHECK(mht_changes_since(ht, 110, consume, &consumer));
+	CHECK(consumer.sets == CHANGE_LOG_CAPACITY && consumer.last_seq == 210 && consumer.last_key == CHANGE_LOG_KEYS + 149);
+
+	mht_clear(ht);
+	CHECK(mht_changes_since(ht, 210, consume, &consumer));
+	CHECK(consumer.clears == 1 && mht_change_seq(ht) == 211);
+
+	/* 複製は変更ログを引き継がない */
+	MHashTable* clone = mht_clone(ht);
+	CHECK(clone != NULL);
+	errno = 0;
+	CHECK(mht_change_seq(clone) == 0);
+	CHECK(errno == EINVAL);
+	mht_destroy(clone);
+
+	/* 作り直すと記録は捨てられるが、番号は続く */
+	CHECK(mht_set_change_log(ht, 10));
+	CHECK(mht_change_seq(ht) == 211);
+	errno = 0;
+	CHECK(!mht_changes_since(ht, 200, consume, &consumer));
+	CHECK(errno == ERANGE);
+	CHECK(key_set(ht, &ctx, 0));
+	CHECK(mht_changes_since(ht, 211, consume, &consumer) && consumer.last_seq == 212);
+
+	/* 容量 0 で変更ログをやめる */
+	CHECK(mht_set_change_log(ht, 0));
+	CHECK_REJECTED(mht_changes_since(ht, 0, consume, &consumer));
+	mht_destroy(ht);
+}
+
+
+/* マージによる追加と、消費したハッシュテーブルからの削除も記録される */
+static void test_merge (void) {
+	MHashTable* dst = engine_create(ENGINE_CHAINED);
+	MHashTable* src = engine_create(ENGINE_CHAINED);
+	CHECK(mht_set_change_log(dst, 64));
+	CHECK(mht_set_change_log(src, 64));
+	for (uint_keyt i = 0; i < 10; i++) {
+		uint_keyt key = i + 5;
+		CHECK(mht_uint_set(dst, i, &i, sizeof(i)));
+		CHECK(mht_uint_set(src, key, &key, sizeof(key)));
+	}
+
+	CHECK(mht_merge_consume(dst, src, MHT_MERGE_TAKE_SRC, NULL, NULL));
+	Consumer dst_consumer = { .engine = ENGINE_CHAINED };
+	CHECK(mht_changes_since(dst, 0, consume, &dst_consumer) && dst_consumer.sets == 20);
+	Consumer src_consumer = { .engine = ENGINE_CHAINED };
+	CHECK(mht_changes_since(src, 0, consume, &src_consumer));
+	CHECK(src_consumer.sets == 10 && src_consumer.deletes == 10);
+
+	mht_destroy(dst);
+	mht_destroy(src);
+}
+
+
+/* 分割順序リスト、大きすぎる容量、変更ログのないハッシュテーブルは拒否される */
+static void test_rejected (void) {
+	MHashTable* split = mht_split_create(4);
+	if (split != NULL) {  /* C11 atomics が使えない環境では作れない */
+		CHECK_REJECTED(mht_set_change_log(split, 4));
+		mht_destroy(split);
+	}
+
+	MHashTable* ht = engine_create(ENGINE_CHAINED);
+	CHECK_REJECTED(mht_set_change_log(ht, SIZE_MAX));
+
+	Consumer consumer = { .engine = ENGINE_CHAINED };
+	CHECK_REJECTED(mht_changes_since(ht, 0, consume, &consumer));
+	errno = 0;
+	CHECK(mht_change_seq(ht) == 0);
+	CHECK(errno == EINVAL);
+	mht_destroy(ht);
+}
+
+
+int main (void) {
+	for (int engine = 0; engine < ENGINE_COUNT; engine++)
+		test_engine(engine);
+	test_merge();
+	test_rejected();
+	return 0;
+}
@@ -0,0 +1,240 @@
+/*
+ * tests/clear.c -- tests for mht_clear on every engine and option
+ */
+
+#include "test_common.h"
+
+#include <pthread.h>
+#include <string.h>
+
+
+#define CLEAR_KEYS 5000
+
+
+typedef enum {
+	CONFIG_CHAINED,
+	CONFIG_SMALL,
+	CONFIG_CUCKOO,
+	CONFIG_COMPACT,
+	CONFIG_ORDERED_POINTER_KEYS,
+	CONFIG_HUGE_PAGES,
+	CONFIG_COMPRESSION,
+	CONFIG_DEDUP,
+	CONFIG_CHANGE_LOG,
+	CONFIG_SPLIT,
+	CONFIG_COUNT
+} Config;
+
+
+/* 作れない構成（C11 atomics のない環境の分割順序リスト）では NULL を返す */
+static MHashTable* config_create (Config config) {
+	if (config == CONFIG_SPLIT) return mht_split_create(4);
+
+	MHashTable* ht = mht_uint_create((config == CONFIG_SMALL) ? 4 : 64);
+	CHECK(ht != NULL);
+	switch (config) {
+		case CONFIG_CUCKOO: CHECK(mht_set_cuckoo(ht)); break;
+		case CONFIG_COMPACT: CHECK(mht_set_compact(ht)); break;
+		case CONFIG_ORDERED_POINTER_KEYS: CHECK(mht_set_pointer_keys(ht, true)); break;
+		case CONFIG_HUGE_PAGES: CHECK(mht_set_huge_pages(ht, MHT_HUGE_PAGE_TRANSPARENT)); break;
+		case CONFIG_COMPRESSION: CHECK(mht_set_compression(ht, 16)); break;
+		case CONFIG_DEDUP: CHECK(mht_set_dedup(ht)); break;
+		case CONFIG_CHANGE_LOG: CHECK(mht_set_change_log(ht, 16)); break;
+		default: break;
+	}
+	return ht;
+}
+
+
+/* 圧縮の対象になるように、値はキーを繰り返した 64 バイトにする */
+typedef struct {
+	uint_keyt words[8];
+} Value;
+
+
+static void fill (MHashTable* ht, uint_keyt count) {
+	for (uint_keyt i = 0; i < count; i++) {
+		Value value;
+		for (size_t w = 0; w < 8; w++) value.words[w] = i;
+		CHECK(mht_uint_set(ht, i, &value, sizeof(value)));
+	}
+}
+
+
+/* 圧縮した値は写し出す get でしか読めず、分割順序リストは写し出す get を使えない */
+static bool read_value (MHashTable* ht, bool compressed, uint_keyt key, Value* out) {
+	if (compressed) {
+		size_t size = 0;
+		if (!mht_uint_get_copy(ht, key, out, sizeof(Value), &size)) return false;
+		CHECK(size == sizeof(Value));
+		return true;
+	}
+	Value* value = mht_uint_get(ht, key);
+	if (value == NULL) return false;
+	*out = *value;
+	return true;
+}
+
+
+/* 圧縮するハッシュテーブルは mht_all_get を使えないので、キーを 1 つずつ引いて数える */
+static void check_count (MHashTable* ht, bool compressed, size_t expected) {
+	size_t count = SIZE_MAX;
+	if (compressed) {
+		count = 0;
+		for (uint_keyt i = 0; i <= CLEAR_KEYS; i++) {
+			Value value;
+			count += read_value(ht, true, i, &value);
+		}
+		CHECK(count == expected);
+		return;
+	}
+
+	void** values = mht_all_get(ht, &count);
+	CHECK(count == expected);
+	mht_all_release_arr(values);
+}
+
+
+static void check_values (MHashTable* ht, bool compressed, uint_keyt count) {
+	Value value;
+	for (uint_keyt i = 0; i < count; i++) {
+		CHECK(read_value(ht, compressed, i, &value));
+		CHECK(value.words[0] == i && value.words[7] == i);
+	}
+	CHECK(!read_value(ht, compressed, count, &value));
+}
+
+
+static void test_config (Config config) {
+	MHashTable* ht = config_create(config);
+	if (ht == NULL) return;
+
+	uint_keyt count = (config == CONFIG_SMALL) ? 5 : CLEAR_KEYS;
+	fill(ht, count);
+	check_count(ht, config == CONFIG_COMPRESSION, count);
+
+	mht_clear(ht);
+	check_count(ht, config == CONFIG_COMPRESSION, 0);
+	CHECK(!mht_uint_delete(ht, 3));
+
+	fill(ht, count / 2);
+	check_count(ht, config == CONFIG_COMPRESSION, count / 2);
+	check_values(ht, config == CONFIG_COMPRESSION, count / 2);
+
+	mht_clear(ht);
+	mht_clear(ht);  /* 空のハッシュテーブルを clear しても何も起きない */
+	fill(ht, count);
+	check_values(ht, config == CONFIG_COMPRESSION, count);
+
+	mht_destroy(ht);
+}
+
+
+static str_keyt str_key (char* buf, size_t buf_size, int i) {
+	int len = snprintf(buf, buf_size, "key%d", i);
+	CHECK(len > 0 && (size_t)len < buf_size);
+	return (str_keyt){ buf, (size_t)len };
+}
+
+
+/* 文字列キーの複製もキープールもまとめて捨てられ、凍結したハッシュテーブルは空になる */
+static void test_str (void) {
+	MHashTable* plain = mht_str_create(2);
+	MHashTable* pooled = mht_str_create(64);
+	MHashTable* frozen = mht_str_create(64);
+	CHECK(plain != NULL && pooled != NULL && frozen != NULL);
+	CHECK(mht_set_key_pool(pooled));
+
+	char buf[32];
+	for (int round = 0; round < 3; round++) {
+		for (int i = 0; i < TEST_KEYS; i++) {
+			CHECK(mht_str_set(plain, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+			CHECK(mht_str_set(pooled, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+		}
+		mht_clear(plain);
+		mht_clear(pooled);
+		CHECK(mht_str_get(plain, str_key(buf, sizeof(buf), 1)) == NULL);
+		CHECK(mht_str_get(pooled, str_key(buf, sizeof(buf), 1)) == NULL);
+	}
+
+	for (int i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_str_set(frozen, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+	CHECK(mht_freeze(frozen));
+	CHECK(mht_str_get(frozen, str_key(buf, sizeof(buf), 1)) != NULL);
+	mht_clear(frozen);
+	CHECK(mht_str_get(frozen, str_key(buf, sizeof(buf), 1)) == NULL);
+	check_count(frozen, false, 0);
+
+	mht_destroy(plain);
+	mht_destroy(pooled);
+	mht_destroy(frozen);
+}
+
+
+typedef struct {
+	MHashTable* ht;
+	uint64_t seed;
+	volatile int* stop;
+} SplitWorker;
+
+
+static void* split_worker_main (void* arg) {
+	SplitWorker* worker = arg;
+	uint64_t seed = worker->seed;
+
+	while (!__atomic_load_n(worker->stop, __ATOMIC_ACQUIRE)) {
+		seed = seed * 6364136223846793005u + 1442695040888963407u;
+		uint_keyt key = (uint_keyt)((seed >> 33) % 4096);
+		if ((seed >> 20) & 1) {
+			CHECK(mht_split_set(worker->ht, key, &key, sizeof(key)));
+		} else {
+			size_t token;
+			CHECK(mht_split_read_begin(worker->ht, &token));
+			uint_keyt* value = mht_split_get(worker->ht, key);
+			CHECK(value == NULL || *value == key);
+			mht_split_read_end(worker->ht, token);
+		}
+	}
+	return NULL;
+}
+
+
+/* 分割順序リストは他のスレッドの書き込みや読み出しと並行して clear できる */
+static void test_split_concurrent (void) {
+	MHashTable* ht = mht_split_create(4);
+	if (ht == NULL) return;
+
+	volatile int stop = 0;
+	SplitWorker workers[3];
+	pthread_t threads[3];
+	for (size_t i = 0; i < 3; i++) {
+		workers[i] = (SplitWorker){ ht, i + 1, &stop };
+		CHECK(pthread_create(&threads[i], NULL, split_worker_main, &workers[i]) == 0);
+	}
+	for (int round = 0; round < 200; round++)
+		mht_clear(ht);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+	for (size_t i = 0; i < 3; i++)
+		CHECK(pthread_join(threads[i], NULL) == 0);
+
+	mht_clear(ht);
+	check_count(ht, false, 0);
+	mht_destroy(ht);
+}
+
+
+static void test_rejected (void) {
+	errno = 0;
+	mht_clear(NULL);
+	CHECK(errno == EINVAL);
+}
+
+
+int main (void) {
+	for (int config = 0; config < CONFIG_COUNT; config++)
+		test_config((Config)config);
+	test_str();
+	test_split_concurrent();
+	test_rejected();
+	return 0;
+}
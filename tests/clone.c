@@ -0,0 +1,208 @@
+/*
+ * tests/clone.c -- tests for mht_clone
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define LARGE_CLONE_KEYS 300000  /* 複数のスレッドで複製される件数 */
+
+
+typedef enum {
+	CONFIG_CHAINED,
+	CONFIG_SMALL,
+	CONFIG_LARGE,
+	CONFIG_CUCKOO,
+	CONFIG_COMPACT,
+	CONFIG_ORDERED_POINTER_KEYS,
+	CONFIG_HUGE_PAGES,
+	CONFIG_READ_CACHE,
+	CONFIG_COMPRESSION,
+	CONFIG_DEDUP,
+	CONFIG_COUNT
+} Config;
+
+
+static MHashTable* config_create (Config config) {
+	MHashTable* ht = mht_uint_create((config == CONFIG_SMALL) ? 4 : (config == CONFIG_LARGE) ? ((size_t)1 << 18) : 64);
+	CHECK(ht != NULL);
+	switch (config) {
+		case CONFIG_CUCKOO: CHECK(mht_set_cuckoo(ht)); break;
+		case CONFIG_COMPACT: CHECK(mht_set_compact(ht)); break;
+		case CONFIG_ORDERED_POINTER_KEYS: CHECK(mht_set_pointer_keys(ht, true)); break;
+		case CONFIG_HUGE_PAGES: CHECK(mht_set_huge_pages(ht, MHT_HUGE_PAGE_TRANSPARENT)); break;
+		case CONFIG_READ_CACHE: if (!mht_set_read_cache(ht, true)) CHECK(errno == ENOSYS); break;
+		case CONFIG_COMPRESSION: CHECK(mht_set_compression(ht, 16)); break;
+		case CONFIG_DEDUP: CHECK(mht_set_dedup(ht)); break;
+		default: break;
+	}
+	return ht;
+}
+
+
+/* 圧縮の対象になるように、値はキーを繰り返した 64 バイトにする */
+typedef struct {
+	uint_keyt words[8];
+} Value;
+
+
+static void set_value (MHashTable* ht, uint_keyt key, uint_keyt word) {
+	Value value;
+	for (size_t w = 0; w < 8; w++) value.words[w] = word;
+	CHECK(mht_uint_set(ht, key, &value, sizeof(value)));
+}
+
+
+/* 圧縮した値は写し出す get でしか読めない */
+static bool read_word (MHashTable* ht, bool compressed, uint_keyt key, uint_keyt* out) {
+	Value copy;
+	Value* value = &copy;
+	if (compressed) {
+		size_t size = 0;
+		if (!mht_uint_get_copy(ht, key, &copy, sizeof(copy), &size)) return false;
+		CHECK(size == sizeof(copy));
+	} else {
+		value = mht_uint_get(ht, key);
+		if (value == NULL) return false;
+	}
+	CHECK(value->words[0] == value->words[7]);
+	*out = value->words[0];
+	return true;
+}
+
+
+static void test_config (Config config) {
+	bool compressed = (config == CONFIG_COMPRESSION);
+	uint_keyt count = (config == CONFIG_SMALL) ? 5 : (config == CONFIG_LARGE) ? LARGE_CLONE_KEYS : 5000;
+
+	MHashTable* ht = config_create(config);
+	for (uint_keyt i = 0; i < count; i++)
+		set_value(ht, i, i);
+	/* コンパクトモードでは削除で空いたスロットを使い回したエントリも写す */
+	CHECK(mht_uint_delete(ht, 3));
+	set_value(ht, 3, 3);
+
+	MHashTable* clone = mht_clone(ht);
+	CHECK(clone != NULL);
+
+	/* 複製は元のハッシュテーブルと独立していて、元を書き換えたり破棄したりしても変わらない */
+	set_value(ht, 1, 100);
+	CHECK(mht_uint_delete(ht, 2));
+	mht_destroy(ht);
+
+	uint_keyt word;
+	for (uint_keyt i = 0; i < count; i++) {
+		CHECK(read_word(clone, compressed, i, &word));
+		CHECK(word == i);
+	}
+	CHECK(!read_word(clone, compressed, count, &word));
+
+	/* 複製も同じ設定のまま拡張、削除、clear ができる */
+	for (uint_keyt i = count; i < count * 2; i++)
+		set_value(clone, i, i);
+	for (uint_keyt i = 0; i < count * 2; i += 2)
+		CHECK(mht_uint_delete(clone, i));
+	for (uint_keyt i = 0; i < count * 2; i++) {
+		bool found = read_word(clone, compressed, i, &word);
+		CHECK(found == (i % 2 != 0));
+		if (found) CHECK(word == i);
+	}
+	mht_clear(clone);
+	CHECK(!read_word(clone, compressed, 1, &word));
+
+	mht_destroy(clone);
+}
+
+
+static void test_other_key_types (void) {
+	MHashTable* str_ht = mht_str_create(64);
+	MHashTable* pooled = mht_str_create(64);
+	MHashTable* u32_ht = mht_uint32_create(64);
+	MHashTable* tuple_ht = mht_tuple_create(64, 3);
+	CHECK(str_ht != NULL && pooled != NULL && u32_ht != NULL && tuple_ht != NULL);
+	CHECK(mht_set_key_pool(pooled));
+
+	char buf[32];
+	for (int i = 0; i < TEST_KEYS; i++) {
+		int len = snprintf(buf, sizeof(buf), "key%d", i);
+		str_keyt key = { buf, (size_t)len };
+		CHECK(mht_str_set(str_ht, key, &i, sizeof(i)));
+		CHECK(mht_str_set(pooled, key, &i, sizeof(i)));
+		CHECK(mht_uint32_set(u32_ht, (uint32_t)i, &i, sizeof(i)));
+		CHECK(mht_tuple_set(tuple_ht, TUPLE_KEY((uint_keyt)i, 1, 2), &i, sizeof(i)));
+	}
+
+	MHashTable* str_clone = mht_clone(str_ht);
+	MHashTable* pooled_clone = mht_clone(pooled);
+	MHashTable* u32_clone = mht_clone(u32_ht);
+	MHashTable* tuple_clone = mht_clone(tuple_ht);
+	CHECK(str_clone != NULL && pooled_clone != NULL && u32_clone != NULL && tuple_clone != NULL);
+	mht_destroy(str_ht);  /* 複製は文字列キーも自前で持つ */
+	mht_destroy(pooled);
+	mht_destroy(u32_ht);
+	mht_destroy(tuple_ht);
+
+	for (int i = 0; i < TEST_KEYS; i++) {
+		int len = snprintf(buf, sizeof(buf), "key%d", i);
+		str_keyt key = { buf, (size_t)len };
+		int* value = mht_str_get(str_clone, key);
+		CHECK(value != NULL && *value == i);
+		value = mht_str_get(pooled_clone, key);
+		CHECK(value != NULL && *value == i);
+		value = mht_uint32_get(u32_clone, (uint32_t)i);
+		CHECK(value != NULL && *value == i);
+		value = mht_tuple_get(tuple_clone, TUPLE_KEY((uint_keyt)i, 1, 2));
+		CHECK(value != NULL && *value == i);
+	}
+	CHECK(mht_str_delete(pooled_clone, TEST_STR_KEY("key1")));
+	CHECK(mht_compact_keys(pooled_clone));
+	CHECK(mht_str_get(pooled_clone, TEST_STR_KEY("key2")) != NULL);
+
+	mht_destroy(str_clone);
+	mht_destroy(pooled_clone);
+	mht_destroy(u32_clone);
+	mht_destroy(tuple_clone);
+}
+
+
+static void test_rejected (void) {
+	int value = 5;
+
+	MHashTable* raw = mht_uint_create(64);
+	CHECK(raw != NULL);
+	CHECK(mht_uint_set(raw, 1, &value, sizeof(value)));
+	CHECK(mht_uint_set_raw(raw, 2, &value));
+	errno = 0;
+	CHECK(mht_clone(raw) == NULL && errno == EINVAL);  /* raw モードの値は大きさが分からない */
+	CHECK(mht_uint_delete(raw, 1));
+	mht_destroy_without_value(raw);
+
+	MHashTable* frozen = mht_str_create(16);
+	CHECK(frozen != NULL);
+	CHECK(mht_str_set(frozen, TEST_STR_KEY("key"), &value, sizeof(value)));
+	CHECK(mht_freeze(frozen));
+	errno = 0;
+	CHECK(mht_clone(frozen) == NULL && errno == EINVAL);
+	mht_destroy(frozen);
+
+	MHashTable* split = mht_split_create(16);
+	if (split != NULL) {  /* C11 atomics が使えない環境では作れない */
+		errno = 0;
+		CHECK(mht_clone(split) == NULL && errno == EINVAL);
+		mht_destroy(split);
+	}
+
+	errno = 0;
+	CHECK(mht_clone(NULL) == NULL && errno == EINVAL);
+}
+
+
+int main (void) {
+	for (int config = 0; config < CONFIG_COUNT; config++)
+		test_config((Config)config);
+	test_other_key_types();
+	test_rejected();
+	return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * tests/compact.c -- tests for compact mode with 32-bit entry indices
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define COMPACT_KEYS 200000  /* プールが何度も倍になる件数 */
+
+
+static MHashTable* compact_table (MHashTable* ht) {
+	CHECK(ht != NULL);
+	CHECK(mht_set_compact(ht));
+	return ht;
+}
+
+
+static void test_uint (void) {
+	MHashTable* ht = compact_table(mht_uint_create(4));
+
+	for (uint_keyt i = 0; i < COMPACT_KEYS; i++) {
+		uint_keyt value = i * 3;
+		CHECK(mht_uint_set(ht, i * 7919, &value, sizeof(value)));
+	}
+	for (uint_keyt i = 0; i < COMPACT_KEYS; i++) {
+		uint_keyt* value = mht_uint_get(ht, i * 7919);
+		CHECK(value != NULL && *value == i * 3);
+	}
+	CHECK(mht_uint_get(ht, 1) == NULL);
+
+	for (uint_keyt i = 0; i < COMPACT_KEYS; i += 3) {
+		CHECK(mht_uint_delete(ht, i * 7919));
+		CHECK(!mht_uint_delete(ht, i * 7919));
+	}
+	size_t count = 0;
+	void** values = mht_all_get(ht, &count);
+	CHECK(count == COMPACT_KEYS - (COMPACT_KEYS + 2) / 3);
+	mht_all_release_arr(values);
+
+	/* 削除したキーは新しく入り、残っているキーは値が置き換わる */
+	for (uint_keyt i = 0; i < COMPACT_KEYS; i++) {
+		uint_keyt value = 1;
+		CHECK(mht_uint_set(ht, i * 7919, &value, sizeof(value)));
+	}
+	values = mht_all_get(ht, &count);
+	CHECK(count == COMPACT_KEYS);
+	mht_all_release_arr(values);
+
+	mht_clear(ht);
+	values = mht_all_get(ht, &count);
+	CHECK(count == 0);
+	mht_all_release_arr(values);
+	CHECK(mht_uint_get(ht, 7919) == NULL);
+	for (uint_keyt i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_uint_set(ht, i, &i, sizeof(i)));
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		uint_keyt* value = mht_uint_get(ht, i);
+		CHECK(value != NULL && *value == i);
+	}
+
+	mht_destroy(ht);
+}
+
+
+static str_keyt str_key (char* buf, size_t buf_size, int i) {
+	int len = snprintf(buf, buf_size, "key%d", i);
+	CHECK(len > 0 && (size_t)len < buf_size);
+	return (str_keyt){ buf, (size_t)len };
+}
+
+
+static void test_other_key_types (void) {
+	MHashTable* str_ht = compact_table(mht_str_create(64));
+	MHashTable* u32_ht = compact_table(mht_uint32_create(4));
+	MHashTable* tuple_ht = compact_table(mht_tuple_create(4, 2));
+
+	char buf[32];
+	for (int i = 0; i < TEST_KEYS * 5; i++) {
+		CHECK(mht_str_set(str_ht, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+		CHECK(mht_uint32_set(u32_ht, (uint32_t)i, &i, sizeof(i)));
+		CHECK(mht_tuple_set(tuple_ht, TUPLE_KEY((uint_keyt)i, 3), &i, sizeof(i)));
+	}
+	for (int i = 0; i < TEST_KEYS * 5; i += 2) {
+		CHECK(mht_str_delete(str_ht, str_key(buf, sizeof(buf), i)));
+		CHECK(mht_uint32_delete(u32_ht, (uint32_t)i));
+		CHECK(mht_tuple_delete(tuple_ht, TUPLE_KEY((uint_keyt)i, 3)));
+	}
+	for (int i = 0; i < TEST_KEYS * 5; i++) {
+		int* str_value = mht_str_get(str_ht, str_key(buf, sizeof(buf), i));
+		int* u32_value = mht_uint32_get(u32_ht, (uint32_t)i);
+		int* tuple_value = mht_tuple_get(tuple_ht, TUPLE_KEY((uint_keyt)i, 3));
+		if (i % 2 == 0) {
+			CHECK(str_value == NULL && u32_value == NULL && tuple_value == NULL);
+		} else {
+			CHECK(str_value != NULL && *str_value == i);
+			CHECK(u32_value != NULL && *u32_value == i);
+			CHECK(tuple_value != NULL && *tuple_value == i);
+		}
+	}
+
+	mht_clear(str_ht);
+	CHECK(mht_str_get(str_ht, str_key(buf, sizeof(buf), 1)) == NULL);
+
+	mht_destroy(str_ht);
+	mht_destroy(u32_ht);
+	mht_destroy(tuple_ht);
+}
+
+
+/* 削除で空いたプールのエントリは、後の追加で使い回される */
+static void test_reuse (void) {
+	MHashTable* ht = compact_table(mht_uint32_create(16));
+
+	for (uint32_t i = 0; i < TEST_KEYS * 10; i++)
+		CHECK(mht_uint32_set(ht, i, &i, sizeof(i)));
+	for (uint32_t i = 0; i < TEST_KEYS * 10; i += 2)
+		CHECK(mht_uint32_delete(ht, i));
+	for (uint32_t i = 0; i < TEST_KEYS * 10; i += 2) {
+		uint32_t value = i + 1;
+		CHECK(mht_uint32_set(ht, i + 100000, &value, sizeof(value)));
+	}
+	for (uint32_t i = 0; i < TEST_KEYS * 10; i++) {
+		uint32_t* value = mht_uint32_get(ht, i);
+		if (i % 2 == 0) {
+			CHECK(value == NULL);
+			value = mht_uint32_get(ht, i + 100000);
+			CHECK(value != NULL && *value == i + 1);
+		} else {
+			CHECK(value != NULL && *value == i);
+		}
+	}
+
+	mht_destroy(ht);
+}
+
+
+/* 順序なしのポインタキーは使えるが、順序付きのポインタキーとは組み合わせられない */
+static void test_pointer_keys (void) {
+	static uint_keyt objects[TEST_KEYS];
+
+	MHashTable* ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_pointer_keys(ht, false));
+	CHECK(mht_set_compact(ht));
+	for (uint_keyt i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_uint_set(ht, (uint_keyt)&objects[i], &i, sizeof(i)));
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		uint_keyt* value = mht_uint_get(ht, (uint_keyt)&objects[i]);
+		CHECK(value != NULL && *value == i);
+	}
+	mht_destroy(ht);
+
+	ht = compact_table(mht_uint_create(16));
+	CHECK(mht_set_pointer_keys(ht, false));
+	CHECK_REJECTED(mht_set_pointer_keys(ht, true));
+	mht_destroy(ht);
+
+	ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_pointer_keys(ht, true));
+	CHECK_REJECTED(mht_set_compact(ht));
+	mht_destroy(ht);
+}
+
+
+static void test_rejected (void) {
+	MHashTable* ht = compact_table(mht_uint_create(16));
+	CHECK_REJECTED(mht_set_compact(ht));  /* 2 回目 */
+	CHECK_REJECTED(mht_set_cuckoo(ht));
+	mht_destroy(ht);
+
+	ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	uint_keyt key = 1;
+	CHECK(mht_uint_set(ht, key, &key, sizeof(key)));
+	CHECK_REJECTED(mht_set_compact(ht));  /* 空でない */
+	mht_destroy(ht);
+
+	ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_cuckoo(ht));
+	CHECK_REJECTED(mht_set_compact(ht));
+	mht_destroy(ht);
+
+	ht = mht_str_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_freeze(ht));
+	CHECK_REJECTED(mht_set_compact(ht));
+	mht_destroy(ht);
+}
+
+
+int main (void) {
+	test_uint();
+	test_other_key_types();
+	test_reuse();
+	test_pointer_keys();
+	test_rejected();
+	return 0;
+}
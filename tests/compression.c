@@ -0,0 +1,279 @@
+/*
+ * tests/compression.c -- tests for mht_set_compression
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define COMPRESSION_KEYS 2000
+#define COMPRESSION_THRESHOLD 64
+#define VALUE_SIZE 4096
+
+
+typedef enum {
+	ENGINE_CHAINED,
+	ENGINE_SMALL,
+	ENGINE_CUCKOO,
+	ENGINE_COMPACT,
+	ENGINE_STR,
+	ENGINE_TUPLE,
+	ENGINE_COUNT
+} Engine;
+
+
+/*
+ * 値は 3 種類。JSON 風のテキスト（圧縮される）、乱数列（縮まないので圧縮せずに持つ）、
+ * しきい値より短いテキスト（圧縮しない）
+ */
+typedef enum {
+	VALUE_TEXT,
+	VALUE_RANDOM,
+	VALUE_SHORT,
+	VALUE_KIND_COUNT
+} ValueKind;
+
+
+static size_t make_value (size_t i, char* buf) {
+	size_t len = 0;
+	switch ((ValueKind)(i % VALUE_KIND_COUNT)) {
+		case VALUE_TEXT:
+			for (;;) {
+				char record[128];
+				int record_len = snprintf(record, sizeof(record), "{\"id\":%zu,\"name\":\"item-%zu\",\"tags\":[\"a\",\"b\"],\"ok\":true},", i, len);
+				CHECK(record_len > 0 && (size_t)record_len < sizeof(record));
+				if (len + (size_t)record_len > VALUE_SIZE) break;
+				memcpy(buf + len, record, (size_t)record_len);
+				len += (size_t)record_len;
+			}
+			break;
+		case VALUE_RANDOM: {
+			/* 同じ i からは同じ値ができるように、i を種にする */
+			uint32_t state = (uint32_t)i;
+			for (len = 0; len < VALUE_SIZE / 2; len++) {
+				state = state * 1103515245 + 12345;
+				buf[len] = (char)(state >> 16);
+			}
+			break;
+		}
+		default:
+			len = 1 + i % (COMPRESSION_THRESHOLD - 1);
+			for (size_t j = 0; j < len; j++) buf[j] = (char)('a' + j % 3);
+			break;
+	}
+	return len;
+}
+
+
+static MHashTable* engine_create (Engine engine) {
+	MHashTable* ht;
+	switch (engine) {
+		case ENGINE_STR: ht = mht_str_create(16); break;
+		case ENGINE_TUPLE: ht = mht_tuple_create(16, 2); break;
+		default: ht = mht_uint_create((engine == ENGINE_SMALL) ? 4 : 16); break;
+	}
+	CHECK(ht != NULL);
+	switch (engine) {
+		case ENGINE_CUCKOO: CHECK(mht_set_cuckoo(ht)); break;
+		case ENGINE_COMPACT: CHECK(mht_set_compact(ht)); break;
+		default: break;
+	}
+	CHECK(mht_set_compression(ht, COMPRESSION_THRESHOLD));
+	return ht;
+}
+
+
+/* キーの種類ごとの set / get_copy / get / delete をまとめる */
+typedef struct {
+	Engine engine;
+	char str_buf[32];
+	uint_keyt tuple[2];
+} KeyCtx;
+
+
+static str_keyt str_key (KeyCtx* ctx, size_t i) {
+	int len = snprintf(ctx->str_buf, sizeof(ctx->str_buf), "key%zu", i);
+	CHECK(len > 0 && (size_t)len < sizeof(ctx->str_buf));
+	return (str_keyt){ ctx->str_buf, (size_t)len };
+}
+
+
+static const uint_keyt* tuple_key (KeyCtx* ctx, size_t i) {
+	ctx->tuple[0] = i;
+	ctx->tuple[1] = 7;
+	return ctx->tuple;
+}
+
+
+static bool key_set (MHashTable* ht, KeyCtx* ctx, size_t i, void* value, size_t size) {
+	if (ctx->engine == ENGINE_STR) return mht_str_set(ht, str_key(ctx, i), value, size);
+	if (ctx->engine == ENGINE_TUPLE) return mht_tuple_set(ht, tuple_key(ctx, i), value, size);
+	return mht_uint_set(ht, i, value, size);
+}
+
+
+static bool key_get_copy (MHashTable* ht, KeyCtx* ctx, size_t i, void* buffer, size_t buffer_size, size_t* out_size) {
+	if (ctx->engine == ENGINE_STR) return mht_str_get_copy(ht, str_key(ctx, i), buffer, buffer_size, out_size);
+	if (ctx->engine == ENGINE_TUPLE) return mht_tuple_get_copy(ht, tuple_key(ctx, i), buffer, buffer_size, out_size);
+	return mht_uint_get_copy(ht, i, buffer, buffer_size, out_size);
+}
+
+
+static void* key_get (MHashTable* ht, KeyCtx* ctx, size_t i) {
+	if (ctx->engine == ENGINE_STR) return mht_str_get(ht, str_key(ctx, i));
+	if (ctx->engine == ENGINE_TUPLE) return mht_tuple_get(ht, tuple_key(ctx, i));
+	return mht_uint_get(ht, i);
+}
+
+
+static bool key_delete (MHashTable* ht, KeyCtx* ctx, size_t i) {
+	if (ctx->engine == ENGINE_STR) return mht_str_delete(ht, str_key(ctx, i));
+	if (ctx->engine == ENGINE_TUPLE) return mht_tuple_delete(ht, tuple_key(ctx, i));
+	return mht_uint_delete(ht, i);
+}
+
+
+static char expected[VALUE_SIZE];
+static char out[VALUE_SIZE];
+
+
+/* キー i に value_index 番目の値が入っていることを確かめる */
+static void check_value (MHashTable* ht, KeyCtx* ctx, size_t i, size_t value_index) {
+	size_t len = make_value(value_index, expected);
+	size_t size = 0;
+	CHECK(key_get_copy(ht, ctx, i, out, sizeof(out), &size));
+	CHECK(size == len && memcmp(out, expected, len) == 0);
+
+	/* バッファが足りなければ ERANGE で失敗し、必要な大きさを返す */
+	size = 0;
+	errno = 0;
+	CHECK(!key_get_copy(ht, ctx, i, NULL, 0, &size));
+	CHECK(errno == ERANGE && size == len);
+
+	/* 圧縮した値だけは直接読めない */
+	void* value = key_get(ht, ctx, i);
+	if (value_index % VALUE_KIND_COUNT == VALUE_TEXT) {
+		CHECK(value == NULL);
+	} else {
+		CHECK(value != NULL && memcmp(value, expected, len) == 0);
+	}
+}
+
+
+static void test_engine (Engine engine) {
+	KeyCtx ctx = { .engine = engine };
+	MHashTable* ht = engine_create(engine);
+	size_t count = (engine == ENGINE_SMALL) ? 6 : COMPRESSION_KEYS;
+	char buf[VALUE_SIZE];
+
+	for (size_t i = 0; i < count; i++)
+		CHECK(key_set(ht, &ctx, i, buf, make_value(i, buf)));
+	for (size_t i = 0; i < count; i++) check_value(ht, &ctx, i, i);
+
+	/* 上書きで種類の違う値に入れ替わる */
+	for (size_t i = 0; i < count; i++)
+		CHECK(key_set(ht, &ctx, i, buf, make_value(i + 1, buf)));
+	for (size_t i = 0; i < count; i += 2)
+		CHECK(key_delete(ht, &ctx, i));
+	for (size_t i = 0; i < count; i++) {
+		if (i % 2 == 0) {
+			size_t size = 0;
+			CHECK(!key_get_copy(ht, &ctx, i, out, sizeof(out), &size));
+		} else {
+			check_value(ht, &ctx, i, i + 1);
+		}
+	}
+
+	/* 圧縮を有効にしたハッシュテーブルは mht_all_get を使えない */
+	size_t all_count = 0;
+	CHECK(mht_all_get(ht, &all_count) == NULL);
+
+	/* 複製は圧縮した値をそのまま持つ */
+	if (engine != ENGINE_TUPLE) {
+		MHashTable* clone = mht_clone(ht);
+		CHECK(clone != NULL);
+		for (size_t i = 1; i < count; i += 2) check_value(clone, &ctx, i, i + 1);
+		mht_destroy(clone);
+	}
+
+	mht_clear(ht);
+	for (size_t i = 0; i < count; i++) {
+		size_t size = 0;
+		CHECK(!key_get_copy(ht, &ctx, i, out, sizeof(out), &size));
+	}
+	CHECK(key_set(ht, &ctx, 0, buf, make_value(0, buf)));
+	check_value(ht, &ctx, 0, 0);
+	mht_destroy(ht);
+}
+
+
+/* しきい値に 0 を渡すと圧縮をやめる */
+static void test_disable (void) {
+	char buf[VALUE_SIZE];
+	MHashTable* ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_compression(ht, COMPRESSION_THRESHOLD));
+	CHECK(mht_set_compression(ht, 0));
+
+	size_t len = make_value(VALUE_TEXT, buf);
+	CHECK(mht_uint_set(ht, 1, buf, len));
+	char* value = mht_uint_get(ht, 1);
+	CHECK(value != NULL && memcmp(value, buf, len) == 0);
+
+	size_t all_count = 0;
+	void** values = mht_all_get(ht, &all_count);
+	CHECK(values != NULL && all_count == 1);
+	CHECK(mht_all_release_arr(values));
+	mht_destroy(ht);
+}
+
+
+/* 対応しないキーの種類やエンジン、同時に使えないオプションは拒否される */
+static void test_rejected (void) {
+	MHashTable* uint32_ht = mht_uint32_create(16);
+	CHECK(uint32_ht != NULL);
+	CHECK_REJECTED(mht_set_compression(uint32_ht, COMPRESSION_THRESHOLD));
+	mht_destroy(uint32_ht);
+
+	MHashTable* split = mht_split_create(16);
+	if (split != NULL) {  /* C11 atomics が使えない環境では作れない */
+		CHECK_REJECTED(mht_set_compression(split, COMPRESSION_THRESHOLD));
+		mht_destroy(split);
+	}
+
+	/* 空でないハッシュテーブル */
+	size_t value = 1;
+	MHashTable* filled = mht_uint_create(16);
+	CHECK(filled != NULL);
+	CHECK(mht_uint_set(filled, 1, &value, sizeof(value)));
+	CHECK_REJECTED(mht_set_compression(filled, COMPRESSION_THRESHOLD));
+
+	/* 圧縮するハッシュテーブルはマージも凍結もできない */
+	MHashTable* compressed = mht_str_create(16);
+	CHECK(compressed != NULL);
+	CHECK(mht_set_compression(compressed, COMPRESSION_THRESHOLD));
+	CHECK_REJECTED(mht_freeze(compressed));
+	MHashTable* compressed_uint = mht_uint_create(16);
+	CHECK(compressed_uint != NULL);
+	CHECK(mht_set_compression(compressed_uint, COMPRESSION_THRESHOLD));
+	CHECK_REJECTED(mht_merge(filled, compressed_uint, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK_REJECTED(mht_merge(compressed_uint, filled, MHT_MERGE_KEEP_DST, NULL, NULL));
+	mht_destroy(compressed_uint);
+	mht_destroy(filled);
+
+	/* NUMA レプリカとは併用できない（Linux 以外ではレプリカ自体が使えない） */
+	errno = 0;
+	CHECK(!mht_set_numa_replicas(compressed));
+	CHECK(errno == EINVAL || errno == ENOSYS);
+	mht_destroy(compressed);
+}
+
+
+int main (void) {
+	for (int engine = 0; engine < ENGINE_COUNT; engine++)
+		test_engine(engine);
+	test_disable();
+	test_rejected();
+	return 0;
+}
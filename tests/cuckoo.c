@@ -0,0 +1,211 @@
+/*
+ * tests/cuckoo.c -- tests for the bucketized cuckoo hashing engine
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define CUCKOO_KEYS 200000  /* 何度も拡張と追い出しを起こす件数 */
+
+
+static MHashTable* cuckoo_table (MHashTable* ht) {
+	CHECK(ht != NULL);
+	CHECK(mht_set_cuckoo(ht));
+	return ht;
+}
+
+
+static void test_uint (void) {
+	MHashTable* ht = cuckoo_table(mht_uint_create(4));
+
+	for (uint_keyt i = 0; i < CUCKOO_KEYS; i++) {
+		uint_keyt value = i * 3;
+		CHECK(mht_uint_set(ht, i * 7919, &value, sizeof(value)));
+	}
+	for (uint_keyt i = 0; i < CUCKOO_KEYS; i++) {
+		uint_keyt* value = mht_uint_get(ht, i * 7919);
+		CHECK(value != NULL && *value == i * 3);
+	}
+	CHECK(mht_uint_get(ht, 1) == NULL);
+
+	for (uint_keyt i = 0; i < CUCKOO_KEYS; i += 3) {
+		CHECK(mht_uint_delete(ht, i * 7919));
+		CHECK(!mht_uint_delete(ht, i * 7919));
+	}
+	size_t count = 0;
+	void** values = mht_all_get(ht, &count);
+	CHECK(count == CUCKOO_KEYS - (CUCKOO_KEYS + 2) / 3);
+	mht_all_release_arr(values);
+
+	/* 削除したキーは新しく入り、残っているキーは値が置き換わる */
+	for (uint_keyt i = 0; i < CUCKOO_KEYS; i++) {
+		uint_keyt value = 1;
+		CHECK(mht_uint_set(ht, i * 7919, &value, sizeof(value)));
+	}
+	values = mht_all_get(ht, &count);
+	CHECK(count == CUCKOO_KEYS);
+	mht_all_release_arr(values);
+
+	mht_clear(ht);
+	values = mht_all_get(ht, &count);
+	CHECK(count == 0);
+	mht_all_release_arr(values);
+	CHECK(mht_uint_get(ht, 7919) == NULL);
+	for (uint_keyt i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_uint_set(ht, i, &i, sizeof(i)));
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		uint_keyt* value = mht_uint_get(ht, i);
+		CHECK(value != NULL && *value == i);
+	}
+
+	mht_destroy(ht);
+}
+
+
+static str_keyt str_key (char* buf, size_t buf_size, int i) {
+	int len = snprintf(buf, buf_size, "key%d", i);
+	CHECK(len > 0 && (size_t)len < buf_size);
+	return (str_keyt){ buf, (size_t)len };
+}
+
+
+static void test_other_key_types (void) {
+	MHashTable* str_ht = cuckoo_table(mht_str_create(64));
+	MHashTable* u32_ht = cuckoo_table(mht_uint32_create(4));
+	MHashTable* tuple_ht = cuckoo_table(mht_tuple_create(4, 2));
+
+	char buf[32];
+	for (int i = 0; i < TEST_KEYS * 5; i++) {
+		CHECK(mht_str_set(str_ht, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+		CHECK(mht_uint32_set(u32_ht, (uint32_t)i, &i, sizeof(i)));
+		CHECK(mht_tuple_set(tuple_ht, TUPLE_KEY((uint_keyt)i, 3), &i, sizeof(i)));
+	}
+	for (int i = 0; i < TEST_KEYS * 5; i += 2) {
+		CHECK(mht_str_delete(str_ht, str_key(buf, sizeof(buf), i)));
+		CHECK(mht_uint32_delete(u32_ht, (uint32_t)i));
+		CHECK(mht_tuple_delete(tuple_ht, TUPLE_KEY((uint_keyt)i, 3)));
+	}
+	for (int i = 0; i < TEST_KEYS * 5; i++) {
+		int* str_value = mht_str_get(str_ht, str_key(buf, sizeof(buf), i));
+		int* u32_value = mht_uint32_get(u32_ht, (uint32_t)i);
+		int* tuple_value = mht_tuple_get(tuple_ht, TUPLE_KEY((uint_keyt)i, 3));
+		if (i % 2 == 0) {
+			CHECK(str_value == NULL && u32_value == NULL && tuple_value == NULL);
+		} else {
+			CHECK(str_value != NULL && *str_value == i);
+			CHECK(u32_value != NULL && *u32_value == i);
+			CHECK(tuple_value != NULL && *tuple_value == i);
+		}
+	}
+
+	mht_clear(str_ht);
+	CHECK(mht_str_get(str_ht, str_key(buf, sizeof(buf), 1)) == NULL);
+
+	mht_destroy(str_ht);
+	mht_destroy(u32_ht);
+	mht_destroy(tuple_ht);
+}
+
+
+/*
+ * djb2 では "aB" と "b!" が同じ値になるので、この 2 つを並べたキーはハッシュ値全体が衝突する。
+ * 同じ 2 バケットとタグを取り合い、stash にも収まらない数を入れても拡張し続けずに格納できる
+ */
+#define COLLIDING_BLOCKS 10
+#define COLLIDING_KEYS (1 << COLLIDING_BLOCKS)
+
+
+static str_keyt colliding_key (char* buf, int i) {
+	for (int b = 0; b < COLLIDING_BLOCKS; b++)
+		memcpy(buf + b * 2, ((i >> b) & 1) ? "b!" : "aB", 2);
+	buf[COLLIDING_BLOCKS * 2] = '\0';
+	return (str_keyt){ buf, COLLIDING_BLOCKS * 2 };
+}
+
+
+static void test_colliding_keys (void) {
+	MHashTable* ht = cuckoo_table(mht_str_create(16));
+	char buf[COLLIDING_BLOCKS * 2 + 1];
+	char other[32];
+
+	for (int i = 0; i < COLLIDING_KEYS; i++) {
+		CHECK(mht_str_set(ht, colliding_key(buf, i), &i, sizeof(i)));
+		/* 衝突しないキーも混ぜて、stash が伸びた状態での拡張も起こす */
+		CHECK(mht_str_set(ht, str_key(other, sizeof(other), i), &i, sizeof(i)));
+	}
+	for (int i = 0; i < COLLIDING_KEYS; i++) {
+		int* value = mht_str_get(ht, colliding_key(buf, i));
+		CHECK(value != NULL && *value == i);
+		value = mht_str_get(ht, str_key(other, sizeof(other), i));
+		CHECK(value != NULL && *value == i);
+	}
+
+	MHashTable* clone = mht_clone(ht);
+	CHECK(clone != NULL);
+
+	for (int i = 0; i < COLLIDING_KEYS; i += 2)
+		CHECK(mht_str_delete(ht, colliding_key(buf, i)));
+	for (int i = 0; i < COLLIDING_KEYS; i++) {
+		int* value = mht_str_get(ht, colliding_key(buf, i));
+		CHECK(i % 2 == 0 ? value == NULL : (value != NULL && *value == i));
+		value = mht_str_get(clone, colliding_key(buf, i));
+		CHECK(value != NULL && *value == i);
+	}
+	mht_destroy(clone);
+
+	mht_clear(ht);
+	CHECK(mht_str_get(ht, colliding_key(buf, 1)) == NULL);
+	for (int i = 0; i < COLLIDING_KEYS; i++)
+		CHECK(mht_str_set(ht, colliding_key(buf, i), &i, sizeof(i)));
+	size_t count = 0;
+	void** values = mht_all_get(ht, &count);
+	CHECK(count == COLLIDING_KEYS);
+	mht_all_release_arr(values);
+	mht_destroy(ht);
+}
+
+
+static void test_rejected (void) {
+	MHashTable* ht = cuckoo_table(mht_uint_create(16));
+	CHECK_REJECTED(mht_set_cuckoo(ht));  /* 2 回目 */
+	CHECK_REJECTED(mht_set_compact(ht));
+	CHECK_REJECTED(mht_set_pointer_keys(ht, false));
+	CHECK_REJECTED(mht_set_pointer_keys(ht, true));
+	mht_destroy(ht);
+
+	ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	uint_keyt key = 1;
+	CHECK(mht_uint_set(ht, key, &key, sizeof(key)));
+	CHECK_REJECTED(mht_set_cuckoo(ht));  /* 空でない */
+	mht_destroy(ht);
+
+	ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_compact(ht));
+	CHECK_REJECTED(mht_set_cuckoo(ht));
+	mht_destroy(ht);
+
+	ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_pointer_keys(ht, false));
+	CHECK_REJECTED(mht_set_cuckoo(ht));
+	mht_destroy(ht);
+
+	ht = mht_str_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_freeze(ht));
+	CHECK_REJECTED(mht_set_cuckoo(ht));
+	mht_destroy(ht);
+}
+
+
+int main (void) {
+	test_uint();
+	test_other_key_types();
+	test_colliding_keys();
+	test_rejected();
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * tests/dedup.c -- tests for mht_set_dedup
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define DEDUP_KEYS 30000
+#define DEDUP_VALUE_SIZE 1000
+#define DEDUP_TEMPLATES 3
+
+
+typedef enum {
+	ENGINE_CHAINED,
+	ENGINE_SMALL,
+	ENGINE_CUCKOO,
+	ENGINE_COMPACT,
+	ENGINE_UINT32,
+	ENGINE_STR,
+	ENGINE_COUNT
+} Engine;
+
+
+static char templates[DEDUP_TEMPLATES][DEDUP_VALUE_SIZE];
+
+
+static MHashTable* engine_create (Engine engine) {
+	MHashTable* ht;
+	switch (engine) {
+		case ENGINE_UINT32: ht = mht_uint32_create(16); break;
+		case ENGINE_STR: ht = mht_str_create(16); break;
+		default: ht = mht_uint_create((engine == ENGINE_SMALL) ? 4 : 16); break;
+	}
+	CHECK(ht != NULL);
+	switch (engine) {
+		case ENGINE_CUCKOO: CHECK(mht_set_cuckoo(ht)); break;
+		case ENGINE_COMPACT: CHECK(mht_set_compact(ht)); break;
+		default: break;
+	}
+	CHECK(mht_set_dedup(ht));
+	return ht;
+}
+
+
+/* キーの種類ごとの set / get / delete をまとめる */
+typedef struct {
+	Engine engine;
+	char str_buf[32];
+} KeyCtx;
+
+
+static str_keyt str_key (KeyCtx* ctx, size_t i) {
+	int len = snprintf(ctx->str_buf, sizeof(ctx->str_buf), "key%zu", i);
+	CHECK(len > 0 && (size_t)len < sizeof(ctx->str_buf));
+	return (str_keyt){ ctx->str_buf, (size_t)len };
+}
+
+
+static bool key_set (MHashTable* ht, KeyCtx* ctx, size_t i, size_t template_index) {
+	void* value = templates[template_index];
+	if (ctx->engine == ENGINE_UINT32) return mht_uint32_set(ht, (uint32_t)i, value, DEDUP_VALUE_SIZE);
+	if (ctx->engine == ENGINE_STR) return mht_str_set(ht, str_key(ctx, i), value, DEDUP_VALUE_SIZE);
+	return mht_uint_set(ht, i, value, DEDUP_VALUE_SIZE);
+}
+
+
+static char* key_get (MHashTable* ht, KeyCtx* ctx, size_t i) {
+	if (ctx->engine == ENGINE_UINT32) return mht_uint32_get(ht, (uint32_t)i);
+	if (ctx->engine == ENGINE_STR) return mht_str_get(ht, str_key(ctx, i));
+	return mht_uint_get(ht, i);
+}
+
+
+static bool key_delete (MHashTable* ht, KeyCtx* ctx, size_t i) {
+	if (ctx->engine == ENGINE_UINT32) return mht_uint32_delete(ht, (uint32_t)i);
+	if (ctx->engine == ENGINE_STR) return mht_str_delete(ht, str_key(ctx, i));
+	return mht_uint_delete(ht, i);
+}
+
+
+/* 偶数のキーは 1 つ先のテンプレートに上書きされている */
+static size_t expected_template (size_t i, bool overwritten) {
+	return (overwritten && i % 2 == 0) ? (i + 1) % DEDUP_TEMPLATES : i % DEDUP_TEMPLATES;
+}
+
+
+static void check_values (MHashTable* ht, KeyCtx* ctx, size_t count, bool overwritten, size_t deleted_step) {
+	for (size_t i = 0; i < count; i++) {
+		char* value = key_get(ht, ctx, i);
+		if (deleted_step != 0 && i % deleted_step == 0) {
+			CHECK(value == NULL);
+			continue;
+		}
+		CHECK(value != NULL && memcmp(value, templates[expected_template(i, overwritten)], DEDUP_VALUE_SIZE) == 0);
+	}
+}
+
+
+static void test_engine (Engine engine) {
+	KeyCtx ctx = { .engine = engine };
+	MHashTable* ht = engine_create(engine);
+	size_t count = (engine == ENGINE_SMALL) ? 8 : DEDUP_KEYS;
+
+	for (size_t i = 0; i < count; i++)
+		CHECK(key_set(ht, &ctx, i, i % DEDUP_TEMPLATES));
+	check_values(ht, &ctx, count, false, 0);
+
+	/* 内容が同じ値は 1 つの写しを共有する */
+	CHECK(key_get(ht, &ctx, 0) == key_get(ht, &ctx, DEDUP_TEMPLATES));
+	CHECK(key_get(ht, &ctx, 0) != key_get(ht, &ctx, 1));
+
+	/* 同じ値と違う値での上書き */
+	for (size_t i = 0; i < count; i += 2) {
+		CHECK(key_set(ht, &ctx, i, i % DEDUP_TEMPLATES));
+		CHECK(key_set(ht, &ctx, i, (i + 1) % DEDUP_TEMPLATES));
+	}
+	check_values(ht, &ctx, count, true, 0);
+
+	/* 複製したハッシュテーブルも値を共有する */
+	MHashTable* clone = NULL;
+	if (engine != ENGINE_UINT32) {
+		clone = mht_clone(ht);
+		CHECK(clone != NULL);
+	}
+
+	for (size_t i = 0; i < count; i += 3)
+		CHECK(key_delete(ht, &ctx, i));
+	check_values(ht, &ctx, count, true, 3);
+
+	if (clone != NULL) {
+		check_values(clone, &ctx, count, true, 0);
+		CHECK(key_get(clone, &ctx, 0) == key_get(clone, &ctx, 6));
+		mht_destroy(clone);
+	}
+
+	/* 空にした後も同じ値を入れ直せる */
+	mht_clear(ht);
+	CHECK(key_get(ht, &ctx, 1) == NULL);
+	for (size_t i = 0; i < count; i++)
+		CHECK(key_set(ht, &ctx, i, i % DEDUP_TEMPLATES));
+	check_values(ht, &ctx, count, false, 0);
+
+	/* 格納した値は mht_destroy_without_value でも解放される */
+	if (engine == ENGINE_CHAINED) {
+		mht_destroy_without_value(ht);
+	} else {
+		mht_destroy(ht);
+	}
+}
+
+
+/* raw モードの値は共有されず、いつも通り削除で解放される */
+static void test_raw (void) {
+	MHashTable* ht = engine_create(ENGINE_CHAINED);
+	CHECK(mht_uint_set(ht, 0, templates[0], DEDUP_VALUE_SIZE));
+
+	int* raw = malloc(sizeof(int));
+	CHECK(raw != NULL);
+	*raw = 9;
+	CHECK(mht_uint_set_raw(ht, 1, raw));
+	CHECK(mht_uint_get(ht, 1) == raw);
+
+	/* raw モードの値があるうちは複製できない */
+	errno = 0;
+	CHECK(mht_clone(ht) == NULL);
+	CHECK(errno == EINVAL);
+
+	CHECK(mht_uint_delete(ht, 1));
+	MHashTable* clone = mht_clone(ht);
+	CHECK(clone != NULL);
+	mht_destroy(clone);
+	mht_destroy(ht);
+}
+
+
+/* 空でないハッシュテーブルと、同時に使えないオプションやエンジンは拒否される */
+static void test_rejected (void) {
+	size_t value = 1;
+	MHashTable* filled = mht_uint_create(16);
+	CHECK(filled != NULL);
+	CHECK(mht_uint_set(filled, 1, &value, sizeof(value)));
+	CHECK_REJECTED(mht_set_dedup(filled));
+
+	MHashTable* compressed = mht_uint_create(16);
+	CHECK(compressed != NULL);
+	CHECK(mht_set_compression(compressed, 64));
+	CHECK_REJECTED(mht_set_dedup(compressed));
+	mht_destroy(compressed);
+
+	MHashTable* split = mht_split_create(16);
+	if (split != NULL) {  /* C11 atomics が使えない環境では作れない */
+		CHECK_REJECTED(mht_set_dedup(split));
+		mht_destroy(split);
+	}
+
+	MHashTable* frozen = mht_str_create(16);
+	CHECK(frozen != NULL);
+	CHECK(mht_freeze(frozen));
+	CHECK_REJECTED(mht_set_dedup(frozen));
+	mht_destroy(frozen);
+
+	/* 重複を除くハッシュテーブルは圧縮、マージ、凍結、NUMA レプリカを使えない */
+	MHashTable* dedup = engine_create(ENGINE_CHAINED);
+	CHECK_REJECTED(mht_set_compression(dedup, 64));
+	CHECK_REJECTED(mht_merge(filled, dedup, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK_REJECTED(mht_merge(dedup, filled, MHT_MERGE_KEEP_DST, NULL, NULL));
+	errno = 0;
+	CHECK(!mht_set_numa_replicas(dedup));
+	CHECK(errno == EINVAL || errno == ENOSYS);  /* Linux 以外ではレプリカ自体が使えない */
+	mht_destroy(dedup);
+
+	MHashTable* dedup_str = engine_create(ENGINE_STR);
+	CHECK(mht_str_set(dedup_str, TEST_STR_KEY("a"), templates[0], DEDUP_VALUE_SIZE));
+	CHECK_REJECTED(mht_freeze(dedup_str));
+	mht_destroy(dedup_str);
+
+	mht_destroy(filled);
+}
+
+
+int main (void) {
+	for (size_t t = 0; t < DEDUP_TEMPLATES; t++) {
+		memset(templates[t], 'a' + (int)t, DEDUP_VALUE_SIZE);
+		templates[t][5] = '\0';
+	}
+	for (int engine = 0; engine < ENGINE_COUNT; engine++)
+		test_engine(engine);
+	test_raw();
+	test_rejected();
+	return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * tests/destroy_async.c -- tests for mht_destroy_async
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define LARGE_KEYS 100000  /* 裏のスレッドに解放を任せる件数 */
+
+
+static str_keyt str_key (char* buf, size_t buf_size, uint_keyt i) {
+	int len = snprintf(buf, buf_size, "key%zu", (size_t)i);
+	CHECK(len > 0 && (size_t)len < buf_size);
+	return (str_keyt){ buf, (size_t)len };
+}
+
+
+static MHashTable* filled_uint_table (size_t count) {
+	MHashTable* ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	for (uint_keyt i = 0; i < count; i++)
+		CHECK(mht_uint_set(ht, i, &i, sizeof(i)));
+	return ht;
+}
+
+
+/* 各エンジンの大きなハッシュテーブルを非同期に破棄している間も、他のハッシュテーブルは使える */
+static void test_engines (void) {
+	MHashTable* chained = filled_uint_table(LARGE_KEYS);
+
+	MHashTable* cuckoo = mht_uint_create(16);
+	MHashTable* compact = mht_uint_create(16);
+	MHashTable* str_ht = mht_str_create(16);
+	CHECK(cuckoo != NULL && compact != NULL && str_ht != NULL);
+	CHECK(mht_set_cuckoo(cuckoo));
+	CHECK(mht_set_compact(compact));
+	char buf[32];
+	for (uint_keyt i = 0; i < LARGE_KEYS; i++) {
+		CHECK(mht_uint_set(cuckoo, i, &i, sizeof(i)));
+		CHECK(mht_uint_set(compact, i, &i, sizeof(i)));
+		CHECK(mht_str_set(str_ht, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+	}
+
+	MHashTable* split = mht_split_create(16);  /* C11 atomics が使えない環境では作れない */
+	if (split != NULL) {
+		for (uint_keyt i = 0; i < TEST_KEYS; i++)
+			CHECK(mht_split_set(split, i, &i, sizeof(i)));
+	}
+
+	MHashTable* in_use = filled_uint_table(TEST_KEYS);
+
+	mht_destroy_async(chained);
+	mht_destroy_async(cuckoo);
+	mht_destroy_async(compact);
+	mht_destroy_async(str_ht);
+	if (split != NULL) mht_destroy_async(split);
+
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		uint_keyt* value = mht_uint_get(in_use, i);
+		CHECK(value != NULL && *value == i);
+		CHECK(mht_uint_delete(in_use, i));
+	}
+	mht_clear(in_use);
+	mht_destroy(in_use);
+}
+
+
+/* 小さいハッシュテーブルは呼び出したスレッドがその場で解放する */
+static void test_small (void) {
+	MHashTable* empty = mht_uint_create(16);
+	CHECK(empty != NULL);
+	mht_destroy_async(empty);
+
+	MHashTable* small = filled_uint_table(5);
+	mht_destroy_async(small);
+
+	for (int i = 0; i < 100; i++) {
+		MHashTable* ht = filled_uint_table(100);
+		mht_destroy_async(ht);
+	}
+
+	MHashTable* after = filled_uint_table(10);
+	uint_keyt* value = mht_uint_get(after, 9);
+	CHECK(value != NULL && *value == 9);
+	mht_destroy(after);
+}
+
+
+static void test_rejected (void) {
+	errno = 0;
+	mht_destroy_async(NULL);
+	CHECK(errno == EINVAL);
+}
+
+
+int main (void) {
+	test_engines();
+	test_small();
+	test_rejected();
+	return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * tests/flat_combining.c -- tests for the flat-combining write path
+ */
+
+#include "test_common.h"
+
+#include <pthread.h>
+#include <string.h>
+
+
+#define FC_THREADS 4
+#define FC_KEYS_PER_THREAD 5000
+#define FC_WAVES 5
+
+
+typedef struct {
+	MHashTable* uint_ht;
+	MHashTable* str_ht;
+	uint_keyt base;
+} Worker;
+
+
+static str_keyt str_key (char* buf, size_t buf_size, uint_keyt i) {
+	int len = snprintf(buf, buf_size, "key%zu", (size_t)i);
+	CHECK(len > 0 && (size_t)len < buf_size);
+	return (str_keyt){ buf, (size_t)len };
+}
+
+
+/* 2 つのハッシュテーブルへの書き込みが同じ combiner でまとめて実行される */
+static void* worker_main (void* arg) {
+	Worker* worker = arg;
+	char buf[32];
+
+	for (uint_keyt i = 0; i < FC_KEYS_PER_THREAD; i++) {
+		uint_keyt key = worker->base + i;
+		CHECK(mht_uint_set(worker->uint_ht, key, &key, sizeof(key)));
+		CHECK(mht_str_set(worker->str_ht, str_key(buf, sizeof(buf), key), &key, sizeof(key)));
+	}
+	for (uint_keyt i = 0; i < FC_KEYS_PER_THREAD; i += 2) {
+		uint_keyt key = worker->base + i;
+		CHECK(mht_uint_delete(worker->uint_ht, key));
+		CHECK(!mht_uint_delete(worker->uint_ht, key));
+		CHECK(mht_str_delete(worker->str_ht, str_key(buf, sizeof(buf), key)));
+	}
+	return NULL;
+}
+
+
+static void check_workers (MHashTable* uint_ht, MHashTable* str_ht, uint_keyt threads) {
+	char buf[32];
+	for (uint_keyt key = 0; key < threads * FC_KEYS_PER_THREAD; key++) {
+		uint_keyt* value = mht_uint_get(uint_ht, key);
+		uint_keyt* str_value = mht_str_get(str_ht, str_key(buf, sizeof(buf), key));
+		if (key % 2 == 0) {
+			CHECK(value == NULL && str_value == NULL);
+		} else {
+			CHECK(value != NULL && *value == key);
+			CHECK(str_value != NULL && *str_value == key);
+		}
+	}
+}
+
+
+/* スレッドを何度も作り直して、終了したスレッドのスロットが再利用されても書き込みが失われないことを確かめる */
+static void test_concurrent_writes (void) {
+	MHashTable* uint_ht = mht_uint_create(16);  /* combiner の中で何度も拡張させる */
+	MHashTable* str_ht = mht_str_create(16);
+	CHECK(uint_ht != NULL && str_ht != NULL);
+
+	Worker workers[FC_WAVES * FC_THREADS];
+	for (size_t wave = 0; wave < FC_WAVES; wave++) {
+		pthread_t threads[FC_THREADS];
+		for (size_t i = 0; i < FC_THREADS; i++) {
+			Worker* worker = &workers[wave * FC_THREADS + i];
+			worker->uint_ht = uint_ht;
+			worker->str_ht = str_ht;
+			worker->base = (uint_keyt)(wave * FC_THREADS + i) * FC_KEYS_PER_THREAD;
+			CHECK(pthread_create(&threads[i], NULL, worker_main, worker) == 0);
+		}
+		for (size_t i = 0; i < FC_THREADS; i++)
+			CHECK(pthread_join(threads[i], NULL) == 0);
+	}
+	check_workers(uint_ht, str_ht, FC_WAVES * FC_THREADS);
+
+	mht_clear(uint_ht);
+	CHECK(mht_uint_get(uint_ht, 1) == NULL);
+
+	mht_destroy(uint_ht);
+	mht_destroy(str_ht);
+}
+
+
+/* 無効にした後もロックを取る通常の経路で同じ結果になる */
+static void test_toggle (void) {
+	MHashTable* ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+
+	static uint_keyt* raw_values[TEST_KEYS];  /* set_raw で渡した値は削除の際にハッシュテーブルが解放する */
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		CHECK(mht_set_flat_combining(i % 2 == 0));
+		raw_values[i] = malloc(sizeof(uint_keyt));
+		CHECK(raw_values[i] != NULL);
+		*raw_values[i] = i;
+		CHECK(mht_uint_set_raw(ht, i, raw_values[i]));
+	}
+	CHECK(mht_set_flat_combining(true));
+	for (uint_keyt i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_uint_get(ht, i) == raw_values[i]);
+	for (uint_keyt i = 0; i < TEST_KEYS; i += 2)
+		CHECK(mht_uint_delete(ht, i));
+	CHECK(mht_set_flat_combining(false));
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		uint_keyt* value = mht_uint_get(ht, i);
+		if (i % 2 == 0) {
+			CHECK(value == NULL);
+		} else {
+			CHECK(value == raw_values[i] && *value == i);
+		}
+	}
+
+	mht_destroy(ht);
+}
+
+
+int main (void) {
+	CHECK(mht_set_flat_combining(false));  /* 無効にするのはどの環境でも成功する */
+
+	errno = 0;
+	if (!mht_set_flat_combining(true)) {  /* C11 atomics が使えない環境では ENOSYS で失敗する */
+		CHECK(errno == ENOSYS);
+		return 0;
+	}
+
+	test_concurrent_writes();
+	test_toggle();
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * tests/freeze.c -- tests for mht_freeze
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define FREEZE_KEYS 20000
+#define FREEZE_KEY_SIZE 48
+
+
+typedef enum {
+	ENGINE_CHAINED,
+	ENGINE_SMALL,
+	ENGINE_CUCKOO,
+	ENGINE_COMPACT,
+	ENGINE_KEY_POOL,
+	ENGINE_EMPTY,
+	ENGINE_COUNT
+} Engine;
+
+
+static char keys[FREEZE_KEYS][FREEZE_KEY_SIZE];
+
+
+/* 接頭辞を共有するキー、他のキーの接頭辞になるキー、非 ASCII のバイトを含むキーを混ぜる */
+static void make_keys (void) {
+	for (size_t i = 0; i < FREEZE_KEYS; i++) {
+		int len;
+		switch (i % 5) {
+			case 0: len = snprintf(keys[i], FREEZE_KEY_SIZE, "https://example.com/p/%zu", i); break;
+			case 1: len = snprintf(keys[i], FREEZE_KEY_SIZE, "https://example.com/p/%zu/x", i - 1); break;
+			case 2: len = snprintf(keys[i], FREEZE_KEY_SIZE, "/usr/lib/\xe9%zu", i * 7919 % 1000003); break;
+			case 3: len = snprintf(keys[i], FREEZE_KEY_SIZE, "a%zu", i); break;
+			default: len = snprintf(keys[i], FREEZE_KEY_SIZE, "\xff%zu", i); break;
+		}
+		CHECK(len > 0 && len < FREEZE_KEY_SIZE);
+	}
+}
+
+
+static str_keyt key_at (size_t i) {
+	return (str_keyt){ keys[i], strlen(keys[i]) };
+}
+
+
+static MHashTable* engine_create (Engine engine) {
+	MHashTable* ht = mht_str_create((engine == ENGINE_SMALL) ? 4 : 64);
+	CHECK(ht != NULL);
+	switch (engine) {
+		case ENGINE_CUCKOO: CHECK(mht_set_cuckoo(ht)); break;
+		case ENGINE_COMPACT: CHECK(mht_set_compact(ht)); break;
+		case ENGINE_KEY_POOL: CHECK(mht_set_key_pool(ht)); break;
+		default: break;
+	}
+	return ht;
+}
+
+
+/* 凍結したハッシュテーブルと凍結していないハッシュテーブルで検索結果が一致する */
+static void check_lookup (MHashTable* frozen, MHashTable* reference, str_keyt key) {
+	size_t* expected = mht_str_get(reference, key);
+	size_t* value = mht_str_get(frozen, key);
+	CHECK((expected == NULL) == (value == NULL));
+	if (expected != NULL) CHECK(*expected == *value);
+}
+
+
+static void test_engine (Engine engine) {
+	MHashTable* ht = engine_create(engine);
+	MHashTable* reference = mht_str_create(64);
+	CHECK(reference != NULL);
+
+	size_t count = (engine == ENGINE_SMALL) ? 5 : (engine == ENGINE_EMPTY) ? 0 : FREEZE_KEYS;
+	for (size_t i = 0; i < count; i++) {
+		CHECK(mht_str_set(ht, key_at(i), &i, sizeof(i)));
+		CHECK(mht_str_set(reference, key_at(i), &i, sizeof(i)));
+	}
+	/* 削除済みのキーは凍結したハッシュテーブルに含まれない */
+	for (size_t i = 0; i < count; i += 7) {
+		CHECK(mht_str_delete(ht, key_at(i)));
+		CHECK(mht_str_delete(reference, key_at(i)));
+	}
+
+	CHECK(mht_freeze(ht));
+	/* 凍結済みなら何もしない */
+	CHECK(mht_freeze(ht));
+
+	char buf[FREEZE_KEY_SIZE + 1];
+	for (size_t i = 0; i < FREEZE_KEYS; i++) {
+		str_keyt key = key_at(i);
+		check_lookup(ht, reference, key);
+
+		/* 前後に 1 バイト足したキーや 1 バイト削ったキーも同じように外れる */
+		memcpy(buf, key.ptr, key.len);
+		buf[key.len] = 'Q';
+		check_lookup(ht, reference, (str_keyt){ buf, key.len + 1 });
+		buf[key.len] = '0';
+		check_lookup(ht, reference, (str_keyt){ buf, key.len + 1 });
+		check_lookup(ht, reference, (str_keyt){ buf, key.len - 1 });
+	}
+	check_lookup(ht, reference, TEST_STR_KEY("0"));
+	check_lookup(ht, reference, TEST_STR_KEY("\xff\xff"));
+
+	size_t all_count = 0;
+	void** values = mht_all_get(ht, &all_count);
+	CHECK(all_count == count - (count + 6) / 7);
+	size_t sum = 0;
+	for (size_t i = 0; i < all_count; i++) sum += *(size_t*)values[i];
+	size_t expected_sum = 0;
+	for (size_t i = 0; i < count; i++)
+		if (i % 7 != 0) expected_sum += i;
+	CHECK(sum == expected_sum);
+	CHECK(mht_all_release_arr(values));
+
+	/* 凍結したハッシュテーブルは読み出し専用で、複製もできない */
+	size_t value = 1;
+	CHECK_REJECTED(mht_str_set(ht, TEST_STR_KEY("new"), &value, sizeof(value)));
+	if (count != 0) CHECK_REJECTED(mht_str_delete(ht, key_at(1)));
+	errno = 0;
+	CHECK(mht_clone(ht) == NULL);
+	CHECK(errno == EINVAL);
+
+	/* 空にしても読み出し専用のまま */
+	mht_clear(ht);
+	CHECK(mht_str_get(ht, key_at(1)) == NULL);
+	CHECK_REJECTED(mht_str_set(ht, key_at(1), &value, sizeof(value)));
+
+	mht_destroy(reference);
+	mht_destroy(ht);
+}
+
+
+/* 文字列キー以外や、凍結できないオプションを使うハッシュテーブルは拒否される */
+static void test_rejected (void) {
+	MHashTable* uint_ht = mht_uint_create(16);
+	CHECK(uint_ht != NULL);
+	CHECK_REJECTED(mht_freeze(uint_ht));
+	mht_destroy(uint_ht);
+
+	MHashTable* compressed = mht_str_create(16);
+	CHECK(compressed != NULL);
+	CHECK(mht_set_compression(compressed, 16));
+	CHECK_REJECTED(mht_freeze(compressed));
+	mht_destroy(compressed);
+
+	MHashTable* dedup = mht_str_create(16);
+	CHECK(dedup != NULL);
+	CHECK(mht_set_dedup(dedup));
+	CHECK_REJECTED(mht_freeze(dedup));
+	mht_destroy(dedup);
+
+	/* 凍結した後はキープールも使えない */
+	MHashTable* frozen = mht_str_create(16);
+	CHECK(frozen != NULL);
+	CHECK(mht_freeze(frozen));
+	CHECK_REJECTED(mht_set_key_pool(frozen));
+	mht_destroy(frozen);
+}
+
+
+int main (void) {
+	make_keys();
+	for (int engine = 0; engine < ENGINE_COUNT; engine++)
+		test_engine(engine);
+	test_rejected();
+	return 0;
+}
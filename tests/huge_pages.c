@@ -0,0 +1,83 @@
+/*
+ * tests/huge_pages.c -- tests for huge page backed bucket arrays
+ */
+
+#include "test_common.h"
+
+
+#define HUGE_KEYS ((uint_keyt)1 << 17)  /* バケット配列が数 MiB になり、拡張でも mmap が使われる件数 */
+
+
+static void check_range (MHashTable* ht, uint_keyt begin, uint_keyt end, uint_keyt step, bool present) {
+	for (uint_keyt i = begin; i < end; i += step) {
+		uint_keyt* value = mht_uint_get(ht, i);
+		if (present) {
+			CHECK(value != NULL && *value == i);
+		} else {
+			CHECK(value == NULL);
+		}
+	}
+}
+
+
+static void test_mode (MHtHugePageMode mode) {
+	MHashTable* ht = mht_uint_create(1024);
+	CHECK(ht != NULL);
+	CHECK(mht_set_huge_pages(ht, mode));
+
+	for (uint_keyt i = 0; i < HUGE_KEYS; i++)
+		CHECK(mht_uint_set(ht, i, &i, sizeof(i)));
+	check_range(ht, 0, HUGE_KEYS, 1, true);
+	CHECK(mht_uint_get(ht, HUGE_KEYS) == NULL);
+
+	for (uint_keyt i = 0; i < HUGE_KEYS; i += 2)
+		CHECK(mht_uint_delete(ht, i));
+	check_range(ht, 0, HUGE_KEYS, 2, false);
+	check_range(ht, 1, HUGE_KEYS, 2, true);
+
+	/* clear はバケット配列を残すので、同じ配列に入れ直せることを確かめる */
+	mht_clear(ht);
+	check_range(ht, 0, HUGE_KEYS, 1, false);
+	for (uint_keyt i = 0; i < HUGE_KEYS; i += 3)
+		CHECK(mht_uint_set(ht, i, &i, sizeof(i)));
+	check_range(ht, 0, HUGE_KEYS, 3, true);
+
+	mht_destroy(ht);
+}
+
+
+/* 既に大きなバケット配列を持つハッシュテーブルに設定すると、その場で移し替えられる */
+static void test_enable_on_filled_table (void) {
+	MHashTable* ht = mht_uint_create(HUGE_KEYS);
+	CHECK(ht != NULL);
+
+	for (uint_keyt i = 0; i < HUGE_KEYS; i++)
+		CHECK(mht_uint_set(ht, i, &i, sizeof(i)));
+	CHECK(mht_set_huge_pages(ht, MHT_HUGE_PAGE_TRANSPARENT));
+	check_range(ht, 0, HUGE_KEYS, 1, true);
+
+	CHECK(mht_set_huge_pages(ht, MHT_HUGE_PAGE_OFF));
+	for (uint_keyt i = HUGE_KEYS; i < HUGE_KEYS * 2; i++)
+		CHECK(mht_uint_set(ht, i, &i, sizeof(i)));
+	check_range(ht, 0, HUGE_KEYS * 2, 1, true);
+
+	mht_destroy(ht);
+}
+
+
+static void test_rejected (void) {
+	MHashTable* ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK_REJECTED(mht_set_huge_pages(ht, (MHtHugePageMode)42));
+	mht_destroy(ht);
+}
+
+
+int main (void) {
+	test_mode(MHT_HUGE_PAGE_OFF);
+	test_mode(MHT_HUGE_PAGE_TRANSPARENT);
+	test_mode(MHT_HUGE_PAGE_EXPLICIT);
+	test_enable_on_filled_table();
+	test_rejected();
+	return 0;
+}
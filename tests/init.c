@@ -0,0 +1,60 @@
+/*
+ * tests/init.c -- tests for mht_init
+ */
+
+#include "test_common.h"
+
+
+#define INIT_TABLES 5000
+#define INIT_ARRAYS 100
+
+
+static MHashTable* tables[INIT_TABLES];
+static void** arrays[INIT_ARRAYS];
+
+
+int main (void) {
+	/* 大きすぎる見積もりは初期化の前に拒否される */
+	MHtInitOptions options = { .expected_tables = SIZE_MAX, .expected_all_get_arrays = 0 };
+	errno = 0;
+	CHECK(!mht_init(&options));
+	CHECK(errno == EINVAL);
+
+	options = (MHtInitOptions){ .expected_tables = INIT_TABLES, .expected_all_get_arrays = INIT_ARRAYS };
+	CHECK(mht_init(&options));
+
+	for (size_t i = 0; i < INIT_TABLES; i++) {
+		tables[i] = mht_uint_create(4);
+		CHECK(tables[i] != NULL);
+		uint_keyt key = i;
+		CHECK(mht_uint_set(tables[i], key, &key, sizeof(key)));
+	}
+	for (size_t i = 0; i < INIT_ARRAYS; i++) {
+		size_t count = 0;
+		arrays[i] = mht_all_get(tables[i], &count);
+		CHECK(arrays[i] != NULL && count == 1 && *(uint_keyt*)arrays[i][0] == i);
+	}
+
+	/* 初期化済みなら登録表を広げるだけで、既存のハッシュテーブルはそのまま使える */
+	options.expected_tables = INIT_TABLES * 4;
+	options.expected_all_get_arrays = INIT_ARRAYS * 4;
+	CHECK(mht_init(&options));
+	CHECK(mht_init(NULL));
+	options.expected_tables = SIZE_MAX;
+	CHECK_REJECTED(mht_init(&options));
+
+	for (size_t i = 0; i < INIT_ARRAYS; i++)
+		CHECK(mht_all_release_arr(arrays[i]));
+	for (size_t i = 0; i < INIT_TABLES; i++) {
+		uint_keyt* value = mht_uint_get(tables[i], i);
+		CHECK(value != NULL && *value == i);
+		if (i % 2 == 0) {
+			CHECK(mht_uint_delete(tables[i], i));
+		} else {
+			mht_clear(tables[i]);
+		}
+		CHECK(mht_uint_get(tables[i], i) == NULL);
+		mht_destroy(tables[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * tests/intern.c -- tests for the string interner
+ */
+
+#include "test_common.h"
+
+#include <pthread.h>
+#include <string.h>
+
+
+#define INTERN_KEYS 20000
+#define INTERN_THREADS 4
+#define INTERN_BIG_SIZE 100000
+
+
+static uint32_t ids[INTERN_KEYS];
+static char big[INTERN_BIG_SIZE];
+
+
+static str_keyt str_key (char* buf, size_t buf_size, size_t i) {
+	int len = snprintf(buf, buf_size, "key-%zu", i);
+	CHECK(len > 0 && (size_t)len < buf_size);
+	return (str_keyt){ buf, (size_t)len };
+}
+
+
+/* ID は 1 から順に振られ、同じ内容の文字列には同じ ID が返る */
+static void test_intern_lookup (void) {
+	char buf[32];
+
+	for (size_t i = 0; i < INTERN_KEYS; i++) {
+		ids[i] = mht_intern(str_key(buf, sizeof(buf), i));
+		CHECK(ids[i] == i + 1);
+	}
+	for (size_t i = 0; i < INTERN_KEYS; i++) {
+		CHECK(mht_intern(str_key(buf, sizeof(buf), i)) == ids[i]);
+
+		/* 呼び出し側のバッファではなくアリーナの文字列が返る */
+		str_keyt str = mht_intern_lookup(ids[i]);
+		CHECK(str.ptr != buf && str.len == strlen(buf));
+		CHECK(memcmp(str.ptr, buf, str.len) == 0 && str.ptr[str.len] == '\0');
+	}
+
+	/* ブロックより大きい文字列も格納できる */
+	memset(big, 'x', sizeof(big));
+	uint32_t id = mht_intern(((str_keyt){ big, sizeof(big) }));
+	CHECK(id == INTERN_KEYS + 1);
+	str_keyt str = mht_intern_lookup(id);
+	CHECK(str.len == sizeof(big) && memcmp(str.ptr, big, sizeof(big)) == 0);
+}
+
+
+/* ID をキーにしたハッシュテーブルで文字列を扱える */
+static void test_intern_as_key (void) {
+	char buf[32];
+	MHashTable* ht = mht_uint32_create(4);
+	CHECK(ht != NULL);
+
+	for (size_t i = 0; i < INTERN_KEYS; i++) {
+		uint32_t value = (uint32_t)i;
+		CHECK(mht_uint32_set(ht, mht_intern(str_key(buf, sizeof(buf), i)), &value, sizeof(value)));
+	}
+	for (size_t i = 0; i < INTERN_KEYS; i += 2) {
+		CHECK(mht_uint32_delete(ht, mht_intern(str_key(buf, sizeof(buf), i))));
+	}
+	for (size_t i = 0; i < INTERN_KEYS; i++) {
+		uint32_t* value = mht_uint32_get(ht, ids[i]);
+		CHECK(i % 2 == 0 ? value == NULL : (value != NULL && *value == i));
+	}
+
+	mht_clear(ht);
+	CHECK(mht_uint32_get(ht, ids[1]) == NULL);
+	mht_destroy(ht);
+}
+
+
+/* 複数のスレッドが同時に登録しても同じ文字列には 1 つの ID だけが振られる */
+static void* intern_worker (void* arg) {
+	uint32_t* out = arg;
+	char buf[32];
+
+	for (size_t i = 0; i < INTERN_KEYS; i++) {
+		out[i] = mht_intern(str_key(buf, sizeof(buf), INTERN_KEYS + i));
+		CHECK(out[i] != MHT_INTERN_NONE);
+	}
+	return NULL;
+}
+
+
+static void test_intern_threads (void) {
+	static uint32_t results[INTERN_THREADS][INTERN_KEYS];
+	pthread_t threads[INTERN_THREADS];
+
+	for (size_t t = 0; t < INTERN_THREADS; t++)
+		CHECK(pthread_create(&threads[t], NULL, intern_worker, results[t]) == 0);
+	for (size_t t = 0; t < INTERN_THREADS; t++)
+		CHECK(pthread_join(threads[t], NULL) == 0);
+
+	for (size_t i = 0; i < INTERN_KEYS; i++) {
+		/* 既に登録済みの ID とは重ならない */
+		CHECK(results[0][i] > INTERN_KEYS + 1 && results[0][i] <= 2 * INTERN_KEYS + 1);
+		for (size_t t = 1; t < INTERN_THREADS; t++)
+			CHECK(results[t][i] == results[0][i]);
+	}
+}
+
+
+/* 不正な文字列や未知の ID は拒否される */
+static void test_intern_rejected (void) {
+	errno = 0;
+	CHECK(mht_intern(STR_KEYT_INVALID) == MHT_INTERN_NONE);
+	CHECK(errno == EINVAL);
+
+	errno = 0;
+	CHECK(mht_intern_lookup(MHT_INTERN_NONE).ptr == NULL);
+	CHECK(errno == EINVAL);
+
+	errno = 0;
+	CHECK(mht_intern_lookup(UINT32_MAX).ptr == NULL);
+	CHECK(errno == EINVAL);
+}
+
+
+int main (void) {
+	test_intern_lookup();
+	test_intern_as_key();
+	test_intern_threads();
+	test_intern_rejected();
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * tests/key_pool.c -- tests for mht_set_key_pool and mht_compact_keys
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define POOL_KEYS 20000
+
+
+typedef enum {
+	ENGINE_CHAINED,
+	ENGINE_SMALL,
+	ENGINE_CUCKOO,
+	ENGINE_COMPACT,
+	ENGINE_COUNT
+} Engine;
+
+
+static str_keyt str_key (char* buf, size_t buf_size, size_t i) {
+	int len = snprintf(buf, buf_size, "some-key-%zu", i);
+	CHECK(len > 0 && (size_t)len < buf_size);
+	return (str_keyt){ buf, (size_t)len };
+}
+
+
+static MHashTable* engine_create (Engine engine) {
+	MHashTable* ht = mht_str_create((engine == ENGINE_SMALL) ? 4 : 16);
+	CHECK(ht != NULL);
+	switch (engine) {
+		case ENGINE_CUCKOO: CHECK(mht_set_cuckoo(ht)); break;
+		case ENGINE_COMPACT: CHECK(mht_set_compact(ht)); break;
+		default: break;
+	}
+	CHECK(mht_set_key_pool(ht));
+	return ht;
+}
+
+
+static void check_odd_keys (MHashTable* ht, size_t count) {
+	char buf[32];
+
+	for (size_t i = 0; i < count; i++) {
+		size_t* value = mht_str_get(ht, str_key(buf, sizeof(buf), i));
+		CHECK(i % 2 == 0 ? value == NULL : (value != NULL && *value == i));
+	}
+}
+
+
+/* 削除した分の領域を詰め直しても、残ったキーはそのまま引ける */
+static void test_engine (Engine engine) {
+	char buf[32];
+	MHashTable* ht = engine_create(engine);
+	size_t count = (engine == ENGINE_SMALL) ? 6 : POOL_KEYS;
+
+	for (size_t i = 0; i < count; i++)
+		CHECK(mht_str_set(ht, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+	for (size_t i = 0; i < count; i += 2)
+		CHECK(mht_str_delete(ht, str_key(buf, sizeof(buf), i)));
+	check_odd_keys(ht, count);
+
+	CHECK(mht_compact_keys(ht));
+	check_odd_keys(ht, count);
+
+	/* 削除済みのキーがなければ何もしない */
+	CHECK(mht_compact_keys(ht));
+	check_odd_keys(ht, count);
+
+	/* 上書きしてもキーは増えない */
+	for (size_t i = 1; i < count; i += 2)
+		CHECK(mht_str_set(ht, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+	check_odd_keys(ht, count);
+
+	/* 複製したハッシュテーブルは自分のページにキーを持つ */
+	MHashTable* clone = mht_clone(ht);
+	CHECK(clone != NULL);
+	mht_clear(ht);
+	CHECK(mht_str_get(ht, str_key(buf, sizeof(buf), 1)) == NULL);
+	check_odd_keys(clone, count);
+	mht_destroy(clone);
+
+	/* 空にした後も使い続けられる */
+	for (size_t i = 0; i < count; i++)
+		CHECK(mht_str_set(ht, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+	for (size_t i = 0; i < count; i++) {
+		size_t* value = mht_str_get(ht, str_key(buf, sizeof(buf), i));
+		CHECK(value != NULL && *value == i);
+	}
+	mht_destroy(ht);
+}
+
+
+/* 追加と削除を繰り返した後に広げると、自動で詰め直される */
+static void test_compact_on_rehash (void) {
+	char buf[32];
+	MHashTable* ht = mht_str_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_key_pool(ht));
+
+	for (size_t round = 0; round < 5; round++) {
+		for (size_t i = 0; i < 1000; i++)
+			CHECK(mht_str_set(ht, str_key(buf, sizeof(buf), POOL_KEYS * (round + 1) + i), &i, sizeof(i)));
+		for (size_t i = 0; i < 1000; i++)
+			CHECK(mht_str_delete(ht, str_key(buf, sizeof(buf), POOL_KEYS * (round + 1) + i)));
+	}
+	for (size_t i = 0; i < POOL_KEYS; i++)
+		CHECK(mht_str_set(ht, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+	for (size_t i = 0; i < POOL_KEYS; i++) {
+		size_t* value = mht_str_get(ht, str_key(buf, sizeof(buf), i));
+		CHECK(value != NULL && *value == i);
+	}
+	CHECK(mht_str_get(ht, str_key(buf, sizeof(buf), POOL_KEYS)) == NULL);
+	mht_destroy(ht);
+}
+
+
+/* 文字列キー以外、空でないハッシュテーブル、キープールのないハッシュテーブルは拒否される */
+static void test_rejected (void) {
+	MHashTable* uint_ht = mht_uint_create(4);
+	CHECK(uint_ht != NULL);
+	CHECK_REJECTED(mht_set_key_pool(uint_ht));
+	CHECK_REJECTED(mht_compact_keys(uint_ht));
+	mht_destroy(uint_ht);
+
+	size_t value = 1;
+	MHashTable* str_ht = mht_str_create(4);
+	CHECK(str_ht != NULL);
+	CHECK_REJECTED(mht_compact_keys(str_ht));
+	CHECK(mht_str_set(str_ht, TEST_STR_KEY("key"), &value, sizeof(value)));
+	CHECK_REJECTED(mht_set_key_pool(str_ht));
+	mht_destroy(str_ht);
+}
+
+
+int main (void) {
+	for (int engine = 0; engine < ENGINE_COUNT; engine++)
+		test_engine(engine);
+	test_compact_on_rehash();
+	test_rejected();
+	return 0;
+}
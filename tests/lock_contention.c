@@ -0,0 +1,120 @@
+/*
+ * tests/lock_contention.c -- tests for the global lock under contention
+ *
+ * Build with "make test LOCK_MODE=fair" (after "make clean") to run these tests
+ * against the fair ticket lock instead of the lock from global_lock.h.
+ */
+
+#include "test_common.h"
+
+#include <pthread.h>
+
+
+#define LOCK_THREADS 16  /* CPU の数より多くして、待っているスレッドを眠らせる */
+#define LOCK_KEYS_PER_THREAD 5000
+#define MERGES_PER_THREAD 200
+
+
+static MHashTable* shared;
+static MHashTable* counters;
+static int callbacks_inside;  /* 結合関数の中にいるスレッドの数。ロックで守られているので 0 か 1 */
+static uint64_t callbacks_total;
+
+
+static void* writer_main (void* arg) {
+	uint_keyt base = *(const uint_keyt*)arg;
+
+	for (uint_keyt i = 0; i < LOCK_KEYS_PER_THREAD; i++) {
+		uint_keyt key = base + i;
+		CHECK(mht_uint_set(shared, key, &key, sizeof(key)));
+		uint_keyt* value = mht_uint_get(shared, key);
+		CHECK(value != NULL && *value == key);
+		if (i % 3 == 0) CHECK(mht_uint_delete(shared, key));
+
+		void* out = NULL;
+		errno = 0;
+		if (mht_uint_try_get(shared, key, &out)) {
+			CHECK((i % 3 == 0) ? out == NULL : (out != NULL && *(uint_keyt*)out == key));
+		} else {
+			CHECK(errno == EWOULDBLOCK || errno == ENOSYS);
+		}
+	}
+	return NULL;
+}
+
+
+static void count_combine (void* dst_value, size_t dst_size, const void* src_value, size_t src_size, void* arg) {
+	(void)arg;
+	CHECK(dst_size == sizeof(uint64_t) && src_size == sizeof(uint64_t));
+	CHECK(callbacks_inside == 0);
+	callbacks_inside++;
+	*(uint64_t*)dst_value += *(const uint64_t*)src_value;
+	callbacks_total++;
+	callbacks_inside--;
+}
+
+
+/* 結合関数はロックを持ったまま呼ばれるので、同時に 2 つのスレッドが中に入ることはない */
+static void* merger_main (void* arg) {
+	(void)arg;
+	MHashTable* local = mht_uint_create(4);
+	CHECK(local != NULL);
+	uint64_t one = 1;
+	CHECK(mht_uint_set(local, 0, &one, sizeof(one)));
+
+	for (int i = 0; i < MERGES_PER_THREAD; i++)
+		CHECK(mht_merge(counters, local, MHT_MERGE_COMBINE, count_combine, NULL));
+
+	mht_destroy(local);
+	return NULL;
+}
+
+
+static void test_writers (void) {
+	shared = mht_uint_create(16);
+	CHECK(shared != NULL);
+
+	uint_keyt bases[LOCK_THREADS];
+	pthread_t threads[LOCK_THREADS];
+	for (size_t i = 0; i < LOCK_THREADS; i++) {
+		bases[i] = (uint_keyt)i * LOCK_KEYS_PER_THREAD;
+		CHECK(pthread_create(&threads[i], NULL, writer_main, &bases[i]) == 0);
+	}
+	for (size_t i = 0; i < LOCK_THREADS; i++)
+		CHECK(pthread_join(threads[i], NULL) == 0);
+
+	size_t count = 0;
+	void** values = mht_all_get(shared, &count);
+	CHECK(count == LOCK_THREADS * (LOCK_KEYS_PER_THREAD - (LOCK_KEYS_PER_THREAD + 2) / 3));
+	mht_all_release_arr(values);
+
+	mht_clear(shared);
+	mht_destroy(shared);
+}
+
+
+static void test_mutual_exclusion (void) {
+	counters = mht_uint_create(4);
+	CHECK(counters != NULL);
+	uint64_t zero = 0;
+	CHECK(mht_uint_set(counters, 0, &zero, sizeof(zero)));
+
+	pthread_t threads[LOCK_THREADS];
+	for (size_t i = 0; i < LOCK_THREADS; i++)
+		CHECK(pthread_create(&threads[i], NULL, merger_main, NULL) == 0);
+	for (size_t i = 0; i < LOCK_THREADS; i++)
+		CHECK(pthread_join(threads[i], NULL) == 0);
+
+	uint64_t* total = mht_uint_get(counters, 0);
+	CHECK(total != NULL && *total == LOCK_THREADS * MERGES_PER_THREAD);
+	CHECK(callbacks_total == LOCK_THREADS * MERGES_PER_THREAD);
+
+	mht_destroy(counters);
+}
+
+
+int main (void) {
+	test_writers();
+	test_mutual_exclusion();
+	return 0;
+}
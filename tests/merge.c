@@ -0,0 +1,238 @@
+/*
+ * tests/merge.c -- tests for mht_merge and mht_merge_consume
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define MERGE_KEYS 3000
+#define MERGE_OFFSET 2  /* 元のハッシュテーブルのキーはこれだけずらして、一部だけを重ねる */
+
+
+typedef enum {
+	ENGINE_CHAINED,
+	ENGINE_CUCKOO,
+	ENGINE_COMPACT,
+	ENGINE_SMALL,
+	ENGINE_ORDERED_POINTER_KEYS,
+	ENGINE_COUNT
+} Engine;
+
+
+/* キー from から count 個を、値をキーの mul 倍にして入れる */
+static MHashTable* engine_table (Engine engine, uint_keyt from, uint_keyt count, uint_keyt mul) {
+	MHashTable* ht = mht_uint_create((engine == ENGINE_SMALL) ? 4 : 16);
+	CHECK(ht != NULL);
+	switch (engine) {
+		case ENGINE_CUCKOO: CHECK(mht_set_cuckoo(ht)); break;
+		case ENGINE_COMPACT: CHECK(mht_set_compact(ht)); break;
+		case ENGINE_ORDERED_POINTER_KEYS: CHECK(mht_set_pointer_keys(ht, true)); break;
+		default: break;
+	}
+	for (uint_keyt i = from; i < from + count; i++) {
+		uint_keyt value = i * mul;
+		CHECK(mht_uint_set(ht, i, &value, sizeof(value)));
+	}
+	return ht;
+}
+
+
+static void add_combine (void* dst_value, size_t dst_size, const void* src_value, size_t src_size, void* arg) {
+	CHECK(dst_size == sizeof(uint_keyt) && src_size == sizeof(uint_keyt));
+	*(uint_keyt*)dst_value += *(const uint_keyt*)src_value;
+	++*(size_t*)arg;
+}
+
+
+static void check_count (MHashTable* ht, size_t expected) {
+	size_t count = SIZE_MAX;
+	void** values = mht_all_get(ht, &count);
+	CHECK(count == expected);
+	mht_all_release_arr(values);
+}
+
+
+static void test_engines (Engine dst_engine, Engine src_engine, MHtMergePolicy policy, bool consume) {
+	uint_keyt dst_count = (dst_engine == ENGINE_SMALL) ? 6 : MERGE_KEYS;
+	uint_keyt src_count = (src_engine == ENGINE_SMALL) ? 6 : MERGE_KEYS;
+	MHashTable* dst = engine_table(dst_engine, 0, dst_count, 1);
+	MHashTable* src = engine_table(src_engine, MERGE_OFFSET, src_count, 10);
+
+	size_t calls = 0;
+	if (consume) {
+		CHECK(mht_merge_consume(dst, src, policy, add_combine, &calls));
+	} else {
+		CHECK(mht_merge(dst, src, policy, add_combine, &calls));
+	}
+
+	uint_keyt total = (dst_count > src_count + MERGE_OFFSET) ? dst_count : src_count + MERGE_OFFSET;
+	check_count(dst, total);
+
+	size_t overlap = 0;
+	for (uint_keyt i = 0; i < total; i++) {
+		bool in_dst = (i < dst_count);
+		bool in_src = (i >= MERGE_OFFSET && i < src_count + MERGE_OFFSET);
+		uint_keyt expected;
+		if (!in_src) {
+			expected = i;
+		} else if (!in_dst) {
+			expected = i * 10;
+		} else {
+			overlap++;
+			expected = (policy == MHT_MERGE_KEEP_DST) ? i : (policy == MHT_MERGE_TAKE_SRC) ? i * 10 : i * 11;
+		}
+		uint_keyt* value = mht_uint_get(dst, i);
+		CHECK(value != NULL && *value == expected);
+	}
+	CHECK(calls == ((policy == MHT_MERGE_COMBINE) ? overlap : 0));
+
+	/* consume では元のハッシュテーブルが空になり、そうでなければ元のまま残る */
+	check_count(src, consume ? 0 : src_count);
+	if (!consume) {
+		uint_keyt* value = mht_uint_get(src, MERGE_OFFSET);
+		CHECK(value != NULL && *value == MERGE_OFFSET * 10);
+	}
+
+	/* 統合先はそのまま使い続けられる */
+	for (uint_keyt i = 0; i < total; i += 2)
+		CHECK(mht_uint_delete(dst, i));
+	mht_clear(dst);
+	check_count(dst, 0);
+
+	mht_destroy(dst);
+	mht_destroy(src);
+}
+
+
+static void test_other_key_types (void) {
+	MHashTable* dst = mht_str_create(16);
+	MHashTable* src = mht_str_create(16);
+	CHECK(dst != NULL && src != NULL);
+	CHECK(mht_set_key_pool(src));
+
+	int value = 1;
+	CHECK(mht_str_set(dst, TEST_STR_KEY("key"), &value, sizeof(value)));
+	value = 2;
+	CHECK(mht_str_set(src, TEST_STR_KEY("key"), &value, sizeof(value)));
+	CHECK(mht_str_set(src, TEST_STR_KEY("other"), &value, sizeof(value)));
+	CHECK(mht_merge_consume(dst, src, MHT_MERGE_TAKE_SRC, NULL, NULL));
+	mht_destroy(src);  /* キーは統合先に複製されている */
+
+	int* got = mht_str_get(dst, TEST_STR_KEY("key"));
+	CHECK(got != NULL && *got == 2);
+	got = mht_str_get(dst, TEST_STR_KEY("other"));
+	CHECK(got != NULL && *got == 2);
+	mht_destroy(dst);
+
+	dst = mht_tuple_create(16, 2);
+	src = mht_tuple_create(16, 2);
+	CHECK(dst != NULL && src != NULL);
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		CHECK(mht_tuple_set(src, TUPLE_KEY(i, i), &i, sizeof(i)));
+		if (i % 2 == 0) CHECK(mht_tuple_set(dst, TUPLE_KEY(i, i), &value, sizeof(value)));
+	}
+	CHECK(mht_merge(dst, src, MHT_MERGE_KEEP_DST, NULL, NULL));
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		void* stored = mht_tuple_get(dst, TUPLE_KEY(i, i));
+		CHECK(stored != NULL);
+		if (i % 2 == 0) {
+			CHECK(*(int*)stored == value);
+		} else {
+			CHECK(*(uint_keyt*)stored == i);
+		}
+	}
+	mht_destroy(dst);
+	mht_destroy(src);
+}
+
+
+/* raw モードの値は複製できないが、consume なら値をそのまま移せる */
+static void test_raw (void) {
+	MHashTable* dst = mht_uint_create(16);
+	MHashTable* src = mht_uint_create(16);
+	CHECK(dst != NULL && src != NULL);
+	int* raw = malloc(sizeof(int));
+	CHECK(raw != NULL);
+	*raw = 7;
+	CHECK(mht_uint_set_raw(src, 1, raw));
+
+	CHECK_REJECTED(mht_merge(dst, src, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK(mht_merge_consume(dst, src, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK(mht_uint_get(dst, 1) == raw);
+	CHECK(mht_uint_get(src, 1) == NULL);
+
+	mht_destroy(dst);
+	mht_destroy(src);
+}
+
+
+static void test_rejected (void) {
+	MHashTable* dst = mht_uint_create(16);
+	MHashTable* other = mht_uint_create(16);
+	MHashTable* str_ht = mht_str_create(16);
+	MHashTable* narrow = mht_tuple_create(16, 2);
+	MHashTable* wide = mht_tuple_create(16, 3);
+	MHashTable* compressed = mht_uint_create(16);
+	MHashTable* dedup = mht_uint_create(16);
+	MHashTable* frozen = mht_str_create(16);
+	CHECK(dst != NULL && other != NULL && str_ht != NULL && narrow != NULL && wide != NULL);
+	CHECK(compressed != NULL && dedup != NULL && frozen != NULL);
+	CHECK(mht_set_compression(compressed, 16));
+	CHECK(mht_set_dedup(dedup));
+	CHECK(mht_freeze(frozen));
+
+	uint_keyt key = 1;
+	CHECK(mht_uint_set(other, key, &key, sizeof(key)));
+
+	CHECK_REJECTED(mht_merge(dst, dst, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK_REJECTED(mht_merge(dst, str_ht, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK_REJECTED(mht_merge(narrow, wide, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK_REJECTED(mht_merge(dst, other, (MHtMergePolicy)42, NULL, NULL));
+	CHECK_REJECTED(mht_merge(dst, other, MHT_MERGE_COMBINE, NULL, NULL));
+	CHECK_REJECTED(mht_merge(dst, compressed, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK_REJECTED(mht_merge_consume(compressed, other, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK_REJECTED(mht_merge(dst, dedup, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK_REJECTED(mht_merge(dedup, other, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK_REJECTED(mht_merge(str_ht, frozen, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK_REJECTED(mht_merge(frozen, str_ht, MHT_MERGE_KEEP_DST, NULL, NULL));
+	CHECK_REJECTED(mht_merge(dst, NULL, MHT_MERGE_KEEP_DST, NULL, NULL));
+
+	/* 拒否された統合は、どちらのハッシュテーブルも書き換えない */
+	check_count(dst, 0);
+	check_count(other, 1);
+	CHECK(mht_uint_get(other, key) != NULL);
+
+	MHashTable* split = mht_split_create(16);
+	if (split != NULL) {  /* C11 atomics が使えない環境では作れない */
+		CHECK_REJECTED(mht_merge(dst, split, MHT_MERGE_KEEP_DST, NULL, NULL));
+		CHECK_REJECTED(mht_merge_consume(split, other, MHT_MERGE_KEEP_DST, NULL, NULL));
+		mht_destroy(split);
+	}
+
+	mht_destroy(dst);
+	mht_destroy(other);
+	mht_destroy(str_ht);
+	mht_destroy(narrow);
+	mht_destroy(wide);
+	mht_destroy(compressed);
+	mht_destroy(dedup);
+	mht_destroy(frozen);
+}
+
+
+int main (void) {
+	for (int dst = 0; dst < ENGINE_COUNT; dst++) {
+		for (int src = 0; src < ENGINE_COUNT; src++) {
+			for (int policy = MHT_MERGE_KEEP_DST; policy <= MHT_MERGE_COMBINE; policy++) {
+				test_engines((Engine)dst, (Engine)src, (MHtMergePolicy)policy, false);
+				test_engines((Engine)dst, (Engine)src, (MHtMergePolicy)policy, true);
+			}
+		}
+	}
+	test_other_key_types();
+	test_raw();
+	test_rejected();
+	return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * tests/numa_replicas.c -- tests for NUMA read replicas
+ *
+ * On machines with a single node mht_set_numa_replicas does nothing, so these tests
+ * only check that the hashtable keeps working and that the preconditions are enforced.
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+static str_keyt str_key (char* buf, size_t buf_size, int i) {
+	int len = snprintf(buf, buf_size, "key%d", i);
+	CHECK(len > 0 && (size_t)len < buf_size);
+	return (str_keyt){ buf, (size_t)len };
+}
+
+
+static void test_set_get_delete (void) {
+	MHashTable* ht = mht_str_create(4);
+	CHECK(ht != NULL);
+	CHECK(mht_set_numa_replicas(ht));
+
+	char buf[32];
+	for (int node = -1; node < 4; node++) {  /* レプリカのないノードを指定しても最初のレプリカが使われる */
+		CHECK(mht_numa_prefer_node(node));
+		for (int i = 0; i < TEST_KEYS; i++) {
+			int value = i + node;
+			CHECK(mht_str_set(ht, str_key(buf, sizeof(buf), i), &value, sizeof(value)));
+		}
+		for (int i = 0; i < TEST_KEYS; i++) {
+			int* value = mht_str_get(ht, str_key(buf, sizeof(buf), i));
+			CHECK(value != NULL && *value == i + node);
+		}
+	}
+	CHECK(mht_numa_prefer_node(-1));
+	CHECK(!mht_numa_prefer_node(-2));
+
+	for (int i = 0; i < TEST_KEYS; i += 2)
+		CHECK(mht_str_delete(ht, str_key(buf, sizeof(buf), i)));
+	for (int i = 0; i < TEST_KEYS; i++) {
+		int* value = mht_str_get(ht, str_key(buf, sizeof(buf), i));
+		if (i % 2 == 0) {
+			CHECK(value == NULL);
+		} else {
+			CHECK(value != NULL && *value == i + 3);
+		}
+	}
+
+	mht_clear(ht);
+	CHECK(mht_str_get(ht, str_key(buf, sizeof(buf), 1)) == NULL);
+	int value = 5;
+	CHECK(mht_str_set(ht, str_key(buf, sizeof(buf), 1), &value, sizeof(value)));
+	int* got = mht_str_get(ht, str_key(buf, sizeof(buf), 1));
+	CHECK(got != NULL && *got == 5);
+
+	mht_destroy(ht);
+}
+
+
+static void test_rejected (void) {
+	MHashTable* ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	uint_keyt key = 1;
+	CHECK(mht_uint_set(ht, key, &key, sizeof(key)));
+	CHECK_REJECTED(mht_set_numa_replicas(ht));  /* 空でない */
+	mht_destroy(ht);
+
+	ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_compression(ht, 64));
+	CHECK_REJECTED(mht_set_numa_replicas(ht));
+	mht_destroy(ht);
+
+	ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_dedup(ht));
+	CHECK_REJECTED(mht_set_numa_replicas(ht));
+	mht_destroy(ht);
+
+	ht = mht_str_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_freeze(ht));
+	CHECK_REJECTED(mht_set_numa_replicas(ht));
+	mht_destroy(ht);
+
+	ht = mht_split_create(16);
+	if (ht != NULL) {  /* C11 atomics が使えない環境では作れない */
+		CHECK_REJECTED(mht_set_numa_replicas(ht));
+		mht_destroy(ht);
+	}
+}
+
+
+int main (void) {
+	MHashTable* probe = mht_uint_create(4);
+	CHECK(probe != NULL);
+	errno = 0;
+	bool supported = mht_set_numa_replicas(probe);
+	mht_destroy(probe);
+	if (!supported) {  /* Linux 以外では ENOSYS で失敗する */
+		CHECK(errno == ENOSYS);
+		return 0;
+	}
+
+	test_set_get_delete();
+	test_rejected();
+	return 0;
+}
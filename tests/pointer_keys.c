@@ -0,0 +1,141 @@
+/*
+ * tests/pointer_keys.c -- tests for the pointer-key hashing mode
+ */
+
+#include "test_common.h"
+
+
+#define POINTER_KEYS 20000
+#define OBJECT_SIZE 48  /* 実際のオブジェクトのように、アドレスの下位ビットが揃ったキーにする */
+#define PAGE_STRIDE 4096  /* ページ境界に揃ったキー。シフトした後も下位ビットが 0 のまま残る */
+
+
+typedef enum {
+	MODE_UNORDERED,
+	MODE_ORDERED,
+	MODE_COMPACT_UNORDERED
+} PointerMode;
+
+
+static MHashTable* pointer_table (PointerMode mode) {
+	MHashTable* ht = mht_uint_create(4);  /* 拡張させる */
+	CHECK(ht != NULL);
+	if (mode == MODE_COMPACT_UNORDERED) CHECK(mht_set_compact(ht));
+	CHECK(mht_set_pointer_keys(ht, mode == MODE_ORDERED));
+	return ht;
+}
+
+
+static void test_mode (PointerMode mode, void** objects) {
+	MHashTable* ht = pointer_table(mode);
+
+	for (size_t i = 0; i < POINTER_KEYS; i++)
+		CHECK(mht_uint_set(ht, (uint_keyt)objects[i], &i, sizeof(i)));
+	for (size_t i = 0; i < POINTER_KEYS; i++) {
+		size_t* value = mht_uint_get(ht, (uint_keyt)objects[i]);
+		CHECK(value != NULL && *value == i);
+	}
+	CHECK(mht_uint_get(ht, (uint_keyt)objects[POINTER_KEYS]) == NULL);
+
+	for (size_t i = 0; i < POINTER_KEYS; i += 2) {
+		CHECK(mht_uint_delete(ht, (uint_keyt)objects[i]));
+		CHECK(!mht_uint_delete(ht, (uint_keyt)objects[i]));
+	}
+	for (size_t i = 0; i < POINTER_KEYS; i++) {
+		size_t* value = mht_uint_get(ht, (uint_keyt)objects[i]);
+		if (i % 2 == 0) {
+			CHECK(value == NULL);
+		} else {
+			CHECK(value != NULL && *value == i);
+		}
+	}
+	size_t count = 0;
+	void** values = mht_all_get(ht, &count);
+	CHECK(count == POINTER_KEYS / 2);
+	mht_all_release_arr(values);
+
+	/* 削除したキーを逆順に入れ直しても、順序付きの連鎖が正しく保たれる */
+	for (size_t i = POINTER_KEYS; i-- > 0; ) {
+		size_t value = i + 1;
+		CHECK(mht_uint_set(ht, (uint_keyt)objects[i], &value, sizeof(value)));
+	}
+	for (size_t i = 0; i < POINTER_KEYS; i++) {
+		size_t* value = mht_uint_get(ht, (uint_keyt)objects[i]);
+		CHECK(value != NULL && *value == i + 1);
+	}
+
+	mht_clear(ht);
+	CHECK(mht_uint_get(ht, (uint_keyt)objects[1]) == NULL);
+	for (size_t i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_uint_set(ht, (uint_keyt)objects[i], &i, sizeof(i)));
+	for (size_t i = 0; i < TEST_KEYS; i++) {
+		size_t* value = mht_uint_get(ht, (uint_keyt)objects[i]);
+		CHECK(value != NULL && *value == i);
+	}
+
+	mht_destroy(ht);
+}
+
+
+static void test_rejected (void) {
+	MHashTable* ht = mht_str_create(16);
+	CHECK(ht != NULL);
+	CHECK_REJECTED(mht_set_pointer_keys(ht, false));  /* uint のハッシュテーブルのみ */
+	mht_destroy(ht);
+
+	ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	uint_keyt key = 1;
+	CHECK(mht_uint_set(ht, key, &key, sizeof(key)));
+	CHECK_REJECTED(mht_set_pointer_keys(ht, false));  /* 空でない */
+	mht_destroy(ht);
+
+	ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_cuckoo(ht));
+	CHECK_REJECTED(mht_set_pointer_keys(ht, false));
+	mht_destroy(ht);
+
+	ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_compact(ht));
+	CHECK_REJECTED(mht_set_pointer_keys(ht, true));
+	mht_destroy(ht);
+
+	ht = pointer_table(MODE_UNORDERED);
+	CHECK_REJECTED(mht_set_cuckoo(ht));
+	mht_destroy(ht);
+
+	ht = pointer_table(MODE_ORDERED);
+	CHECK_REJECTED(mht_set_cuckoo(ht));
+	CHECK_REJECTED(mht_set_compact(ht));
+	mht_destroy(ht);
+}
+
+
+int main (void) {
+	void** objects = malloc((POINTER_KEYS + 1) * sizeof(void*));
+	CHECK(objects != NULL);
+	for (size_t i = 0; i <= POINTER_KEYS; i++) {
+		objects[i] = malloc(OBJECT_SIZE);
+		CHECK(objects[i] != NULL);
+	}
+
+	test_mode(MODE_UNORDERED, objects);
+	test_mode(MODE_ORDERED, objects);
+	test_mode(MODE_COMPACT_UNORDERED, objects);
+	test_rejected();
+
+	/* キーは参照しないので、ページ単位に並んだ番地を作るだけでよい */
+	void** pages = malloc((POINTER_KEYS + 1) * sizeof(void*));
+	CHECK(pages != NULL);
+	for (size_t i = 0; i <= POINTER_KEYS; i++) pages[i] = (void*)((uintptr_t)0x10000000U + i * PAGE_STRIDE);
+	test_mode(MODE_UNORDERED, pages);
+	test_mode(MODE_ORDERED, pages);
+	test_mode(MODE_COMPACT_UNORDERED, pages);
+	free(pages);
+
+	for (size_t i = 0; i <= POINTER_KEYS; i++) free(objects[i]);
+	free(objects);
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * tests/read_cache.c -- tests for the per-thread read cache
+ */
+
+#include "test_common.h"
+
+#include <pthread.h>
+#include <string.h>
+
+
+static void test_key_types (void) {
+	MHashTable* uint_ht = mht_uint_create(16);
+	MHashTable* str_ht = mht_str_create(16);
+	MHashTable* u32_ht = mht_uint32_create(16);
+	MHashTable* tuple_ht = mht_tuple_create(16, 3);
+	CHECK(uint_ht != NULL && str_ht != NULL && u32_ht != NULL && tuple_ht != NULL);
+	CHECK(mht_set_read_cache(uint_ht, true));
+	CHECK(mht_set_read_cache(str_ht, true));
+	CHECK(mht_set_read_cache(u32_ht, true));
+	CHECK(mht_set_read_cache(tuple_ht, true));
+
+	/* 32 バイトを超える文字列キーはキャッシュされないが、結果は変わらない */
+	str_keyt long_key = TEST_STR_KEY("a string key that is longer than thirty-two bytes");
+
+	for (int value = 0; value < 3; value++) {
+		CHECK(mht_uint_set(uint_ht, 1, &value, sizeof(value)));
+		CHECK(mht_str_set(str_ht, TEST_STR_KEY("hot"), &value, sizeof(value)));
+		CHECK(mht_str_set(str_ht, long_key, &value, sizeof(value)));
+		CHECK(mht_uint32_set(u32_ht, 1, &value, sizeof(value)));
+		CHECK(mht_tuple_set(tuple_ht, TUPLE_KEY(1, 2, 3), &value, sizeof(value)));
+		for (int i = 0; i < 5; i++) {  /* 2 回目以降はキャッシュから返る */
+			int* got = mht_uint_get(uint_ht, 1);
+			CHECK(got != NULL && *got == value);
+			got = mht_str_get(str_ht, TEST_STR_KEY("hot"));
+			CHECK(got != NULL && *got == value);
+			got = mht_str_get(str_ht, long_key);
+			CHECK(got != NULL && *got == value);
+			got = mht_uint32_get(u32_ht, 1);
+			CHECK(got != NULL && *got == value);
+			got = mht_tuple_get(tuple_ht, TUPLE_KEY(1, 2, 3));
+			CHECK(got != NULL && *got == value);
+		}
+	}
+	CHECK(mht_tuple_get(tuple_ht, TUPLE_KEY(1, 2, 4)) == NULL);
+	CHECK(mht_str_get(str_ht, TEST_STR_KEY("ho")) == NULL);
+
+	CHECK(mht_uint_delete(uint_ht, 1));
+	CHECK(mht_str_delete(str_ht, TEST_STR_KEY("hot")));
+	CHECK(mht_uint32_delete(u32_ht, 1));
+	CHECK(mht_tuple_delete(tuple_ht, TUPLE_KEY(1, 2, 3)));
+	CHECK(mht_uint_get(uint_ht, 1) == NULL);
+	CHECK(mht_str_get(str_ht, TEST_STR_KEY("hot")) == NULL);
+	CHECK(mht_uint32_get(u32_ht, 1) == NULL);
+	CHECK(mht_tuple_get(tuple_ht, TUPLE_KEY(1, 2, 3)) == NULL);
+
+	mht_destroy(uint_ht);
+	mht_destroy(str_ht);
+	mht_destroy(u32_ht);
+	mht_destroy(tuple_ht);
+}
+
+
+/* 拡張と clear の後もキャッシュから古い値が返らない */
+static void test_rehash_and_clear (void) {
+	MHashTable* ht = mht_uint_create(4);
+	CHECK(ht != NULL);
+	CHECK(mht_set_read_cache(ht, true));
+
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		CHECK(mht_uint_set(ht, i, &i, sizeof(i)));
+		for (uint_keyt j = (i < 8) ? 0 : i - 8; j <= i; j++) {
+			uint_keyt* value = mht_uint_get(ht, j);
+			CHECK(value != NULL && *value == j);
+		}
+	}
+	for (uint_keyt i = 0; i < TEST_KEYS; i += 2)
+		CHECK(mht_uint_delete(ht, i));
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		uint_keyt* value = mht_uint_get(ht, i);
+		if (i % 2 == 0) {
+			CHECK(value == NULL);
+		} else {
+			CHECK(value != NULL && *value == i);
+		}
+	}
+
+	mht_clear(ht);
+	for (uint_keyt i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_uint_get(ht, i) == NULL);
+
+	CHECK(mht_set_read_cache(ht, false));
+	uint_keyt key = 3;
+	CHECK(mht_uint_set(ht, key, &key, sizeof(key)));
+	uint_keyt* value = mht_uint_get(ht, key);
+	CHECK(value != NULL && *value == key);
+
+	mht_destroy(ht);
+
+	/* 破棄したハッシュテーブルと同じアドレスに作られたハッシュテーブルにキャッシュが残っていない */
+	ht = mht_uint_create(4);
+	CHECK(ht != NULL);
+	CHECK(mht_set_read_cache(ht, true));
+	CHECK(mht_uint_get(ht, key) == NULL);
+	mht_destroy(ht);
+}
+
+
+/* 複製は別々にキャッシュされ、破棄したテーブルのキャッシュは型の違うテーブルにも残らない */
+static void test_clone_and_destroy (void) {
+	MHashTable* ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_read_cache(ht, true));
+	int value = 1;
+	CHECK(mht_uint_set(ht, 7, &value, sizeof(value)));
+	int* got = mht_uint_get(ht, 7);
+	CHECK(got != NULL && *got == 1);
+
+	MHashTable* clone = mht_clone(ht);
+	CHECK(clone != NULL);
+	got = mht_uint_get(clone, 7);
+	CHECK(got != NULL && *got == 1);
+	value = 2;
+	CHECK(mht_uint_set(clone, 7, &value, sizeof(value)));
+	got = mht_uint_get(ht, 7);
+	CHECK(got != NULL && *got == 1);
+	got = mht_uint_get(clone, 7);
+	CHECK(got != NULL && *got == 2);
+
+	mht_destroy(ht);
+	mht_destroy_async(clone);
+
+	for (int i = 0; i < 2; i++) {
+		MHashTable* str_ht = mht_str_create(16);
+		MHashTable* uint_ht = mht_uint_create(16);
+		CHECK(str_ht != NULL && uint_ht != NULL);
+		CHECK(mht_set_read_cache(str_ht, true));
+		CHECK(mht_set_read_cache(uint_ht, true));
+		CHECK(mht_str_get(str_ht, TEST_STR_KEY("7")) == NULL);
+		CHECK(mht_uint_get(uint_ht, 7) == NULL);
+		mht_destroy(str_ht);
+		mht_destroy(uint_ht);
+	}
+}
+
+
+typedef struct {
+	MHashTable* ht;
+	pthread_barrier_t* barrier;
+} Reader;
+
+
+static void* reader_main (void* arg) {
+	Reader* reader = arg;
+
+	int* value = mht_uint_get(reader->ht, 1);  /* このスレッドのキャッシュに入る */
+	CHECK(value != NULL && *value == 1);
+	pthread_barrier_wait(reader->barrier);
+	pthread_barrier_wait(reader->barrier);  /* この間に別のスレッドが値を書き換える */
+	value = mht_uint_get(reader->ht, 1);
+	CHECK(value != NULL && *value == 2);
+	return NULL;
+}
+
+
+/* 他のスレッドの書き込みでもキャッシュは無効になる */
+static void test_other_thread_write (void) {
+	MHashTable* ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK(mht_set_read_cache(ht, true));
+
+	int value = 1;
+	CHECK(mht_uint_set(ht, 1, &value, sizeof(value)));
+
+	pthread_barrier_t barrier;
+	CHECK(pthread_barrier_init(&barrier, NULL, 2) == 0);
+	Reader reader = { ht, &barrier };
+	pthread_t thread;
+	CHECK(pthread_create(&thread, NULL, reader_main, &reader) == 0);
+
+	pthread_barrier_wait(&barrier);
+	value = 2;
+	CHECK(mht_uint_set(ht, 1, &value, sizeof(value)));
+	pthread_barrier_wait(&barrier);
+
+	CHECK(pthread_join(thread, NULL) == 0);
+	pthread_barrier_destroy(&barrier);
+	mht_destroy(ht);
+}
+
+
+static void test_rejected (void) {
+	MHashTable* ht = mht_split_create(16);
+	if (ht != NULL) {
+		CHECK_REJECTED(mht_set_read_cache(ht, true));
+		CHECK(mht_set_read_cache(ht, false));
+		mht_destroy(ht);
+	}
+}
+
+
+int main (void) {
+	MHashTable* probe = mht_uint_create(4);
+	CHECK(probe != NULL);
+	errno = 0;
+	bool supported = mht_set_read_cache(probe, true);
+	mht_destroy(probe);
+	if (!supported) {  /* C11 atomics が使えない環境では ENOSYS で失敗する */
+		CHECK(errno == ENOSYS);
+		return 0;
+	}
+
+	test_key_types();
+	test_rehash_and_clear();
+	test_clone_and_destroy();
+	test_other_thread_write();
+	test_rejected();
+	return 0;
+}
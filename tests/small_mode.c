@@ -0,0 +1,140 @@
+/*
+ * tests/small_mode.c -- tests for tables created with a size of 8 or less
+ */
+
+#include "test_common.h"
+
+#include <string.h>
+
+
+#define SMALL_KEYS 8
+
+
+static str_keyt str_key (char* buf, size_t buf_size, size_t i) {
+	int len = snprintf(buf, buf_size, "key%zu", i);
+	CHECK(len > 0 && (size_t)len < buf_size);
+	return (str_keyt){ buf, (size_t)len };
+}
+
+
+/* 8 件までは小さいモードのまま、9 件目で通常のバケットに切り替わる */
+static void test_str_upgrade (size_t count) {
+	MHashTable* ht = mht_str_create(4);
+	CHECK(ht != NULL);
+
+	char buf[32];
+	for (size_t i = 0; i < count; i++)
+		CHECK(mht_str_set(ht, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+
+	for (size_t i = 0; i < count; i++) {
+		size_t* value = mht_str_get(ht, str_key(buf, sizeof(buf), i));
+		CHECK(value != NULL && *value == i);
+	}
+	CHECK(mht_str_get(ht, str_key(buf, sizeof(buf), count)) == NULL);
+
+	for (size_t i = 0; i < count; i += 3)
+		CHECK(mht_str_delete(ht, str_key(buf, sizeof(buf), i)));
+
+	for (size_t i = 0; i < count; i++) {
+		size_t* value = mht_str_get(ht, str_key(buf, sizeof(buf), i));
+		if (i % 3 == 0) {
+			CHECK(value == NULL);
+		} else {
+			CHECK(value != NULL && *value == i);
+		}
+	}
+
+	size_t out_count = 0;
+	void** values = mht_all_get(ht, &out_count);
+	CHECK(out_count == count - (count + 2) / 3);
+	mht_all_release_arr(values);
+
+	mht_clear(ht);
+	CHECK(mht_str_get(ht, str_key(buf, sizeof(buf), 1)) == NULL);
+	for (size_t i = 0; i < count; i++)
+		CHECK(mht_str_set(ht, str_key(buf, sizeof(buf), i), &i, sizeof(i)));
+	size_t* value = mht_str_get(ht, str_key(buf, sizeof(buf), count - 1));
+	CHECK(value != NULL && *value == count - 1);
+
+	mht_destroy(ht);
+}
+
+
+/* 8 件以内で削除と追加を繰り返してから、9 件目以降を追加して通常のバケットに切り替える */
+static void test_uint_reuse (void) {
+	MHashTable* ht = mht_uint_create(SMALL_KEYS);
+	CHECK(ht != NULL);
+
+	for (uint_keyt round = 0; round < 100; round++) {
+		for (uint_keyt i = 0; i < SMALL_KEYS; i++) {
+			uint_keyt key = round * SMALL_KEYS + i;
+			CHECK(mht_uint_set(ht, key, &key, sizeof(key)));
+		}
+		for (uint_keyt i = 0; i < SMALL_KEYS; i++) {
+			uint_keyt key = round * SMALL_KEYS + i;
+			uint_keyt* value = mht_uint_get(ht, key);
+			CHECK(value != NULL && *value == key);
+			CHECK(mht_uint_delete(ht, key));
+		}
+	}
+
+	for (uint_keyt i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_uint_set(ht, i, &i, sizeof(i)));
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		uint_keyt* value = mht_uint_get(ht, i);
+		CHECK(value != NULL && *value == i);
+	}
+
+	mht_destroy(ht);
+}
+
+
+static void test_other_key_types (void) {
+	MHashTable* u32 = mht_uint32_create(2);
+	MHashTable* tuple = mht_tuple_create(2, 3);
+	CHECK(u32 != NULL && tuple != NULL);
+
+	for (uint32_t i = 0; i < 100; i++) {
+		CHECK(mht_uint32_set(u32, i, &i, sizeof(i)));
+		CHECK(mht_tuple_set(tuple, TUPLE_KEY(i, i + 1, i + 2), &i, sizeof(i)));
+	}
+	for (uint32_t i = 0; i < 100; i++) {
+		uint32_t* value = mht_uint32_get(u32, i);
+		CHECK(value != NULL && *value == i);
+		value = mht_tuple_get(tuple, TUPLE_KEY(i, i + 1, i + 2));
+		CHECK(value != NULL && *value == i);
+	}
+
+	mht_destroy(u32);
+	mht_destroy(tuple);
+}
+
+
+/* 順序付きのポインタキーは小さいモードでは使えないので、設定した時点で通常のバケットに切り替わる */
+static void test_ordered_pointer_keys (void) {
+	MHashTable* ht = mht_uint_create(4);
+	CHECK(ht != NULL);
+	CHECK(mht_set_pointer_keys(ht, true));
+
+	static uint_keyt objects[64];
+	for (uint_keyt i = 0; i < 64; i++)
+		CHECK(mht_uint_set(ht, (uint_keyt)&objects[i], &i, sizeof(i)));
+	for (uint_keyt i = 0; i < 64; i++) {
+		uint_keyt* value = mht_uint_get(ht, (uint_keyt)&objects[i]);
+		CHECK(value != NULL && *value == i);
+	}
+
+	mht_destroy(ht);
+}
+
+
+int main (void) {
+	test_str_upgrade(5);
+	test_str_upgrade(SMALL_KEYS);
+	test_str_upgrade(SMALL_KEYS + 1);
+	test_str_upgrade(200);
+	test_uint_reuse();
+	test_other_key_types();
+	test_ordered_pointer_keys();
+	return 0;
+}
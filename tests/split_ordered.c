@@ -0,0 +1,220 @@
+/*
+ * tests/split_ordered.c -- tests for lock-free split-ordered hashtables
+ */
+
+#include "test_common.h"
+
+#include <pthread.h>
+
+
+#define SPLIT_THREADS 4
+#define SPLIT_KEYS_PER_THREAD 20000
+#define SHARED_KEYS 512
+#define SHARED_ROUNDS 100000
+
+
+typedef struct {
+	MHashTable* ht;
+	uint_keyt base;
+} Worker;
+
+
+/* 各スレッドは自分の範囲のキーだけを扱い、表はスレッドの書き込みと並行して拡張される */
+static void* disjoint_worker (void* arg) {
+	Worker* worker = arg;
+	MHashTable* ht = worker->ht;
+
+	for (uint_keyt i = 0; i < SPLIT_KEYS_PER_THREAD; i++) {
+		uint_keyt key = worker->base + i;
+		CHECK(mht_split_set(ht, key, &key, sizeof(key)));
+	}
+	for (uint_keyt i = 0; i < SPLIT_KEYS_PER_THREAD; i++) {
+		uint_keyt key = worker->base + i;
+		uint_keyt* value = mht_split_get(ht, key);
+		CHECK(value != NULL && *value == key);
+	}
+	for (uint_keyt i = 0; i < SPLIT_KEYS_PER_THREAD; i += 2) {
+		CHECK(mht_split_delete(ht, worker->base + i));
+		CHECK(!mht_split_delete(ht, worker->base + i));
+	}
+	uint_keyt replaced = 7;
+	for (uint_keyt i = 1; i < SPLIT_KEYS_PER_THREAD; i += 4)
+		CHECK(mht_split_set(ht, worker->base + i, &replaced, sizeof(replaced)));
+	return NULL;
+}
+
+
+static void test_concurrent_disjoint (void) {
+	MHashTable* ht = mht_split_create(4);
+	CHECK(ht != NULL);
+
+	Worker workers[SPLIT_THREADS];
+	pthread_t threads[SPLIT_THREADS];
+	for (size_t i = 0; i < SPLIT_THREADS; i++) {
+		workers[i].ht = ht;
+		workers[i].base = (uint_keyt)i * SPLIT_KEYS_PER_THREAD;
+		CHECK(pthread_create(&threads[i], NULL, disjoint_worker, &workers[i]) == 0);
+	}
+	for (size_t i = 0; i < SPLIT_THREADS; i++)
+		CHECK(pthread_join(threads[i], NULL) == 0);
+
+	for (uint_keyt key = 0; key < SPLIT_THREADS * SPLIT_KEYS_PER_THREAD; key++) {
+		uint_keyt* value = mht_split_get(ht, key);
+		uint_keyt i = key % SPLIT_KEYS_PER_THREAD;
+		if (i % 2 == 0) {
+			CHECK(value == NULL);
+		} else {
+			CHECK(value != NULL && *value == ((i % 4 == 1) ? 7 : key));
+		}
+	}
+
+	size_t count = 0;
+	void** values = mht_all_get(ht, &count);
+	CHECK(values != NULL && count == SPLIT_THREADS * SPLIT_KEYS_PER_THREAD / 2);
+	mht_all_release_arr(values);
+
+	mht_destroy(ht);
+}
+
+
+/* 同じキーを奪い合う書き込みの間も、読み出し区間の中で得た値は解放されない */
+static void* shared_worker (void* arg) {
+	Worker* worker = arg;
+	MHashTable* ht = worker->ht;
+	uint64_t seed = worker->base + 1;
+
+	for (int round = 0; round < SHARED_ROUNDS; round++) {
+		seed = seed * 6364136223846793005u + 1442695040888963407u;
+		uint_keyt key = (uint_keyt)((seed >> 33) % SHARED_KEYS);
+		switch ((seed >> 20) % 3) {
+			case 0:
+				CHECK(mht_split_set(ht, key, &key, sizeof(key)));
+				break;
+			case 1: {
+				size_t token;
+				CHECK(mht_split_read_begin(ht, &token));
+				uint_keyt* value = mht_split_get(ht, key);
+				CHECK(value == NULL || *value == key);
+				mht_split_read_end(ht, token);
+				break;
+			}
+			default:
+				mht_split_delete(ht, key);
+				break;
+		}
+	}
+	return NULL;
+}
+
+
+static void test_concurrent_shared (void) {
+	MHashTable* ht = mht_split_create(4);
+	CHECK(ht != NULL);
+
+	Worker workers[SPLIT_THREADS];
+	pthread_t threads[SPLIT_THREADS];
+	for (size_t i = 0; i < SPLIT_THREADS; i++) {
+		workers[i].ht = ht;
+		workers[i].base = (uint_keyt)i;
+		CHECK(pthread_create(&threads[i], NULL, shared_worker, &workers[i]) == 0);
+	}
+	for (size_t i = 0; i < SPLIT_THREADS; i++)
+		CHECK(pthread_join(threads[i], NULL) == 0);
+
+	for (uint_keyt key = 0; key < SHARED_KEYS; key++) {
+		uint_keyt* value = mht_split_get(ht, key);
+		CHECK(value == NULL || *value == key);
+	}
+
+	mht_destroy(ht);
+}
+
+
+/* 通常の uint 用の関数と clear も分割順序リストのハッシュテーブルを受け付ける */
+static void test_uint_api_and_clear (void) {
+	MHashTable* ht = mht_split_create(2);
+	CHECK(ht != NULL);
+
+	for (uint_keyt i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_uint_set(ht, i, &i, sizeof(i)));
+	for (uint_keyt i = 0; i < TEST_KEYS; i += 2)
+		CHECK(mht_uint_delete(ht, i));
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		uint_keyt* value = mht_uint_get(ht, i);
+		if (i % 2 == 0) {
+			CHECK(value == NULL);
+		} else {
+			CHECK(value != NULL && *value == i);
+		}
+	}
+
+	mht_clear(ht);
+	size_t count = 1;
+	void** values = mht_all_get(ht, &count);
+	CHECK(count == 0);
+	mht_all_release_arr(values);
+	CHECK(mht_split_get(ht, 1) == NULL);
+
+	for (uint_keyt i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_split_set(ht, i, &i, sizeof(i)));
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		uint_keyt* value = mht_split_get(ht, i);
+		CHECK(value != NULL && *value == i);
+	}
+
+	uint_keyt* raw = malloc(sizeof(uint_keyt));
+	CHECK(raw != NULL);
+	*raw = 42;
+	CHECK(mht_uint_set_raw(ht, TEST_KEYS, raw));
+	CHECK(mht_split_get(ht, TEST_KEYS) == raw);
+
+	mht_destroy(ht);
+}
+
+
+static void test_rejected (void) {
+	MHashTable* ht = mht_split_create(16);
+	MHashTable* other = mht_uint_create(16);
+	CHECK(ht != NULL && other != NULL);
+
+	uint_keyt key = 1;
+	CHECK_REJECTED(mht_split_set(other, key, &key, sizeof(key)));
+	errno = 0;
+	CHECK(mht_split_get(other, key) == NULL && errno == EINVAL);
+	CHECK_REJECTED(mht_split_set(ht, key, NULL, sizeof(key)));
+	CHECK_REJECTED(mht_split_set(ht, key, &key, 0));
+
+	CHECK_REJECTED(mht_set_cuckoo(ht));
+	CHECK_REJECTED(mht_set_compact(ht));
+	CHECK_REJECTED(mht_set_pointer_keys(ht, false));
+	CHECK_REJECTED(mht_set_numa_replicas(ht));
+	CHECK_REJECTED(mht_set_read_cache(ht, true));
+	CHECK_REJECTED(mht_set_access_tracking(ht, 8));
+	CHECK_REJECTED(mht_set_compression(ht, 64));
+	CHECK_REJECTED(mht_set_dedup(ht));
+	CHECK_REJECTED(mht_set_change_log(ht, 16));
+	CHECK_REJECTED(mht_merge(other, ht, MHT_MERGE_TAKE_SRC, NULL, NULL));
+	CHECK_REJECTED(mht_merge(ht, other, MHT_MERGE_TAKE_SRC, NULL, NULL));
+	errno = 0;
+	CHECK(mht_clone(ht) == NULL && errno == EINVAL);
+
+	mht_destroy(ht);
+	mht_destroy(other);
+}
+
+
+int main (void) {
+	errno = 0;
+	MHashTable* probe = mht_split_create(4);
+	if (probe == NULL) {  /* C11 atomics が使えない環境では ENOSYS で失敗する */
+		CHECK(errno == ENOSYS);
+		return 0;
+	}
+	mht_destroy(probe);
+
+	test_concurrent_disjoint();
+	test_concurrent_shared();
+	test_uint_api_and_clear();
+	test_rejected();
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * tests/test_common.h -- helpers shared by the test programs of mhashtable
+ *
+ * Each test program in this directory is built from a single .c file by
+ * "make test" and exits with a non-zero status on the first failed check.
+ * Failed checks are reported on stdout, because "make test" keeps the error
+ * messages that the library writes to stderr in a .log file next to the test.
+ */
+
+#pragma once
+
+#ifndef MHT_TEST_COMMON_H
+#define MHT_TEST_COMMON_H
+
+
+#include "mhashtable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+
+/* NDEBUG でも無効にならないように assert の代わりに使う */
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			exit(EXIT_FAILURE); \
+		} \
+	} while (0)
+
+/* 組み合わせられない設定が EINVAL で拒否されることを確認する */
+#define CHECK_REJECTED(call) \
+	do { \
+		errno = 0; \
+		CHECK(!(call)); \
+		CHECK(errno == EINVAL); \
+	} while (0)
+
+/*
+ * 文字列リテラルから str_keyt を作る。デバッグビルドの -Wwrite-strings では文字列リテラルが
+ * const になり STR_KEY_LITERAL を使えないので、書き換え可能な配列に写してから渡す
+ */
+#define TEST_STR_KEY(s) (str_keyt){ .ptr = (char[]){ s }, .len = sizeof(s) - 1 }
+
+/* 各テストで値として格納する件数（size の小さいハッシュテーブルに入れて拡張させる） */
+#define TEST_KEYS 1000
+
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * tests/try_lock.c -- tests for the non-blocking try_get and try_set variants
+ */
+
+#include "test_common.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+
+static void test_uncontended (void) {
+	MHashTable* uint_ht = mht_uint_create(4);  /* try_set でも拡張させる */
+	MHashTable* str_ht = mht_str_create(4);
+	MHashTable* u32_ht = mht_uint32_create(4);
+	MHashTable* tuple_ht = mht_tuple_create(4, 2);
+	CHECK(uint_ht != NULL && str_ht != NULL && u32_ht != NULL && tuple_ht != NULL);
+
+	char buf[32];
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		int len = snprintf(buf, sizeof(buf), "key%zu", (size_t)i);
+		str_keyt key = { buf, (size_t)len };
+		CHECK(mht_uint_try_set(uint_ht, i, &i, sizeof(i)));
+		CHECK(mht_str_try_set(str_ht, key, &i, sizeof(i)));
+		CHECK(mht_uint32_try_set(u32_ht, (uint32_t)i, &i, sizeof(i)));
+		CHECK(mht_tuple_try_set(tuple_ht, TUPLE_KEY(i, 1), &i, sizeof(i)));
+	}
+
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		int len = snprintf(buf, sizeof(buf), "key%zu", (size_t)i);
+		str_keyt key = { buf, (size_t)len };
+		void* value = NULL;
+		CHECK(mht_uint_try_get(uint_ht, i, &value) && value != NULL && *(uint_keyt*)value == i);
+		value = NULL;
+		CHECK(mht_str_try_get(str_ht, key, &value) && value != NULL && *(uint_keyt*)value == i);
+		value = NULL;
+		CHECK(mht_uint32_try_get(u32_ht, (uint32_t)i, &value) && value != NULL && *(uint_keyt*)value == i);
+		value = NULL;
+		CHECK(mht_tuple_try_get(tuple_ht, TUPLE_KEY(i, 1), &value) && value != NULL && *(uint_keyt*)value == i);
+	}
+
+	/* 見つからないキーも検索はできたので true を返し、値は NULL になる */
+	void* value = &value;
+	CHECK(mht_uint_try_get(uint_ht, TEST_KEYS, &value) && value == NULL);
+	value = &value;
+	CHECK(mht_tuple_try_get(tuple_ht, TUPLE_KEY(TEST_KEYS, 1), &value) && value == NULL);
+
+	/* 通常の関数で削除や clear をした結果も読める */
+	CHECK(mht_uint_delete(uint_ht, 1));
+	value = &value;
+	CHECK(mht_uint_try_get(uint_ht, 1, &value) && value == NULL);
+	mht_clear(str_ht);
+	value = &value;
+	CHECK(mht_str_try_get(str_ht, TEST_STR_KEY("key2"), &value) && value == NULL);
+
+	mht_destroy(uint_ht);
+	mht_destroy(str_ht);
+	mht_destroy(u32_ht);
+	mht_destroy(tuple_ht);
+}
+
+
+static MHashTable* busy_table;
+static volatile int holder_inside;
+static volatile int holder_release;
+
+
+/* 結合関数はグローバルロックを持ったまま呼ばれるので、解放の合図があるまでロックを握り続ける */
+static void hold_lock (void* dst_value, size_t dst_size, const void* src_value, size_t src_size, void* arg) {
+	(void)dst_value;
+	(void)dst_size;
+	(void)src_value;
+	(void)src_size;
+	(void)arg;
+
+	/* ロックを持っているスレッド自身が呼んでも待たずに失敗する */
+	void* value = NULL;
+	errno = 0;
+	CHECK(!mht_uint_try_get(busy_table, 1, &value) && errno == EWOULDBLOCK);
+
+	__atomic_store_n(&holder_inside, 1, __ATOMIC_RELEASE);
+	while (!__atomic_load_n(&holder_release, __ATOMIC_ACQUIRE))
+		sched_yield();
+}
+
+
+static void* holder_main (void* arg) {
+	MHashTable** tables = arg;
+	CHECK(mht_merge(tables[0], tables[1], MHT_MERGE_COMBINE, hold_lock, NULL));
+	return NULL;
+}
+
+
+static void test_contended (void) {
+	MHashTable* dst = mht_uint_create(16);
+	MHashTable* src = mht_uint_create(16);
+	busy_table = mht_uint_create(16);
+	CHECK(dst != NULL && src != NULL && busy_table != NULL);
+
+	int value = 1;
+	CHECK(mht_uint_set(dst, 1, &value, sizeof(value)));
+	CHECK(mht_uint_set(src, 1, &value, sizeof(value)));
+	CHECK(mht_uint_set(busy_table, 1, &value, sizeof(value)));
+
+	MHashTable* tables[2] = { dst, src };
+	pthread_t holder;
+	CHECK(pthread_create(&holder, NULL, holder_main, tables) == 0);
+	while (!__atomic_load_n(&holder_inside, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	void* out = NULL;
+	errno = 0;
+	CHECK(!mht_uint_try_get(busy_table, 1, &out) && errno == EWOULDBLOCK);
+	errno = 0;
+	CHECK(!mht_uint_try_set(busy_table, 2, &value, sizeof(value)) && errno == EWOULDBLOCK);
+	errno = 0;
+	CHECK(!mht_str_try_set(busy_table, TEST_STR_KEY("key"), &value, sizeof(value)) && errno == EWOULDBLOCK);
+
+	__atomic_store_n(&holder_release, 1, __ATOMIC_RELEASE);
+	CHECK(pthread_join(holder, NULL) == 0);
+
+	/* ロックが空けば成功し、失敗した try_set は何も書いていない */
+	CHECK(mht_uint_try_get(busy_table, 1, &out) && out != NULL && *(int*)out == 1);
+	CHECK(mht_uint_try_get(busy_table, 2, &out) && out == NULL);
+
+	mht_destroy(dst);
+	mht_destroy(src);
+	mht_destroy(busy_table);
+}
+
+
+static void test_rejected (void) {
+	MHashTable* ht = mht_uint_create(16);
+	CHECK(ht != NULL);
+	CHECK_REJECTED(mht_uint_try_get(ht, 1, NULL));
+	CHECK_REJECTED(mht_uint_try_set(ht, 1, NULL, sizeof(int)));
+	int value = 1;
+	CHECK_REJECTED(mht_str_try_set(ht, TEST_STR_KEY("key"), &value, sizeof(value)));  /* キーの型が違う */
+	mht_destroy(ht);
+}
+
+
+int main (void) {
+	MHashTable* probe = mht_uint_create(4);
+	CHECK(probe != NULL);
+	int value = 1;
+	errno = 0;
+	bool supported = mht_uint_try_set(probe, 1, &value, sizeof(value));
+	mht_destroy(probe);
+	if (!supported) {  /* C11 atomics が使えない環境では ENOSYS で失敗する */
+		CHECK(errno == ENOSYS);
+		return 0;
+	}
+
+	test_uncontended();
+	test_contended();
+	test_rejected();
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * tests/tuple_keys.c -- tests for hashtables with fixed-width tuple keys
+ */
+
+#include "test_common.h"
+
+
+/* i 番目のキーを作る（どの語も i から決まるので、語数が 1 でも 16 でも重複しない） */
+static void make_key (uint_keyt* key, size_t key_words, uint_keyt i) {
+	for (size_t w = 0; w < key_words; w++)
+		key[w] = i * (w + 1) + w;
+}
+
+
+static void test_set_get_delete (size_t key_words) {
+	MHashTable* ht = mht_tuple_create(4, key_words);  /* size 4 から拡張させる */
+	CHECK(ht != NULL);
+
+	uint_keyt key[TUPLE_KEY_MAX_WORDS];
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		make_key(key, key_words, i);
+		CHECK(mht_tuple_set(ht, key, &i, sizeof(i)));
+	}
+
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		make_key(key, key_words, i);
+		uint_keyt* value = mht_tuple_get(ht, key);
+		CHECK(value != NULL && *value == i);
+	}
+
+	make_key(key, key_words, TEST_KEYS);
+	CHECK(mht_tuple_get(ht, key) == NULL);
+	CHECK(!mht_tuple_delete(ht, key));
+
+	for (uint_keyt i = 0; i < TEST_KEYS; i += 2) {
+		make_key(key, key_words, i);
+		CHECK(mht_tuple_delete(ht, key));
+		CHECK(!mht_tuple_delete(ht, key));
+	}
+
+	for (uint_keyt i = 0; i < TEST_KEYS; i++) {
+		make_key(key, key_words, i);
+		uint_keyt* value = mht_tuple_get(ht, key);
+		if (i % 2 == 0) {
+			CHECK(value == NULL);
+		} else {
+			CHECK(value != NULL && *value == i);
+		}
+	}
+
+	mht_destroy(ht);
+}
+
+
+static void test_replace_and_clear (void) {
+	MHashTable* ht = mht_tuple_create(8, 3);
+	CHECK(ht != NULL);
+
+	int first = 1, second = 2;
+	CHECK(mht_tuple_set(ht, TUPLE_KEY(1, 2, 3), &first, sizeof(first)));
+	CHECK(mht_tuple_set(ht, TUPLE_KEY(1, 2, 3), &second, sizeof(second)));
+	int* value = mht_tuple_get(ht, TUPLE_KEY(1, 2, 3));
+	CHECK(value != NULL && *value == 2);
+	CHECK(mht_tuple_get(ht, TUPLE_KEY(3, 2, 1)) == NULL);
+
+	for (uint_keyt i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_tuple_set(ht, TUPLE_KEY(i, i, i), &first, sizeof(first)));
+
+	mht_clear(ht);
+	CHECK(mht_tuple_get(ht, TUPLE_KEY(1, 2, 3)) == NULL);
+	CHECK(mht_tuple_get(ht, TUPLE_KEY(5, 5, 5)) == NULL);
+
+	CHECK(mht_tuple_set(ht, TUPLE_KEY(5, 5, 5), &second, sizeof(second)));
+	value = mht_tuple_get(ht, TUPLE_KEY(5, 5, 5));
+	CHECK(value != NULL && *value == 2);
+
+	mht_destroy(ht);
+}
+
+
+static void test_rejected (void) {
+	errno = 0;
+	CHECK(mht_tuple_create(4, 0) == NULL);
+	CHECK(errno == EINVAL);
+	errno = 0;
+	CHECK(mht_tuple_create(4, TUPLE_KEY_MAX_WORDS + 1) == NULL);
+	CHECK(errno == EINVAL);
+
+	MHashTable* ht = mht_tuple_create(4, 2);
+	CHECK(ht != NULL);
+	CHECK_REJECTED(mht_set_pointer_keys(ht, false));
+	CHECK_REJECTED(mht_set_key_pool(ht));
+	CHECK_REJECTED(mht_freeze(ht));
+	mht_destroy(ht);
+}
+
+
+int main (void) {
+	test_set_get_delete(1);
+	test_set_get_delete(2);
+	test_set_get_delete(5);
+	test_set_get_delete(TUPLE_KEY_MAX_WORDS);
+	test_replace_and_clear();
+	test_rejected();
+	return 0;
+}
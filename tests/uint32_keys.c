@@ -0,0 +1,96 @@
+/*
+ * tests/uint32_keys.c -- tests for hashtables with packed 32-bit keys
+ */
+
+#include "test_common.h"
+
+#include <stdint.h>
+
+
+static void test_set_get_delete (void) {
+	MHashTable* ht = mht_uint32_create(4);  /* size 4 から拡張させる */
+	CHECK(ht != NULL);
+
+	for (uint32_t i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_uint32_set(ht, i * 3, &i, sizeof(i)));
+
+	for (uint32_t i = 0; i < TEST_KEYS; i++) {
+		uint32_t* value = mht_uint32_get(ht, i * 3);
+		CHECK(value != NULL && *value == i);
+	}
+	CHECK(mht_uint32_get(ht, 1) == NULL);
+	CHECK(mht_uint32_get(ht, UINT32_MAX) == NULL);
+
+	for (uint32_t i = 0; i < TEST_KEYS; i += 2) {
+		CHECK(mht_uint32_delete(ht, i * 3));
+		CHECK(!mht_uint32_delete(ht, i * 3));
+	}
+
+	for (uint32_t i = 0; i < TEST_KEYS; i++) {
+		uint32_t* value = mht_uint32_get(ht, i * 3);
+		if (i % 2 == 0) {
+			CHECK(value == NULL);
+		} else {
+			CHECK(value != NULL && *value == i);
+		}
+	}
+
+	uint32_t replaced = 7;
+	CHECK(mht_uint32_set(ht, 3, &replaced, sizeof(replaced)));
+	uint32_t copy = 0;
+	size_t copy_size = 0;
+	CHECK(mht_uint32_get_copy(ht, 3, &copy, sizeof(copy), &copy_size));
+	CHECK(copy == 7 && copy_size == sizeof(copy));
+
+	mht_destroy(ht);
+}
+
+
+static void test_clear (void) {
+	MHashTable* ht = mht_uint32_create(16);
+	CHECK(ht != NULL);
+
+	for (uint32_t i = 0; i < TEST_KEYS; i++)
+		CHECK(mht_uint32_set(ht, i, &i, sizeof(i)));
+
+	mht_clear(ht);
+	size_t count = 1;
+	void** values = mht_all_get(ht, &count);
+	CHECK(count == 0);
+	mht_all_release_arr(values);
+	CHECK(mht_uint32_get(ht, 0) == NULL);
+
+	uint32_t key = UINT32_MAX;
+	CHECK(mht_uint32_set(ht, key, &key, sizeof(key)));
+	uint32_t* value = mht_uint32_get(ht, key);
+	CHECK(value != NULL && *value == key);
+
+	mht_destroy(ht);
+}
+
+
+static void test_rejected (void) {
+	MHashTable* ht = mht_uint32_create(4);
+	CHECK(ht != NULL);
+
+	int value = 1;
+	CHECK_REJECTED(mht_uint_set(ht, 1, &value, sizeof(value)));
+#if SIZE_MAX > UINT32_MAX
+	CHECK_REJECTED(mht_uint32_set(ht, 1, &value, (size_t)UINT32_MAX + 1));  /* サイズは検査だけされ、読まれない */
+#endif
+	CHECK_REJECTED(mht_set_compression(ht, 64));
+	CHECK_REJECTED(mht_set_pointer_keys(ht, false));
+	CHECK_REJECTED(mht_set_key_pool(ht));
+	CHECK_REJECTED(mht_freeze(ht));
+	CHECK(mht_uint32_get(ht, 1) == NULL);
+
+	mht_destroy(ht);
+}
+
+
+int main (void) {
+	test_set_get_delete();
+	test_clear();
+	test_rejected();
+	return 0;
+}